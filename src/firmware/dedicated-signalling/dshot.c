@@ -0,0 +1,197 @@
+/**
+ * Copyright (C) 2018 Shreyas Vinod
+ *
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file dshot.c
+ * \author Shreyas Vinod <shreyas@shreyasvinod.xyz>
+ *
+ * \brief DShot frames for digital ESCs, sent on GPIO pins timed by a TC.
+ */
+
+#include <asf.h>
+
+#include "dshot.h"
+#include "pwm.h"
+
+/*
+ * A DShot bit is high for 3/8 of its period for a 0 and 3/4 for a 1. The SAMD20 has no
+ * DMA, and a TC interrupt per bit can not move the compares inside 3/8 of a bit, so a
+ * frame is bit-banged: one TC counts bit periods, with compare 0 at the end of a 0 and
+ * compare 1 at the end of a 1, and dshot_send(..) polls its flags and writes the PORT
+ * from a buffer built ahead of time. Every pin goes out in the same pass, so the ESCs
+ * get their frames together.
+ */
+
+static struct tc_module dshot_tc;
+static uint16_t dshot_div;  /* bit clock divider */
+
+/* bit clock dividers to choose from, slowest bit period (DShot150) has to fit 8 bits */
+static const struct
+{
+  uint16_t div;
+  enum tc_clock_prescaler prescaler;
+} dshot_prescalers[] =
+{
+  { 1, TC_CLOCK_PRESCALER_DIV1 },
+  { 2, TC_CLOCK_PRESCALER_DIV2 },
+  { 4, TC_CLOCK_PRESCALER_DIV4 },
+  { 8, TC_CLOCK_PRESCALER_DIV8 }
+};
+
+#define DSHOT_PRESCALER_COUNT ( sizeof(dshot_prescalers) / sizeof(dshot_prescalers[0]) )
+
+/* counts in one bit */
+static inline uint32_t dshot_bit_counts( uint16_t kbps )
+{
+  return PWM_GCLK_HZ / dshot_div / ( kbps * 1000UL );
+}
+
+/**
+ * \brief Frame for a value: value and telemetry bit, then the XOR of their three nibbles.
+ *
+ * \param [in] value 0 to DSHOT_VALUE_MAX, higher bits are ignored
+ * \param [in] telemetry ask the ESC for telemetry
+ *
+ * \return frame, first bit in bit 15
+ */
+
+uint16_t dshot_frame( uint16_t value, bool telemetry )
+{
+  uint16_t packet = (uint16_t) ( ( value & DSHOT_VALUE_MAX ) << 1 ) | ( telemetry ? 1 : 0 );
+  uint16_t crc    = ( packet ^ ( packet >> 4 ) ^ ( packet >> 8 ) ) & 0x0f;
+
+  return (uint16_t) ( packet << 4 ) | crc;
+}
+
+/* empty a buffer, before dshot_encode(..)-ing the frames of a pass into it */
+void dshot_clear( Dshot_buffer_t* buffer )
+{
+  buffer->port = NULL;
+  buffer->all  = 0;
+  for ( uint8_t b = 0; b < DSHOT_FRAME_BITS; ++b )
+    buffer->zero[b] = 0;
+}
+
+/**
+ * \brief Add one pin's frame to a buffer. All pins of a buffer have to be on one port.
+ *
+ * \param [in] buffer buffer to add to
+ * \param [in] pin GPIO pin
+ * \param [in] frame as from dshot_frame()
+ */
+
+void dshot_encode( Dshot_buffer_t* buffer, uint8_t pin, uint16_t frame )
+{
+  uint32_t mask = 1UL << ( pin % 32 );
+
+  buffer->port = port_get_group_from_gpio_pin( pin );
+  buffer->all |= mask;
+
+  for ( uint8_t b = 0; b < DSHOT_FRAME_BITS; ++b )
+  {
+    if ( !( frame & ( 0x8000 >> b ) ) )
+      buffer->zero[b] |= mask;
+  }
+}
+
+/**
+ * \brief Set up a TC as the bit clock: 8-bit, at the smallest divider that fits a
+ *        DShot150 bit. It runs from here on and is only polled, never interrupts.
+ *
+ * \param [in] hw TC instance
+ *
+ * \return false if the TC could not be set up
+ */
+
+bool dshot_init( Tc* hw )
+{
+  struct tc_config config_tc;
+  uint8_t p;
+
+  for ( p = 0; p < DSHOT_PRESCALER_COUNT; ++p )
+  {
+    dshot_div = dshot_prescalers[p].div;
+    if ( dshot_bit_counts( 150 ) <= 0x100 )
+      break;
+  }
+  if ( p == DSHOT_PRESCALER_COUNT )
+    return false;
+
+  tc_get_config_defaults( &config_tc );
+
+  config_tc.counter_size         = TC_COUNTER_SIZE_8BIT;
+  config_tc.wave_generation      = TC_WAVE_GENERATION_NORMAL_FREQ;
+  config_tc.clock_prescaler      = dshot_prescalers[p].prescaler;
+  config_tc.counter_8_bit.period = 0xff;
+
+  if ( tc_init( &dshot_tc, hw, &config_tc ) != STATUS_OK )
+    return false;
+
+  tc_enable( &dshot_tc );
+  return true;
+}
+
+/* whether a bit rate fits the bit clock and leaves dshot_send(..) time to time a 0 */
+bool dshot_rate_ok( uint16_t kbps )
+{
+  uint32_t counts = dshot_bit_counts( kbps );
+
+  return counts <= 0x100 && counts * 3 / 8 * dshot_div >= DSHOT_MIN_CYCLES;
+}
+
+/**
+ * \brief Send a buffer's frames, then hold the pins low for DSHOT_GAP_BITS. Interrupts
+ *        are off meanwhile: 19 bit periods, some 125 us at DShot150.
+ *
+ * \param [in] kbps bit rate, see dshot_rate_ok()
+ * \param [in] buffer frames to send
+ */
+
+void dshot_send( uint16_t kbps, const Dshot_buffer_t* buffer )
+{
+  Tc* const hw = dshot_tc.hw;
+  PortGroup* const port = buffer->port;
+  uint32_t counts = dshot_bit_counts( kbps );
+
+  if ( buffer->all == 0 )
+    return;
+
+  tc_set_top_value( &dshot_tc, counts - 1 );
+  tc_set_compare_value( &dshot_tc, TC_COMPARE_CAPTURE_CHANNEL_0, counts * 3 / 8 );
+  tc_set_compare_value( &dshot_tc, TC_COMPARE_CAPTURE_CHANNEL_1, counts * 3 / 4 );
+
+  system_interrupt_enter_critical_section();
+
+  /* start on a bit boundary */
+  hw->COUNT8.INTFLAG.reg = TC_INTFLAG_OVF;
+  while ( !( hw->COUNT8.INTFLAG.reg & TC_INTFLAG_OVF ) )
+    continue;
+
+  for ( uint8_t b = 0; b < DSHOT_FRAME_BITS; ++b )
+  {
+    port->OUTSET.reg = buffer->all;
+    /* still short of compare 0, so this only drops the last bit's compare flags */
+    hw->COUNT8.INTFLAG.reg = TC_INTFLAG_OVF | TC_INTFLAG_MC0 | TC_INTFLAG_MC1;
+
+    while ( !( hw->COUNT8.INTFLAG.reg & TC_INTFLAG_MC0 ) )
+      continue;
+    port->OUTCLR.reg = buffer->zero[b];
+
+    while ( !( hw->COUNT8.INTFLAG.reg & TC_INTFLAG_MC1 ) )
+      continue;
+    port->OUTCLR.reg = buffer->all;
+
+    while ( !( hw->COUNT8.INTFLAG.reg & TC_INTFLAG_OVF ) )
+      continue;
+  }
+
+  for ( uint8_t b = 0; b < DSHOT_GAP_BITS; ++b )
+  {
+    hw->COUNT8.INTFLAG.reg = TC_INTFLAG_OVF;
+    while ( !( hw->COUNT8.INTFLAG.reg & TC_INTFLAG_OVF ) )
+      continue;
+  }
+
+  system_interrupt_leave_critical_section();
+}
@@ -0,0 +1,84 @@
+/**
+ * Copyright (C) 2018 Shreyas Vinod
+ *
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file dshot.h
+ * \author Shreyas Vinod <shreyas@shreyasvinod.xyz>
+ *
+ * \brief DShot frames for digital ESCs, sent on GPIO pins timed by a TC.
+ */
+
+#ifndef DSHOT_H_
+#define DSHOT_H_
+
+#include <asf.h>
+
+/**
+ * \defgroup dshot DShot
+ * \brief DShot150 and DShot300 frames, every pin of a frame sent at once.
+ * \{
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \def DSHOT_FRAME_BITS
+ * \brief Bits in a frame: 11 bits of value, the telemetry bit and a 4-bit CRC.
+ */
+#define DSHOT_FRAME_BITS 16
+
+/**
+ * \def DSHOT_VALUE_MAX
+ * \brief Largest value: 0 is disarmed, 1 to 47 are commands and 48 to 2047 throttle.
+ */
+#define DSHOT_VALUE_MAX 0x07ff
+
+/**
+ * \def DSHOT_TELEMETRY
+ * \brief Set next to a channel's value (see pwm_set_duty()) to ask its ESC for telemetry.
+ */
+#define DSHOT_TELEMETRY 0x0800
+
+/**
+ * \def DSHOT_GAP_BITS
+ * \brief Bit periods the pins stay low after a frame, before another one may start.
+ */
+#define DSHOT_GAP_BITS 2
+
+/**
+ * \def DSHOT_MIN_CYCLES
+ * \brief Shortest high time, in core cycles, dshot_send() can time: one turn of its
+ *        polling loop plus the PORT write, with some margin.
+ */
+#define DSHOT_MIN_CYCLES 16
+
+/**
+ * \struct Dshot_buffer_t
+ * \brief One frame for a set of pins, as the PORT writes sending it.
+ */
+typedef struct Dshot_buffer_t
+{
+  PortGroup* port;                  /**< port of every pin in the frame */
+  uint32_t all;                     /**< every pin in the frame */
+  uint32_t zero[DSHOT_FRAME_BITS];  /**< pins sending a 0 in each bit, first bit first */
+} Dshot_buffer_t;
+
+uint16_t dshot_frame( uint16_t value, bool telemetry );
+void dshot_clear( Dshot_buffer_t* buffer );
+void dshot_encode( Dshot_buffer_t* buffer, uint8_t pin, uint16_t frame );
+bool dshot_init( Tc* hw );
+bool dshot_rate_ok( uint16_t kbps );
+void dshot_send( uint16_t kbps, const Dshot_buffer_t* buffer );
+
+/**
+ * \} end of dshot
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DSHOT_H_ */
@@ -14,12 +14,20 @@
 #include <asf.h>
 
 #include "pindefs.h"
+#include "pwm.h"
 
 #define BUFFER_LENGTH 48
 
 /* i2c commands */
 #define REG_GET_CHANNEL 0x11
 #define REG_SET_CHANNEL 0x12
+#define REG_SET_ALL     0x13
+
+/* REG_SET_CHANNEL write: the command, the channel, then the duty */
+#define REG_SET_CHANNEL_LENGTH 4
+
+/* REG_SET_ALL write: the command, then two bytes for each channel */
+#define REG_SET_ALL_LENGTH ( 1 + 2 * PWM_CHANNEL_COUNT )
 
 /* i2c */
 static struct i2c_slave_packet packet;
@@ -27,20 +35,21 @@ static struct i2c_slave_module pi_bus;
 static uint8_t read_buffer[BUFFER_LENGTH];
 static uint8_t write_buffer[BUFFER_LENGTH];
 
-/* tc */
-static struct tc_module tc1_instance;
+/* reply to REG_SET_CHANNEL: 42 if the last one was taken, 200 if not */
+static volatile uint8_t set_channel_status = 200;
 
-static uint16_t pwm_duty_setpoint[PWM_CHANNEL_COUNT];
+/* reply to REG_SET_ALL: status as above, then the commit's sequence number */
+static volatile uint8_t  set_all_status = 200;
+static volatile uint16_t set_all_sequence;
 
 void init_pibus( void );
-void init_tc( void );
 
 /* i2c callbacks */
 void pi_bus_read_callback( struct i2c_slave_module *const module );
 void pi_bus_write_callback( struct i2c_slave_module *const module );
+void pi_bus_write_complete_callback( struct i2c_slave_module *const module );
 
-/* tc callbacks */
-void pwm_channel1( struct tc_module *const module_inst );
+void SysTick_Handler( void );
 
 void init_pibus( void )
 {
@@ -63,32 +72,9 @@ void init_pibus( void )
   i2c_slave_register_callback( &pi_bus, pi_bus_write_callback,
                               I2C_SLAVE_CALLBACK_WRITE_REQUEST );
   i2c_slave_enable_callback( &pi_bus, I2C_SLAVE_CALLBACK_WRITE_REQUEST );
-}
-
-void init_tc( void )
-{
-  struct tc_config config_tc;
-  tc_get_config_defaults( &config_tc );
-
-  config_tc.counter_size    = TC_COUNTER_SIZE_16BIT;
-  config_tc.wave_generation = TC_WAVE_GENERATION_NORMAL_PWM;
-  config_tc.clock_prescaler = TC_CLOCK_PRESCALER_DIV2;
-  config_tc.counter_16_bit.compare_capture_channel[0] = 0xffff;
-  config_tc.counter_16_bit.compare_capture_channel[1] = 0xffff;
-
-  config_tc.pwm_channel[0].enabled = true;
-  config_tc.pwm_channel[0].pin_out = PWM1;
-  config_tc.pwm_channel[0].pin_mux = PWM1_MUX;
-
-  config_tc.pwm_channel[1].enabled = true;
-  config_tc.pwm_channel[1].pin_out = PWM2;
-  config_tc.pwm_channel[1].pin_mux = PWM2_MUX;
-
-  tc_init( &tc1_instance, PWM1_MOD, &config_tc );
-  tc_enable( &tc1_instance );
-
-  // tc_register_callback( &tc1_instance, pwm_channel1, TC_CALLBACK_CC_CHANNEL0 );
-  // tc_enable_callback( &tc1_instance, TC_CALLBACK_CC_CHANNEL0 );
+  i2c_slave_register_callback( &pi_bus, pi_bus_write_complete_callback,
+                               I2C_SLAVE_CALLBACK_READ_COMPLETE );
+  i2c_slave_enable_callback( &pi_bus, I2C_SLAVE_CALLBACK_READ_COMPLETE );
 }
 
 /* i2c callbacks */
@@ -105,29 +91,37 @@ void pi_bus_read_callback( struct i2c_slave_module *const module )
     if ( get_channel < PWM_CHANNEL_COUNT )
     /* get_channel >= 0 implicit due to unsigned */
     {
-      write_buffer[0] = pwm_duty_setpoint[get_channel];
+      uint16_t duty = pwm_get_duty( get_channel );
+      write_buffer[0] = duty & 0xff;
+      write_buffer[1] = duty >> 8;
+      packet.data_length = 2;
     }
     else
     {
       write_buffer[0] = 200;
+      packet.data_length = 1;
     }
-    packet.data_length = 1;
   }
   else if ( cmd == REG_SET_CHANNEL )
   {
-    uint8_t  set_channel = read_buffer[1] - 1;
-    uint16_t new_duty    = ( read_buffer[3] << 8 ) | read_buffer[2];
-    if ( set_channel < PWM_CHANNEL_COUNT && new_duty <= 65536 )
-    /* set_channel >= 0 && new_duty >= 0 implicit due to unsigned */
-    {
-      pwm_duty_setpoint[set_channel] = new_duty;
-      write_buffer[0] = 42;
-    }
-    else
-    {
-      write_buffer[0] = 200;
-    }
-    packet.data_length = 200;
+    write_buffer[0] = set_channel_status;
+    packet.data_length = 1;
+  }
+  else if ( cmd == REG_SET_ALL )
+  {
+    /* status, the commit staged and the last one latched, each little endian */
+    uint16_t applied = pwm_get_commit();
+    write_buffer[0] = set_all_status;
+    write_buffer[1] = set_all_sequence & 0xff;
+    write_buffer[2] = set_all_sequence >> 8;
+    write_buffer[3] = applied & 0xff;
+    write_buffer[4] = applied >> 8;
+    packet.data_length = 5;
+  }
+  else
+  {
+    write_buffer[0] = 200;
+    packet.data_length = 1;
   }
 
   /* finally, write it to the bus! */
@@ -144,45 +138,95 @@ void pi_bus_write_callback( struct i2c_slave_module *const module )
   packet.data_length = BUFFER_LENGTH;
   packet.data        = read_buffer;
 
-  /* read the packet */
+  /* read the packet, it is acted on once it is all in */
   if ( i2c_slave_read_packet_job(module, &packet) != STATUS_OK )
   {
     // TODO
   }
-  
-  uint8_t cmd = read_buffer[0]; /* readability */
-  
-
 }
 
-/* tc callbacks */
-
-void pwm_channel1( struct tc_module *const module_inst )
+/* master has finished sending data */
+void pi_bus_write_complete_callback( struct i2c_slave_module *const module )
 {
-  static uint16_t i = 32768;
+  /* the driver has zeroed its lengths by now, its buffer pointer is one past the last byte */
+  uint16_t received = module->buffer - read_buffer;
+  uint8_t  cmd      = read_buffer[0]; /* readability */
+
+  if ( cmd == REG_SET_CHANNEL )
+  {
+    uint8_t  set_channel = read_buffer[1] - 1;
+    uint16_t new_duty    = ( read_buffer[3] << 8 ) | read_buffer[2];
 
-  tc_set_compare_value( module_inst, TC_COMPARE_CAPTURE_CHANNEL_0, i );
-  tc_set_compare_value( module_inst, TC_COMPARE_CAPTURE_CHANNEL_1, i );
+    /* the command alone selects the register to read the status from, and a short
+     * write would apply whatever an earlier write left in the buffer */
+    if ( received == 1 )
+      return;
+    if ( received < REG_SET_CHANNEL_LENGTH )
+    {
+      set_channel_status = 200;
+      return;
+    }
+
+    /* set_channel >= 0 implicit due to unsigned, any 16-bit duty is valid */
+    set_channel_status = pwm_set_duty( set_channel, new_duty ) ? 42 : 200;
+  }
+  else if ( cmd == REG_SET_ALL )
+  {
+    /* PWM1 to PWM12, two bytes each, little endian */
+    uint16_t duty[PWM_CHANNEL_COUNT];
+    uint16_t sequence;
+
+    /* the command alone selects the register to read the status of the last commit
+     * from, a short write would commit stale duties for the channels it left out */
+    if ( received == 1 )
+      return;
+    if ( received < REG_SET_ALL_LENGTH )
+    {
+      set_all_status = 200;
+      return;
+    }
+
+    for ( uint8_t c = 0; c < PWM_CHANNEL_COUNT; ++c )
+      duty[c] = ( read_buffer[2 * c + 2] << 8 ) | read_buffer[2 * c + 1];
+
+    sequence       = pwm_set_all( duty );
+    set_all_status = sequence != 0 ? 42 : 200;
+    if ( sequence != 0 )
+      set_all_sequence = sequence;
+  }
+}
+
+/* paces the DShot frames, only running if there are any */
+void SysTick_Handler( void )
+{
+  pwm_tick();
 }
 
 int main( void )
 {
   system_init();
 
-  for ( int i = 0; i < PWM_CHANNEL_COUNT; ++i )
-  {
-    pwm_duty_setpoint[i] = 50;
-    pwm_duty_counter[i]  = 32768;
-  }
-
-  init_tc();
+  pwm_init();
   system_interrupt_enable_global();
   init_pibus();
 
+  /* DShot ESCs disarm without a steady stream of frames, even at a steady throttle */
+  if ( pwm_dshot_active() )
+    SysTick_Config( system_gclk_gen_get_hz( GCLK_GENERATOR_0 ) / PWM_DSHOT_HZ );
+
+  /* setpoints only change from the pi bus interrupt, and DShot frames fall due on
+   * SysTick; both also wake the core */
+  system_set_sleepmode( SYSTEM_SLEEPMODE_IDLE_0 );
+
   while ( true )
   {
-    tc_set_compare_value( &tc1_instance, PWM1_CHANNEL, pwm_duty_setpoint[0] );
-    /* THIS IS TEMPORARY! */
-    tc_set_compare_value( &tc1_instance, PWM2_CHANNEL, pwm_duty_setpoint[0] );
+    /* DShot frames go out here, clear of the pi bus interrupt */
+    pwm_service();
+
+    /* an interrupt still wakes the core with them off, and runs once they are back on */
+    system_interrupt_enter_critical_section();
+    if ( !pwm_pending() )
+      system_sleep();
+    system_interrupt_leave_critical_section();
   }
 }
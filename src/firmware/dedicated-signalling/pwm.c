@@ -0,0 +1,576 @@
+/**
+ * Copyright (C) 2018 Shreyas Vinod
+ *
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file pwm.c
+ * \author Shreyas Vinod <shreyas@shreyasvinod.xyz>
+ *
+ * \brief Table-driven PWM on the twelve TC outputs of the dedicated signalling
+ *        controller.
+ */
+
+#include <asf.h>
+
+#include "dshot.h"
+#include "pindefs.h"
+#include "pwm.h"
+
+/* TC instances, in the order Pwm_channel_t.tc counts them */
+static Tc *const pwm_tc_hw[PWM_TC_COUNT] = { TC0, TC1, TC2, TC3, TC4, TC5 };
+
+static struct tc_module pwm_tc[PWM_TC_COUNT];
+
+/*
+ * Frequency and protocol of each TC pair. PWM_TOP_NORMAL counts the full 16 bits, at 61 Hz
+ * with the clock divided by 2. Any other top frees the frequency but costs the pair its
+ * output on compare 0, e.g. { 8, PWM_TOP_HZ( 50, 8 ), false, PWM_PROTOCOL_PWM } for a 50 Hz
+ * servo with 1 us counts, { 1, PWM_TOP_HZ( 400, 1 ), false, PWM_PROTOCOL_PWM } for a 400 Hz
+ * ESC or { 1, PWM_TOP_HZ( 20000, 1 ), true, PWM_PROTOCOL_PWM } for a 20 kHz fan, dithered
+ * since a period is only 400 counts. { 1, PWM_TOP_HZ( 2000, 1 ), false,
+ * PWM_PROTOCOL_ONESHOT125 } sends OneShot125 at 2 kHz, { 0, 0, false, PWM_PROTOCOL_DSHOT300 }
+ * DShot300 on both outputs.
+ */
+static const Pwm_tc_t pwm_tcs[PWM_TC_COUNT] =
+{
+  { 2, PWM_TOP_NORMAL, false, PWM_PROTOCOL_PWM }, /* TC0: PWM3, PWM4 */
+  { 2, PWM_TOP_NORMAL, false, PWM_PROTOCOL_PWM }, /* TC1: PWM1, PWM2 */
+  { 2, PWM_TOP_NORMAL, false, PWM_PROTOCOL_PWM }, /* TC2: PWM5, PWM6 */
+  { 2, PWM_TOP_NORMAL, false, PWM_PROTOCOL_PWM }, /* TC3: PWM11, PWM12 */
+  { 2, PWM_TOP_NORMAL, false, PWM_PROTOCOL_PWM }, /* TC4: PWM9, PWM10 */
+  { 2, PWM_TOP_NORMAL, false, PWM_PROTOCOL_PWM }  /* TC5: PWM7, PWM8 */
+};
+
+/* PWM1 to PWM12, see pindefs.h */
+static const Pwm_channel_t pwm_channels[PWM_CHANNEL_COUNT] =
+{
+  { 1, PWM1_CHANNEL,  PWM1,  PWM1_MUX  },
+  { 1, PWM2_CHANNEL,  PWM2,  PWM2_MUX  },
+  { 0, PWM3_CHANNEL,  PWM3,  PWM3_MUX  },
+  { 0, PWM4_CHANNEL,  PWM4,  PWM4_MUX  },
+  { 2, PWM5_CHANNEL,  PWM5,  PWM5_MUX  },
+  { 2, PWM6_CHANNEL,  PWM6,  PWM6_MUX  },
+  { 5, PWM7_CHANNEL,  PWM7,  PWM7_MUX  },
+  { 5, PWM8_CHANNEL,  PWM8,  PWM8_MUX  },
+  { 4, PWM9_CHANNEL,  PWM9,  PWM9_MUX  },
+  { 4, PWM10_CHANNEL, PWM10, PWM10_MUX },
+  { 3, PWM11_CHANNEL, PWM11, PWM11_MUX },
+  { 3, PWM12_CHANNEL, PWM12, PWM12_MUX }
+};
+
+/*
+ * Duty updates are double buffered: pwm_set_duty(..) only writes a shadow value and marks
+ * it dirty, and the TC's overflow interrupt copies dirty shadows into the compare
+ * registers as a new period starts, so a period never mixes two duty values. The SAMD20
+ * TC has no buffered compare (CCBUF) to do this in hardware. The overflow interrupt is
+ * only enabled while a TC has something dirty, or for good on a dithered TC.
+ *
+ * A duty is a fraction of the period, 0x10000 being all of it, so it scales to any top;
+ * for OneShot125 it is the fraction of the 125 us past the first 125. A dithered TC
+ * carries what is left below one count over to the next period, so over a few periods
+ * the mean pulse width has all 16 bits of the duty.
+ *
+ * DShot outputs have no compare: a duty only goes into its shadow, and pwm_service(..)
+ * sends the next frame of every DShot output out of the main loop, as soon as a value
+ * changes and otherwise every pwm_tick(..).
+ */
+
+static volatile uint16_t pwm_shadow[PWM_CHANNEL_COUNT];  /* requested duty */
+static uint16_t pwm_applied[PWM_CHANNEL_COUNT];          /* duty being output */
+static uint16_t pwm_compare[PWM_CHANNEL_COUNT];          /* value in the compare register */
+static uint16_t pwm_residue[PWM_CHANNEL_COUNT];          /* dither error, in 1/0x10000 counts */
+static volatile uint8_t pwm_dirty[PWM_TC_COUNT];         /* bit cc: shadow not applied yet */
+static uint8_t pwm_tc_channel[PWM_TC_COUNT][2];          /* channel on each compare */
+static uint16_t pwm_offset[PWM_TC_COUNT];                /* compare at duty 0 */
+static uint32_t pwm_span[PWM_TC_COUNT];                  /* counts from duty 0 to 0x10000 */
+static bool pwm_dshot_ready[PWM_TC_COUNT];               /* DShot pair with a bit clock */
+static bool pwm_dshot_any;                               /* some DShot pair is ready */
+static volatile bool pwm_dshot_pending;                  /* frames are due */
+
+/*
+ * pwm_set_all(..) stages every output at once as a commit. The counters are started
+ * together so their periods line up, and the commit is latched by one overflow callback,
+ * that of pwm_commit_tc: the last TC with compare outputs, it is started last, so the
+ * other counters have already wrapped by the time it does. Either all their compares move
+ * in that period or, if one of them can not, none do until the next. TCs running at
+ * another frequency than pwm_commit_tc still take the commit in one piece, just not on a
+ * period boundary of their own. DShot outputs take it in their next frame.
+ */
+
+static uint8_t pwm_commit_tc;                            /* PWM_TC_COUNT if none */
+static volatile bool pwm_commit_pending;
+static volatile uint16_t pwm_commit_sequence;            /* last commit staged */
+static volatile uint16_t pwm_commit_applied;             /* last commit latched */
+
+static void pwm_overflow_callback( struct tc_module *const module );
+
+/* ASF prescaler setting for a clock divider, see Pwm_tc_t */
+static enum tc_clock_prescaler pwm_prescaler( uint16_t div )
+{
+  switch ( div )
+  {
+    case 1:    return TC_CLOCK_PRESCALER_DIV1;
+    case 4:    return TC_CLOCK_PRESCALER_DIV4;
+    case 8:    return TC_CLOCK_PRESCALER_DIV8;
+    case 16:   return TC_CLOCK_PRESCALER_DIV16;
+    case 64:   return TC_CLOCK_PRESCALER_DIV64;
+    case 256:  return TC_CLOCK_PRESCALER_DIV256;
+    case 1024: return TC_CLOCK_PRESCALER_DIV1024;
+    default:   return TC_CLOCK_PRESCALER_DIV2;
+  }
+}
+
+static inline bool pwm_dshot( uint8_t t )
+{
+  return pwm_tcs[t].protocol == PWM_PROTOCOL_DSHOT150 ||
+         pwm_tcs[t].protocol == PWM_PROTOCOL_DSHOT300;
+}
+
+/* bit rate of a DShot protocol, in kbit/s */
+static inline uint16_t pwm_dshot_kbps( uint8_t protocol )
+{
+  return protocol == PWM_PROTOCOL_DSHOT300 ? 300 : 150;
+}
+
+/* whether an output runs off its TC's compare; not so for the output on compare 0 of a
+ * TC in match PWM, compare 0 holds its top */
+static inline bool pwm_compare_output( uint8_t channel )
+{
+  const Pwm_channel_t* ch = &pwm_channels[channel];
+
+  if ( pwm_dshot( ch->tc ) )
+    return false;
+
+  return pwm_tcs[ch->tc].top == PWM_TOP_NORMAL || ch->cc != TC_COMPARE_CAPTURE_CHANNEL_0;
+}
+
+/* whether an output can be set at all */
+static inline bool pwm_available( uint8_t channel )
+{
+  uint8_t t = pwm_channels[channel].tc;
+
+  return pwm_dshot( t ) ? pwm_dshot_ready[t] : pwm_compare_output( channel );
+}
+
+/* compare value putting duty out this period, taking the dither error along in residue */
+static uint16_t pwm_target( uint8_t channel, uint16_t duty, uint16_t* residue )
+{
+  uint8_t t = pwm_channels[channel].tc;
+  const Pwm_tc_t* tc = &pwm_tcs[t];
+  uint32_t scaled  = (uint32_t) duty * pwm_span[t];
+  uint16_t compare = pwm_offset[t] + ( scaled >> 16 );
+
+  if ( tc->dither )
+  {
+    uint32_t sum = (uint32_t) *residue + ( scaled & 0xffff );
+
+    compare  += sum >> 16;
+    *residue  = sum & 0xffff;
+  }
+
+  return compare;
+}
+
+/**
+ * \brief Set up every TC in 16-bit PWM at its frequency (see pwm_tcs) with its outputs
+ *        enabled and held low (duty 0), then start them. DShot pairs get their pins as
+ *        GPIO outputs, low, and the first of them gives its TC to dshot_init().
+ */
+
+void pwm_init( void )
+{
+  struct tc_config config_tc;
+  struct port_config config_port_pin;
+  bool dshot_tried = false;
+  bool dshot_ok    = false;
+
+  port_get_config_defaults( &config_port_pin );
+  config_port_pin.direction = PORT_PIN_DIR_OUTPUT;
+
+  pwm_commit_tc = PWM_TC_COUNT;
+  pwm_dshot_any = false;
+
+  for ( uint8_t t = 0; t < PWM_TC_COUNT; ++t )
+  {
+    const Pwm_tc_t* tc = &pwm_tcs[t];
+
+    for ( uint8_t c = 0; c < PWM_CHANNEL_COUNT; ++c )
+    {
+      if ( pwm_channels[c].tc != t )
+        continue;
+
+      pwm_tc_channel[t][pwm_channels[c].cc] = c;
+      pwm_shadow[c]  = 0;
+      pwm_applied[c] = 0;
+      pwm_compare[c] = 0;
+      pwm_residue[c] = 0;
+    }
+    pwm_dirty[t]       = 0;
+    pwm_dshot_ready[t] = false;
+
+    if ( pwm_dshot( t ) )
+    {
+      if ( !dshot_tried )
+      {
+        dshot_ok    = dshot_init( pwm_tc_hw[t] );
+        dshot_tried = true;
+      }
+      pwm_dshot_ready[t] = dshot_ok && dshot_rate_ok( pwm_dshot_kbps( tc->protocol ) );
+      pwm_dshot_any     |= pwm_dshot_ready[t];
+
+      for ( uint8_t cc = 0; cc < 2; ++cc )
+      {
+        uint8_t pin = pwm_channels[pwm_tc_channel[t][cc]].pin;
+
+        port_pin_set_output_level( pin, false );
+        port_pin_set_config( pin, &config_port_pin );
+      }
+      continue;
+    }
+
+    tc_get_config_defaults( &config_tc );
+
+    config_tc.counter_size    = TC_COUNTER_SIZE_16BIT;
+    config_tc.clock_prescaler = pwm_prescaler( tc->div );
+    if ( tc->top == PWM_TOP_NORMAL )
+    {
+      config_tc.wave_generation = TC_WAVE_GENERATION_NORMAL_PWM;
+    }
+    else
+    {
+      config_tc.wave_generation = TC_WAVE_GENERATION_MATCH_PWM;
+      config_tc.counter_16_bit.compare_capture_channel[TC_COMPARE_CAPTURE_CHANNEL_0] = tc->top;
+    }
+
+    if ( tc->protocol == PWM_PROTOCOL_ONESHOT125 )
+    {
+      pwm_offset[t] = PWM_COUNTS_US( 125, tc->div );
+      pwm_span[t]   = pwm_offset[t];
+    }
+    else
+    {
+      pwm_offset[t] = 0;
+      pwm_span[t]   = (uint32_t) tc->top + 1;
+    }
+
+    for ( uint8_t cc = 0; cc < 2; ++cc )
+    {
+      uint8_t c = pwm_tc_channel[t][cc];
+      const Pwm_channel_t* channel = &pwm_channels[c];
+
+      if ( !pwm_compare_output( c ) )
+        continue;
+
+      /* held low until set, whatever the protocol */
+      config_tc.counter_16_bit.compare_capture_channel[channel->cc] = 0;
+      config_tc.pwm_channel[channel->cc].enabled = true;
+      config_tc.pwm_channel[channel->cc].pin_out = channel->pin;
+      config_tc.pwm_channel[channel->cc].pin_mux = channel->mux;
+    }
+
+    tc_init( &pwm_tc[t], pwm_tc_hw[t], &config_tc );
+    tc_register_callback( &pwm_tc[t], pwm_overflow_callback, TC_CALLBACK_OVERFLOW );
+    if ( tc->dither )
+      tc_enable_callback( &pwm_tc[t], TC_CALLBACK_OVERFLOW );
+    pwm_commit_tc = t;
+  }
+
+  pwm_commit_pending  = false;
+  pwm_commit_sequence = 0;
+  pwm_commit_applied  = 0;
+  pwm_dshot_pending   = false;
+
+  /* back to back, so the counters stay within a few counts of each other */
+  system_interrupt_enter_critical_section();
+  for ( uint8_t t = 0; t < PWM_TC_COUNT; ++t )
+  {
+    if ( !pwm_dshot( t ) )
+      tc_enable( &pwm_tc[t] );
+  }
+  system_interrupt_leave_critical_section();
+}
+
+/**
+ * \brief Set the duty cycle of one output, from the start of its next PWM period.
+ *
+ * \param [in] channel output, 0 for PWM1
+ * \param [in] duty as its TC's protocol has it, see Pwm_protocol
+ *
+ * \return false if there is no such channel, its compare holds the TC's top or its DShot
+ *         rate is out of reach
+ */
+
+bool pwm_set_duty( uint8_t channel, uint16_t duty )
+{
+  uint8_t t;
+
+  if ( channel >= PWM_CHANNEL_COUNT || !pwm_available( channel ) )
+    return false;
+
+  t = pwm_channels[channel].tc;
+
+  system_interrupt_enter_critical_section();
+  pwm_shadow[channel] = duty;
+  if ( pwm_dshot( t ) )
+  {
+    pwm_dshot_pending = true;
+  }
+  else if ( pwm_commit_pending )
+  {
+    /* joins the staged commit rather than going out ahead of it */
+  }
+  else if ( duty != pwm_applied[channel] )
+  {
+    /* an overflow flagged earlier in this period must not latch it straight away */
+    if ( pwm_dirty[t] == 0 && !pwm_tcs[t].dither )
+    {
+      pwm_tc[t].hw->COUNT16.INTFLAG.reg = TC_INTFLAG_OVF;
+      tc_enable_callback( &pwm_tc[t], TC_CALLBACK_OVERFLOW );
+    }
+    pwm_dirty[t] |= 1 << pwm_channels[channel].cc;
+  }
+  else
+  {
+    pwm_dirty[t] &= ~( 1 << pwm_channels[channel].cc );
+  }
+  system_interrupt_leave_critical_section();
+
+  return true;
+}
+
+/**
+ * \brief Stage the duty cycle of every output, to be applied to all of them from the start
+ *        of the same PWM period.
+ *
+ * A commit staged before the last one was latched replaces it. Outputs on a compare that
+ * holds their TC's top ignore their value. A DShot pair whose rate is out of reach (see
+ * pwm_set_duty()) fails the whole commit instead, its ESCs would never get their values.
+ *
+ * \param [in] duty duties as pwm_set_duty() takes them, PWM1 to PWM12
+ *
+ * \return sequence number of the commit, see pwm_get_commit(), or 0 if nothing was staged
+ */
+
+uint16_t pwm_set_all( const uint16_t duty[PWM_CHANNEL_COUNT] )
+{
+  uint16_t sequence;
+
+  for ( uint8_t t = 0; t < PWM_TC_COUNT; ++t )
+  {
+    if ( pwm_dshot( t ) && !pwm_dshot_ready[t] )
+      return 0;
+  }
+
+  system_interrupt_enter_critical_section();
+  for ( uint8_t c = 0; c < PWM_CHANNEL_COUNT; ++c )
+  {
+    if ( !pwm_available( c ) )
+      continue;
+
+    pwm_shadow[c] = duty[c];
+    if ( pwm_dshot( pwm_channels[c].tc ) )
+      pwm_dshot_pending = true;
+  }
+
+  /* single updates still waiting would otherwise latch ahead of the rest */
+  for ( uint8_t t = 0; t < PWM_TC_COUNT; ++t )
+    pwm_dirty[t] = 0;
+
+  /* 0 stays free to report a refused commit */
+  if ( ++pwm_commit_sequence == 0 )
+    ++pwm_commit_sequence;
+  sequence = pwm_commit_sequence;
+  if ( pwm_commit_tc == PWM_TC_COUNT )
+  {
+    /* nothing but DShot, there is no compare to wait for */
+    pwm_commit_applied = sequence;
+  }
+  else
+  {
+    if ( !pwm_commit_pending && !pwm_tcs[pwm_commit_tc].dither )
+    {
+      pwm_tc[pwm_commit_tc].hw->COUNT16.INTFLAG.reg = TC_INTFLAG_OVF;
+      tc_enable_callback( &pwm_tc[pwm_commit_tc], TC_CALLBACK_OVERFLOW );
+    }
+    pwm_commit_pending = true;
+  }
+  system_interrupt_leave_critical_section();
+
+  return sequence;
+}
+
+/* sequence number of the last commit that has been latched, 0 before the first */
+uint16_t pwm_get_commit( void )
+{
+  return pwm_commit_applied;
+}
+
+/* duty cycle last set on one output, 0 if there is no such channel */
+uint16_t pwm_get_duty( uint8_t channel )
+{
+  if ( channel >= PWM_CHANNEL_COUNT )
+    return 0;
+
+  return pwm_shadow[channel];
+}
+
+/* whether pwm_service() has a DShot frame to send */
+bool pwm_pending( void )
+{
+  return pwm_dshot_pending;
+}
+
+/* whether any output sends DShot, and so needs pwm_tick() */
+bool pwm_dshot_active( void )
+{
+  return pwm_dshot_any;
+}
+
+/* have pwm_service() resend every DShot frame, call at PWM_DSHOT_HZ (e.g. from SysTick) */
+void pwm_tick( void )
+{
+  if ( pwm_dshot_any )
+    pwm_dshot_pending = true;
+}
+
+/**
+ * \brief Send the DShot outputs their values, one frame each, all outputs of a bit rate
+ *        in the same pass. Call from the main loop: a pass keeps interrupts off for a
+ *        frame, see dshot_send().
+ */
+
+void pwm_service( void )
+{
+  uint16_t value[PWM_CHANNEL_COUNT];
+  Dshot_buffer_t buffer;
+
+  if ( !pwm_dshot_pending )
+    return;
+
+  system_interrupt_enter_critical_section();
+  for ( uint8_t c = 0; c < PWM_CHANNEL_COUNT; ++c )
+    value[c] = pwm_shadow[c];
+  pwm_dshot_pending = false;
+  system_interrupt_leave_critical_section();
+
+  for ( uint8_t protocol = PWM_PROTOCOL_DSHOT150; protocol <= PWM_PROTOCOL_DSHOT300;
+        ++protocol )
+  {
+    dshot_clear( &buffer );
+
+    for ( uint8_t c = 0; c < PWM_CHANNEL_COUNT; ++c )
+    {
+      uint8_t t = pwm_channels[c].tc;
+
+      if ( pwm_tcs[t].protocol != protocol || !pwm_dshot_ready[t] )
+        continue;
+
+      dshot_encode( &buffer, pwm_channels[c].pin,
+                    dshot_frame( value[c], value[c] & DSHOT_TELEMETRY ) );
+    }
+
+    dshot_send( pwm_dshot_kbps( protocol ), &buffer );
+  }
+}
+
+/*
+ * A new period has started: the outputs went high at the overflow and each goes low again
+ * when the counter reaches its compare value. A compare can only be moved while that still
+ * yields one clean pulse this period, i.e. unless it moves earlier and the counter has
+ * already passed the new value but maybe not the old one (the output would then stay high
+ * all period); that compare waits for the next overflow instead.
+ */
+
+static inline bool pwm_can_latch( uint8_t channel, uint16_t compare, uint32_t count )
+{
+  return compare >= pwm_compare[channel] || count < compare || count > pwm_compare[channel];
+}
+
+static void pwm_latch( uint8_t channel, uint16_t duty, uint16_t compare, uint16_t residue )
+{
+  const Pwm_channel_t* ch = &pwm_channels[channel];
+
+  if ( compare != pwm_compare[channel] )
+    tc_set_compare_value( &pwm_tc[ch->tc], ch->cc, compare );
+
+  pwm_applied[channel] = duty;
+  pwm_compare[channel] = compare;
+  pwm_residue[channel] = residue;
+}
+
+/* latch the staged commit into every compare, unless one of them has to wait */
+static bool pwm_commit( void )
+{
+  uint32_t count[PWM_TC_COUNT];
+  uint16_t compare[PWM_CHANNEL_COUNT];
+  uint16_t residue[PWM_CHANNEL_COUNT];
+
+  /* a DShot pair was never given its TC, it has no count */
+  for ( uint8_t t = 0; t < PWM_TC_COUNT; ++t )
+    count[t] = pwm_dshot( t ) ? 0 : tc_get_count_value( &pwm_tc[t] );
+
+  for ( uint8_t c = 0; c < PWM_CHANNEL_COUNT; ++c )
+  {
+    if ( !pwm_compare_output( c ) )
+      continue;
+
+    residue[c] = pwm_residue[c];
+    compare[c] = pwm_target( c, pwm_shadow[c], &residue[c] );
+    if ( !pwm_can_latch( c, compare[c], count[pwm_channels[c].tc] ) )
+      return false;
+  }
+
+  for ( uint8_t c = 0; c < PWM_CHANNEL_COUNT; ++c )
+  {
+    if ( pwm_compare_output( c ) )
+      pwm_latch( c, pwm_shadow[c], compare[c], residue[c] );
+  }
+
+  pwm_commit_pending = false;
+  pwm_commit_applied = pwm_commit_sequence;
+  return true;
+}
+
+/* move the dirty (or, dithering, all) compares of one TC on to this period */
+static void pwm_update( struct tc_module *const module, uint8_t t )
+{
+  uint8_t  dirty = pwm_dirty[t];
+  uint32_t count = tc_get_count_value( module );
+
+  for ( uint8_t cc = 0; cc < 2; ++cc )
+  {
+    uint8_t  channel = pwm_tc_channel[t][cc];
+    uint16_t duty;
+    uint16_t compare;
+    uint16_t residue = pwm_residue[channel];
+
+    if ( dirty & ( 1 << cc ) )
+      duty = pwm_shadow[channel];
+    else if ( pwm_tcs[t].dither && pwm_compare_output( channel ) )
+      duty = pwm_applied[channel];
+    else
+      continue;
+
+    compare = pwm_target( channel, duty, &residue );
+    if ( !pwm_can_latch( channel, compare, count ) )
+      continue;
+
+    pwm_latch( channel, duty, compare, residue );
+    dirty &= ~( 1 << cc );
+  }
+
+  pwm_dirty[t] = dirty;
+}
+
+static void pwm_overflow_callback( struct tc_module *const module )
+{
+  uint8_t t = (uint8_t) ( module - pwm_tc );
+
+  /* a commit sets this TC's compares for the period too */
+  if ( !( t == pwm_commit_tc && pwm_commit_pending && pwm_commit() ) )
+    pwm_update( module, t );
+
+  if ( pwm_dirty[t] == 0 && !pwm_tcs[t].dither &&
+       !( t == pwm_commit_tc && pwm_commit_pending ) )
+    tc_disable_callback( module, TC_CALLBACK_OVERFLOW );
+}
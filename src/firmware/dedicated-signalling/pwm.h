@@ -0,0 +1,136 @@
+/**
+ * Copyright (C) 2018 Shreyas Vinod
+ *
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file pwm.h
+ * \author Shreyas Vinod <shreyas@shreyasvinod.xyz>
+ *
+ * \brief Table-driven PWM on the twelve TC outputs of the dedicated signalling
+ *        controller.
+ */
+
+#ifndef PWM_H_
+#define PWM_H_
+
+#include <asf.h>
+
+#include "pindefs.h"
+
+/**
+ * \defgroup pwm PWM
+ * \brief Twelve PWM outputs, two per TC instance.
+ * \{
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \def PWM_TC_COUNT
+ * \brief TC instances driving the PWM outputs, TC0 to TC5.
+ */
+#define PWM_TC_COUNT 6
+
+/**
+ * \def PWM_GCLK_HZ
+ * \brief Clock feeding the TCs: GCLK generator 0, OSC8M undivided as ASF sets it up.
+ *        Define it to match when GCLK0 runs faster, e.g. 48 MHz off the DFLL for DShot300.
+ */
+#ifndef PWM_GCLK_HZ
+#define PWM_GCLK_HZ 8000000UL
+#endif
+
+/**
+ * \def PWM_DSHOT_HZ
+ * \brief Rate at which every DShot output gets its frame again, changed or not, see
+ *        pwm_tick(). An ESC disarms once its frames stop.
+ */
+#define PWM_DSHOT_HZ 1000
+
+/**
+ * \def PWM_TOP_NORMAL
+ * \brief Top of a TC left in normal PWM: the full 16-bit count, both outputs in use.
+ */
+#define PWM_TOP_NORMAL 0xffff
+
+/**
+ * \def PWM_TOP_HZ
+ * \brief Top giving a PWM frequency of hz with the TC clock divided by div. Any other
+ *        top than PWM_TOP_NORMAL puts the TC in match PWM, where compare 0 holds the top
+ *        and only the output on compare 1 is left.
+ */
+#define PWM_TOP_HZ( hz, div ) ( PWM_GCLK_HZ / ( (uint32_t) ( div ) * ( hz ) ) - 1 )
+
+/**
+ * \def PWM_COUNTS_US
+ * \brief Counts in us microseconds with the TC clock divided by div.
+ */
+#define PWM_COUNTS_US( us, div ) \
+  ( (uint32_t) ( (uint64_t) PWM_GCLK_HZ * ( us ) / ( (uint64_t) ( div ) * 1000000UL ) ) )
+
+/**
+ * \def PWM_DUTY_US
+ * \brief Duty (see pwm_set_duty()) of a us microsecond pulse, on a TC with the given top
+ *        and clock divider.
+ */
+#define PWM_DUTY_US( us, top, div ) \
+  ( (uint16_t) ( ( (uint64_t) PWM_COUNTS_US( us, div ) << 16 ) / ( (uint32_t) ( top ) + 1 ) ) )
+
+/**
+ * \enum Pwm_protocol
+ * \brief What the outputs of a TC pair send, and what a duty means for them.
+ */
+typedef enum PWM_PROTOCOL
+{
+  PWM_PROTOCOL_PWM        = 0x00, /**< duty is a fraction of the period, in 1/0x10000 */
+  PWM_PROTOCOL_ONESHOT125 = 0x01, /**< 125 us pulse plus duty times another 125 us */
+  PWM_PROTOCOL_DSHOT150   = 0x02, /**< duty is a DShot value, see DSHOT_TELEMETRY */
+  PWM_PROTOCOL_DSHOT300   = 0x03  /**< as above */
+} Pwm_protocol;
+
+/**
+ * \struct Pwm_tc_t
+ * \brief How one TC instance counts. A DShot pair only uses protocol: its pins are
+ *        driven as GPIO, and the TC of the first DShot pair times every DShot frame.
+ */
+typedef struct Pwm_tc_t
+{
+  uint16_t div;     /**< clock divider: 1, 2, 4, 8, 16, 64, 256 or 1024 */
+  uint16_t top;     /**< last count of a period, see PWM_TOP_HZ */
+  bool dither;      /**< sigma-delta the part of a duty finer than one count */
+  uint8_t protocol; /**< Pwm_protocol */
+} Pwm_tc_t;
+
+/**
+ * \struct Pwm_channel_t
+ * \brief Where one PWM output comes from.
+ */
+typedef struct Pwm_channel_t
+{
+  uint8_t tc;                         /**< TC instance, index into the TC table */
+  enum tc_compare_capture_channel cc; /**< compare channel (waveform output) of that TC */
+  uint32_t pin;                       /**< output pin */
+  uint32_t mux;                       /**< pinmux setting routing WOx to the pin */
+} Pwm_channel_t;
+
+void pwm_init( void );
+bool pwm_set_duty( uint8_t channel, uint16_t duty );
+uint16_t pwm_get_duty( uint8_t channel );
+uint16_t pwm_set_all( const uint16_t duty[PWM_CHANNEL_COUNT] );
+uint16_t pwm_get_commit( void );
+bool pwm_pending( void );
+bool pwm_dshot_active( void );
+void pwm_tick( void );
+void pwm_service( void );
+
+/**
+ * \} end of pwm
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PWM_H_ */
@@ -3,6 +3,9 @@
 
 #define DEBUG_MODE
 
+/* the POWER_* quantities below in milli-units (mV, mA, mW), as the power code uses them */
+#define POWER_MILLI( x ) ( (int32_t) ( (x) * 1000 ) )
+
 #define POWER_VOUT_SETPOINT 12.0
 #define POWER_VIN_NOMINAL   48.0
 
@@ -21,4 +24,42 @@
 #define POWER_POUT_RANGE_MIN 0.0
 #define POWER_POUT_RANGE_MAX 600.0
 
+/* power sequencing, times in ms */
+#define POWER_STAGGER_ON      20   /* between bringing up consecutive modules */
+#define POWER_STAGGER_OFF     5    /* between shutting down consecutive modules */
+#define POWER_INRUSH_DELAY    2    /* from enable to the inrush current check */
+#define POWER_INRUSH_LIMIT    12.0 /* per module, in A; under POWER_IOUT_OC_FAULT */
+#define POWER_SETTLE_DELAY    10   /* between Vout settling checks */
+#define POWER_SETTLE_ATTEMPTS 5    /* Vout checks before a module is declared faulty */
+
+/* current sharing */
+#define POWER_BALANCE_PERIOD   500   /* ms between balancing steps */
+#define POWER_BALANCE_BAND     0.5   /* A a module may stray from the mean untrimmed */
+#define POWER_BALANCE_MIN_LOAD 2.0   /* A per module below which sharing is left alone */
+#define POWER_BALANCE_GAIN     10    /* mV of trim per A of imbalance, per step */
+#define POWER_TRIM_STEP        0.02  /* V, largest trim change per step */
+#define POWER_TRIM_MAX         0.24  /* V, largest trim either way */
+
+/* limits programmed into every module, per module (V, A, degrees C) */
+#define POWER_VOUT_OV_FAULT 13.2
+#define POWER_VOUT_OV_WARN  12.6
+#define POWER_IOUT_OC_FAULT 14.0
+#define POWER_IOUT_OC_WARN  10.0
+#define POWER_OT_FAULT      110.0
+#define POWER_OT_WARN       95.0
+#define POWER_VIN_OV_FAULT  60.0
+#define POWER_VIN_OV_WARN   56.0
+#define POWER_VIN_UV_WARN   42.0
+#define POWER_VIN_UV_FAULT  38.0
+
+/* what a module does on each fault, PMBus response bytes: bits 7:6 the response,
+ * 5:3 restart attempts, 2:0 the delay unit */
+#define POWER_VOUT_OV_RESPONSE 0x80 /* shut down, stay off until cleared */
+#define POWER_IOUT_OC_RESPONSE 0xc0 /* shut down, stay off until cleared */
+#define POWER_OT_RESPONSE      0xc0 /* off while too hot, back on once cooled */
+#define POWER_VIN_OV_RESPONSE  0xc0 /* off while Vin is out of range */
+#define POWER_VIN_UV_RESPONSE  0xc0 /* off while Vin is out of range */
+
+#define POWER_ALERT_RETRY 10 /* ms before looking again at an SMBALERT# still asserted */
+
 #endif /* DEFS_H_ */
@@ -0,0 +1,226 @@
+#include <asf.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "task_handler.h"
+#include "history.h"
+
+/* milli-units per count of each channel, see History_channel */
+static const uint16_t history_scale[HISTORY_CHANNELS] = { 10, 1, 1, 10, 10 };
+
+/* a bulk read is the header and the ring as they sit in memory, with nothing between */
+_Static_assert( offsetof( History_t, raw.entry ) == sizeof(History_header_t) &&
+                offsetof( History_t, seconds.entry ) - offsetof( History_t, seconds.header )
+                  == sizeof(History_header_t) &&
+                offsetof( History_t, minutes.entry ) - offsetof( History_t, minutes.header )
+                  == sizeof(History_header_t),
+                "history rings must follow their headers directly" );
+_Static_assert( sizeof(History_page_t) == 48 && HISTORY_PAGE_DATA == sizeof(History_header_t),
+                "a history page is 48 bytes, the first one the header" );
+
+static void history_initHeader( History_header_t* header, uint8_t level, uint8_t modules,
+                                uint16_t depth, uint16_t entry_size, uint32_t period )
+{
+  memset( header, 0, sizeof(History_header_t) );
+  header->version    = HISTORY_VERSION;
+  header->level      = level;
+  header->modules    = modules;
+  header->channels   = HISTORY_CHANNELS;
+  header->depth      = depth;
+  header->entry_size = entry_size;
+  header->period     = period;
+  memcpy( header->scale, history_scale, sizeof(history_scale) );
+}
+
+static void history_resetAccumulator( History_accumulator_t* acc )
+{
+  memset( acc->sum, 0, sizeof(acc->sum) );
+  memset( acc->valid, 0, sizeof(acc->valid) );
+  acc->samples = 0;
+}
+
+/* the entry at head has been written, make it the newest; in one go, as far as a page
+ * copied from the pi bus interrupt can tell */
+static void history_push( History_header_t* header )
+{
+  system_interrupt_enter_critical_section();
+  header->timestamp = system_time;
+  header->written++;
+  if ( header->count < header->depth - 1 )
+    header->count++;
+  header->head = (uint16_t) ( ( header->head + 1 ) % header->depth );
+  system_interrupt_leave_critical_section();
+}
+
+/* value / divisor rounded to nearest, clear of HISTORY_INVALID */
+static int16_t history_divide( int32_t value, int32_t divisor )
+{
+  int32_t q = ( value >= 0 ? value + divisor / 2 : value - divisor / 2 ) / divisor;
+
+  if ( q > INT16_MAX )     return INT16_MAX;
+  if ( q <= INT16_MIN )    return INT16_MIN + 1;
+  return (int16_t) q;
+}
+
+/* one sample (or one finer aggregate) into a running aggregate, O(1) per value */
+static void history_fold( History_accumulator_t* acc, uint8_t m, uint8_t c,
+                          int16_t min, int16_t max, int16_t mean )
+{
+  if ( acc->valid[m] == 0 || min < acc->min[m][c] ) acc->min[m][c] = min;
+  if ( acc->valid[m] == 0 || max > acc->max[m][c] ) acc->max[m][c] = max;
+  acc->sum[m][c] += mean;
+}
+
+static void history_emit( History_accumulator_t* acc, History_aggregate_t* entry,
+                          uint8_t modules )
+{
+  for ( uint8_t m = 0; m < POWER_MODULE_MAX; ++m )
+  {
+    for ( uint8_t c = 0; c < HISTORY_CHANNELS; ++c )
+    {
+      History_stat_t* stat = &entry->stat[m][c];
+
+      if ( m >= modules || acc->valid[m] == 0 )
+      {
+        stat->min = stat->max = stat->mean = HISTORY_INVALID;
+        continue;
+      }
+      stat->min  = acc->min[m][c];
+      stat->max  = acc->max[m][c];
+      stat->mean = history_divide( acc->sum[m][c], acc->valid[m] );
+    }
+  }
+}
+
+void historyInit( History_t* history, uint8_t modules )
+{
+  if ( modules > POWER_MODULE_MAX )
+    modules = POWER_MODULE_MAX;
+
+  history_initHeader( &history->raw.header, HISTORY_LEVEL_RAW, modules,
+                      HISTORY_RAW_DEPTH, sizeof(History_raw_t), HISTORY_RAW_PERIOD );
+  history_initHeader( &history->seconds.header, HISTORY_LEVEL_SECOND, modules,
+                      HISTORY_SECOND_DEPTH, sizeof(History_aggregate_t),
+                      HISTORY_RAW_PERIOD * HISTORY_SECOND_SAMPLES );
+  history_initHeader( &history->minutes.header, HISTORY_LEVEL_MINUTE, modules,
+                      HISTORY_MINUTE_DEPTH, sizeof(History_aggregate_t),
+                      HISTORY_RAW_PERIOD * HISTORY_SECOND_SAMPLES * HISTORY_MINUTE_SECONDS );
+  history_resetAccumulator( &history->second );
+  history_resetAccumulator( &history->minute );
+}
+
+/* one raw sample; every HISTORY_SECOND_SAMPLES of them make a 1 s entry, and every
+ * HISTORY_MINUTE_SECONDS of those a 1 min entry */
+void historyAdd( History_t* history, const Power_snapshot_t* snapshot )
+{
+  uint8_t modules = history->raw.header.modules;
+  History_raw_t* raw = &history->raw.entry[history->raw.header.head];
+
+  for ( uint8_t m = 0; m < POWER_MODULE_MAX; ++m )
+  {
+    const Power_module_snapshot_t* module = &snapshot->module[m];
+    bool valid = m < modules && m < snapshot->module_count && module->status == POWER_OK;
+    int32_t milli[HISTORY_CHANNELS];
+
+    if ( !valid )
+    {
+      for ( uint8_t c = 0; c < HISTORY_CHANNELS; ++c )
+        raw->value[m][c] = HISTORY_INVALID;
+      continue;
+    }
+
+    milli[HISTORY_VIN]         = module->vin;
+    milli[HISTORY_VOUT]        = module->vout;
+    milli[HISTORY_IOUT]        = module->iout;
+    milli[HISTORY_POUT]        = module->pout;
+    milli[HISTORY_TEMPERATURE] = module->temperature;
+
+    for ( uint8_t c = 0; c < HISTORY_CHANNELS; ++c )
+    {
+      int16_t value = history_divide( milli[c], history_scale[c] );
+
+      raw->value[m][c] = value;
+      history_fold( &history->second, m, c, value, value, value );
+    }
+    history->second.valid[m]++;
+  }
+  history_push( &history->raw.header );
+
+  if ( ++history->second.samples < HISTORY_SECOND_SAMPLES )
+    return;
+
+  History_aggregate_t* second = &history->seconds.entry[history->seconds.header.head];
+  history_emit( &history->second, second, modules );
+  history_push( &history->seconds.header );
+  history_resetAccumulator( &history->second );
+
+  /* a minute is the mean of its seconds, each weighted alike */
+  for ( uint8_t m = 0; m < modules; ++m )
+  {
+    if ( second->stat[m][0].mean == HISTORY_INVALID )
+      continue;
+    for ( uint8_t c = 0; c < HISTORY_CHANNELS; ++c )
+      history_fold( &history->minute, m, c, second->stat[m][c].min,
+                    second->stat[m][c].max, second->stat[m][c].mean );
+    history->minute.valid[m]++;
+  }
+
+  if ( ++history->minute.samples < HISTORY_MINUTE_SECONDS )
+    return;
+
+  history_emit( &history->minute, &history->minutes.entry[history->minutes.header.head],
+                modules );
+  history_push( &history->minutes.header );
+  history_resetAccumulator( &history->minute );
+}
+
+/* a level's header, its ring right behind it, or NULL if there is no such level */
+const History_header_t* historyLevel( const History_t* history, uint8_t level )
+{
+  switch ( level )
+  {
+    case HISTORY_LEVEL_RAW:    return &history->raw.header;
+    case HISTORY_LEVEL_SECOND: return &history->seconds.header;
+    case HISTORY_LEVEL_MINUTE: return &history->minutes.header;
+    default:                   return NULL;
+  }
+}
+
+/* bytes in a level's image: header and whole ring */
+uint32_t historyLevelSize( const History_header_t* header )
+{
+  return sizeof(History_header_t) + (uint32_t) header->depth * header->entry_size;
+}
+
+/* page of a level's image, see History_page_t; false if there is no such level or page.
+ * Safe from the pi bus interrupt, historyAdd(..) never leaves a page half pushed. */
+bool historyPage( const History_t* history, uint8_t level, uint16_t page,
+                  History_page_t* out )
+{
+  const History_header_t* header = historyLevel( history, level );
+  uint32_t size, offset;
+
+  if ( header == NULL )
+    return false;
+
+  size   = historyLevelSize( header );
+  offset = (uint32_t) page * HISTORY_PAGE_DATA;
+  if ( offset >= size )
+    return false;
+
+  out->level  = level;
+  out->length = (uint8_t) ( size - offset < HISTORY_PAGE_DATA ? size - offset
+                                                              : HISTORY_PAGE_DATA );
+  out->page   = page;
+  out->pages  = (uint16_t) ( ( size + HISTORY_PAGE_DATA - 1 ) / HISTORY_PAGE_DATA );
+  memset( out->data, 0, sizeof(out->data) );
+
+  system_interrupt_enter_critical_section();
+  out->written = header->written;
+  out->head    = header->head;
+  memcpy( out->data, (const uint8_t*) header + offset, out->length );
+  system_interrupt_leave_critical_section();
+
+  return true;
+}
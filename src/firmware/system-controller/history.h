@@ -0,0 +1,145 @@
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <stdint.h>
+
+#include "power.h"
+
+/* raw sample period, in ms: one power_snapshot() per sample */
+#define HISTORY_RAW_PERIOD 100
+
+/* slots at each resolution, one of them always being written: raw samples for 2 s, all of
+ * the second behind the newest 1 s entry; 1 s aggregates for 30 s; 1 min aggregates for
+ * 30 min, well past a pi reboot. About 13 KB in all */
+#define HISTORY_RAW_DEPTH    ( 20 + 1 )
+#define HISTORY_SECOND_DEPTH ( 30 + 1 )
+#define HISTORY_MINUTE_DEPTH ( 30 + 1 )
+
+#define HISTORY_SECOND_SAMPLES ( 1000 / HISTORY_RAW_PERIOD ) /* raw samples per second */
+#define HISTORY_MINUTE_SECONDS 60
+
+/* layout version of History_header_t and the entries behind it */
+#define HISTORY_VERSION 2
+
+/* a reading that is missing: the module failed the sweep, or none of an aggregate's did */
+#define HISTORY_INVALID INT16_MIN
+
+/* readings per module, in this order */
+#define HISTORY_CHANNELS 5
+
+typedef enum HISTORY_CHANNEL
+{
+  HISTORY_VIN         = 0x00, /* 10 mV */
+  HISTORY_VOUT        = 0x01, /* mV */
+  HISTORY_IOUT        = 0x02, /* mA */
+  HISTORY_POUT        = 0x03, /* 10 mW */
+  HISTORY_TEMPERATURE = 0x04  /* 10 milli-degrees C */
+} History_channel;
+
+typedef enum HISTORY_LEVEL
+{
+  HISTORY_LEVEL_RAW    = 0x00,
+  HISTORY_LEVEL_SECOND = 0x01,
+  HISTORY_LEVEL_MINUTE = 0x02
+} History_level;
+
+/* 36 bytes on the wire, little endian, in this order, followed by depth slots of
+ * entry_size bytes each. The count slots before head hold the entries, oldest first,
+ * wrapping around; the slot at head is the one being written and never an entry. */
+typedef struct History_header_t
+{
+  uint8_t  version;   /* HISTORY_VERSION */
+  uint8_t  level;     /* History_level */
+  uint8_t  modules;   /* power modules per entry */
+  uint8_t  channels;  /* HISTORY_CHANNELS */
+  uint16_t depth;     /* entries in the ring */
+  uint16_t entry_size;
+  uint16_t head;      /* next entry to be written */
+  uint16_t count;     /* entries written so far, up to depth - 1 */
+  uint32_t written;   /* entries written since historyInit() */
+  uint32_t timestamp; /* system_time of the newest entry */
+  uint32_t period;    /* ms between entries */
+  uint16_t scale[HISTORY_CHANNELS]; /* milli-units per count of each channel */
+  uint16_t reserved;
+} History_header_t;
+
+/* raw entry: value[module][channel] */
+typedef struct History_raw_t
+{
+  int16_t value[POWER_MODULE_MAX][HISTORY_CHANNELS];
+} History_raw_t;
+
+/* aggregate entry: mean is over the valid samples only */
+typedef struct History_stat_t
+{
+  int16_t min;
+  int16_t max;
+  int16_t mean;
+} History_stat_t;
+
+typedef struct History_aggregate_t
+{
+  History_stat_t stat[POWER_MODULE_MAX][HISTORY_CHANNELS];
+} History_aggregate_t;
+
+/* running aggregate of the entry being built */
+typedef struct History_accumulator_t
+{
+  int32_t sum[POWER_MODULE_MAX][HISTORY_CHANNELS];
+  int16_t min[POWER_MODULE_MAX][HISTORY_CHANNELS];
+  int16_t max[POWER_MODULE_MAX][HISTORY_CHANNELS];
+  uint8_t valid[POWER_MODULE_MAX]; /* samples the module had readings in */
+  uint8_t samples;                 /* samples folded in, valid or not */
+} History_accumulator_t;
+
+/* fixed RAM, each level a header directly followed by its ring: the image the pi reads
+ * a page at a time */
+typedef struct History_t
+{
+  struct
+  {
+    History_header_t header;
+    History_raw_t entry[HISTORY_RAW_DEPTH];
+  } raw;
+  struct
+  {
+    History_header_t header;
+    History_aggregate_t entry[HISTORY_SECOND_DEPTH];
+  } seconds;
+  struct
+  {
+    History_header_t header;
+    History_aggregate_t entry[HISTORY_MINUTE_DEPTH];
+  } minutes;
+
+  History_accumulator_t second; /* building the next 1 s entry */
+  History_accumulator_t minute; /* building the next 1 min entry */
+} History_t;
+
+/* bytes of a level's image in each page, the first page holds exactly the header */
+#define HISTORY_PAGE_DATA 36
+
+/* One REG_HISTORY read: 48 bytes on the wire, little endian, in this order. The level
+ * keeps gaining entries while the pi reads it page by page, so each page carries written
+ * and head as they were when it was copied, all in one go. A page with written k more
+ * than the page the pi took head from holds nothing trustworthy in the k + 1 slots from
+ * that head on: rewritten, or being rewritten. */
+typedef struct History_page_t
+{
+  uint8_t  level;    /* History_level */
+  uint8_t  length;   /* bytes of the image in data */
+  uint16_t page;     /* data starts page * HISTORY_PAGE_DATA bytes into the image */
+  uint32_t written;  /* of the level, see History_header_t */
+  uint16_t head;
+  uint16_t pages;    /* in the level */
+  uint8_t  data[HISTORY_PAGE_DATA];
+} History_page_t;
+
+extern void historyInit( History_t* history, uint8_t modules );
+extern void historyAdd( History_t* history, const Power_snapshot_t* snapshot );
+extern const History_header_t* historyLevel( const History_t* history, uint8_t level );
+extern uint32_t historyLevelSize( const History_header_t* header );
+extern bool historyPage( const History_t* history, uint8_t level, uint16_t page,
+                         History_page_t* out );
+
+#endif /* HISTORY_H_ */
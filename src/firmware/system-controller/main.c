@@ -1,20 +1,75 @@
 #include <asf.h>
-#include <math.h>
+#include <string.h>
 
+#include "defs.h"
 #include "pindefs.h"
 #include "smbus.h"
+#include "power.h"
+#include "history.h"
+#include "task_handler.h"
+#include "trace.h"
+#include "update.h"
 
 #define BUFFER_LENGTH 48 /* in bytes (needs to be greater than ID_LENGTH */
+#define INIT_ATTEMPTS 5  /* bus initialisation attempts before carrying on without it */
+
+#define TELEMETRY_PERIOD ( HISTORY_RAW_PERIOD * TASK_TICK_HZ / 1000 ) /* power telemetry
+                                                                       sweep, in ticks */
+#define BALANCE_PERIOD ( POWER_BALANCE_PERIOD * TASK_TICK_HZ / 1000 ) /* in ticks */
 #define NAME_LENGTH   22 /* in bytes */
 
 const char MY_NAME[NAME_LENGTH] = "AHTI System Controller";
 const uint8_t MY_ID = 1;
 
 struct i2c_master_module sys_bus;
+struct i2c_master_module exp_bus;
 struct i2c_slave_module  pi_bus;
 
 struct i2c_slave_packet  packet;
 
+List_t     task_list;
+TaskRing_t pi_ring;    /* work handed over from the pi bus interrupt */
+TaskRing_t alert_ring; /* work handed over from the SMBALERT# interrupt */
+TaskRing_t smbus_ring; /* bus recoveries asked for by the SMBus time base */
+
+/* 12V power modules */
+uint8_t power_addr[POWER_MODULE_MAX] = { STW1_ADDR, STW2_ADDR, STW3_ADDR,
+                                         STW4_ADDR, STW5_ADDR, STW6_ADDR };
+uint8_t power_pins[POWER_MODULE_MAX] = { STW1, STW2, STW3, STW4, STW5, STW6 };
+bool    power_state[POWER_MODULE_MAX];
+
+Power_t power =
+{
+  .status       = POWER_OFF,
+  .pmbus        = &sys_bus,
+  .module_count = POWER_MODULE_MAX,
+  .power_state  = power_state,
+  .module_addr  = power_addr,
+  .max_power    = (uint16_t) POWER_POUT_RANGE_MAX,
+  .enable_pin   = power_pins,
+  .task_list    = &task_list,
+};
+
+/* 12V power supplies on the expansion bus */
+uint8_t exp_power_addr[EXP_PSU_COUNT] = { EXP_PSU1_ADDR, EXP_PSU2_ADDR };
+bool    exp_power_state[EXP_PSU_COUNT];
+
+Power_t exp_power =
+{
+  .status       = POWER_OFF,
+  .pmbus        = &exp_bus,
+  .module_count = EXP_PSU_COUNT,
+  .power_state  = exp_power_state,
+  .module_addr  = exp_power_addr,
+  .max_power    = (uint16_t) POWER_POUT_RANGE_MAX,
+  .enable_pin   = NULL,
+  .task_list    = &task_list,
+};
+
+Power_snapshot_t power_telemetry;     /* latest sweep */
+Power_snapshot_t exp_power_telemetry; /* latest sweep */
+History_t        power_history;       /* of the sweeps above, for the pi */
+
 uint8_t read_buffer[BUFFER_LENGTH];
 uint8_t write_buffer[BUFFER_LENGTH];
 
@@ -22,19 +77,41 @@ uint8_t write_buffer[BUFFER_LENGTH];
 volatile bool status_fan   = 1;
 volatile bool status_power = 1;
 
+uint32_t scheduler_load; /* over the last telemetry period, in tenths of a percent */
+
+_Static_assert( sizeof(UpdateFrame_t) <= BUFFER_LENGTH, "REG_UPDATE frame too long" );
+_Static_assert( sizeof(History_page_t) <= BUFFER_LENGTH, "REG_HISTORY page too long" );
+
+Update_t update; /* the REG_UPDATE frame */
+
 /* SMBus commands */
 #define REG_YOUR_NAME      0x01 /* read block */
 #define REG_ID             0x02 /* read byte  */
 #define REG_UPDATE         0x03 /* read block */
+#define REG_TRACE          0x04 /* read block */
+#define REG_STATS          0x05 /* write byte, read block */
+#define REG_HISTORY        0x06 /* write level and page, read block */
 #define REG_FAN            0x11 /* write byte */
 #define REG_POWER          0x12 /* write byte */
 
 /* proto */
 void portConfig( int pin, int direction );
-void initSysBys( void );
+void initSysBus( void );
+void initExpBus( void );
 void initPiBus( void );
 void piBusReadCallback( struct i2c_slave_module *const module );
 void piBusWriteCallback( struct i2c_slave_module *const module );
+void piBusWriteCompleteCallback( struct i2c_slave_module *const module );
+void SysTick_Handler( void );
+void fanTask( TaskContext_t* context );
+void powerTask( TaskContext_t* context );
+void telemetryTask( TaskContext_t* context );
+void balanceTask( TaskContext_t* context );
+void initPowerAlert( void );
+void powerAlertCallback( void );
+void alertTask( TaskContext_t* context );
+void smbusRecoveryTask( TaskContext_t* context );
+void updateFrame( void );
 
 void portConfig( int pin, int direction )
 {
@@ -46,15 +123,24 @@ void portConfig( int pin, int direction )
 
 void initSysBus( void )
 {
-  struct i2c_master_config config_i2c_master;
-  i2c_slave_get_config_defaults( &config_i2c_slave );
-  config_i2c_slave.baud_rate    = 400;
-  config_i2c_master.pinmux_pad0 = SYS_PAD0;
-  config_i2c_master.pinmux_pad1 = SYS_PAD1;
-  /* watchdog (if set up) will detect an init failure that lasts for too long */
-  while ( i2c_master_init( &sys_bus, SYS_MOD, &config_i2c_master ) != STATUS_OK )
-    continue;
-  i2c_master_enable( &sys_bus ); 
+  /* without a bus, every transfer on it fails with STATUS_ERR_NOT_INITIALIZED */
+  for ( uint32_t i = 0; i < INIT_ATTEMPTS; ++i )
+  {
+    if ( SMBus.configure( &sys_bus, SYS_MOD, SYS_PAD0, SYS_PAD1, 400 ) == STATUS_OK )
+      return;
+    delay_ms( 1 );
+  }
+}
+
+void initExpBus( void )
+{
+  /* without a bus, every transfer on it fails with STATUS_ERR_NOT_INITIALIZED */
+  for ( uint32_t i = 0; i < INIT_ATTEMPTS; ++i )
+  {
+    if ( SMBus.configure( &exp_bus, EXP_MOD, EXP_PAD0, EXP_PAD1, 400 ) == STATUS_OK )
+      return;
+    delay_ms( 1 );
+  }
 }
 
 void initPiBus( void )
@@ -65,15 +151,26 @@ void initPiBus( void )
   config_i2c_slave.address_mode = I2C_SLAVE_ADDRESS_MODE_MASK;
   config_i2c_slave.pinmux_pad0  = PI_PAD0;
   config_i2c_slave.pinmux_pad1  = PI_PAD1;
-  while ( i2c_slave_init( &pi_bus, PI_MOD, &config_i2c_slave ) != STATUS_OK )
-    continue;
-  i2c_slave_enable( &pi_bus );
+  for ( uint32_t i = 0; ; ++i )
+  {
+    if ( i2c_slave_init( &pi_bus, PI_MOD, &config_i2c_slave ) == STATUS_OK )
+      break;
+    if ( i == INIT_ATTEMPTS - 1 )
+      return; /* run headless */
+    delay_ms( 1 );
+  }
+  /* every pi bus callback lives here, all in place before the slave answers: a write
+   * taken in without the READ_COMPLETE one would be dropped without a word */
   i2c_slave_register_callback( &pi_bus, piBusReadCallback,
                                I2C_SLAVE_CALLBACK_READ_REQUEST );
   i2c_slave_enable_callback( &pi_bus, I2C_SLAVE_CALLBACK_READ_REQUEST );
   i2c_slave_register_callback( &pi_bus, piBusWriteCallback,
                                I2C_SLAVE_CALLBACK_WRITE_REQUEST );
   i2c_slave_enable_callback( &pi_bus, I2C_SLAVE_CALLBACK_WRITE_REQUEST );
+  i2c_slave_register_callback( &pi_bus, piBusWriteCompleteCallback,
+                               I2C_SLAVE_CALLBACK_READ_COMPLETE );
+  i2c_slave_enable_callback( &pi_bus, I2C_SLAVE_CALLBACK_READ_COMPLETE );
+  i2c_slave_enable( &pi_bus );
 }
 
 /* master wants to receive data */
@@ -98,7 +195,49 @@ void piBusReadCallback( struct i2c_slave_module *const module )
   /* master wants to receive updates! */
   else if ( cmd == REG_UPDATE )
   {
-    // TODO
+    /* the tasks never touch the current frame, and cannot run while this does */
+    memcpy( write_buffer, updateCurrent( &update ), sizeof(UpdateFrame_t) );
+    packet.data_length = sizeof(UpdateFrame_t);
+  }
+  /* master wants the oldest scheduler trace events! */
+  else if ( cmd == REG_TRACE )
+  {
+    TraceRecord_t records[( BUFFER_LENGTH - 1 ) / sizeof(TraceRecord_t)];
+    uint32_t n = traceRead( records, sizeof(records) / sizeof(TraceRecord_t) );
+    write_buffer[0] = (uint8_t) n;
+    memcpy( &write_buffer[1], records, n * sizeof(TraceRecord_t) );
+    packet.data_length = 1 + n * sizeof(TraceRecord_t);
+  }
+  /* master wants a task handler's runtime statistics! */
+  else if ( cmd == REG_STATS )
+  {
+    TraceStats_t stats;
+    if ( traceStats( read_buffer[1], &stats ) )
+    {
+      memcpy( write_buffer, &stats, sizeof(TraceStats_t) );
+      packet.data_length = sizeof(TraceStats_t);
+    }
+    else
+    {
+      write_buffer[0] = 99;
+      packet.data_length = 1;
+    }
+  }
+  /* master wants a page of the power history! */
+  else if ( cmd == REG_HISTORY )
+  {
+    History_page_t page;
+    if ( historyPage( &power_history, read_buffer[1],
+                      (uint16_t) ( read_buffer[2] | ( read_buffer[3] << 8 ) ), &page ) )
+    {
+      memcpy( write_buffer, &page, sizeof(History_page_t) );
+      packet.data_length = sizeof(History_page_t);
+    }
+    else
+    {
+      write_buffer[0] = 99;
+      packet.data_length = 1;
+    }
   }
   /* master wants to know the fan's status! */
   else if ( cmd == REG_FAN )
@@ -127,57 +266,205 @@ void piBusReadCallback( struct i2c_slave_module *const module )
   }
 }
 
+/* SMBALERT# of the 12V modules, on a falling edge */
+void initPowerAlert( void )
+{
+  struct extint_chan_conf config_extint_chan;
+  extint_chan_get_config_defaults( &config_extint_chan );
+  config_extint_chan.gpio_pin            = PWR_ALERT_EIC_PIN;
+  config_extint_chan.gpio_pin_mux        = PWR_ALERT_EIC_MUX;
+  config_extint_chan.gpio_pin_pull       = EXTINT_PULL_UP;
+  config_extint_chan.detection_criteria  = EXTINT_DETECT_FALLING;
+  config_extint_chan.filter_input_signal = true;
+  extint_chan_set_config( PWR_ALERT_EIC_LINE, &config_extint_chan );
+  extint_register_callback( powerAlertCallback, PWR_ALERT_EIC_LINE,
+                            EXTINT_CALLBACK_TYPE_DETECT );
+  extint_chan_enable_callback( PWR_ALERT_EIC_LINE, EXTINT_CALLBACK_TYPE_DETECT );
+}
+
+/* a module wants attention, the bus work is done by alertTask */
+void powerAlertCallback( void )
+{
+  postTask( &alert_ring, alertTask, NULL, 0, PRIORITY_REALTIME, 0 );
+}
+
 /* master wants to send data */
 void piBusWriteCallback( struct i2c_slave_module *const module )
 {
   packet.data_length = BUFFER_LENGTH;
   packet.data        = read_buffer;
-  /* read the packet */
+  /* read the packet, it is acted on once it is all in */
   if ( i2c_slave_read_packet_job(module, &packet) != STATUS_OK )
   {
     // TODO in the future
   }
-  
+}
+
+/* master has finished sending data */
+void piBusWriteCompleteCallback( struct i2c_slave_module *const module )
+{
+  /* the driver has zeroed its lengths by now, its buffer pointer is one past the last byte */
+  uint16_t received = module->buffer - read_buffer;
   uint8_t cmd = read_buffer[0]; /* readability */
 
+  /* all take a command and at least one byte */
+  if ( received < 2 )
+    return;
+
   /* master wants to mess with my fans! */
   if ( cmd == REG_FAN )
   {
-    if ( read_buffer[1] )
-    {
-      // TODO - turn the fan on
-    }
-    else
-    {
-      // TODO - turn the fan off
-    }
+    postTask( &pi_ring, fanTask, &read_buffer[1], 1, PRIORITY_HIGH, 0 );
   }
   /* master wants pooooooower! :o */
   else if ( cmd == REG_POWER )
   {
-    if ( read_buffer[1] )
-    {
-      // TODO - turn the power on
-    }
-    else
-    {
-      // TODO - turn the power off
-    }
+    postTask( &pi_ring, powerTask, &read_buffer[1], 1, PRIORITY_HIGH, 0 );
+  }
+  /* master picks a page of the power history, the level alone picks its header */
+  else if ( cmd == REG_HISTORY )
+  {
+    if ( received < 4 )
+      read_buffer[2] = read_buffer[3] = 0;
+  }
+}
+
+/* tasks posted by the pi bus callbacks, run by the scheduler outside interrupt context */
+
+void fanTask( TaskContext_t* context )
+{
+  uint8_t on = *(uint8_t*) context->params;
+
+  if ( on )
+  {
+    // TODO - turn the fan on
+  }
+  else
+  {
+    // TODO - turn the fan off
   }
 }
 
+void powerTask( TaskContext_t* context )
+{
+  uint8_t on = *(uint8_t*) context->params;
+
+  /* both only start the sequence, power.status follows it */
+  if ( on )
+  {
+    Power.switchOn( &power );
+    Power.switchOn( &exp_power );
+  }
+  else
+  {
+    Power.switchOff( &power );
+    Power.switchOff( &exp_power );
+  }
+
+  status_power = on;
+  updateFrame();
+}
+
+/* rebuilds the REG_UPDATE frame, call from task context after anything in it changed */
+void updateFrame( void )
+{
+  UpdateFrame_t* frame = updateBegin( &update );
+
+  updatePower( frame, &power, &power_telemetry );
+  frame->exp_power_status = (uint8_t) exp_power.status;
+  frame->fan              = status_fan;
+  frame->power            = status_power;
+  frame->exp_pout         = exp_power_telemetry.pout;
+  frame->load             = (uint16_t) scheduler_load;
+
+  updateCommit( &update );
+}
+
+/* finds out which modules asserted SMBALERT# and why */
+void alertTask( TaskContext_t* context )
+{
+  (void) context;
+
+  Power.handleAlert( &power );
+  updateFrame();
+
+  /* another module alerting while this one was handled leaves the line low with no
+   * fresh edge, look again shortly */
+  if ( !port_pin_get_input_level( PWR_ALERT ) )
+    createTaskDelayed( &task_list, alertTask, NULL, 0, PRIORITY_REALTIME, 0, 0,
+                       POWER_ALERT_RETRY * TASK_TICK_HZ / 1000 );
+}
+
+/* periodic power telemetry sweep */
+void telemetryTask( TaskContext_t* context )
+{
+  (void) context;
+
+  /* both buses at once, each has its own transaction queue */
+  Power.snapshotBegin( &power );
+  Power.snapshotBegin( &exp_power );
+  Power.snapshotEnd( &power, &power_telemetry );
+  Power.snapshotEnd( &exp_power, &exp_power_telemetry );
+
+  historyAdd( &power_history, &power_telemetry );
+
+  scheduler_load = getSchedulerLoad( &task_list );
+  updateFrame();
+}
+
+/* periodic current sharing step, on the latest telemetry */
+void balanceTask( TaskContext_t* context )
+{
+  (void) context;
+
+  if ( power.status == POWER_OK )
+    Power.balance( &power, &power_telemetry );
+}
+
+/* clocks a bus free after a bus error, too slow for the SysTick interrupt */
+void smbusRecoveryTask( TaskContext_t* context )
+{
+  (void) context;
+
+  SMBus.recover();
+}
+
+/* scheduler and SMBus time base */
+void SysTick_Handler( void )
+{
+  schedulerTick();
+  if ( SMBus.service( 1000000 / TASK_TICK_HZ ) )
+    postTask( &smbus_ring, smbusRecoveryTask, NULL, 0, PRIORITY_REALTIME, 0 );
+}
+
 int main( void )
 {
   system_init();
+  delay_init();
+
+  initTaskList( &task_list );
+  registerTaskRing( &task_list, &pi_ring );
+  registerTaskRing( &task_list, &alert_ring );
+  registerTaskRing( &task_list, &smbus_ring );
+  SysTick_Config( system_gclk_gen_get_hz( GCLK_GENERATOR_0 ) / TASK_TICK_HZ );
 
   initSysBus();
+  initExpBus();
   initPiBus();
 
+  Power.init( &power );
+  Power.init( &exp_power );
+  historyInit( &power_history, power.module_count );
+  updateFrame();
+  initPowerAlert();
+
   portConfig( PTW, PORT_PIN_DIR_OUTPUT );
   portConfig( FAN, PORT_PIN_DIR_OUTPUT );
 
-  while ( true )
-  {
-    
-  }
+  createTask( &task_list, telemetryTask, NULL, 0, PRIORITY_NORMAL,
+              TELEMETRY_PERIOD, TELEMETRY_PERIOD );
+  createTask( &task_list, balanceTask, NULL, 0, PRIORITY_LOW,
+              BALANCE_PERIOD, BALANCE_PERIOD );
+
+  beginScheduler( &task_list );
 }
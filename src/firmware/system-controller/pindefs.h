@@ -70,6 +70,12 @@ extern "C" {
 #define STW5 PIN_PA11          /* pin 20 */
 #define STW6 PIN_PA10          /* pin 19 */
 
+/* 12V power SMBALERT#, wired-OR of all modules to a 3V3 signalling line */
+#define PWR_ALERT          SIG8
+#define PWR_ALERT_EIC_PIN  PIN_PA06A_EIC_EXTINT6
+#define PWR_ALERT_EIC_MUX  MUX_PA06A_EIC_EXTINT6
+#define PWR_ALERT_EIC_LINE 6
+
 /* 12V power I2C addresses */
 // #define STW1_ADDR 0x2a         /*  68k  33k */
 // #define STW2_ADDR 0x2c         /*  68k  68k */
@@ -108,6 +114,11 @@ extern "C" {
 #define EXP_PAD0 PINMUX_PB30D_SERCOM5_PAD0
 #define EXP_PAD1 PINMUX_PB31D_SERCOM5_PAD1
 
+/* expansion 12V power I2C addresses, switched over PMBus (no enable pins) */
+#define EXP_PSU1_ADDR 0x58
+#define EXP_PSU2_ADDR 0x59
+#define EXP_PSU_COUNT 2
+
 /* ################################################## */
 /*                   STEPPER CONTROL                  */
 /* ################################################## */
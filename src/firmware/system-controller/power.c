@@ -11,11 +11,11 @@
  */
 
 #include <asf.h>
-#include <math.h>
 
 #include "defs.h"
 #include "notifier.h"
 #include "smbus.h"
+#include "task_handler.h"
 #include "power.h"
 
 /* i2c commands */
@@ -65,32 +65,272 @@
 #define REG_READ_TEMPERATURE_2       0x8e
 #define REG_READ_POUT                0x96
 
-double power_parseLinearFormatBytes( uint8_t lsb, int8_t msb );
-double power_parseLinearFormat( uint16_t word );
-double power_getCumulativeMeasurement( Power_t* pc, uint8_t cmd );
-double power_getMeanMeasurement( Power_t* pc, uint8_t cmd );
-double power_getVin( Power_t* pc );
-double power_getIout( Power_t* pc );
-double power_getPout( Power_t* pc );
-double power_getVout( Power_t* pc );
+/* OPERATION and ON_OFF_CONFIG values, for modules switched over PMBus */
+#define OPERATION_ON                 0x80
+#define OPERATION_OFF                0x00
+#define ON_OFF_CONFIG_OPERATION      0x18 /* on/off by OPERATION only, CONTROL ignored */
+
+/* SMBus Alert Response Address, answered by the alerting device with its own address */
+#define PMBUS_ARA                    0x0c
+
+/* STATUS_WORD bits */
+#define STATUS_CML                   0x0002
+#define STATUS_TEMPERATURE           0x0004
+#define STATUS_VIN_UV                0x0008
+#define STATUS_IOUT_OC               0x0010
+#define STATUS_VOUT_OV               0x0020
+#define STATUS_INPUT                 0x2000
+#define STATUS_IOUT                  0x4000
+#define STATUS_VOUT                  0x8000
+
+/* sub-status bits that are faults rather than warnings */
+#define STATUS_VOUT_FAULTS           0x90 /* OV, UV fault */
+#define STATUS_IOUT_FAULTS           0xc0 /* OC, OC with low Vout fault */
+#define STATUS_INPUT_FAULTS          0x98 /* OV, UV fault, off for low input */
+#define STATUS_TEMPERATURE_FAULTS    0x90 /* OT, UT fault */
+
+int32_t power_saturate( int64_t value );
+int32_t power_decodeLinear11( uint16_t word );
+int32_t power_decodeLinear16( uint16_t word, int8_t exp );
+uint16_t power_encodeLinear11( int32_t value );
+uint16_t power_encodeLinear16( int32_t value, int8_t exp );
+Power_status power_parseVoutMode( Power_t* pc, uint8_t i, uint8_t mode );
+Power_status power_getVoutExponent( Power_t* pc, uint8_t i, int8_t* exp );
+Power_status power_setVout( Power_t* pc, int32_t vout );
+Power_status power_setLimit( Power_t* pc, uint8_t cmd, int32_t limit );
+Power_status power_getCumulativeMeasurement( Power_t* pc, uint8_t cmd, int32_t* meas );
+Power_status power_getMeanMeasurement( Power_t* pc, uint8_t cmd, int32_t* meas );
+Power_status power_getVin( Power_t* pc, int32_t* vin );
+Power_status power_getIout( Power_t* pc, int32_t* iout );
+Power_status power_getPout( Power_t* pc, int32_t* pout );
+Power_status power_getVout( Power_t* pc, int32_t* vout );
+Power_status power_readModule( Power_t* pc, uint8_t i, uint8_t cmd, int32_t* meas );
+Power_status power_init( Power_t* pc );
+Power_status power_snapshot( Power_t* pc, Power_snapshot_t* snapshot );
+Power_status power_snapshotBegin( Power_t* pc );
+Power_status power_snapshotEnd( Power_t* pc, Power_snapshot_t* snapshot );
+Power_status power_enableModule( Power_t* pc, uint8_t i, bool on );
+Power_status power_sequenceAfter( Power_t* pc, uint32_t delay_ms );
+void power_sequenceFault( Power_t* pc, Power_status status );
+void power_sequenceTask( TaskContext_t* context );
 Power_status power_switchOn( Power_t* pc );
 Power_status power_switchOff( Power_t* pc );
+Power_status power_setTrim( Power_t* pc, uint8_t i, int32_t trim );
+Power_status power_balance( Power_t* pc, const Power_snapshot_t* snapshot );
+Power_status power_setResponse( Power_t* pc, uint8_t cmd, uint8_t response );
+Power_status power_setLimits( Power_t* pc );
+Power_status power_readStatus( Power_t* pc, uint8_t i, uint8_t cmd, uint8_t* status );
+Power_status power_handleAlert( Power_t* pc );
+
+/*
+ * PMBus LINEAR11/LINEAR16 codec in milli-units (mV, mA, mW, m°C), integer-only: the
+ * Cortex-M0+ has no FPU, and pow() is a soft-float libm call of hundreds of cycles.
+ *
+ * LINEAR11: Y * 2^N, N the top 5 bits and Y the low 11 bits, both two's complement.
+ * LINEAR16: V * 2^N, V an unsigned 16-bit word and N the exponent from VOUT_MODE.
+ */
+
+int32_t power_saturate( int64_t value )
+{
+  if ( value > INT32_MAX ) return INT32_MAX;
+  if ( value < INT32_MIN ) return INT32_MIN;
+  return (int32_t) value;
+}
+
+/* mantissa * 2^exp in milli-units, rounded to nearest */
+static int32_t power_scale( int32_t mantissa, int8_t exp )
+{
+  /* |mantissa| < 2^16, so this fits 32 bits; only growing it needs 64 */
+  int32_t milli = mantissa * 1000;
+
+  if ( exp >= 0 )
+    return power_saturate( (int64_t) milli * ( 1 << exp ) );
+
+  return ( milli + ( 1 << ( -exp - 1 ) ) ) >> -exp;
+}
+
+int32_t power_decodeLinear11( uint16_t word )
+{
+  int8_t  exp      = (int8_t) ( (int16_t) word >> 11 );
+  int16_t mantissa = (int16_t) ( (int16_t) ( word << 5 ) >> 5 );
+
+  return power_scale( mantissa, exp );
+}
+
+int32_t power_decodeLinear16( uint16_t word, int8_t exp )
+{
+  return power_scale( word, exp );
+}
+
+/* value / 2^exp, from milli-units, rounded to nearest */
+static int64_t power_unscale( int32_t value, int8_t exp )
+{
+  int64_t num = value;
+  int64_t den = 1000;
+
+  if ( exp < 0 )
+    num *= (int64_t) 1 << -exp;
+  else
+    den <<= exp;
+
+  return ( num >= 0 ? num + den / 2 : num - den / 2 ) / den;
+}
+
+/* picks the smallest exponent (most precision) the mantissa fits with */
+uint16_t power_encodeLinear11( int32_t value )
+{
+  int8_t  exp;
+  int64_t mantissa = 0;
+
+  for ( exp = -16; exp < 15; ++exp )
+  {
+    mantissa = power_unscale( value, exp );
+    if ( mantissa >= -1024 && mantissa <= 1023 )
+      break;
+  }
+
+  if ( mantissa > 1023 )  mantissa = 1023;
+  if ( mantissa < -1024 ) mantissa = -1024;
+
+  return (uint16_t) ( ( (uint16_t) exp << 11 ) | ( (uint16_t) mantissa & 0x7ff ) );
+}
+
+uint16_t power_encodeLinear16( int32_t value, int8_t exp )
+{
+  int64_t mantissa = power_unscale( value, exp );
+
+  if ( mantissa > 65535 ) return 65535;
+  if ( mantissa < 0 )     return 0;
+  return (uint16_t) mantissa;
+}
+
+/* caches the VOUT_MODE exponent of module i, leaving pc->status alone */
+static Power_status power_cacheVoutMode( Power_t* pc, uint8_t i, uint8_t mode )
+{
+  int8_t exp;
+
+  if ( mode & 16 ) exp = (int8_t) (224 | (mode & 31));
+  else exp = (int8_t) (mode & 15);
+
+  if ( exp < -16 || exp > 15 )
+    return POWER_EXP_OUT_OF_RANGE;
+
+  pc->vout_exponent[i] = exp;
+  pc->vout_exponent_known |= (uint8_t) ( 1 << i );
+
+  return POWER_OK;
+}
+
+/* caches the VOUT_MODE exponent of module i */
+Power_status power_parseVoutMode( Power_t* pc, uint8_t i, uint8_t mode )
+{
+  if ( power_cacheVoutMode( pc, i, mode ) != POWER_OK )
+  {
+    pc->status = POWER_EXP_OUT_OF_RANGE;
+    #ifdef DEBUG_MODE
+      Notifier.error( SYSTEM_POWER, pc->status );
+    #endif /* DEBUG_MODE */
+    return pc->status;
+  }
+
+  return POWER_OK;
+}
 
-double power_parseLinearFormatBytes( uint8_t lsb, int8_t msb )
+/* reads and caches the VOUT_MODE exponent of module i, leaving pc->status alone */
+static Power_status power_readVoutExponent( Power_t* pc, uint8_t i, int8_t* exp )
 {
-  int8_t n = msb >> 3;
-  int16_t y = ( ( msb & 7 ) << 8 ) | lsb;
-  return (double) ( y * powl(2, n) );
+  uint8_t tmp;
+
+  if ( !( pc->vout_exponent_known & ( 1 << i ) ) )
+  {
+    if ( SMBus.readByteData( pc->pmbus, pc->module_addr[i], REG_VOUT_MODE, &tmp ) != STATUS_OK )
+      return POWER_PMBUS;
+
+    if ( power_cacheVoutMode( pc, i, tmp ) != POWER_OK )
+      return POWER_EXP_OUT_OF_RANGE;
+  }
+
+  *exp = pc->vout_exponent[i];
+  return POWER_OK;
 }
 
-double power_parseLinearFormat( uint16_t word )
+/* VOUT_MODE only changes with the module's configuration, so it is read once */
+Power_status power_getVoutExponent( Power_t* pc, uint8_t i, int8_t* exp )
 {
-  return power_parseLinearFormatBytes( (uint8_t) (word & 255), (uint8_t) (word >> 8) );
+  Power_status status = power_readVoutExponent( pc, i, exp );
+
+  if ( status != POWER_OK )
+  {
+    pc->status = status;
+    #ifdef DEBUG_MODE
+      Notifier.error( SYSTEM_POWER, pc->status );
+    #endif /* DEBUG_MODE */
+    return pc->status;
+  }
+
+  return POWER_OK;
 }
 
-double power_getCumulativeMeasurement( Power_t* pc, uint8_t cmd )
+/* sets VOUT_COMMAND of every module, vout in mV */
+Power_status power_setVout( Power_t* pc, int32_t vout )
 {
-  double   meas = 0;
+  int8_t exp;
+
+  for ( int i = 0; i < pc->module_count; ++i )
+  {
+    if ( power_getVoutExponent( pc, i, &exp ) != POWER_OK )
+      return pc->status;
+
+    if ( SMBus.writeWordData( pc->pmbus, pc->module_addr[i], REG_VOUT_COMMAND,
+                              power_encodeLinear16( vout, exp ) ) != STATUS_OK )
+    {
+      pc->status = POWER_PMBUS;
+      #ifdef DEBUG_MODE
+        Notifier.error( SYSTEM_POWER, pc->status );
+      #endif /* DEBUG_MODE */
+      return pc->status;
+    }
+  }
+
+  return POWER_OK;
+}
+
+/* sets a limit register of every module, limit in milli-units; the VOUT_* limits take
+ * the module's LINEAR16 format, the others LINEAR11 */
+Power_status power_setLimit( Power_t* pc, uint8_t cmd, int32_t limit )
+{
+  int8_t   exp;
+  uint16_t word;
+
+  for ( int i = 0; i < pc->module_count; ++i )
+  {
+    if ( cmd == REG_VOUT_OV_FAULT_LIMIT || cmd == REG_VOUT_OV_WARN_LIMIT )
+    {
+      if ( power_getVoutExponent( pc, i, &exp ) != POWER_OK )
+        return pc->status;
+      word = power_encodeLinear16( limit, exp );
+    }
+    else
+    {
+      word = power_encodeLinear11( limit );
+    }
+
+    if ( SMBus.writeWordData( pc->pmbus, pc->module_addr[i], cmd, word ) != STATUS_OK )
+    {
+      pc->status = POWER_PMBUS;
+      #ifdef DEBUG_MODE
+        Notifier.error( SYSTEM_POWER, pc->status );
+      #endif /* DEBUG_MODE */
+      return pc->status;
+    }
+  }
+
+  return POWER_OK;
+}
+
+Power_status power_getCumulativeMeasurement( Power_t* pc, uint8_t cmd, int32_t* meas )
+{
+  int64_t  sum = 0;
   uint16_t tmp16;
 
   for ( int i = 0; i < pc->module_count; ++i )
@@ -101,143 +341,585 @@ double power_getCumulativeMeasurement( Power_t* pc, uint8_t cmd )
       #ifdef DEBUG_MODE
         Notifier.error( SYSTEM_POWER, pc->status );
       #endif /* DEBUG_MODE */
-      return -1;
+      return pc->status;
     }
 
-    meas += power_parseLinearFormat( tmp16 );
+    sum += power_decodeLinear11( tmp16 );
   }
 
-  return meas;
+  *meas = power_saturate( sum );
+  return POWER_OK;
 }
 
-double power_getMeanMeasurement( Power_t* pc, uint8_t cmd )
+Power_status power_getMeanMeasurement( Power_t* pc, uint8_t cmd, int32_t* meas )
 {
-  return power_getCumulativeMeasurement( pc, cmd ) / pc->module_count;
+  if ( power_getCumulativeMeasurement( pc, cmd, meas ) != POWER_OK )
+    return pc->status;
+
+  *meas /= pc->module_count;
+  return POWER_OK;
 }
 
-double power_getVin( Power_t* pc )
+/* vin in mV */
+Power_status power_getVin( Power_t* pc, int32_t* vin )
 {
-  double vin;
-
-  vin = power_getMeanMeasurement( pc, REG_READ_VIN );
-  if ( vin < 0 ) return -1;
+  if ( power_getMeanMeasurement( pc, REG_READ_VIN, vin ) != POWER_OK )
+    return pc->status;
 
-  if ( vin < POWER_VIN_RANGE_MIN || vin > POWER_VIN_RANGE_MAX )
+  if ( *vin < POWER_MILLI( POWER_VIN_RANGE_MIN ) || *vin > POWER_MILLI( POWER_VIN_RANGE_MAX ) )
   {
     pc->status = POWER_VIN_OUT_OF_RANGE;
     #ifdef DEBUG_MODE
       Notifier.error( SYSTEM_POWER, pc->status );
     #endif /* DEBUG_MODE */
-    return -1;
+    return pc->status;
   }
 
-  return vin;
+  return POWER_OK;
 }
 
-double power_getIout( Power_t* pc )
+/* iout in mA */
+Power_status power_getIout( Power_t* pc, int32_t* iout )
 {
-  double iout;
-
-  iout = power_getCumulativeMeasurement( pc, REG_READ_IOUT );
-  if ( iout < 0 ) return -1;
+  if ( power_getCumulativeMeasurement( pc, REG_READ_IOUT, iout ) != POWER_OK )
+    return pc->status;
 
-  if ( iout < POWER_IOUT_RANGE_MIN || iout > POWER_IOUT_RANGE_MAX )
+  if ( *iout < POWER_MILLI( POWER_IOUT_RANGE_MIN ) || *iout > POWER_MILLI( POWER_IOUT_RANGE_MAX ) )
   {
     pc->status = POWER_IOUT_OUT_OF_RANGE;
     #ifdef DEBUG_MODE
       Notifier.error( SYSTEM_POWER, pc->status );
     #endif /* DEBUG_MODE */
-    return -1;
+    return pc->status;
   }
 
-  return iout;
+  return POWER_OK;
 }
 
-double power_getPout( Power_t* pc )
+/* pout in mW */
+Power_status power_getPout( Power_t* pc, int32_t* pout )
 {
-  double pout;
-
-  pout = power_getCumulativeMeasurement( pc, REG_READ_POUT );
-  if ( pout < 0 ) return -1;
+  if ( power_getCumulativeMeasurement( pc, REG_READ_POUT, pout ) != POWER_OK )
+    return pc->status;
 
-  if ( pout < POWER_POUT_RANGE_MIN || pout > POWER_POUT_RANGE_MAX )
+  if ( *pout < POWER_MILLI( POWER_POUT_RANGE_MIN ) || *pout > POWER_MILLI( POWER_POUT_RANGE_MAX ) )
   {
     pc->status = POWER_POUT_OUT_OF_RANGE;
     #ifdef DEBUG_MODE
       Notifier.error( SYSTEM_POWER, pc->status );
     #endif /* DEBUG_MODE */
-    return -1;
+    return pc->status;
   }
 
-  return pout;
+  return POWER_OK;
 }
 
-double power_getVout( Power_t* pc )
+/* vout in mV, mean over the modules */
+Power_status power_getVout( Power_t* pc, int32_t* vout )
 {
-  double   vout = 0;
-  uint8_t  tmp;
+  int64_t  sum = 0;
   uint16_t tmp16;
   int8_t   exp;
-  double   vout_tmp;
+  int32_t  vout_tmp;
 
   for ( int i = 0; i < pc->module_count; ++i ) 
   {
-    if ( SMBus.readByteData( pc->pmbus, pc->module_addr[i], REG_VOUT_MODE, &tmp ) != STATUS_OK )
+    if ( power_getVoutExponent( pc, i, &exp ) != POWER_OK )
+      return pc->status;
+
+    if ( SMBus.readWordData( pc->pmbus, pc->module_addr[i], REG_READ_VOUT, &tmp16 ) != STATUS_OK )
     {
       pc->status = POWER_PMBUS;
       #ifdef DEBUG_MODE
         Notifier.error( SYSTEM_POWER, pc->status );
       #endif /* DEBUG_MODE */
-      return -1;
+      return pc->status;
     }
 
-    if ( tmp & 16 ) exp = (int8_t) (224 | (tmp & 31));
-    else exp = (int8_t) (tmp & 15);
+    vout_tmp = power_decodeLinear16( tmp16, exp );
 
-    if ( exp < -16 || exp > 15 )
+    if ( vout_tmp < POWER_MILLI( POWER_VOUT_RANGE_MIN ) || vout_tmp > POWER_MILLI( POWER_VOUT_RANGE_MAX ) )
     {
-      pc->status = POWER_EXP_OUT_OF_RANGE;
+      pc->status = POWER_VOUT_OUT_OF_RANGE;
       #ifdef DEBUG_MODE
         Notifier.error( SYSTEM_POWER, pc->status );
       #endif /* DEBUG_MODE */
-      return -1;
+      return pc->status;
     }
 
-    if ( SMBus.readWordData( pc->pmbus, pc->module_addr[i], REG_READ_VOUT, &tmp16 ) != STATUS_OK )
+    sum += vout_tmp;
+  }
+
+  *vout = (int32_t) ( sum / pc->module_count );
+  return POWER_OK;
+}
+
+/* one READ_* command of one module in a snapshot sweep */
+typedef struct Power_read_t
+{
+  SMBus_transaction transaction;
+  uint8_t cmd;
+  uint8_t data[3];                 /* word, plus a spare byte for the PEC */
+} Power_read_t;
+
+#define POWER_SNAPSHOT_READS 5
+
+static const uint8_t power_snapshot_cmds[POWER_SNAPSHOT_READS] =
+{
+  REG_READ_VIN, REG_READ_VOUT, REG_READ_IOUT, REG_READ_POUT, REG_READ_TEMPERATURE_1
+};
+
+/* the sweep of one power controller, too big for the stack: VOUT_MODE, then the
+ * READ_* commands of each module */
+typedef struct Power_sweep_t
+{
+  Power_t* owner;                  /* NULL while unclaimed */
+  uint16_t transactions;           /* queued by power_snapshotBegin(..) */
+  Power_read_t reads[POWER_MODULE_MAX][1 + POWER_SNAPSHOT_READS];
+} Power_sweep_t;
+
+static Power_sweep_t power_sweeps[POWER_INSTANCES_MAX];
+
+/* the sweep buffers of a power controller, claimed on first use */
+static Power_sweep_t* power_findSweep( Power_t* pc )
+{
+  Power_sweep_t* free_sweep = NULL;
+
+  for ( uint32_t k = 0; k < POWER_INSTANCES_MAX; ++k )
+  {
+    if ( power_sweeps[k].owner == pc )
+      return &power_sweeps[k];
+    if ( power_sweeps[k].owner == NULL && free_sweep == NULL )
+      free_sweep = &power_sweeps[k];
+  }
+
+  if ( free_sweep != NULL )
+    free_sweep->owner = pc;
+
+  return free_sweep;
+}
+
+/**
+ * \brief Read VIN, VOUT, IOUT, POUT and TEMPERATURE_1 of every module in one sweep.
+ *
+ * All reads are queued on the bus at once and run back-to-back from the SMBus interrupts,
+ * one combined (repeated START) transaction each. VOUT_MODE is only read for modules
+ * whose exponent is not cached yet, so a sweep normally takes 5 transactions per module.
+ *
+ * Same as power_snapshotBegin(..) followed by power_snapshotEnd(..); call those instead
+ * to sweep power controllers on different buses at the same time.
+ *
+ * \param [in,out] pc power controller
+ * \param [out] snapshot per-module and aggregate telemetry, timestamped
+ *
+ * \return POWER_OK if every module was read, otherwise the (last) failure; the snapshot
+ *         is filled in either way, with each module's own status. pc->status is left to
+ *         the sequencer, a failed read says nothing about the rail.
+ */
+
+Power_status power_snapshot( Power_t* pc, Power_snapshot_t* snapshot )
+{
+  Power_status status = power_snapshotBegin( pc );
+
+  if ( status != POWER_OK )
+    return status;
+
+  return power_snapshotEnd( pc, snapshot );
+}
+
+/**
+ * \brief Queue a telemetry sweep, see power_snapshot(..). Returns straight away, the
+ *        sweep runs on the bus until power_snapshotEnd(..) collects it.
+ *
+ * \return POWER_OK, or POWER_UNKNOWN if more than POWER_INSTANCES_MAX power controllers
+ *         are sweeping
+ */
+
+Power_status power_snapshotBegin( Power_t* pc )
+{
+  Power_sweep_t* sweep = power_findSweep( pc );
+
+  if ( pc->module_count > POWER_MODULE_MAX || sweep == NULL )
+    return POWER_UNKNOWN;
+
+  sweep->transactions = 0;
+
+  for ( uint8_t i = 0; i < pc->module_count; ++i )
+  {
+    for ( uint8_t j = 0; j < 1 + POWER_SNAPSHOT_READS; ++j )
     {
-      pc->status = POWER_PMBUS;
-      #ifdef DEBUG_MODE
-        Notifier.error( SYSTEM_POWER, pc->status );
-      #endif /* DEBUG_MODE */
-      return -1;
+      Power_read_t* read = &sweep->reads[i][j];
+
+      read->cmd = j == 0 ? REG_VOUT_MODE : power_snapshot_cmds[j - 1];
+      read->transaction = (SMBus_transaction)
+      {
+        .address      = pc->module_addr[i],
+        .write_data   = &read->cmd,
+        .write_length = 1,
+        .read_data    = read->data,
+        .read_length  = j == 0 ? 1 : 2,
+        .pec          = SMBus.hasPEC( pc->pmbus, pc->module_addr[i] ),
+        .callback     = NULL,
+      };
+
+      /* VOUT_MODE is cached */
+      if ( j == 0 && ( pc->vout_exponent_known & ( 1 << i ) ) )
+      {
+        read->transaction.status = STATUS_OK;
+        continue;
+      }
+
+      if ( SMBus.submit( pc->pmbus, &read->transaction ) != STATUS_OK )
+        read->transaction.status = STATUS_ERR_NOT_INITIALIZED;
+      else
+        ++sweep->transactions;
     }
+  }
 
-    vout_tmp = tmp16 * pow(2,exp);
+  return POWER_OK;
+}
 
-    if ( vout_tmp < POWER_VOUT_RANGE_MIN || vout_tmp > POWER_VOUT_RANGE_MAX )
+/**
+ * \brief Wait for the sweep queued by power_snapshotBegin(..) and fill in the snapshot.
+ *
+ * \return as power_snapshot(..)
+ */
+
+Power_status power_snapshotEnd( Power_t* pc, Power_snapshot_t* snapshot )
+{
+  Power_sweep_t* sweep = power_findSweep( pc );
+  Power_status status = POWER_OK;
+
+  if ( pc->module_count > POWER_MODULE_MAX || sweep == NULL )
+    return POWER_UNKNOWN;
+
+  snapshot->module_count = pc->module_count;
+  snapshot->valid_count  = 0;
+  int64_t vin  = 0;
+  int64_t vout = 0;
+  int64_t iout = 0;
+  int64_t pout = 0;
+  snapshot->temperature = INT32_MIN;
+
+  for ( uint8_t i = 0; i < pc->module_count; ++i )
+  {
+    Power_module_snapshot_t* module = &snapshot->module[i];
+    int32_t values[POWER_SNAPSHOT_READS];
+
+    module->status = POWER_OK;
+    for ( uint8_t j = 0; j < 1 + POWER_SNAPSHOT_READS; ++j )
     {
-      pc->status = POWER_VOUT_OUT_OF_RANGE;
+      if ( SMBus.wait( &sweep->reads[i][j].transaction ) != STATUS_OK )
+        module->status = POWER_PMBUS;
+    }
+
+    if ( module->status == POWER_OK && !( pc->vout_exponent_known & ( 1 << i ) ) )
+      module->status = power_cacheVoutMode( pc, i, sweep->reads[i][0].data[0] );
+
+    if ( module->status != POWER_OK )
+    {
+      status = module->status;
       #ifdef DEBUG_MODE
-        Notifier.error( SYSTEM_POWER, pc->status );
+        Notifier.error( SYSTEM_POWER, module->status );
       #endif /* DEBUG_MODE */
-      return -1;
+      continue;
+    }
+
+    for ( uint8_t j = 0; j < POWER_SNAPSHOT_READS; ++j )
+    {
+      uint16_t word = (uint16_t) ( ( sweep->reads[i][j + 1].data[1] << 8 ) |
+                                   sweep->reads[i][j + 1].data[0] );
+
+      if ( power_snapshot_cmds[j] == REG_READ_VOUT )
+        values[j] = power_decodeLinear16( word, pc->vout_exponent[i] );
+      else
+        values[j] = power_decodeLinear11( word );
+    }
+
+    module->vin         = values[0];
+    module->vout        = values[1];
+    module->iout        = values[2];
+    module->pout        = values[3];
+    module->temperature = values[4];
+
+    snapshot->valid_count++;
+    vin  += module->vin;
+    vout += module->vout;
+    iout += module->iout;
+    pout += module->pout;
+    if ( module->temperature > snapshot->temperature )
+      snapshot->temperature = module->temperature;
+  }
+
+  if ( snapshot->valid_count )
+  {
+    vin  /= snapshot->valid_count;
+    vout /= snapshot->valid_count;
+  }
+  snapshot->vin  = power_saturate( vin );
+  snapshot->vout = power_saturate( vout );
+  snapshot->iout = power_saturate( iout );
+  snapshot->pout = power_saturate( pout );
+
+  snapshot->transactions = sweep->transactions;
+  snapshot->timestamp    = system_time;
+
+  return status;
+}
+
+/* one reading of module i in milli-units; READ_VOUT is LINEAR16, the rest LINEAR11 */
+Power_status power_readModule( Power_t* pc, uint8_t i, uint8_t cmd, int32_t* meas )
+{
+  uint16_t tmp16;
+  int8_t   exp = 0;
+
+  if ( cmd == REG_READ_VOUT && power_getVoutExponent( pc, i, &exp ) != POWER_OK )
+    return pc->status;
+
+  if ( SMBus.readWordData( pc->pmbus, pc->module_addr[i], cmd, &tmp16 ) != STATUS_OK )
+  {
+    pc->status = POWER_PMBUS;
+    #ifdef DEBUG_MODE
+      Notifier.error( SYSTEM_POWER, pc->status );
+    #endif /* DEBUG_MODE */
+    return pc->status;
+  }
+
+  *meas = cmd == REG_READ_VOUT ? power_decodeLinear16( tmp16, exp )
+                               : power_decodeLinear11( tmp16 );
+  return POWER_OK;
+}
+
+/* switches module i by its enable pin or, without enable pins, by OPERATION */
+Power_status power_enableModule( Power_t* pc, uint8_t i, bool on )
+{
+  if ( pc->enable_pin != NULL )
+  {
+    port_pin_set_output_level( pc->enable_pin[i], on );
+    return POWER_OK;
+  }
+
+  if ( SMBus.writeByteData( pc->pmbus, pc->module_addr[i], REG_OPERATION,
+                            on ? OPERATION_ON : OPERATION_OFF ) != STATUS_OK )
+  {
+    pc->status = POWER_PMBUS;
+    #ifdef DEBUG_MODE
+      Notifier.error( SYSTEM_POWER, pc->status );
+    #endif /* DEBUG_MODE */
+    return pc->status;
+  }
+
+  return POWER_OK;
+}
+
+/* switches every module off; call once before anything else */
+Power_status power_init( Power_t* pc )
+{
+  struct port_config pin_conf;
+
+  if ( pc->module_count > POWER_MODULE_MAX )
+    return pc->status = POWER_UNKNOWN;
+
+  port_get_config_defaults( &pin_conf );
+  pin_conf.direction = PORT_PIN_DIR_OUTPUT;
+
+  for ( uint8_t i = 0; i < pc->module_count; ++i )
+  {
+    if ( pc->enable_pin != NULL )
+    {
+      port_pin_set_output_level( pc->enable_pin[i], false );
+      port_pin_set_config( pc->enable_pin[i], &pin_conf );
+    }
+    else
+    {
+      if ( SMBus.writeByteData( pc->pmbus, pc->module_addr[i], REG_ON_OFF_CONFIG,
+                                ON_OFF_CONFIG_OPERATION ) != STATUS_OK ||
+           power_enableModule( pc, i, false ) != POWER_OK )
+        return pc->status = POWER_PMBUS;
     }
+    pc->power_state[i]     = false;
+    pc->transition_time[i] = system_time;
+  }
+
+  pc->sequence = POWER_SEQ_IDLE;
+  pc->status   = POWER_OFF;
 
-    vout += vout_tmp;
+  /* whatever trim a module kept from before a reset is unknown, start from none */
+  for ( uint8_t i = 0; i < pc->module_count; ++i )
+  {
+    Power_status status = power_setTrim( pc, i, 0 );
+
+    if ( status != POWER_OK )
+      return pc->status = status;
+  }
+
+  return power_setLimits( pc );
+}
+
+/*
+ * Power sequencer: a chain of scheduler tasks, each doing one step and scheduling the
+ * next, so nothing blocks while modules soft-start. Modules come up one at a time,
+ * POWER_STAGGER_ON apart, so the 48 V input only ever sees one inrush at once:
+ *
+ *   ENABLE -> (POWER_INRUSH_DELAY) -> INRUSH -> (POWER_SETTLE_DELAY) -> SETTLE -+
+ *     ^                                                                         |
+ *     +------------------------------- (POWER_STAGGER_ON) ---------------------+
+ *
+ * and go down in reverse order, POWER_STAGGER_OFF apart. Any failure shuts every module
+ * down at once.
+ */
+
+typedef struct Power_sequence_params_t
+{
+  Power_t* pc;
+  uint32_t generation;
+} Power_sequence_params_t;
+
+Power_status power_sequenceAfter( Power_t* pc, uint32_t delay_ms )
+{
+  Power_sequence_params_t params = { pc, pc->sequence_generation };
+
+  if ( createTaskDelayed( pc->task_list, power_sequenceTask, &params, sizeof(params),
+                          PRIORITY_HIGH, 0, 0,
+                          delay_ms * TASK_TICK_HZ / 1000 ) != TASK_OK )
+  {
+    power_sequenceFault( pc, POWER_UNKNOWN );
+    return pc->status;
   }
 
-  vout /= pc->module_count;
-  return vout;
+  return POWER_OK;
+}
+
+void power_sequenceFault( Power_t* pc, Power_status status )
+{
+  /* best effort, a module that cannot be told stays as it is */
+  for ( uint8_t i = 0; i < pc->module_count; ++i )
+  {
+    power_enableModule( pc, i, false );
+    if ( pc->power_state[i] )
+      pc->transition_time[i] = system_time;
+    pc->power_state[i] = false;
+  }
+
+  pc->sequence = POWER_SEQ_IDLE;
+  pc->sequence_generation++;
+  pc->status = status;
+  #ifdef DEBUG_MODE
+    Notifier.error( SYSTEM_POWER, pc->status );
+  #endif /* DEBUG_MODE */
+}
+
+void power_sequenceTask( TaskContext_t* context )
+{
+  Power_sequence_params_t* params = (Power_sequence_params_t*) context->params;
+  Power_t* pc = params->pc;
+  uint8_t  i  = pc->sequence_module;
+  int32_t  meas;
+
+  /* superseded by a later switchOn/switchOff */
+  if ( params->generation != pc->sequence_generation )
+    return;
+
+  switch ( pc->sequence )
+  {
+    case POWER_SEQ_ENABLE:
+      if ( i >= pc->module_count )
+      {
+        pc->sequence = POWER_SEQ_IDLE;
+        pc->status   = POWER_OK;
+        return;
+      }
+      if ( power_enableModule( pc, i, true ) != POWER_OK )
+      {
+        power_sequenceFault( pc, POWER_PMBUS );
+        return;
+      }
+      pc->sequence = POWER_SEQ_INRUSH;
+      power_sequenceAfter( pc, POWER_INRUSH_DELAY );
+      break;
+
+    case POWER_SEQ_INRUSH:
+      if ( power_readModule( pc, i, REG_READ_IOUT, &meas ) != POWER_OK )
+      {
+        power_sequenceFault( pc, POWER_PMBUS );
+        return;
+      }
+      if ( meas > POWER_MILLI( POWER_INRUSH_LIMIT ) )
+      {
+        power_sequenceFault( pc, POWER_OVERLIMIT );
+        return;
+      }
+      pc->sequence = POWER_SEQ_SETTLE;
+      pc->settle_attempts = 0;
+      power_sequenceAfter( pc, POWER_SETTLE_DELAY );
+      break;
+
+    case POWER_SEQ_SETTLE:
+      if ( power_readModule( pc, i, REG_READ_VOUT, &meas ) != POWER_OK )
+      {
+        power_sequenceFault( pc, POWER_PMBUS );
+        return;
+      }
+      if ( abs( POWER_MILLI( POWER_VOUT_SETPOINT ) - meas ) >
+           POWER_MILLI( POWER_VOUT_TOLERANCE / 100 * POWER_VOUT_SETPOINT ) )
+      {
+        if ( ++pc->settle_attempts >= POWER_SETTLE_ATTEMPTS )
+          power_sequenceFault( pc, POWER_VOUT_FAULT );
+        else
+          power_sequenceAfter( pc, POWER_SETTLE_DELAY );
+        return;
+      }
+      pc->power_state[i]     = true;
+      pc->transition_time[i] = system_time;
+      pc->sequence_module    = i + 1;
+      pc->sequence           = POWER_SEQ_ENABLE;
+      power_sequenceAfter( pc, pc->sequence_module < pc->module_count ? POWER_STAGGER_ON : 0 );
+      break;
+
+    case POWER_SEQ_DISABLE:
+      if ( i == 0 )
+      {
+        pc->sequence = POWER_SEQ_IDLE;
+        pc->status   = POWER_OFF;
+        return;
+      }
+      if ( power_enableModule( pc, i - 1, false ) != POWER_OK )
+      {
+        power_sequenceFault( pc, POWER_PMBUS );
+        return;
+      }
+      pc->power_state[i - 1]     = false;
+      pc->transition_time[i - 1] = system_time;
+      pc->sequence_module        = i - 1;
+      power_sequenceAfter( pc, pc->sequence_module > 0 ? POWER_STAGGER_OFF : 0 );
+      break;
+
+    default:
+      break;
+  }
 }
 
+/**
+ * \brief Start bringing the modules up, one at a time. Returns straight away: the
+ *        sequence runs as scheduler tasks, pc->status is POWER_INIT while it does and
+ *        POWER_OK once every module is up and its Vout has settled. Also cancels a
+ *        power_switchOff(..) in progress; modules it has not shut down yet stay up.
+ *
+ * \return POWER_INIT if the sequence started (or is already running), otherwise why not
+ *         (also in pc->status)
+ */
+
 Power_status power_switchOn( Power_t* pc )
 {
-  Power_status status = POWER_INIT;
+  int32_t vin;
+  uint8_t enabled = 0;
 
-  double vin, vout;
+  if ( pc->sequence != POWER_SEQ_IDLE && pc->sequence != POWER_SEQ_DISABLE )
+    return POWER_INIT;
 
-  if ( (vin = power_getVin( pc )) < 0 ) return pc->status;
-  if ( abs( (double) (POWER_VIN_NOMINAL - vin) ) > (POWER_VIN_TOLERANCE/100)*POWER_VIN_NOMINAL )
+  if ( power_getVin( pc, &vin ) != POWER_OK ) return pc->status;
+  if ( abs( POWER_MILLI( POWER_VIN_NOMINAL ) - vin ) >
+       POWER_MILLI( POWER_VIN_TOLERANCE / 100 * POWER_VIN_NOMINAL ) )
   {
     pc->status = POWER_VIN_FAULT;
     #ifdef DEBUG_MODE
@@ -246,6 +928,403 @@ Power_status power_switchOn( Power_t* pc )
     return pc->status;
   }
 
-  
+  /* modules go down in reverse order, so those still up are the first ones */
+  while ( enabled < pc->module_count && pc->power_state[enabled] )
+    ++enabled;
+
+  pc->sequence_generation++;
+  pc->sequence        = POWER_SEQ_ENABLE;
+  pc->sequence_module = enabled;
+  pc->status          = POWER_INIT;
+
+  if ( power_sequenceAfter( pc, 0 ) != POWER_OK )
+    return pc->status;
+
+  return POWER_INIT;
+}
+
+/**
+ * \brief Start shutting the modules down in reverse order. Returns straight away; also
+ *        cancels a power_switchOn(..) in progress. pc->status becomes POWER_OFF once
+ *        every module is down.
+ *
+ * \return POWER_INIT if the sequence started
+ */
+
+Power_status power_switchOff( Power_t* pc )
+{
+  uint8_t enabled = 0;
+
+  /* everything up to and including a module that is still starting */
+  for ( uint8_t i = 0; i < pc->module_count; ++i )
+  {
+    if ( pc->power_state[i] || ( pc->sequence != POWER_SEQ_IDLE &&
+                                 pc->sequence != POWER_SEQ_DISABLE &&
+                                 i == pc->sequence_module ) )
+      enabled = i + 1;
+  }
+  if ( pc->sequence == POWER_SEQ_DISABLE && pc->sequence_module > enabled )
+    enabled = pc->sequence_module;
+
+  pc->sequence_generation++;
+  pc->sequence        = POWER_SEQ_DISABLE;
+  pc->sequence_module = enabled;
+  pc->status          = POWER_INIT;
+
+  if ( power_sequenceAfter( pc, 0 ) != POWER_OK )
+    return pc->status;
+
+  return POWER_INIT;
+}
+
+/*
+ * sets VOUT_TRIM of module i, trim in mV; the register is a signed LINEAR16. A failed
+ * write is returned, not left in pc->status: it says nothing about the rail, and the
+ * balancing loop only runs while pc->status is POWER_OK.
+ */
+Power_status power_setTrim( Power_t* pc, uint8_t i, int32_t trim )
+{
+  Power_status status;
+  int8_t  exp = 0;
+  int64_t mantissa;
+
+  status = power_readVoutExponent( pc, i, &exp );
+  if ( status == POWER_OK )
+  {
+    mantissa = power_unscale( trim, exp );
+    if ( mantissa > INT16_MAX ) mantissa = INT16_MAX;
+    if ( mantissa < INT16_MIN ) mantissa = INT16_MIN;
+
+    if ( SMBus.writeWordData( pc->pmbus, pc->module_addr[i], REG_VOUT_TRIM,
+                              (uint16_t) (int16_t) mantissa ) != STATUS_OK )
+      status = POWER_PMBUS;
+  }
+
+  if ( status != POWER_OK )
+  {
+    #ifdef DEBUG_MODE
+      Notifier.error( SYSTEM_POWER, status );
+    #endif /* DEBUG_MODE */
+    return status;
+  }
+
+  pc->vout_trim[i] = trim;
+  return POWER_OK;
+}
+
+/**
+ * \brief One step of the current sharing loop: nudge the VOUT_TRIM of every module whose
+ *        output current strays more than POWER_BALANCE_BAND from the mean, down if it
+ *        carries too much and up if too little.
+ *
+ * Integral control: each step moves the trim by POWER_BALANCE_GAIN per A of imbalance,
+ * at most POWER_TRIM_STEP, within +-POWER_TRIM_MAX. Run it periodically, slower than the
+ * modules' own output loops settle (POWER_BALANCE_PERIOD), on a recent snapshot.
+ *
+ * \param [in,out] pc power controller, must be POWER_OK (all modules up)
+ * \param [in] snapshot telemetry to balance on
+ *
+ * \return POWER_OK, also if there was nothing to do, or the last failed trim write;
+ *         pc->status is left to the sequencer
+ */
+
+Power_status power_balance( Power_t* pc, const Power_snapshot_t* snapshot )
+{
+  Power_status status = POWER_OK;
+  Power_status result;
+  int32_t mean;
+  int32_t error;
+  int32_t step;
+  int32_t trim;
+
+  if ( pc->status != POWER_OK || snapshot->valid_count == 0 )
+    return POWER_OK;
+
+  mean = snapshot->iout / snapshot->valid_count;
+  if ( mean < POWER_MILLI( POWER_BALANCE_MIN_LOAD ) )
+    return POWER_OK;
+
+  for ( uint8_t i = 0; i < snapshot->module_count; ++i )
+  {
+    if ( snapshot->module[i].status != POWER_OK )
+      continue;
+
+    error = snapshot->module[i].iout - mean;
+    if ( abs( error ) <= POWER_MILLI( POWER_BALANCE_BAND ) )
+      continue;
+
+    /* mA * mV/A / 1000 = mV, rate limited */
+    step = -error * POWER_BALANCE_GAIN / 1000;
+    if ( step > POWER_MILLI( POWER_TRIM_STEP ) )  step = POWER_MILLI( POWER_TRIM_STEP );
+    if ( step < -POWER_MILLI( POWER_TRIM_STEP ) ) step = -POWER_MILLI( POWER_TRIM_STEP );
+
+    trim = pc->vout_trim[i] + step;
+    if ( trim > POWER_MILLI( POWER_TRIM_MAX ) )  trim = POWER_MILLI( POWER_TRIM_MAX );
+    if ( trim < -POWER_MILLI( POWER_TRIM_MAX ) ) trim = -POWER_MILLI( POWER_TRIM_MAX );
+
+    if ( trim == pc->vout_trim[i] )
+      continue;
+
+    /* a module that missed its trim keeps the old one, and is retried next step */
+    result = power_setTrim( pc, i, trim );
+    if ( result != POWER_OK )
+      status = result;
+  }
+
+  return status;
+}
+
+Power_status power_setResponse( Power_t* pc, uint8_t cmd, uint8_t response )
+{
+  for ( int i = 0; i < pc->module_count; ++i )
+  {
+    if ( SMBus.writeByteData( pc->pmbus, pc->module_addr[i], cmd, response ) != STATUS_OK )
+    {
+      pc->status = POWER_PMBUS;
+      #ifdef DEBUG_MODE
+        Notifier.error( SYSTEM_POWER, pc->status );
+      #endif /* DEBUG_MODE */
+      return pc->status;
+    }
+  }
+
+  return POWER_OK;
+}
+
+/*
+ * Fault handling is left to the modules themselves: each is given its limits and what to
+ * do when it crosses them, and asserts SMBALERT# when it does (or crosses a warning limit).
+ * power_handleAlert(..) then finds out who and why, instead of the limits being polled.
+ */
+
+static const struct
+{
+  uint8_t cmd;
+  int32_t limit;
+} power_limits[] =
+{
+  { REG_VOUT_OV_FAULT_LIMIT, POWER_MILLI( POWER_VOUT_OV_FAULT ) },
+  { REG_VOUT_OV_WARN_LIMIT,  POWER_MILLI( POWER_VOUT_OV_WARN )  },
+  { REG_IOUT_OC_FAULT_LIMIT, POWER_MILLI( POWER_IOUT_OC_FAULT ) },
+  { REG_IOUT_OC_WARN_LIMIT,  POWER_MILLI( POWER_IOUT_OC_WARN )  },
+  { REG_OT_FAULT_LIMIT,      POWER_MILLI( POWER_OT_FAULT )      },
+  { REG_OT_WARN_LIMIT,       POWER_MILLI( POWER_OT_WARN )       },
+  { REG_VIN_OV_FAULT_LIMIT,  POWER_MILLI( POWER_VIN_OV_FAULT )  },
+  { REG_VIN_OV_WARN_LIMIT,   POWER_MILLI( POWER_VIN_OV_WARN )   },
+  { REG_VIN_UV_WARN_LIMIT,   POWER_MILLI( POWER_VIN_UV_WARN )   },
+  { REG_VIN_UV_FAULT_LIMIT,  POWER_MILLI( POWER_VIN_UV_FAULT )  }
+};
+
+static const struct
+{
+  uint8_t cmd;
+  uint8_t response;
+} power_responses[] =
+{
+  { REG_VOUT_OV_FAULT_RESPONSE, POWER_VOUT_OV_RESPONSE },
+  { REG_IOUT_OC_FAULT_RESPONSE, POWER_IOUT_OC_RESPONSE },
+  { REG_OT_FAULT_RESPONSE,      POWER_OT_RESPONSE      },
+  { REG_VIN_OV_FAULT_RESPONSE,  POWER_VIN_OV_RESPONSE  },
+  { REG_VIN_UV_FAULT_RESPONSE,  POWER_VIN_UV_RESPONSE  }
+};
+
+/* reads of the Alert Response Address: a NACK there just means nobody is alerting, so
+ * one retry is enough to ride out a bus error, and the deadline keeps a stuck bus from
+ * holding up alert handling */
+static const SMBus_policy power_ara_policy =
+{
+  .retries        = 1,
+  .backoff_us     = SMBUS_DEFAULT_BACKOFF_US,
+  .backoff_max_us = SMBUS_DEFAULT_BACKOFF_US,
+  .deadline_us    = SMBUS_DEFAULT_DEADLINE_US,
+};
+
+/* programs the limits and fault responses from defs.h into every module */
+Power_status power_setLimits( Power_t* pc )
+{
+
+  for ( uint32_t j = 0; j < sizeof(power_limits) / sizeof(power_limits[0]); ++j )
+  {
+    if ( power_setLimit( pc, power_limits[j].cmd, power_limits[j].limit ) != POWER_OK )
+      return pc->status;
+  }
+
+  for ( uint32_t j = 0; j < sizeof(power_responses) / sizeof(power_responses[0]); ++j )
+  {
+    if ( power_setResponse( pc, power_responses[j].cmd, power_responses[j].response )
+         != POWER_OK )
+      return pc->status;
+  }
+
+  /* start from a clean slate, releasing SMBALERT# */
+  for ( uint8_t i = 0; i < pc->module_count; ++i )
+  {
+    if ( SMBus.writeByte( pc->pmbus, pc->module_addr[i], REG_CLEAR_FAULTS ) != STATUS_OK )
+    {
+      pc->status = POWER_PMBUS;
+      #ifdef DEBUG_MODE
+        Notifier.error( SYSTEM_POWER, pc->status );
+      #endif /* DEBUG_MODE */
+      return pc->status;
+    }
+  }
+
+  SMBus.setPolicy( pc->pmbus, PMBUS_ARA, &power_ara_policy );
+
+  return POWER_OK;
+}
+
+/* reads a sub-status register of module i, a failure goes to pc->fault[i] */
+Power_status power_readStatus( Power_t* pc, uint8_t i, uint8_t cmd, uint8_t* status )
+{
+  if ( SMBus.readByteData( pc->pmbus, pc->module_addr[i], cmd, status ) != STATUS_OK )
+  {
+    pc->fault[i].bus = POWER_PMBUS;
+    #ifdef DEBUG_MODE
+      Notifier.error( SYSTEM_POWER, POWER_PMBUS );
+    #endif /* DEBUG_MODE */
+    return POWER_PMBUS;
+  }
+
+  return POWER_OK;
+}
 
+/**
+ * \brief Services SMBALERT#: asks the Alert Response Address who is alerting, reads that
+ *        module's STATUS_WORD and whichever sub-status registers it flags into
+ *        pc->fault[], and clears its faults, until no module answers any more.
+ *
+ * A fault (as opposed to a warning) means the module has already responded as told by
+ * power_setLimits(..); the rest of the rail is then shut down with it, as the sequencer
+ * does, since the others cannot carry its share.
+ *
+ * A module whose status could not be read, or its faults cleared, is left alerting with
+ * pc->fault[i].bus set, and is asked again on the next round. A bus error alone says
+ * nothing about the rail, so it does not go to pc->status.
+ *
+ * \param [in,out] pc power controller
+ *
+ * \return POWER_OK if only warnings (or nothing) were found, otherwise the fault (also in
+ *         pc->status), or POWER_PMBUS if no fault was found but a module could not be
+ *         read or cleared
+ */
+
+Power_status power_handleAlert( Power_t* pc )
+{
+  Power_status fault = POWER_OK;
+  Power_status bus = POWER_OK;
+  Power_fault_t* f;
+  uint8_t address;
+  uint8_t i;
+
+  /* every module answers once, so more rounds than modules means something is stuck */
+  for ( uint8_t round = 0; round <= pc->module_count; ++round )
+  {
+    if ( SMBus.readByte( pc->pmbus, PMBUS_ARA, &address ) != STATUS_OK )
+      break;
+    address >>= 1;
+
+    for ( i = 0; i < pc->module_count && pc->module_addr[i] != address; ++i );
+    if ( i == pc->module_count )
+    {
+      /* not one of ours, clear it anyway or it keeps the line down */
+      SMBus.writeByte( pc->pmbus, address, REG_CLEAR_FAULTS );
+      continue;
+    }
+
+    f = &pc->fault[i];
+    f->vout = f->iout = f->input = f->temperature = f->cml = 0;
+    f->status = POWER_OK;
+    f->bus = POWER_OK;
+    f->time = system_time;
+    f->count++;
+    pc->alerts++;
+
+    if ( SMBus.readWordData( pc->pmbus, address, REG_STATUS_WORD, &f->status_word )
+         != STATUS_OK )
+    {
+      bus = f->bus = POWER_PMBUS;
+      #ifdef DEBUG_MODE
+        Notifier.error( SYSTEM_POWER, bus );
+      #endif /* DEBUG_MODE */
+      continue;
+    }
+
+    if ( f->status_word & ( STATUS_VOUT | STATUS_VOUT_OV ) )
+    {
+      if ( power_readStatus( pc, i, REG_STATUS_VOUT, &f->vout ) != POWER_OK )
+        bus = POWER_PMBUS;
+      else if ( f->vout & STATUS_VOUT_FAULTS )
+        f->status = POWER_VOUT_FAULT;
+    }
+    if ( f->status_word & ( STATUS_IOUT | STATUS_IOUT_OC ) )
+    {
+      if ( power_readStatus( pc, i, REG_STATUS_IOUT, &f->iout ) != POWER_OK )
+        bus = POWER_PMBUS;
+      else if ( f->iout & STATUS_IOUT_FAULTS )
+        f->status = POWER_OVERLIMIT;
+    }
+    if ( f->status_word & ( STATUS_INPUT | STATUS_VIN_UV ) )
+    {
+      if ( power_readStatus( pc, i, REG_STATUS_INPUT, &f->input ) != POWER_OK )
+        bus = POWER_PMBUS;
+      else if ( f->input & STATUS_INPUT_FAULTS )
+        f->status = POWER_VIN_FAULT;
+    }
+    if ( f->status_word & STATUS_TEMPERATURE )
+    {
+      if ( power_readStatus( pc, i, REG_STATUS_TEMPERATURE, &f->temperature ) != POWER_OK )
+        bus = POWER_PMBUS;
+      else if ( f->temperature & STATUS_TEMPERATURE_FAULTS )
+        f->status = POWER_OVERTEMP;
+    }
+    if ( f->status_word & STATUS_CML )
+    {
+      if ( power_readStatus( pc, i, REG_STATUS_CML, &f->cml ) != POWER_OK )
+        bus = POWER_PMBUS;
+    }
+
+    if ( f->status != POWER_OK )
+      fault = f->status;
+
+    /* a partial read is not cleared, so the module alerts again for a full one */
+    if ( f->bus != POWER_OK )
+      continue;
+
+    if ( SMBus.writeByte( pc->pmbus, address, REG_CLEAR_FAULTS ) != STATUS_OK )
+    {
+      bus = f->bus = POWER_PMBUS;
+      #ifdef DEBUG_MODE
+        Notifier.error( SYSTEM_POWER, bus );
+      #endif /* DEBUG_MODE */
+    }
+  }
+
+  if ( fault != POWER_OK )
+  {
+    power_sequenceFault( pc, fault );
+    return fault;
+  }
+
+  return bus;
 }
+
+const struct Power_ Power =
+{
+  .init           = power_init,
+  .switchOn       = power_switchOn,
+  .switchOff      = power_switchOff,
+  .snapshot       = power_snapshot,
+  .snapshotBegin  = power_snapshotBegin,
+  .snapshotEnd    = power_snapshotEnd,
+  .balance        = power_balance,
+  .handleAlert    = power_handleAlert,
+  .setVout        = power_setVout,
+  .setLimit       = power_setLimit,
+  .setTrim        = power_setTrim,
+  .getVin         = power_getVin,
+  .getVout        = power_getVout,
+  .getIout        = power_getIout,
+  .getPout        = power_getPout,
+  .readModule     = power_readModule,
+};
@@ -13,6 +13,8 @@
 #ifndef POWER_H_
 #define POWER_H_
 
+#include "task_handler.h"
+
 /**
  * \defgroup power Power Control
  * \brief Power controller initialisation and management wrappers.
@@ -23,6 +25,19 @@
 extern "C" {
 #endif
 
+/**
+ * \def POWER_MODULE_MAX
+ * \brief Largest number of power converters one power controller can manage.
+ */
+#define POWER_MODULE_MAX 6
+
+/**
+ * \def POWER_INSTANCES_MAX
+ * \brief Largest number of power controllers (Power_t) that can take telemetry sweeps,
+ *        one per bus is the useful most.
+ */
+#define POWER_INSTANCES_MAX 2
+
 /**
  * \enum POWER_STATUS
  * \brief Power status enumerations.
@@ -47,6 +62,40 @@ typedef enum POWER_STATUS
   POWER_UNKNOWN            = 0x39
 } Power_status;
 
+/**
+ * \enum POWER_SEQUENCE
+ * \brief Steps of the power sequencer, see power_switchOn(..)/power_switchOff(..).
+ */
+typedef enum POWER_SEQUENCE
+{
+  POWER_SEQ_IDLE           = 0x00, /**< not sequencing */
+  POWER_SEQ_ENABLE         = 0x01, /**< about to enable the next module */
+  POWER_SEQ_INRUSH         = 0x02, /**< module enabled, about to check its inrush current */
+  POWER_SEQ_SETTLE         = 0x03, /**< waiting for the module's Vout to settle */
+  POWER_SEQ_DISABLE        = 0x04  /**< about to disable the next module */
+} Power_sequence;
+
+/**
+ * \struct Power_fault_t
+ * \brief What a power converter reported the last time it asserted SMBALERT#, see
+ *        power_handleAlert(..).
+ */
+typedef struct Power_fault_t
+{
+  uint16_t status_word;            /**< STATUS_WORD */
+  uint8_t vout;                    /**< STATUS_VOUT, if STATUS_WORD flagged it */
+  uint8_t iout;                    /**< STATUS_IOUT, if STATUS_WORD flagged it */
+  uint8_t input;                   /**< STATUS_INPUT, if STATUS_WORD flagged it */
+  uint8_t temperature;             /**< STATUS_TEMPERATURE, if STATUS_WORD flagged it */
+  uint8_t cml;                     /**< STATUS_CML, if STATUS_WORD flagged it */
+  Power_status status;             /**< the fault it was taken for, POWER_OK if it only
+                                        flagged warnings */
+  Power_status bus;                /**< POWER_PMBUS if a status read or CLEAR_FAULTS
+                                        failed, the registers above are then partial */
+  uint32_t time;                   /**< system_time of the alert */
+  uint32_t count;                  /**< alerts from this module so far */
+} Power_fault_t;
+
 typedef struct Power_t
 {
   Power_status status;             /**< power status */
@@ -55,11 +104,98 @@ typedef struct Power_t
   bool* power_state;               /**< power state of each individual module */
   uint8_t* module_addr;            /**< SMBus addresses of each module */
   uint16_t max_power;              /**< maximum power output */
+  uint8_t* enable_pin;             /**< enable (STWx) pin of each module, or NULL to
+                                        switch them with OPERATION instead */
+  List_t* task_list;               /**< scheduler the power sequencer runs on */
+  int8_t vout_exponent[POWER_MODULE_MAX]; /**< VOUT_MODE exponent of each module */
+  uint8_t vout_exponent_known;     /**< bit i set once vout_exponent[i] has been read */
+  int32_t vout_trim[POWER_MODULE_MAX]; /**< VOUT_TRIM of each module (mV), see
+                                            power_balance(..) */
+
+  Power_sequence sequence;         /**< power sequencer step */
+  uint8_t sequence_module;         /**< module the sequencer is working on */
+  uint8_t settle_attempts;         /**< Vout checks of that module so far */
+  uint32_t sequence_generation;    /**< bumped to cancel a sequence in progress */
+  uint32_t transition_time[POWER_MODULE_MAX]; /**< system_time of each module's last
+                                                   completed on/off transition */
+
+  Power_fault_t fault[POWER_MODULE_MAX]; /**< last alert of each module */
+  uint32_t alerts;                 /**< alerts handled, from any module */
 } Power_t;
 
-struct Power_
+/**
+ * \struct Power_module_snapshot_t
+ * \brief Telemetry of one power converter, as read by power_snapshot(..).
+ */
+typedef struct Power_module_snapshot_t
+{
+  Power_status status;             /**< POWER_OK if all readings below are valid */
+  int32_t vin;                     /**< input voltage (mV) */
+  int32_t vout;                    /**< output voltage (mV) */
+  int32_t iout;                    /**< output current (mA) */
+  int32_t pout;                    /**< output power (mW) */
+  int32_t temperature;             /**< temperature sensor 1 (milli-degrees C) */
+} Power_module_snapshot_t;
+
+/**
+ * \struct Power_snapshot_t
+ * \brief Telemetry of all power converters of a power controller, taken in one sweep.
+ *        Aggregates cover the modules whose status is POWER_OK.
+ */
+typedef struct Power_snapshot_t
 {
+  uint32_t timestamp;              /**< system_time when the sweep completed */
+  uint8_t module_count;            /**< entries used in module[] */
+  uint8_t valid_count;             /**< modules with status POWER_OK */
+  uint16_t transactions;           /**< bus transactions the sweep took */
+  Power_module_snapshot_t module[POWER_MODULE_MAX];
+  int32_t vin;                     /**< mean input voltage (mV) */
+  int32_t vout;                    /**< mean output voltage (mV) */
+  int32_t iout;                    /**< total output current (mA) */
+  int32_t pout;                    /**< total output power (mW) */
+  int32_t temperature;             /**< hottest module (milli-degrees C) */
+} Power_snapshot_t;
 
+Power_status power_init( Power_t* pc );
+Power_status power_snapshot( Power_t* pc, Power_snapshot_t* snapshot );
+Power_status power_snapshotBegin( Power_t* pc );
+Power_status power_snapshotEnd( Power_t* pc, Power_snapshot_t* snapshot );
+Power_status power_switchOn( Power_t* pc );
+Power_status power_switchOff( Power_t* pc );
+Power_status power_balance( Power_t* pc, const Power_snapshot_t* snapshot );
+Power_status power_handleAlert( Power_t* pc );
+Power_status power_setVout( Power_t* pc, int32_t vout );
+Power_status power_setLimit( Power_t* pc, uint8_t cmd, int32_t limit );
+Power_status power_setTrim( Power_t* pc, uint8_t i, int32_t trim );
+Power_status power_getVin( Power_t* pc, int32_t* vin );
+Power_status power_getVout( Power_t* pc, int32_t* vout );
+Power_status power_getIout( Power_t* pc, int32_t* iout );
+Power_status power_getPout( Power_t* pc, int32_t* pout );
+Power_status power_readModule( Power_t* pc, uint8_t i, uint8_t cmd, int32_t* meas );
+
+/**
+ * \struct Power_
+ * \brief Power controller operations, as Power.xxx( pc, .. ). Every one works on the
+ *        Power_t it is given, so power controllers on different buses are independent.
+ */
+struct Power_
+{
+  Power_status (*init)( Power_t* pc );
+  Power_status (*switchOn)( Power_t* pc );
+  Power_status (*switchOff)( Power_t* pc );
+  Power_status (*snapshot)( Power_t* pc, Power_snapshot_t* snapshot );
+  Power_status (*snapshotBegin)( Power_t* pc );
+  Power_status (*snapshotEnd)( Power_t* pc, Power_snapshot_t* snapshot );
+  Power_status (*balance)( Power_t* pc, const Power_snapshot_t* snapshot );
+  Power_status (*handleAlert)( Power_t* pc );
+  Power_status (*setVout)( Power_t* pc, int32_t vout );
+  Power_status (*setLimit)( Power_t* pc, uint8_t cmd, int32_t limit );
+  Power_status (*setTrim)( Power_t* pc, uint8_t i, int32_t trim );
+  Power_status (*getVin)( Power_t* pc, int32_t* vin );
+  Power_status (*getVout)( Power_t* pc, int32_t* vout );
+  Power_status (*getIout)( Power_t* pc, int32_t* iout );
+  Power_status (*getPout)( Power_t* pc, int32_t* pout );
+  Power_status (*readModule)( Power_t* pc, uint8_t i, uint8_t cmd, int32_t* meas );
 };
 
 extern const struct Power_ Power;
@@ -10,15 +10,919 @@
  * This is an abstraction layer for an SMBus master using Atmel's ASF, providing a full set of
  * I2C hardware communication functions.
  *
- * \note Requires the correct modules be set up in ASF (I2C Master and System).
+ * \note Requires the correct modules be set up in ASF (I2C Master, in callback mode,
+ *       System, PORT and Delay routines), and smbus_service(..) to be called periodically.
  *
- * \warning These I2C operations are BLOCKING!
+ * \warning The smbus_write*(..)/smbus_read*(..) operations are BLOCKING! They are thin
+ *          wrappers over the asynchronous transaction queue, see smbus_submit(..).
  */
 
 #include <asf.h>
+#include <string.h>
 
 #include "smbus.h"
 
+/**
+ * \defgroup atmel_samd20_smbus_master_async Atmel SAMD20 SMBus Master Transaction Queue
+ * \brief Atmel SAMD20 SMBus Master Transaction Queue (interrupt driven)
+ * \{
+ */
+
+/**
+ * \internal
+ * \brief Wraparound-safe "a is earlier than b" for smbus_time values.
+ */
+#define SMBUS_BEFORE( a, b ) ( (int32_t) ( (uint32_t) (a) - (uint32_t) (b) ) < 0 )
+
+/**
+ * \internal
+ * \brief Retry policy and error counters of one device on a bus.
+ */
+typedef struct SMBus_device
+{
+  bool used;
+  uint8_t address;
+  SMBus_policy policy;
+  SMBus_errors errors;
+} SMBus_device;
+
+/**
+ * \internal
+ * \brief Transaction queue attached to one I2C master instance. One transaction is on
+ *        the bus at a time, the waiting ones run back-to-back from the completion
+ *        interrupts. A transaction backing off after an error is parked until its own
+ *        retry_at, so the devices behind it keep the bus. After a bus error the queue
+ *        holds off until smbus_recover(..) has clocked the bus free.
+ */
+typedef struct SMBus_queue
+{
+  struct i2c_master_module* module;
+  uint32_t pinmux_sda;             /**< kept for bus recovery */
+  uint32_t pinmux_scl;
+  SMBus_transaction* active;       /**< on the bus, or NULL if the bus is idle */
+  SMBus_transaction* head;         /**< waiting, in submission order */
+  SMBus_transaction* tail;
+  SMBus_transaction* parked;       /**< backing off, each until its retry_at */
+  bool recovering;                 /**< bus error seen, waiting for smbus_recover(..) */
+  bool recovery_announced;         /**< smbus_service(..) has asked for the recovery */
+  uint8_t recovery_address;        /**< device the bus error was seen on */
+  uint32_t pec_devices[4];         /**< bitmap of 7-bit addresses that use PEC */
+  SMBus_device devices[SMBUS_DEVICES_MAX];
+  bool reading;                    /**< active has finished writing and is reading */
+  struct i2c_master_packet packet; /**< ASF job descriptor for the current phase */
+} SMBus_queue;
+
+static SMBus_queue smbus_queues[SMBUS_QUEUES_MAX];
+
+/**
+ * \internal
+ * \brief Microseconds, advanced by smbus_service(..).
+ */
+static volatile uint32_t smbus_time;
+
+/**
+ * \internal
+ * \brief Policy of devices that have not been given one with smbus_setPolicy(..).
+ */
+static const SMBus_policy smbus_default_policy =
+{
+  .retries        = MAX_RETRIES,
+  .backoff_us     = SMBUS_DEFAULT_BACKOFF_US,
+  .backoff_max_us = SMBUS_DEFAULT_BACKOFF_MAX_US,
+  .deadline_us    = SMBUS_DEFAULT_DEADLINE_US,
+};
+
+/**
+ * \internal
+ * \brief CRC-8 (x^8 + x^2 + x + 1, as used for the SMBus PEC) lookup table, generated by
+ *        the preprocessor: entry i is i shifted through the polynomial eight times.
+ */
+#define SMBUS_CRC8_BIT( c )   ( (uint8_t) ( ( (c) << 1 ) ^ ( ( (c) & 0x80 ) ? 0x07 : 0x00 ) ) )
+#define SMBUS_CRC8_BYTE( c )  SMBUS_CRC8_BIT( SMBUS_CRC8_BIT( SMBUS_CRC8_BIT( SMBUS_CRC8_BIT( \
+                              SMBUS_CRC8_BIT( SMBUS_CRC8_BIT( SMBUS_CRC8_BIT( SMBUS_CRC8_BIT( \
+                              (c) ) ) ) ) ) ) ) )
+#define SMBUS_CRC8_ROW( c )   SMBUS_CRC8_BYTE( (c) + 0x0 ), SMBUS_CRC8_BYTE( (c) + 0x1 ), \
+                              SMBUS_CRC8_BYTE( (c) + 0x2 ), SMBUS_CRC8_BYTE( (c) + 0x3 ), \
+                              SMBUS_CRC8_BYTE( (c) + 0x4 ), SMBUS_CRC8_BYTE( (c) + 0x5 ), \
+                              SMBUS_CRC8_BYTE( (c) + 0x6 ), SMBUS_CRC8_BYTE( (c) + 0x7 ), \
+                              SMBUS_CRC8_BYTE( (c) + 0x8 ), SMBUS_CRC8_BYTE( (c) + 0x9 ), \
+                              SMBUS_CRC8_BYTE( (c) + 0xa ), SMBUS_CRC8_BYTE( (c) + 0xb ), \
+                              SMBUS_CRC8_BYTE( (c) + 0xc ), SMBUS_CRC8_BYTE( (c) + 0xd ), \
+                              SMBUS_CRC8_BYTE( (c) + 0xe ), SMBUS_CRC8_BYTE( (c) + 0xf )
+
+static const uint8_t smbus_crc8[256] =
+{
+  SMBUS_CRC8_ROW( 0x00 ), SMBUS_CRC8_ROW( 0x10 ), SMBUS_CRC8_ROW( 0x20 ), SMBUS_CRC8_ROW( 0x30 ),
+  SMBUS_CRC8_ROW( 0x40 ), SMBUS_CRC8_ROW( 0x50 ), SMBUS_CRC8_ROW( 0x60 ), SMBUS_CRC8_ROW( 0x70 ),
+  SMBUS_CRC8_ROW( 0x80 ), SMBUS_CRC8_ROW( 0x90 ), SMBUS_CRC8_ROW( 0xa0 ), SMBUS_CRC8_ROW( 0xb0 ),
+  SMBUS_CRC8_ROW( 0xc0 ), SMBUS_CRC8_ROW( 0xd0 ), SMBUS_CRC8_ROW( 0xe0 ), SMBUS_CRC8_ROW( 0xf0 )
+};
+
+static void smbus_start( SMBus_queue* queue );
+static void smbus_dispatch( SMBus_queue* queue );
+
+/**
+ * \internal
+ * \brief Find the queue attached to an I2C master instance.
+ *
+ * \return pointer to the queue, or NULL if the instance has none
+ */
+
+static SMBus_queue* smbus_findQueue( struct i2c_master_module *const i2c_master_instance )
+{
+  for ( uint32_t i = 0; i < SMBUS_QUEUES_MAX; ++i )
+  {
+    if ( smbus_queues[i].module == i2c_master_instance )
+      return &smbus_queues[i];
+  }
+
+  return NULL;
+}
+
+/**
+ * \internal
+ * \brief Find the entry of a device on a bus.
+ *
+ * \param [in] add take a free entry (with the default policy) if the device has none
+ *
+ * \return pointer to the entry, or NULL if there is none (or none left)
+ */
+
+static SMBus_device* smbus_findDevice( SMBus_queue* queue, uint8_t address, bool add )
+{
+  SMBus_device* free_device = NULL;
+
+  for ( uint32_t i = 0; i < SMBUS_DEVICES_MAX; ++i )
+  {
+    if ( queue->devices[i].used && queue->devices[i].address == address )
+      return &queue->devices[i];
+    if ( !queue->devices[i].used && free_device == NULL )
+      free_device = &queue->devices[i];
+  }
+
+  if ( !add || free_device == NULL )
+    return NULL;
+
+  memset( free_device, 0, sizeof(SMBus_device) );
+  free_device->used    = true;
+  free_device->address = address;
+  free_device->policy  = smbus_default_policy;
+
+  return free_device;
+}
+
+/**
+ * \internal
+ * \brief Retry policy that applies to a device.
+ */
+
+static const SMBus_policy* smbus_policyOf( SMBus_queue* queue, uint8_t address )
+{
+  SMBus_device* device = smbus_findDevice( queue, address, false );
+
+  return device != NULL ? &device->policy : &smbus_default_policy;
+}
+
+/**
+ * \internal
+ * \brief Whether a transaction has run out of time.
+ */
+
+static bool smbus_expired( SMBus_transaction* transaction )
+{
+  return transaction->has_deadline && !SMBUS_BEFORE( smbus_time, transaction->deadline );
+}
+
+/**
+ * \internal
+ * \brief Clock a stuck slave off the bus: with the SERCOM disabled, toggle SCL (up to
+ *        SMBUS_RECOVERY_CLOCKS times) until SDA is released, then send a STOP. Pins are
+ *        driven open-drain style: low, or released to the pull-up.
+ *
+ * \warning Busy-waits for up to about 100 us.
+ *
+ * \return true if SDA was held low, i.e. recovery was needed
+ */
+
+static bool smbus_clockFree( SMBus_queue* queue )
+{
+  uint8_t sda = (uint8_t) ( queue->pinmux_sda >> 16 );
+  uint8_t scl = (uint8_t) ( queue->pinmux_scl >> 16 );
+  bool stuck;
+
+  struct port_config release;
+  struct port_config drive;
+  struct system_pinmux_config mux;
+
+  port_get_config_defaults( &release );
+  release.direction  = PORT_PIN_DIR_INPUT;
+  release.input_pull = PORT_PIN_PULL_UP;
+  port_get_config_defaults( &drive );
+  drive.direction = PORT_PIN_DIR_OUTPUT_WTH_READBACK;
+
+  i2c_master_disable( queue->module );
+
+  port_pin_set_output_level( sda, false );
+  port_pin_set_output_level( scl, false );
+  port_pin_set_config( sda, &release );
+  port_pin_set_config( scl, &release );
+  delay_us( SMBUS_RECOVERY_HALF_CLOCK_US );
+
+  stuck = !port_pin_get_input_level( sda );
+  for ( uint32_t i = 0; i < SMBUS_RECOVERY_CLOCKS && !port_pin_get_input_level( sda ); ++i )
+  {
+    port_pin_set_config( scl, &drive );
+    delay_us( SMBUS_RECOVERY_HALF_CLOCK_US );
+    port_pin_set_config( scl, &release );
+    delay_us( SMBUS_RECOVERY_HALF_CLOCK_US );
+  }
+
+  /* STOP: SDA rises while SCL is high */
+  port_pin_set_config( scl, &drive );
+  port_pin_set_config( sda, &drive );
+  delay_us( SMBUS_RECOVERY_HALF_CLOCK_US );
+  port_pin_set_config( scl, &release );
+  delay_us( SMBUS_RECOVERY_HALF_CLOCK_US );
+  port_pin_set_config( sda, &release );
+  delay_us( SMBUS_RECOVERY_HALF_CLOCK_US );
+
+  /* hand the pins back to the SERCOM */
+  system_pinmux_get_config_defaults( &mux );
+  mux.mux_position = (uint8_t) ( queue->pinmux_sda & 0xffff );
+  system_pinmux_pin_set_config( sda, &mux );
+  mux.mux_position = (uint8_t) ( queue->pinmux_scl & 0xffff );
+  system_pinmux_pin_set_config( scl, &mux );
+
+  i2c_master_enable( queue->module );
+
+  return stuck;
+}
+
+/**
+ * \internal
+ * \brief PEC of the head transaction up to and including its read address byte (or up to
+ *        the end of the write, if it has no read phase).
+ */
+
+static uint8_t smbus_framePEC( SMBus_transaction* transaction )
+{
+  uint8_t crc = 0;
+
+  if ( transaction->write_length )
+  {
+    crc = smbus_crc8[(uint8_t) ( transaction->address << 1 )];
+    crc = smbus_pec( crc, transaction->write_data, transaction->write_length );
+  }
+  if ( transaction->read_length )
+    crc = smbus_crc8[crc ^ (uint8_t) ( ( transaction->address << 1 ) | 1 )];
+
+  return crc;
+}
+
+/**
+ * \internal
+ * \brief Hand a finished transaction back to its owner.
+ */
+
+static void smbus_finish( SMBus_transaction* transaction, enum status_code status )
+{
+  transaction->status = status;
+  if ( transaction->callback != NULL )
+    transaction->callback( transaction );
+}
+
+/**
+ * \internal
+ * \brief Retire the active transaction, start the next one and notify the owner.
+ *
+ * The next transaction is started before the callback runs, so a callback may safely
+ * submit follow-up transactions.
+ */
+
+static void smbus_complete( SMBus_queue* queue, enum status_code status )
+{
+  SMBus_transaction* transaction = queue->active;
+
+  queue->active  = NULL;
+  queue->reading = false;
+  smbus_dispatch( queue );
+
+  smbus_finish( transaction, status );
+}
+
+/**
+ * \internal
+ * \brief Whether a device has a transaction backing off.
+ */
+
+static bool smbus_isParked( SMBus_queue* queue, uint8_t address )
+{
+  for ( SMBus_transaction* parked = queue->parked; parked != NULL; parked = parked->next )
+  {
+    if ( parked->address == address )
+      return true;
+  }
+
+  return false;
+}
+
+/**
+ * \internal
+ * \brief Put the first waiting transaction whose device has none parked on the bus, if
+ *        the bus is idle and not waiting for recovery. Transactions for one device
+ *        always run in order.
+ */
+
+static void smbus_dispatch( SMBus_queue* queue )
+{
+  SMBus_transaction* previous = NULL;
+  SMBus_transaction* transaction = queue->head;
+
+  if ( queue->active != NULL || queue->recovering )
+    return;
+
+  while ( transaction != NULL && smbus_isParked( queue, transaction->address ) )
+  {
+    previous = transaction;
+    transaction = transaction->next;
+  }
+  if ( transaction == NULL )
+    return;
+
+  if ( previous == NULL )
+    queue->head = transaction->next;
+  else
+    previous->next = transaction->next;
+  if ( queue->tail == transaction )
+    queue->tail = previous;
+
+  transaction->next = NULL;
+  queue->active  = transaction;
+  queue->reading = false;
+  smbus_start( queue );
+}
+
+/**
+ * \internal
+ * \brief Count an error against the active transaction's device and decide what to do
+ *        about it under the device's policy:
+ *
+ * - NACK (address or data): the device is busy or absent, back off and retry.
+ * - arbitration lost: another master had the bus, retry straight away.
+ * - PEC mismatch: the frame was corrupted, retry straight away.
+ * - bus error or SCL low timeout: a slave may be holding SDA, hold the queue until
+ *   smbus_recover(..) has clocked the bus free, back off and retry.
+ * - anything else (e.g. the job could not start): back off and retry.
+ *
+ * The transaction gives up with the last error once it has used up its retries, or with
+ * STATUS_ERR_TIMEOUT if the backoff would take it past its deadline.
+ */
+
+static void smbus_fail( SMBus_queue* queue, enum status_code status )
+{
+  SMBus_transaction* transaction = queue->active;
+  SMBus_device* device = smbus_findDevice( queue, transaction->address, true );
+  const SMBus_policy* policy = device != NULL ? &device->policy : &smbus_default_policy;
+  SMBus_errors dummy;
+  SMBus_errors* errors = device != NULL ? &device->errors : &dummy;
+  uint32_t backoff = 0;
+
+  switch ( status )
+  {
+    case STATUS_ERR_BAD_ADDRESS:
+    case STATUS_ERR_OVERFLOW:
+      errors->nack++;
+      backoff = policy->backoff_us;
+      break;
+    case STATUS_ERR_PACKET_COLLISION:
+      errors->arbitration++;
+      break;
+    case STATUS_ERR_BAD_DATA:
+      errors->pec++;
+      break;
+    case STATUS_ERR_TIMEOUT:
+      errors->timeout++;
+      queue->recovering       = true;
+      queue->recovery_address = transaction->address;
+      backoff = policy->backoff_us;
+      break;
+    case STATUS_ERR_BAD_FORMAT:
+      errors->bus++;
+      queue->recovering       = true;
+      queue->recovery_address = transaction->address;
+      backoff = policy->backoff_us;
+      break;
+    default:
+      errors->bus++;
+      backoff = policy->backoff_us;
+      break;
+  }
+
+  if ( ++transaction->retries > policy->retries )
+  {
+    smbus_complete( queue, status );
+    return;
+  }
+
+  /* exponential, capped */
+  for ( uint32_t i = 1; i < transaction->retries && backoff < policy->backoff_max_us; ++i )
+    backoff <<= 1;
+  if ( backoff > policy->backoff_max_us )
+    backoff = policy->backoff_max_us;
+
+  if ( transaction->has_deadline && !SMBUS_BEFORE( smbus_time + backoff, transaction->deadline ) )
+  {
+    errors->timeout++;
+    smbus_complete( queue, STATUS_ERR_TIMEOUT );
+  }
+  else if ( backoff == 0 && !queue->recovering )
+  {
+    /* restart from the write phase */
+    queue->reading = false;
+    smbus_start( queue );
+  }
+  else
+  {
+    transaction->retry_at = smbus_time + backoff;
+    transaction->next     = queue->parked;
+    queue->parked  = transaction;
+    queue->active  = NULL;
+    queue->reading = false;
+    smbus_dispatch( queue );
+  }
+}
+
+/**
+ * \internal
+ * \brief Issue the current phase (write or read) of the active transaction as an ASF job.
+ */
+
+static void smbus_start( SMBus_queue* queue )
+{
+  SMBus_transaction* transaction = queue->active;
+  enum status_code status;
+
+  if ( !queue->reading && smbus_expired( transaction ) )
+  {
+    SMBus_device* device = smbus_findDevice( queue, transaction->address, true );
+    if ( device != NULL )
+      device->errors.timeout++;
+    smbus_complete( queue, STATUS_ERR_TIMEOUT );
+    return;
+  }
+
+  queue->packet.address         = transaction->address;
+  queue->packet.ten_bit_address = false;
+  queue->packet.high_speed      = false;
+  queue->packet.hs_master_code  = 0x0;
+
+  if ( !queue->reading && transaction->write_length )
+  {
+    queue->packet.data        = transaction->write_data;
+    queue->packet.data_length = transaction->write_length;
+    if ( transaction->pec && !transaction->read_length )
+    {
+      transaction->write_data[transaction->write_length] = smbus_framePEC( transaction );
+      queue->packet.data_length++;
+    }
+    /* a read phase follows with a repeated START instead of STOP + START */
+    if ( transaction->read_length )
+      status = i2c_master_write_packet_job_no_stop( queue->module, &queue->packet );
+    else
+      status = i2c_master_write_packet_job( queue->module, &queue->packet );
+  }
+  else
+  {
+    queue->reading = true;
+    queue->packet.data        = transaction->read_data;
+    queue->packet.data_length = transaction->read_length + ( transaction->pec ? 1 : 0 );
+    status = i2c_master_read_packet_job( queue->module, &queue->packet );
+  }
+
+  if ( status != STATUS_OK )
+    smbus_fail( queue, status );
+}
+
+/**
+ * \internal
+ * \brief ASF write complete callback: move on to the read phase, or retire.
+ */
+
+static void smbus_writeComplete( struct i2c_master_module *const module )
+{
+  SMBus_queue* queue = smbus_findQueue( module );
+
+  if ( queue->active->read_length )
+  {
+    queue->reading = true;
+    smbus_start( queue );
+  }
+  else
+  {
+    smbus_complete( queue, STATUS_OK );
+  }
+}
+
+/**
+ * \internal
+ * \brief ASF read complete callback: the transaction is done, unless its PEC is wrong,
+ *        in which case it is retried like any other bus error.
+ *
+ * For a block read the PEC sits right after the byte count the slave sent, not at the end
+ * of the buffer.
+ */
+
+static void smbus_readComplete( struct i2c_master_module *const module )
+{
+  SMBus_queue* queue = smbus_findQueue( module );
+  SMBus_transaction* transaction = queue->active;
+
+  if ( transaction->pec )
+  {
+    uint32_t length = transaction->read_length;
+    uint8_t crc;
+
+    if ( transaction->block )
+    {
+      /* the slave claims more than fits, retrying will not change its mind */
+      if ( transaction->read_data[0] >= transaction->read_length )
+      {
+        smbus_complete( queue, STATUS_ERR_OVERFLOW );
+        return;
+      }
+      length = transaction->read_data[0] + 1;
+    }
+
+    crc = smbus_pec( smbus_framePEC( transaction ), transaction->read_data, length );
+    if ( crc != transaction->read_data[length] )
+    {
+      smbus_fail( queue, STATUS_ERR_BAD_DATA );
+      return;
+    }
+  }
+
+  smbus_complete( queue, STATUS_OK );
+}
+
+/**
+ * \internal
+ * \brief ASF error callback: retry the transaction from the start, see smbus_fail(..).
+ */
+
+static void smbus_error( struct i2c_master_module *const module )
+{
+  smbus_fail( smbus_findQueue( module ), i2c_master_get_job_status( module ) );
+}
+
+/**
+ * \internal
+ * \brief Give an I2C master instance a transaction queue and hook up its callbacks.
+ *
+ * \return STATUS_OK, or STATUS_ERR_NO_MEMORY if all SMBUS_QUEUES_MAX queues are taken
+ */
+
+static enum status_code smbus_attachQueue( struct i2c_master_module *const i2c_master_instance,
+                                           uint32_t pinmux_sda, uint32_t pinmux_scl )
+{
+  SMBus_queue* queue = smbus_findQueue( i2c_master_instance );
+
+  if ( queue == NULL )
+    queue = smbus_findQueue( NULL );
+  if ( queue == NULL )
+    return STATUS_ERR_NO_MEMORY;
+
+  memset( queue, 0, sizeof(SMBus_queue) );
+  queue->module     = i2c_master_instance;
+  queue->pinmux_sda = pinmux_sda;
+  queue->pinmux_scl = pinmux_scl;
+
+  i2c_master_register_callback( i2c_master_instance, smbus_writeComplete,
+                                I2C_MASTER_CALLBACK_WRITE_COMPLETE );
+  i2c_master_enable_callback( i2c_master_instance, I2C_MASTER_CALLBACK_WRITE_COMPLETE );
+  i2c_master_register_callback( i2c_master_instance, smbus_readComplete,
+                                I2C_MASTER_CALLBACK_READ_COMPLETE );
+  i2c_master_enable_callback( i2c_master_instance, I2C_MASTER_CALLBACK_READ_COMPLETE );
+  i2c_master_register_callback( i2c_master_instance, smbus_error,
+                                I2C_MASTER_CALLBACK_ERROR );
+  i2c_master_enable_callback( i2c_master_instance, I2C_MASTER_CALLBACK_ERROR );
+
+  return STATUS_OK;
+}
+
+/**
+ * \brief Queue a transaction on an I2C master instance. It starts immediately if the bus
+ *        is idle, otherwise as soon as the transactions ahead of it complete.
+ *
+ * Errors are retried under the device's policy, see smbus_setPolicy(..); its deadline
+ * runs from now.
+ *
+ * Safe to call from interrupt context, including from a completion callback. The
+ * descriptor (and its buffers) must stay valid until its status leaves STATUS_BUSY.
+ *
+ * \param [in] i2c_master_instance pointer to i2c_master_module instance set up with
+ *                                 smbus_configure(..)
+ * \param [in,out] transaction transaction descriptor
+ *
+ * \return STATUS_OK if queued, STATUS_ERR_NOT_INITIALIZED if the instance has no queue
+ */
+
+enum status_code smbus_submit( struct i2c_master_module *const i2c_master_instance,
+                               SMBus_transaction* transaction )
+{
+  SMBus_queue* queue = smbus_findQueue( i2c_master_instance );
+
+  if ( queue == NULL )
+    return STATUS_ERR_NOT_INITIALIZED;
+
+  transaction->status  = STATUS_BUSY;
+  transaction->retries = 0;
+  transaction->next    = NULL;
+
+  system_interrupt_enter_critical_section();
+  transaction->deadline     = smbus_time + smbus_policyOf( queue, transaction->address )->deadline_us;
+  transaction->has_deadline = smbus_policyOf( queue, transaction->address )->deadline_us != 0;
+  if ( queue->tail != NULL )
+    queue->tail->next = transaction;
+  else
+    queue->head = transaction;
+  queue->tail = transaction;
+  smbus_dispatch( queue );
+  system_interrupt_leave_critical_section();
+
+  return STATUS_OK;
+}
+
+/**
+ * \brief Advance the SMBus clock: restart transactions whose backoff is over and abort
+ *        the ones past their deadline. Call it periodically, e.g. from SysTick_Handler;
+ *        backoffs and deadlines are only as fine as its period.
+ *
+ * \param [in] elapsed_us microseconds since the previous call
+ *
+ * \return true, once per bus error, if a bus is held for smbus_recover(..): have a task
+ *         run it, it busy-waits too long for interrupt context
+ */
+
+bool smbus_service( uint32_t elapsed_us )
+{
+  bool recover = false;
+
+  smbus_time += elapsed_us;
+
+  for ( uint32_t i = 0; i < SMBUS_QUEUES_MAX; ++i )
+  {
+    SMBus_queue* queue = &smbus_queues[i];
+
+    if ( queue->module == NULL )
+      continue;
+
+    system_interrupt_enter_critical_section();
+
+    /* a transaction stuck on the bus, e.g. a slave stretching SCL forever */
+    if ( queue->active != NULL && smbus_expired( queue->active ) )
+    {
+      SMBus_device* device = smbus_findDevice( queue, queue->active->address, true );
+      if ( device != NULL )
+        device->errors.timeout++;
+      i2c_master_cancel_job( queue->module );
+      i2c_master_send_stop( queue->module );
+      smbus_complete( queue, STATUS_ERR_TIMEOUT );
+    }
+
+    /* backoff over: a parked transaction goes next, ahead of its device's others */
+    for ( SMBus_transaction** link = &queue->parked; *link != NULL; )
+    {
+      SMBus_transaction* parked = *link;
+
+      if ( SMBUS_BEFORE( smbus_time, parked->retry_at ) )
+      {
+        link = &parked->next;
+        continue;
+      }
+
+      *link = parked->next;
+      parked->next = queue->head;
+      queue->head  = parked;
+      if ( queue->tail == NULL )
+        queue->tail = parked;
+    }
+    smbus_dispatch( queue );
+
+    if ( queue->recovering && !queue->recovery_announced )
+    {
+      queue->recovery_announced = true;
+      recover = true;
+    }
+
+    system_interrupt_leave_critical_section();
+  }
+
+  return recover;
+}
+
+/**
+ * \brief Clock free every bus held after a bus error (see smbus_fail(..)), then let its
+ *        queue carry on. Call from task context: it busy-waits for up to about 100 us
+ *        per bus. smbus_wait(..) calls it too, so a blocking caller never waits on a
+ *        recovery that only it could run.
+ */
+
+void smbus_recover( void )
+{
+  for ( uint32_t i = 0; i < SMBUS_QUEUES_MAX; ++i )
+  {
+    SMBus_queue* queue = &smbus_queues[i];
+    bool stuck;
+
+    if ( queue->module == NULL || !queue->recovering )
+      continue;
+
+    /* nothing starts on the bus meanwhile, smbus_dispatch(..) holds off */
+    stuck = smbus_clockFree( queue );
+
+    system_interrupt_enter_critical_section();
+    if ( stuck )
+    {
+      SMBus_device* device = smbus_findDevice( queue, queue->recovery_address, true );
+      if ( device != NULL )
+        device->errors.recoveries++;
+    }
+    queue->recovering         = false;
+    queue->recovery_announced = false;
+    smbus_dispatch( queue );
+    system_interrupt_leave_critical_section();
+  }
+}
+
+/**
+ * \brief Give a device on a bus its own retry policy. Devices without one use MAX_RETRIES
+ *        and the SMBUS_DEFAULT_* backoff and deadline.
+ *
+ * \param [in] i2c_master_instance pointer to i2c_master_module instance set up with
+ *                                 smbus_configure(..)
+ * \param [in] device_address 7-bit I2C address of the slave
+ * \param [in] policy retry policy, copied
+ *
+ * \return STATUS_OK, STATUS_ERR_NOT_INITIALIZED if the instance has no queue, or
+ *         STATUS_ERR_NO_MEMORY if SMBUS_DEVICES_MAX devices already have an entry
+ */
+
+enum status_code smbus_setPolicy( struct i2c_master_module *const i2c_master_instance,
+                                  uint8_t device_address, const SMBus_policy* policy )
+{
+  SMBus_queue* queue = smbus_findQueue( i2c_master_instance );
+  SMBus_device* device;
+  enum status_code status = STATUS_OK;
+
+  if ( queue == NULL )
+    return STATUS_ERR_NOT_INITIALIZED;
+
+  system_interrupt_enter_critical_section();
+  device = smbus_findDevice( queue, device_address, true );
+  if ( device != NULL )
+    device->policy = *policy;
+  else
+    status = STATUS_ERR_NO_MEMORY;
+  system_interrupt_leave_critical_section();
+
+  return status;
+}
+
+/**
+ * \brief Read the error counters of a device on a bus. Devices are counted once they
+ *        have a policy or their first error, while fewer than SMBUS_DEVICES_MAX are.
+ *
+ * \param [in] i2c_master_instance pointer to i2c_master_module instance set up with
+ *                                 smbus_configure(..)
+ * \param [in] device_address 7-bit I2C address of the slave
+ * \param [out] errors error counters, zeroed if the device is not counted
+ *
+ * \return STATUS_OK, STATUS_ERR_NOT_INITIALIZED if the instance has no queue, or
+ *         STATUS_ERR_INVALID_ARG if the device is not counted
+ */
+
+enum status_code smbus_getErrors( struct i2c_master_module *const i2c_master_instance,
+                                  uint8_t device_address, SMBus_errors* errors )
+{
+  SMBus_queue* queue = smbus_findQueue( i2c_master_instance );
+  SMBus_device* device;
+  enum status_code status = STATUS_OK;
+
+  memset( errors, 0, sizeof(SMBus_errors) );
+  if ( queue == NULL )
+    return STATUS_ERR_NOT_INITIALIZED;
+
+  system_interrupt_enter_critical_section();
+  device = smbus_findDevice( queue, device_address, false );
+  if ( device != NULL )
+    *errors = device->errors;
+  else
+    status = STATUS_ERR_INVALID_ARG;
+  system_interrupt_leave_critical_section();
+
+  return status;
+}
+
+/**
+ * \brief Turn Packet Error Code checking on or off for one device on a bus. The blocking
+ *        smbus_*(..) functions then send and verify a PEC byte for it, and retry any
+ *        transfer whose PEC does not match.
+ *
+ * \param [in] i2c_master_instance pointer to i2c_master_module instance set up with
+ *                                 smbus_configure(..)
+ * \param [in] device_address 7-bit I2C address of the slave
+ * \param [in] enable true to use PEC with this device
+ *
+ * \return STATUS_OK, or STATUS_ERR_NOT_INITIALIZED if the instance has no queue
+ */
+
+enum status_code smbus_setPEC( struct i2c_master_module *const i2c_master_instance,
+                               uint8_t device_address, bool enable )
+{
+  SMBus_queue* queue = smbus_findQueue( i2c_master_instance );
+  uint32_t bit = 1UL << ( device_address & 31 );
+
+  if ( queue == NULL )
+    return STATUS_ERR_NOT_INITIALIZED;
+
+  if ( enable )
+    queue->pec_devices[( device_address >> 5 ) & 3] |= bit;
+  else
+    queue->pec_devices[( device_address >> 5 ) & 3] &= ~bit;
+
+  return STATUS_OK;
+}
+
+/**
+ * \brief Whether PEC is turned on for a device, see smbus_setPEC(..). Transactions built
+ *        by hand for smbus_submit(..) should set their pec flag from this.
+ *
+ * \param [in] i2c_master_instance pointer to i2c_master_module instance set up with
+ *                                 smbus_configure(..)
+ * \param [in] device_address 7-bit I2C address of the slave
+ *
+ * \return true if PEC is on for the device
+ */
+
+bool smbus_hasPEC( struct i2c_master_module *const i2c_master_instance,
+                   uint8_t device_address )
+{
+  SMBus_queue* queue = smbus_findQueue( i2c_master_instance );
+
+  if ( queue == NULL )
+    return false;
+
+  return ( queue->pec_devices[( device_address >> 5 ) & 3] >> ( device_address & 31 ) ) & 1;
+}
+
+/**
+ * \brief Continue an SMBus Packet Error Code (CRC-8, polynomial 0x07) over more bytes.
+ *
+ * Start with crc 0 and feed the frame exactly as it appears on the bus: address byte
+ * (including the R/W bit), command, data, and the repeated-start address byte if any.
+ *
+ * \param [in] crc PEC of the bytes so far
+ * \param [in] data next bytes of the frame
+ * \param [in] count number of bytes
+ *
+ * \return PEC of the bytes so far followed by data
+ */
+
+uint8_t smbus_pec( uint8_t crc, const uint8_t* data, uint32_t count )
+{
+  while ( count-- )
+    crc = smbus_crc8[crc ^ *data++];
+
+  return crc;
+}
+
+/**
+ * \brief Block until a submitted transaction completes.
+ *
+ * \warning Must not be called from interrupt context or with interrupts disabled, or
+ *          before smbus_service(..) is being called: retries after a backoff, and
+ *          deadlines, depend on it.
+ *
+ * \param [in] transaction transaction descriptor passed to smbus_submit(..)
+ *
+ * \return the transaction's final status_code
+ */
+
+enum status_code smbus_wait( SMBus_transaction* transaction )
+{
+  while ( transaction->status == STATUS_BUSY )
+  {
+    /* the transaction may be held up behind a bus recovery */
+    smbus_recover();
+  }
+
+  return transaction->status;
+}
+
+/**
+ * \} end of atmel_samd20_smbus_master_async group
+ */
+
 /**
  * \defgroup atmel_samd20_smbus_master_blocking Atmel SAMD20 SMBus Master Abstraction (blocking)
  * \brief Atmel SAMD20 SMBus Master Abstraction (blocking)
@@ -29,7 +933,8 @@
  * \brief Configures the I2C master instance provided by initialising the SERCOM module
  *        correctly. Also takes care of pin multiplexing.
  *
- * Internally uses the ASF function i2c_master_init(..).
+ * Internally uses the ASF function i2c_master_init(..), then attaches a transaction queue
+ * to the instance for smbus_submit(..).
  *
  * \param [in,out] i2c_master_instance pointer to i2c_master_module instance in your main
  *                                     application
@@ -39,7 +944,8 @@
  * \param [in] i2c_speed_khz I2C speed to use (in kHz - 100 or 400)
  *
  * \return status_code enumeration defined in ASF status code abstractions; returns
- *                     exactly what i2c_master_init(..) returns
+ *                     what i2c_master_init(..) returns, or STATUS_ERR_NO_MEMORY if no
+ *                     transaction queue is left for the instance
  *
  */
 
@@ -57,15 +963,60 @@ enum status_code smbus_configure( struct i2c_master_module *const i2c_master_ins
   config_i2c_master.pinmux_pad1 = pinmux_scl;
 
   status = i2c_master_init( i2c_master_instance, hw, &config_i2c_master );
+  if ( status != STATUS_OK )
+    return status;
   i2c_master_enable( i2c_master_instance );
 
-  return status;
+  return smbus_attachQueue( i2c_master_instance, pinmux_sda, pinmux_scl );
+}
+
+/**
+ * \internal
+ * \brief Queue a transaction and wait for it.
+ *
+ * \param [in] pec send/verify a PEC byte; the buffer carrying the last phase must then have
+ *                 one spare byte past its length
+ *
+ * \return status_code enumeration defined in ASF status code abstractions; the status of
+ *                     the last attempt of the transaction
+ */
+
+static enum status_code smbus_transfer( struct i2c_master_module *const i2c_master_instance,
+                                        uint8_t device_address, uint8_t* write_data,
+                                        uint32_t write_count, uint8_t* read_data,
+                                        uint32_t read_count, bool pec )
+{
+  enum status_code status = STATUS_OK;
+
+  SMBus_transaction transaction =
+  {
+    .address      = device_address,
+    .write_data   = write_data,
+    .write_length = (uint16_t) write_count,
+    .read_data    = read_data,
+    .read_length  = (uint16_t) read_count,
+    .block        = false,
+    .pec          = pec,
+    .callback     = NULL,
+  };
+
+  /* the transaction's lengths are 16-bit */
+  if ( write_count > UINT16_MAX || read_count > UINT16_MAX )
+    return STATUS_ERR_INVALID_ARG;
+
+  if ( ( status = smbus_submit( i2c_master_instance, &transaction ) ) != STATUS_OK )
+    return status;
+
+  return smbus_wait( &transaction );
 }
 
 /**
  * \brief Write an arbitrary number of bytes to the specified I2C device address.
  *
- * Internally uses the ASF function i2c_master_write_packet_wait(..)
+ * Internally queues a transaction with smbus_submit(..) and waits for it. This is a plain
+ * I2C transfer, no PEC is sent. data goes out from the caller's buffer, uncopied, so
+ * count is only limited by the transaction's 16-bit write length (STATUS_ERR_INVALID_ARG
+ * beyond it).
  *
  * \param [in] i2c_master_instance pointer to i2c_master_module instance in your main
  *                                 application
@@ -73,39 +1024,21 @@ enum status_code smbus_configure( struct i2c_master_module *const i2c_master_ins
  * \param [in] data data byte array
  * \param [in] count array length
  *
- * \return status_code enumeration defined in ASF status code abstractions; returns
- *                     exactly what i2c_master_write_packet_wait(..) returns
+ * \return status_code enumeration defined in ASF status code abstractions; the status of
+ *                     the last attempt of the transaction
  */
 
 enum status_code smbus_writeBlock( struct i2c_master_module *const i2c_master_instance,
                                    uint8_t device_address, uint8_t* data, uint32_t count )
 {
-  enum status_code status = STATUS_OK;
-  uint16_t timeout = 0;
-
-  struct i2c_master_packet packet =
-  {
-    .address         = device_address,
-    .data_length     = count,
-    .data            = data,
-    .ten_bit_address = false,
-    .high_speed      = false,
-    .hs_master_code  = 0x0,
-  };
-
-  while ( ( status = i2c_master_write_packet_wait( i2c_master_instance, &packet ) ) != STATUS_OK )
-  {
-    if ( timeout++ >= MAX_RETRIES )
-      break;
-  }
-
-  return status;
+  return smbus_transfer( i2c_master_instance, device_address, data, count, NULL, 0, false );
 }
 
 /**
  * \brief Read an arbitrary number of bytes from the specified I2C device address.
  *
- * Internally uses the ASF function i2c_master_read_packet_wait(..)
+ * Internally queues a transaction with smbus_submit(..) and waits for it. This is a plain
+ * I2C transfer, no PEC is expected.
  *
  * \param [in] i2c_master_instance pointer to i2c_master_module instance in your main
  *                                 application
@@ -113,80 +1046,98 @@ enum status_code smbus_writeBlock( struct i2c_master_module *const i2c_master_in
  * \param [out] data data byte array
  * \param [in] count number of bytes to read from slave
  *
- * \return status_code enumeration defined in ASF status code abstractions; returns
- *                     exactly what i2c_master_read_packet_wait(..) returns
+ * \return status_code enumeration defined in ASF status code abstractions; the status of
+ *                     the last attempt of the transaction
  */
 
 enum status_code smbus_readBlock( struct i2c_master_module *const i2c_master_instance,
                                   uint8_t device_address, uint8_t *data, uint32_t count )
 {
-  enum status_code status = STATUS_OK;
-  uint16_t timeout = 0;
-
-  struct i2c_master_packet packet =
-  {
-    .address         = device_address,
-    .data_length     = count,
-    .data            = data,
-    .ten_bit_address = false,
-    .high_speed      = false,
-    .hs_master_code  = 0x0,
-  };
+  return smbus_transfer( i2c_master_instance, device_address, NULL, 0, data, count, false );
+}
 
-  while ( ( status = i2c_master_read_packet_wait( i2c_master_instance, &packet ) ) != STATUS_OK )
-  {
-    if ( timeout++ >= MAX_RETRIES )
-      break;
-  }
+/**
+ * \brief Write bytes to, then read bytes back from, the specified I2C device address as
+ *        one combined transaction (repeated START, no STOP in between).
+ *
+ * Internally queues a transaction with smbus_submit(..) and waits for it. This is a plain
+ * I2C transfer, no PEC is expected.
+ *
+ * \param [in] i2c_master_instance pointer to i2c_master_module instance in your main
+ *                                 application
+ * \param [in] device_address 7-bit I2C address of the slave
+ * \param [in] write_data bytes to write (usually the command code)
+ * \param [in] write_count number of bytes to write
+ * \param [out] read_data buffer for the bytes read back
+ * \param [in] read_count number of bytes to read from the slave
+ *
+ * \return status_code enumeration defined in ASF status code abstractions; the status of
+ *                     the last attempt of the transaction
+ */
 
-  return status;
+enum status_code smbus_writeRead( struct i2c_master_module *const i2c_master_instance,
+                                  uint8_t device_address, uint8_t* write_data,
+                                  uint32_t write_count, uint8_t* read_data, uint32_t read_count )
+{
+  return smbus_transfer( i2c_master_instance, device_address, write_data, write_count,
+                         read_data, read_count, false );
 }
 
 /**
  * \brief Write a single byte to the specified I2C address.
  *
- * Internally uses the ASF function i2c_master_write_packet_wait(..), through
- * SMBus.writeBlock(..)
+ * Sends a PEC byte if PEC is enabled for the device, see smbus_setPEC(..).
  *
  * \param [in] i2c_master_instance pointer to i2c_master_module instance in your main
  *                                 application
  * \param [in] device_address 7-bit I2C address of the slave
  * \param [in] data byte to send to the slave
  *
- * \return status_code enumeration defined in ASF status code abstractions; returns
- *                     exactly what i2c_master_write_packet_wait(..) returns
+ * \return status_code enumeration defined in ASF status code abstractions
  */
 
 enum status_code smbus_writeByte( struct i2c_master_module *const i2c_master_instance,
                                   uint8_t device_address, uint8_t data )
 {
-  return smbus_writeBlock( i2c_master_instance, device_address, &data, 1 );
+  uint8_t arr[2] = { data, 0 };
+
+  return smbus_transfer( i2c_master_instance, device_address, (uint8_t*) arr, 1, NULL, 0,
+                         smbus_hasPEC( i2c_master_instance, device_address ) );
 }
 
 /**
  * \brief Read a single byte from the specified I2C address.
  *
- * Internally uses the ASF function i2c_master_read_packet_wait(..), through
- * SMBus.readBlock(..)
+ * Verifies the PEC byte if PEC is enabled for the device, see smbus_setPEC(..).
  *
  * \param [in] i2c_master_instance pointer to i2c_master_module instance in your main
  *                                 application
  * \param [in] device_address 7-bit I2C address of the slave
- * \param [out] data byte received from the slave
+ * \param [out] data byte received from the slave, left untouched on failure
  *
- * \return status_code enumeration defined in ASF status code abstractions; returns
- *                     exactly what i2c_master_read_packet_wait(..) returns
+ * \return status_code enumeration defined in ASF status code abstractions
  */
 
 enum status_code smbus_readByte( struct i2c_master_module *const i2c_master_instance,
                                  uint8_t device_address, uint8_t* data )
 {
-  return smbus_readBlock( i2c_master_instance, device_address, data, 1 );
+  enum status_code status = STATUS_OK;
+
+  uint8_t arr[2] = { 255, 255 };
+
+  status = smbus_transfer( i2c_master_instance, device_address, NULL, 0, (uint8_t*) arr, 1,
+                           smbus_hasPEC( i2c_master_instance, device_address ) );
+  if ( status == STATUS_OK )
+    *data = arr[0];
+
+  return status;
 }
 
 /**
  * \brief Write a word to the specified I2C address.
  *
+ * Sends a PEC byte if PEC is enabled for the device, see smbus_setPEC(..).
+ *
  * \param [in] i2c_master_instance pointer to the i2c_master_module instance in your main
  *                                 application
  * \param [in] device_address 7-bit I2C address of the slave
@@ -198,18 +1149,21 @@ enum status_code smbus_readByte( struct i2c_master_module *const i2c_master_inst
 enum status_code smbus_writeWord( struct i2c_master_module *const i2c_master_instance,
                                   uint8_t device_address, uint16_t data )
 {
-  uint8_t arr[2] = { (uint8_t) (data & 255), (uint8_t) (data >> 8) };
+  uint8_t arr[3] = { (uint8_t) (data & 255), (uint8_t) (data >> 8), 0 };
 
-  return smbus_writeBlock( i2c_master_instance, device_address, (uint8_t*) &arr, 2 );
+  return smbus_transfer( i2c_master_instance, device_address, (uint8_t*) arr, 2, NULL, 0,
+                         smbus_hasPEC( i2c_master_instance, device_address ) );
 }
 
 /**
  * \brief Read a word from the specified I2C address.
  *
+ * Verifies the PEC byte if PEC is enabled for the device, see smbus_setPEC(..).
+ *
  * \param [in] i2c_master_instance pointer to the i2c_master_module instance in your main
  *                                 application
  * \param [in] device_address 7-bit I2C address of the slave
- * \param [out] data byte received from the slave
+ * \param [out] data word received from the slave, left untouched on failure
  *
  * \return status_code enumeration defined in ASF status code abstractions
  */
@@ -219,10 +1173,12 @@ enum status_code smbus_readWord( struct i2c_master_module *const i2c_master_inst
 {
   enum status_code status = STATUS_OK;
 
-  uint8_t arr[2] = { 255, 255 };
+  uint8_t arr[3] = { 255, 255, 255 };
 
-  status = smbus_readBlock( i2c_master_instance, device_address, (uint8_t*) arr, 2 );
-  *data = (uint16_t) ( (arr[1] << 8) | arr[0] );
+  status = smbus_transfer( i2c_master_instance, device_address, NULL, 0, (uint8_t*) arr, 2,
+                           smbus_hasPEC( i2c_master_instance, device_address ) );
+  if ( status == STATUS_OK )
+    *data = (uint16_t) ( (arr[1] << 8) | arr[0] );
 
   return status;
 }
@@ -230,6 +1186,8 @@ enum status_code smbus_readWord( struct i2c_master_module *const i2c_master_inst
 /**
  * \brief Write a single byte of data (to a specific register) to the specified I2C address.
  *
+ * Sends a PEC byte if PEC is enabled for the device, see smbus_setPEC(..).
+ *
  * \param [in] i2c_master_instance pointer to the i2c_master_module instance in your main
  *                                 application
  * \param [in] device_address 7-bit I2C address of the slave
@@ -242,19 +1200,23 @@ enum status_code smbus_readWord( struct i2c_master_module *const i2c_master_inst
 enum status_code smbus_writeByteData( struct i2c_master_module *const i2c_master_instance,
                                       uint8_t device_address, uint8_t cmd, uint8_t data )
 {
-  uint8_t arr[2] = { cmd, data };
+  uint8_t arr[3] = { cmd, data, 0 };
 
-  return smbus_writeBlock( i2c_master_instance, device_address, (uint8_t*) &arr, 2 );
+  return smbus_transfer( i2c_master_instance, device_address, (uint8_t*) arr, 2, NULL, 0,
+                         smbus_hasPEC( i2c_master_instance, device_address ) );
 }
 
 /**
  * \brief Read a single byte of data (from a specific register) from the specified I2C address.
  *
+ * One combined transaction (repeated START). Verifies the PEC byte if PEC is enabled for
+ * the device, see smbus_setPEC(..).
+ *
  * \param [in] i2c_master_instance pointer to the i2c_master_module instance in your main
  *                                 application
  * \param [in] device_address 7-bit I2C address of the slave
  * \param [in] cmd register address/command to send to the slave
- * \param [out] data byte received from the slave
+ * \param [out] data byte received from the slave, left untouched on failure
  *
  * \return status_code enumeration defined in ASF status code abstractions
  */
@@ -264,8 +1226,12 @@ enum status_code smbus_readByteData( struct i2c_master_module *const i2c_master_
 {
   enum status_code status = STATUS_OK;
 
-  status |= smbus_writeByte( i2c_master_instance, device_address, cmd );
-  status |= smbus_readByte( i2c_master_instance, device_address, data );
+  uint8_t arr[2] = { 255, 255 };
+
+  status = smbus_transfer( i2c_master_instance, device_address, &cmd, 1, (uint8_t*) arr, 1,
+                           smbus_hasPEC( i2c_master_instance, device_address ) );
+  if ( status == STATUS_OK )
+    *data = arr[0];
 
   return status;
 }
@@ -273,6 +1239,8 @@ enum status_code smbus_readByteData( struct i2c_master_module *const i2c_master_
 /**
  * \brief Write a word of data (to a specific register) to the specified I2C address.
  *
+ * Sends a PEC byte if PEC is enabled for the device, see smbus_setPEC(..).
+ *
  * \param [in] i2c_master_instance pointer to the i2c_master_module instance in your main
  *                                 application
  * \param [in] device_address 7-bit I2C address of the slave
@@ -285,19 +1253,23 @@ enum status_code smbus_readByteData( struct i2c_master_module *const i2c_master_
 enum status_code smbus_writeWordData( struct i2c_master_module *const i2c_master_instance,
                                       uint8_t device_address, uint8_t cmd, uint16_t data )
 {
-  uint8_t arr[3] = { cmd, (uint8_t) (data & 255), (uint8_t) (data >> 8) };
+  uint8_t arr[4] = { cmd, (uint8_t) (data & 255), (uint8_t) (data >> 8), 0 };
 
-  return smbus_writeBlock( i2c_master_instance, device_address, (uint8_t*) &arr, 3 );
+  return smbus_transfer( i2c_master_instance, device_address, (uint8_t*) arr, 3, NULL, 0,
+                         smbus_hasPEC( i2c_master_instance, device_address ) );
 }
 
 /**
  * \brief Read a word data (from a specific register) from the specified I2C address.
  *
+ * One combined transaction (repeated START). Verifies the PEC byte if PEC is enabled for
+ * the device, see smbus_setPEC(..).
+ *
  * \param [in] i2c_master_instance pointer to the i2c_master_module instance in your main
  *                                 application
  * \param [in] device_address 7-bit I2C address of the slave
  * \param [in] cmd register address/command to send to the slave
- * \param [out] data byte received from the slave
+ * \param [out] data word received from the slave, left untouched on failure
  *
  * \return status_code enumeration defined in ASF status code abstractions
  */
@@ -307,8 +1279,12 @@ enum status_code smbus_readWordData( struct i2c_master_module *const i2c_master_
 {
   enum status_code status = STATUS_OK;
 
-  status |= smbus_writeByte( i2c_master_instance, device_address, cmd );
-  status |= smbus_readWord( i2c_master_instance, device_address, data );
+  uint8_t arr[3] = { 255, 255, 255 };
+
+  status = smbus_transfer( i2c_master_instance, device_address, &cmd, 1, (uint8_t*) arr, 2,
+                           smbus_hasPEC( i2c_master_instance, device_address ) );
+  if ( status == STATUS_OK )
+    *data = (uint16_t) ( (arr[1] << 8) | arr[0] );
 
   return status;
 }
@@ -317,6 +1293,11 @@ enum status_code smbus_readWordData( struct i2c_master_module *const i2c_master_
  * \brief Write a block of data (to a specific starting register) to the specified I2C
  *        address.
  *
+ * Internally uses smbus_writeGather(..) with a single span, which frames the command and
+ * data on the stack: count is limited to SMBUS_BLOCK_MAX. A longer raw write goes through
+ * smbus_writeBlock(..) with the command in the first byte of the caller's buffer, which is
+ * sent as it is, without a copy and of any length.
+ *
  * \param [in] i2c_master_instance pointer to the i2c_master_module instance in your main
  *                                 application
  * \param [in] device_address 7-bit I2C address of the slave
@@ -326,31 +1307,27 @@ enum status_code smbus_readWordData( struct i2c_master_module *const i2c_master_
  *
  * \note Not really part of the SMBus standard.
  *
- * \return status_code enumeration defined in ASF status code abstractions
+ * \return status_code enumeration defined in ASF status code abstractions; returns
+ *                     exactly what smbus_writeGather(..) returns, so
+ *                     STATUS_ERR_INVALID_ARG if count is over SMBUS_BLOCK_MAX
  */
 
 enum status_code smbus_writeBlockData( struct i2c_master_module *const i2c_master_instance,
                                        uint8_t device_address, uint8_t cmd, uint8_t* data,
                                        uint32_t count )
 {
-  enum status_code status = STATUS_OK;
-
-  uint8_t* write_data = (uint8_t*) malloc( (count+1)*sizeof(uint8_t) );
-  write_data[0] = cmd;
-  for ( unsigned int i = 1; i < count+1; ++i )
-    write_data[i] = data[i-1];
-
-  status = smbus_writeBlock( i2c_master_instance, device_address, write_data, count+1 );
-
-  free( write_data );
+  SMBus_span span = { data, count };
 
-  return status;
+  return smbus_writeGather( i2c_master_instance, device_address, cmd, &span, 1 );
 }
 
 /**
  * \brief Read a block of data (from a specific starting register) from the specified I2C
  *        address.
  *
+ * One combined transaction (repeated START). Verifies the PEC byte if PEC is enabled for
+ * the device, see smbus_setPEC(..); count is then limited to SMBUS_BLOCK_MAX.
+ *
  * \param [in] i2c_master_instance pointer to the i2c_master_module instance in your main
  *                                 application
  * \param [in] device_address 7-bit I2C address of the slave
@@ -360,7 +1337,8 @@ enum status_code smbus_writeBlockData( struct i2c_master_module *const i2c_maste
  *
  * \note Not really a part of the SMBus standard.
  *
- * \return status_code enumeration defined in ASF status code abstractions
+ * \return status_code enumeration defined in ASF status code abstractions, or
+ *                     STATUS_ERR_INVALID_ARG if count is too long to check the PEC
  */
 
 enum status_code smbus_readBlockData( struct i2c_master_module *const i2c_master_instance,
@@ -369,12 +1347,200 @@ enum status_code smbus_readBlockData( struct i2c_master_module *const i2c_master
 {
   enum status_code status = STATUS_OK;
 
-  status |= smbus_writeByte( i2c_master_instance, device_address, cmd );
-  status |= smbus_readBlock( i2c_master_instance, device_address, data, count );
+  uint8_t frame[SMBUS_BLOCK_MAX + 1];
+
+  if ( !smbus_hasPEC( i2c_master_instance, device_address ) )
+    return smbus_transfer( i2c_master_instance, device_address, &cmd, 1, data, count, false );
+
+  if ( count > SMBUS_BLOCK_MAX )
+    return STATUS_ERR_INVALID_ARG;
+
+  status = smbus_transfer( i2c_master_instance, device_address, &cmd, 1, frame, count, true );
+  if ( status == STATUS_OK )
+  {
+    for ( unsigned int i = 0; i < count; ++i )
+      data[i] = frame[i];
+  }
 
   return status;
 }
 
+/**
+ * \internal
+ * \brief Gather a command byte, an optional SMBus byte count and the spans into one frame
+ *        and write it. The frame lives on the stack: the ASF packet jobs need the bytes
+ *        contiguous, but nothing is allocated.
+ *
+ * \return status_code enumeration defined in ASF status code abstractions, or
+ *                     STATUS_ERR_INVALID_ARG if the spans add up to more than
+ *                     SMBUS_BLOCK_MAX bytes
+ */
+
+static enum status_code smbus_gather( struct i2c_master_module *const i2c_master_instance,
+                                      uint8_t device_address, uint8_t cmd,
+                                      const SMBus_span* spans, uint32_t span_count,
+                                      bool byte_count )
+{
+  /* command, byte count, data, PEC */
+  uint8_t frame[SMBUS_BLOCK_MAX + 3];
+  uint32_t length = 0;
+  uint32_t total = 0;
+
+  for ( uint32_t i = 0; i < span_count; ++i )
+    total += spans[i].length;
+  if ( total > SMBUS_BLOCK_MAX )
+    return STATUS_ERR_INVALID_ARG;
+
+  frame[length++] = cmd;
+  if ( byte_count )
+    frame[length++] = (uint8_t) total;
+  for ( uint32_t i = 0; i < span_count; ++i )
+  {
+    memcpy( &frame[length], spans[i].data, spans[i].length );
+    length += spans[i].length;
+  }
+
+  return smbus_transfer( i2c_master_instance, device_address, frame, length, NULL, 0,
+                         smbus_hasPEC( i2c_master_instance, device_address ) );
+}
+
+/**
+ * \brief Write a command byte followed by the concatenation of several buffers (e.g. a
+ *        header and a payload) to the specified I2C address, without any heap use.
+ *
+ * Sends a PEC byte if PEC is enabled for the device, see smbus_setPEC(..).
+ *
+ * \param [in] i2c_master_instance pointer to the i2c_master_module instance in your main
+ *                                 application
+ * \param [in] device_address 7-bit I2C address of the slave
+ * \param [in] cmd register address/command to send to the slave
+ * \param [in] spans buffers to send after the command, in order
+ * \param [in] span_count number of spans
+ *
+ * \return status_code enumeration defined in ASF status code abstractions, or
+ *                     STATUS_ERR_INVALID_ARG if the spans add up to more than
+ *                     SMBUS_BLOCK_MAX bytes
+ */
+
+enum status_code smbus_writeGather( struct i2c_master_module *const i2c_master_instance,
+                                    uint8_t device_address, uint8_t cmd,
+                                    const SMBus_span* spans, uint32_t span_count )
+{
+  return smbus_gather( i2c_master_instance, device_address, cmd, spans, span_count, false );
+}
+
+/**
+ * \brief SMBus Block Write: command byte, byte count, then the concatenated spans.
+ *
+ * Sends a PEC byte if PEC is enabled for the device, see smbus_setPEC(..).
+ *
+ * \param [in] i2c_master_instance pointer to the i2c_master_module instance in your main
+ *                                 application
+ * \param [in] device_address 7-bit I2C address of the slave
+ * \param [in] cmd register address/command to send to the slave
+ * \param [in] spans buffers making up the block, in order
+ * \param [in] span_count number of spans
+ *
+ * \return status_code enumeration defined in ASF status code abstractions, or
+ *                     STATUS_ERR_INVALID_ARG if the block is longer than SMBUS_BLOCK_MAX
+ */
+
+enum status_code smbus_blockWrite( struct i2c_master_module *const i2c_master_instance,
+                                   uint8_t device_address, uint8_t cmd,
+                                   const SMBus_span* spans, uint32_t span_count )
+{
+  return smbus_gather( i2c_master_instance, device_address, cmd, spans, span_count, true );
+}
+
+/**
+ * \brief SMBus Block Read: command byte, repeated START, then a byte count from the slave
+ *        followed by that many bytes.
+ *
+ * The length of the read has to be fixed before it starts, so 1 + max_count bytes are
+ * clocked in and the slave's byte count picks out the valid ones. Verifies the PEC byte
+ * if PEC is enabled for the device, see smbus_setPEC(..).
+ *
+ * \param [in] i2c_master_instance pointer to the i2c_master_module instance in your main
+ *                                 application
+ * \param [in] device_address 7-bit I2C address of the slave
+ * \param [in] cmd register address/command to send to the slave
+ * \param [out] data block received from the slave
+ * \param [out] count number of bytes in the block
+ * \param [in] max_count size of data, at most SMBUS_BLOCK_MAX
+ *
+ * \return status_code enumeration defined in ASF status code abstractions;
+ *                     STATUS_ERR_INVALID_ARG if max_count is too large, STATUS_ERR_OVERFLOW
+ *                     if the slave sent a longer block than max_count
+ */
+
+enum status_code smbus_blockRead( struct i2c_master_module *const i2c_master_instance,
+                                  uint8_t device_address, uint8_t cmd, uint8_t* data,
+                                  uint8_t* count, uint32_t max_count )
+{
+  enum status_code status = STATUS_OK;
+
+  /* byte count, data, PEC */
+  uint8_t frame[SMBUS_BLOCK_MAX + 2];
+
+  if ( max_count > SMBUS_BLOCK_MAX )
+    return STATUS_ERR_INVALID_ARG;
+
+  SMBus_transaction transaction =
+  {
+    .address      = device_address,
+    .write_data   = &cmd,
+    .write_length = 1,
+    .read_data    = frame,
+    .read_length  = max_count + 1,
+    .block        = true,
+    .pec          = smbus_hasPEC( i2c_master_instance, device_address ),
+    .callback     = NULL,
+  };
+
+  if ( ( status = smbus_submit( i2c_master_instance, &transaction ) ) != STATUS_OK )
+    return status;
+  if ( ( status = smbus_wait( &transaction ) ) != STATUS_OK )
+    return status;
+
+  if ( frame[0] > max_count )
+    return STATUS_ERR_OVERFLOW;
+
+  memcpy( data, &frame[1], frame[0] );
+  *count = frame[0];
+
+  return STATUS_OK;
+}
+
 /**
  * \} end of atmel_samd20_smbus_master_blocking group
  */
+
+const struct SMBus_ SMBus =
+{
+  .configure      = smbus_configure,
+  .setPEC         = smbus_setPEC,
+  .hasPEC         = smbus_hasPEC,
+  .pec            = smbus_pec,
+  .writeBlock     = smbus_writeBlock,
+  .readBlock      = smbus_readBlock,
+  .writeRead      = smbus_writeRead,
+  .writeByte      = smbus_writeByte,
+  .readByte       = smbus_readByte,
+  .writeWord      = smbus_writeWord,
+  .readWord       = smbus_readWord,
+  .writeByteData  = smbus_writeByteData,
+  .readByteData   = smbus_readByteData,
+  .writeWordData  = smbus_writeWordData,
+  .readWordData   = smbus_readWordData,
+  .writeBlockData = smbus_writeBlockData,
+  .readBlockData  = smbus_readBlockData,
+  .writeGather    = smbus_writeGather,
+  .blockWrite     = smbus_blockWrite,
+  .blockRead      = smbus_blockRead,
+  .submit         = smbus_submit,
+  .wait           = smbus_wait,
+  .service        = smbus_service,
+  .recover        = smbus_recover,
+  .setPolicy      = smbus_setPolicy,
+  .getErrors      = smbus_getErrors,
+};
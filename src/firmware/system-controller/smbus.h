@@ -10,9 +10,11 @@
  * This is an abstraction layer for an SMBus master using Atmel's ASF, providing a full set of
  * I2C hardware communication functions.
  *
- * \note Requires the correct modules be set up in ASF (I2C Master and System).
+ * \note Requires the correct modules be set up in ASF (I2C Master, in callback mode,
+ *       System, PORT and Delay routines), and smbus_service(..) to be called periodically.
  *
- * \warning These I2C operations are BLOCKING!
+ * \warning The smbus_write*(..)/smbus_read*(..) operations are BLOCKING! They are thin
+ *          wrappers over the asynchronous transaction queue, see smbus_submit(..).
  */
 
 #ifndef SMBUS_H_
@@ -28,10 +30,27 @@
 
 /**
  * \def MAX_RETRIES
- * \brief Number of times to retry for I2C packet read/writes.
+ * \brief Number of times to retry a failed transaction, for devices without a policy of
+ *        their own (see smbus_setPolicy(..)).
  */
 #define MAX_RETRIES 10
 
+/**
+ * \def SMBUS_BLOCK_MAX
+ * \brief Largest SMBus block transfer, in data bytes.
+ */
+#define SMBUS_BLOCK_MAX 32
+
+/**
+ * \struct SMBus_span
+ * \brief One piece of a gathered write, see smbus_writeGather(..).
+ */
+typedef struct SMBus_span
+{
+  const uint8_t* data;
+  uint32_t length;
+} SMBus_span;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -40,11 +59,21 @@ enum status_code smbus_configure( struct i2c_master_module *const i2c_master_ins
                                   Sercom *const hw, uint32_t pinmux_sda, uint32_t pinmux_scl,
                                   uint32_t i2c_speed_khz );
 
+enum status_code smbus_setPEC( struct i2c_master_module *const i2c_master_instance,
+                               uint8_t device_address, bool enable );
+bool smbus_hasPEC( struct i2c_master_module *const i2c_master_instance,
+                   uint8_t device_address );
+uint8_t smbus_pec( uint8_t crc, const uint8_t* data, uint32_t count );
+
 enum status_code smbus_writeBlock( struct i2c_master_module *const i2c_master_instance, uint8_t device_address,
                                    uint8_t* data, uint32_t count );
 enum status_code smbus_readBlock( struct i2c_master_module *const i2c_master_instance, uint8_t device_address,
                                   uint8_t *data, uint32_t count );
 
+enum status_code smbus_writeRead( struct i2c_master_module *const i2c_master_instance,
+                                  uint8_t device_address, uint8_t* write_data,
+                                  uint32_t write_count, uint8_t* read_data, uint32_t read_count );
+
 enum status_code smbus_writeByte( struct i2c_master_module *const i2c_master_instance, uint8_t device_address,
                                   uint8_t data );
 enum status_code smbus_readByte( struct i2c_master_module *const i2c_master_instance, uint8_t device_address,
@@ -69,10 +98,221 @@ enum status_code smbus_readBlockData( struct i2c_master_module *const i2c_master
                                       uint8_t device_address, uint8_t cmd, uint8_t* data,
                                       uint32_t count );
 
+enum status_code smbus_writeGather( struct i2c_master_module *const i2c_master_instance,
+                                    uint8_t device_address, uint8_t cmd,
+                                    const SMBus_span* spans, uint32_t span_count );
+enum status_code smbus_blockWrite( struct i2c_master_module *const i2c_master_instance,
+                                   uint8_t device_address, uint8_t cmd,
+                                   const SMBus_span* spans, uint32_t span_count );
+enum status_code smbus_blockRead( struct i2c_master_module *const i2c_master_instance,
+                                  uint8_t device_address, uint8_t cmd, uint8_t* data,
+                                  uint8_t* count, uint32_t max_count );
+
 /**
  * \} end of atmel_samd20_smbus_master_blocking
  */
 
+/**
+ * \defgroup atmel_samd20_smbus_master_async Atmel SAMD20 SMBus Master Transaction Queue
+ * \brief Atmel SAMD20 SMBus Master Transaction Queue (interrupt driven)
+ * \{
+ */
+
+/**
+ * \def SMBUS_QUEUES_MAX
+ * \brief Number of I2C master instances that can have a transaction queue.
+ */
+#define SMBUS_QUEUES_MAX 2
+
+/**
+ * \def SMBUS_DEVICES_MAX
+ * \brief Number of devices per bus that can have a retry policy and error counters.
+ */
+#define SMBUS_DEVICES_MAX 8
+
+/**
+ * \def SMBUS_DEFAULT_BACKOFF_US
+ * \brief Wait before the first retry after a NACK or bus error, for devices without a
+ *        policy of their own.
+ */
+#define SMBUS_DEFAULT_BACKOFF_US 1000
+
+/**
+ * \def SMBUS_DEFAULT_BACKOFF_MAX_US
+ * \brief Cap on the (doubling) backoff, for devices without a policy of their own.
+ */
+#define SMBUS_DEFAULT_BACKOFF_MAX_US 8000
+
+/**
+ * \def SMBUS_DEFAULT_DEADLINE_US
+ * \brief Time a transaction may take from smbus_submit(..) to completion, for devices
+ *        without a policy of their own.
+ */
+#define SMBUS_DEFAULT_DEADLINE_US 50000
+
+/**
+ * \def SMBUS_RECOVERY_CLOCKS
+ * \brief SCL pulses sent to free SDA from a slave stuck mid-byte.
+ */
+#define SMBUS_RECOVERY_CLOCKS 9
+
+/**
+ * \def SMBUS_RECOVERY_HALF_CLOCK_US
+ * \brief Half period of the recovery clock (100 kHz).
+ */
+#define SMBUS_RECOVERY_HALF_CLOCK_US 5
+
+/**
+ * \struct SMBus_policy
+ * \brief How a device's failed transactions are retried.
+ */
+typedef struct SMBus_policy
+{
+  uint8_t retries;         /**< attempts after the first before giving up */
+  uint32_t backoff_us;     /**< wait before retrying after a NACK or bus error, doubled
+                                with every further retry; 0 retries straight away */
+  uint32_t backoff_max_us; /**< cap on the backoff */
+  uint32_t deadline_us;    /**< hard limit from smbus_submit(..) to completion, 0 for none */
+} SMBus_policy;
+
+/**
+ * \struct SMBus_errors
+ * \brief Error counters of one device, see smbus_getErrors(..).
+ */
+typedef struct SMBus_errors
+{
+  uint32_t nack;        /**< address or data not acknowledged */
+  uint32_t arbitration; /**< arbitration lost to another master */
+  uint32_t pec;         /**< PEC mismatches */
+  uint32_t timeout;     /**< bus timeouts and missed deadlines */
+  uint32_t bus;         /**< other bus errors */
+  uint32_t recoveries;  /**< times SDA was found stuck and clocked free */
+} SMBus_errors;
+
+typedef struct SMBus_transaction SMBus_transaction;
+
+/**
+ * \brief Transaction completion callback, called from interrupt context.
+ */
+typedef void (*smbus_callback_t)( SMBus_transaction* transaction );
+
+/**
+ * \struct SMBus_transaction
+ * \brief Descriptor for one queued I2C transaction: an optional write followed by an
+ *        optional read from the same device. Owned by the caller until it completes.
+ */
+struct SMBus_transaction
+{
+  uint8_t address;                  /**< 7-bit I2C address of the slave */
+  uint8_t* write_data;              /**< bytes to write, may be NULL if write_length is 0 */
+  uint16_t write_length;            /**< number of bytes to write */
+  uint8_t* read_data;               /**< buffer to read into, may be NULL if read_length is 0 */
+  uint16_t read_length;             /**< number of bytes to read */
+  bool block;                       /**< read_data[0] is an SMBus block byte count, the
+                                         PEC (if any) follows that many bytes */
+  bool pec;                         /**< send/verify a Packet Error Code; write_data (if
+                                         there is no read) or read_data must then have one
+                                         spare byte past its length for the PEC byte */
+
+  smbus_callback_t callback;        /**< called on completion, may be NULL */
+  void* context;                    /**< free for the caller's use */
+
+  volatile enum status_code status; /**< STATUS_BUSY while queued or in flight */
+  uint8_t retries;                  /**< attempts that have failed so far */
+  bool has_deadline;                /**< deadline set from the device's policy */
+  uint32_t deadline;                /**< SMBus clock time it must be done by */
+  uint32_t retry_at;                /**< SMBus clock time its backoff ends, while parked */
+  SMBus_transaction* next;          /**< queue link, owned by the engine */
+};
+
+enum status_code smbus_submit( struct i2c_master_module *const i2c_master_instance,
+                               SMBus_transaction* transaction );
+enum status_code smbus_wait( SMBus_transaction* transaction );
+bool smbus_service( uint32_t elapsed_us );
+void smbus_recover( void );
+enum status_code smbus_setPolicy( struct i2c_master_module *const i2c_master_instance,
+                                  uint8_t device_address, const SMBus_policy* policy );
+enum status_code smbus_getErrors( struct i2c_master_module *const i2c_master_instance,
+                                  uint8_t device_address, SMBus_errors* errors );
+
+/**
+ * \} end of atmel_samd20_smbus_master_async
+ */
+
+/**
+ * \struct SMBus_
+ * \brief SMBus operations, as SMBus.xxx( i2c_master_instance, .. ); see the smbus_*(..)
+ *        functions they point to. Each I2C master instance has its own transaction queue,
+ *        so devices on different buses are serviced in parallel.
+ */
+struct SMBus_
+{
+  enum status_code (*configure)( struct i2c_master_module *const i2c_master_instance,
+                                 Sercom *const hw, uint32_t pinmux_sda, uint32_t pinmux_scl,
+                                 uint32_t i2c_speed_khz );
+
+  enum status_code (*setPEC)( struct i2c_master_module *const i2c_master_instance,
+                              uint8_t device_address, bool enable );
+  bool (*hasPEC)( struct i2c_master_module *const i2c_master_instance,
+                  uint8_t device_address );
+  uint8_t (*pec)( uint8_t crc, const uint8_t* data, uint32_t count );
+
+  enum status_code (*writeBlock)( struct i2c_master_module *const i2c_master_instance,
+                                  uint8_t device_address, uint8_t* data, uint32_t count );
+  enum status_code (*readBlock)( struct i2c_master_module *const i2c_master_instance,
+                                 uint8_t device_address, uint8_t* data, uint32_t count );
+  enum status_code (*writeRead)( struct i2c_master_module *const i2c_master_instance,
+                                 uint8_t device_address, uint8_t* write_data,
+                                 uint32_t write_count, uint8_t* read_data,
+                                 uint32_t read_count );
+
+  enum status_code (*writeByte)( struct i2c_master_module *const i2c_master_instance,
+                                 uint8_t device_address, uint8_t data );
+  enum status_code (*readByte)( struct i2c_master_module *const i2c_master_instance,
+                                uint8_t device_address, uint8_t* data );
+  enum status_code (*writeWord)( struct i2c_master_module *const i2c_master_instance,
+                                 uint8_t device_address, uint16_t data );
+  enum status_code (*readWord)( struct i2c_master_module *const i2c_master_instance,
+                                uint8_t device_address, uint16_t* data );
+
+  enum status_code (*writeByteData)( struct i2c_master_module *const i2c_master_instance,
+                                     uint8_t device_address, uint8_t cmd, uint8_t data );
+  enum status_code (*readByteData)( struct i2c_master_module *const i2c_master_instance,
+                                    uint8_t device_address, uint8_t cmd, uint8_t* data );
+  enum status_code (*writeWordData)( struct i2c_master_module *const i2c_master_instance,
+                                     uint8_t device_address, uint8_t cmd, uint16_t data );
+  enum status_code (*readWordData)( struct i2c_master_module *const i2c_master_instance,
+                                    uint8_t device_address, uint8_t cmd, uint16_t* data );
+  enum status_code (*writeBlockData)( struct i2c_master_module *const i2c_master_instance,
+                                      uint8_t device_address, uint8_t cmd, uint8_t* data,
+                                      uint32_t count );
+  enum status_code (*readBlockData)( struct i2c_master_module *const i2c_master_instance,
+                                     uint8_t device_address, uint8_t cmd, uint8_t* data,
+                                     uint32_t count );
+
+  enum status_code (*writeGather)( struct i2c_master_module *const i2c_master_instance,
+                                   uint8_t device_address, uint8_t cmd,
+                                   const SMBus_span* spans, uint32_t span_count );
+  enum status_code (*blockWrite)( struct i2c_master_module *const i2c_master_instance,
+                                  uint8_t device_address, uint8_t cmd,
+                                  const SMBus_span* spans, uint32_t span_count );
+  enum status_code (*blockRead)( struct i2c_master_module *const i2c_master_instance,
+                                 uint8_t device_address, uint8_t cmd, uint8_t* data,
+                                 uint8_t* count, uint32_t max_count );
+
+  enum status_code (*submit)( struct i2c_master_module *const i2c_master_instance,
+                              SMBus_transaction* transaction );
+  enum status_code (*wait)( SMBus_transaction* transaction );
+  bool (*service)( uint32_t elapsed_us );
+  void (*recover)( void );
+  enum status_code (*setPolicy)( struct i2c_master_module *const i2c_master_instance,
+                                 uint8_t device_address, const SMBus_policy* policy );
+  enum status_code (*getErrors)( struct i2c_master_module *const i2c_master_instance,
+                                 uint8_t device_address, SMBus_errors* errors );
+};
+
+extern const struct SMBus_ SMBus;
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,31 +1,300 @@
 #include <stdint.h>
-#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+#ifndef TASK_HOST_BUILD
+  #include <asf.h>
+#endif /* TASK_HOST_BUILD */
+
 #include "task_handler.h"
+#include "trace.h"
+
+volatile uint32_t system_time = 0;
+
+/* one fixed-size slot holds everything a queued task needs */
+typedef struct TaskSlot_t
+{
+  Task_t task; /* must stay first, see slotOf() */
+  TaskContext_t context;
+  Node_t node;
+  uint32_t params[( TASK_PARAMS_LENGTH + 3 ) / 4]; /* word aligned for the handler */
+} TaskSlot_t;
+
+static TaskSlot_t task_pool[TASK_POOL_LENGTH];
+static Node_t* pool_free = NULL;
+static bool pool_ready = false;
+static TaskPoolStats_t pool_stats = { TASK_POOL_LENGTH, 0, 0, 0 };
+
+static TaskSlot_t* slotOf( Task_t* task )
+{
+  return (TaskSlot_t*) task;
+}
+
+static TaskSlot_t* poolAlloc( void )
+{
+  TaskSlot_t* slot;
+
+  if ( !pool_ready )
+  {
+    for ( uint32_t i = 0; i < TASK_POOL_LENGTH; ++i )
+    {
+      task_pool[i].node.task = &task_pool[i].task;
+      task_pool[i].node.next = pool_free;
+      pool_free = &task_pool[i].node;
+    }
+    pool_ready = true;
+  }
+
+  if ( pool_free == NULL )
+  {
+    ++pool_stats.failures;
+    return NULL;
+  }
+
+  slot = (TaskSlot_t*) pool_free->task;
+  pool_free = pool_free->next;
+
+  if ( ++pool_stats.in_use > pool_stats.high_water )
+    pool_stats.high_water = pool_stats.in_use;
+
+  return slot;
+}
+
+static void poolFree( TaskSlot_t* slot )
+{
+  slot->node.task = &slot->task;
+  slot->node.next = pool_free;
+  pool_free = &slot->node;
+  --pool_stats.in_use;
+}
 
-uint32_t system_time = 0;
+void getTaskPoolStats( TaskPoolStats_t* stats )
+{
+  *stats = pool_stats;
+}
 
 void initTaskList( List_t* task_list )
 {
-  task_list = (List_t*) malloc( sizeof(List_t) );
   memset( task_list, 0, sizeof(List_t) );
-  task_list->head = NULL;
-  task_list->tail = NULL;
 }
 
-void createTask( List_t* task_list, void (*taskHandler)( TaskContext_t* ),
-                 const void* params, uint32_t params_size,
-                 uint32_t priority, uint32_t deadline, uint32_t period )
+/* <0 if a is due before b, >0 if after, 0 if neither orders them; no deadline sorts last */
+static int32_t compareDeadline( const TaskContext_t* a, const TaskContext_t* b )
+{
+  uint32_t da, db;
+
+  if ( a->has_deadline != b->has_deadline )
+    return a->has_deadline ? -1 : 1;
+  if ( !a->has_deadline )
+    return 0;
+
+  da = a->release_time + a->deadline;
+  db = b->release_time + b->deadline;
+  if ( da == db )
+    return 0;
+  return TIME_BEFORE( da, db ) ? -1 : 1;
+}
+
+/* true if node a should run before node b under the list's policy */
+static bool nodeBefore( const List_t* task_list, const Node_t* a, const Node_t* b )
 {
-  Task_t* new_task           = (Task_t*)        malloc( sizeof(Task_t) );
-  TaskContext_t* new_context = (TaskContext_t*) malloc( sizeof(TaskContext_t) );
-  memset( new_task,    0, sizeof( Task_t ) );
-  memset( new_context, 0, sizeof(TaskContext_t) );
+  const Task_t* ta = a->task;
+  const Task_t* tb = b->task;
+  int32_t order;
+
+  /* PRIORITY_NOW jumps the queue under every policy */
+  if ( ( ta->priority == PRIORITY_NOW ) != ( tb->priority == PRIORITY_NOW ) )
+    return ta->priority == PRIORITY_NOW;
+
+  if ( task_list->policy != SCHEDULER_EDF && ta->priority != tb->priority )
+    return ta->priority < tb->priority;
+
+  if ( task_list->policy != SCHEDULER_PRIORITY )
+  {
+    order = compareDeadline( ta->context, tb->context );
+    if ( order != 0 )
+      return order < 0;
+  }
+
+  if ( ta->priority != tb->priority )
+    return ta->priority < tb->priority;
+
+  return TIME_BEFORE( a->sequence, b->sequence );
+}
+
+static void heapSiftUp( List_t* task_list, uint32_t i )
+{
+  Node_t* node = task_list->heap[i];
+
+  while ( i > 0 )
+  {
+    uint32_t parent = ( i - 1 ) / 2;
+    if ( !nodeBefore( task_list, node, task_list->heap[parent] ) )
+      break;
+    task_list->heap[i] = task_list->heap[parent];
+    i = parent;
+  }
+
+  task_list->heap[i] = node;
+}
+
+static void heapSiftDown( List_t* task_list, uint32_t i )
+{
+  Node_t* node = task_list->heap[i];
+  uint32_t count = task_list->count;
+
+  while ( true )
+  {
+    uint32_t child = 2 * i + 1;
+    if ( child >= count )
+      break;
+    if ( child + 1 < count &&
+         nodeBefore( task_list, task_list->heap[child + 1], task_list->heap[child] ) )
+      ++child;
+    if ( !nodeBefore( task_list, task_list->heap[child], node ) )
+      break;
+    task_list->heap[i] = task_list->heap[child];
+    i = child;
+  }
+
+  task_list->heap[i] = node;
+}
+
+static Node_t* heapPop( List_t* task_list )
+{
+  Node_t* top;
+
+  if ( task_list->count == 0 )
+    return NULL;
+
+  top = task_list->heap[0];
+  if ( --task_list->count > 0 )
+  {
+    task_list->heap[0] = task_list->heap[task_list->count];
+    heapSiftDown( task_list, 0 );
+  }
+
+  return top;
+}
+
+/* switch policy and re-heapify whatever is already queued, O(n) */
+void setSchedulerPolicy( List_t* task_list, Scheduler_policy policy )
+{
+  task_list->policy = policy;
+  for ( uint32_t i = task_list->count / 2; i-- > 0; )
+    heapSiftDown( task_list, i );
+}
+
+/* park a node on the wheel until node->expires, or queue it now if already due */
+static void wheelInsert( List_t* task_list, Node_t* node )
+{
+  Task_t* task = node->task;
+  uint32_t delta;
+  uint32_t expires;
+  uint32_t level = 0;
+  uint32_t slot;
+
+  while ( !TIME_BEFORE( task_list->wheel_time, node->expires ) )
+  {
+    if ( createTaskExisting( task_list, task ) == TASK_OK )
+      return;
+
+    /* a full ready queue loses the release: a one-shot task is freed, a periodic one
+     * keeps its slot and skips to its next period */
+    ++task_list->dropped;
+    if ( !task->periodic )
+    {
+      poolFree( slotOf( task ) );
+      return;
+    }
+    task->context->release_time += task->period;
+    node->expires = task->context->release_time;
+  }
+
+  delta   = node->expires - task_list->wheel_time;
+  expires = node->expires;
+
+  while ( level < TIMER_WHEEL_LEVELS - 1 &&
+          delta >= ( 1UL << ( TIMER_WHEEL_BITS * ( level + 1 ) ) ) )
+    ++level;
+
+  /* beyond the wheel's range: park in the furthest bucket, re-filed when it cascades */
+  if ( delta >= ( 1UL << ( TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS ) ) )
+    expires = task_list->wheel_time + ( 1UL << ( TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS ) ) - 1;
+
+  slot = ( expires >> ( TIMER_WHEEL_BITS * level ) ) & ( TIMER_WHEEL_SLOTS - 1 );
+  node->next = task_list->wheel[level][slot];
+  task_list->wheel[level][slot] = node;
+  ++task_list->armed;
+}
+
+/* re-file every node of a bucket against the current wheel_time */
+static void wheelCascade( List_t* task_list, uint32_t level, uint32_t slot )
+{
+  Node_t* node = task_list->wheel[level][slot];
+  Node_t* next;
+
+  task_list->wheel[level][slot] = NULL;
+  while ( node != NULL )
+  {
+    next = node->next;
+    --task_list->armed;
+    wheelInsert( task_list, node );
+    node = next;
+  }
+}
+
+/* catch the wheel up with system_time, moving due tasks into the ready queue */
+static void wheelAdvance( List_t* task_list )
+{
+  uint32_t now = system_time;
+
+  while ( task_list->wheel_time != now )
+  {
+    uint32_t t = ++task_list->wheel_time;
+
+    for ( uint32_t level = 1; level < TIMER_WHEEL_LEVELS; ++level )
+    {
+      if ( t & ( ( 1UL << ( TIMER_WHEEL_BITS * level ) ) - 1 ) )
+        break;
+      wheelCascade( task_list, level,
+                    ( t >> ( TIMER_WHEEL_BITS * level ) ) & ( TIMER_WHEEL_SLOTS - 1 ) );
+    }
+
+    wheelCascade( task_list, 0, t & ( TIMER_WHEEL_SLOTS - 1 ) );
+  }
+}
+
+Task_status createTask( List_t* task_list, void (*taskHandler)( TaskContext_t* ),
+                        const void* params, uint32_t params_size,
+                        uint32_t priority, uint32_t deadline, uint32_t period )
+{
+  return createTaskDelayed( task_list, taskHandler, params, params_size,
+                            priority, deadline, period, 0 );
+}
+
+static Task_status taskCreate( List_t* task_list, void (*taskHandler)( TaskContext_t* ),
+                               const void* params, uint32_t params_size,
+                               uint32_t priority, uint32_t deadline, uint32_t period,
+                               uint32_t delay, uint32_t issue_time )
+{
+  TaskSlot_t* slot;
+  Task_t* new_task;
+
+  if ( params_size > TASK_PARAMS_LENGTH )
+    return TASK_PARAMS_TOO_LONG;
+  if ( delay == 0 && task_list->count >= TASK_QUEUE_LENGTH )
+    return TASK_QUEUE_FULL;
+  if ( ( slot = poolAlloc() ) == NULL )
+    return TASK_POOL_EMPTY;
+
+  new_task = &slot->task;
+  memset( new_task,       0, sizeof(Task_t) );
+  memset( &slot->context, 0, sizeof(TaskContext_t) );
 
   new_task->taskHandler = taskHandler;
   new_task->priority    = priority;
+  new_task->trace_id    = traceHandlerId( taskHandler );
   if ( period )
   {
     new_task->period   = period;
@@ -37,11 +306,12 @@ void createTask( List_t* task_list, void (*taskHandler)( TaskContext_t* ),
     new_task->periodic = false;
   }
 
-  new_task->context             = new_context;
-  new_task->context->params     = malloc( params_size );
-  memcpy( new_task->context->params, params, params_size );
+  new_task->context             = &slot->context;
+  new_task->context->params     = slot->params;
+  if ( params_size )
+    memcpy( new_task->context->params, params, params_size );
 
-  new_task->context->issue_time = system_time;
+  new_task->context->issue_time = issue_time;
   new_task->context->start_time = 0;
   new_task->context->end_time   = 0;
   if ( deadline )
@@ -55,102 +325,154 @@ void createTask( List_t* task_list, void (*taskHandler)( TaskContext_t* ),
     new_task->context->has_deadline = false;
   }
 
-  createTaskExisting( task_list, new_task );
+  new_task->context->release_time = issue_time + delay;
+  if ( delay == 0 )
+    return createTaskExisting( task_list, new_task );
+
+  slot->node.expires = new_task->context->release_time;
+  wheelInsert( task_list, &slot->node );
+  return TASK_OK;
+}
+
+/* as createTask(), but the first release is delay ticks from now */
+Task_status createTaskDelayed( List_t* task_list, void (*taskHandler)( TaskContext_t* ),
+                               const void* params, uint32_t params_size,
+                               uint32_t priority, uint32_t deadline, uint32_t period,
+                               uint32_t delay )
+{
+  return taskCreate( task_list, taskHandler, params, params_size,
+                     priority, deadline, period, delay, system_time );
 }
 
-void createTaskExisting( List_t* task_list, Task_t* new_task )
+/* call during init only, before interrupts start posting to the ring */
+Task_status registerTaskRing( List_t* task_list, TaskRing_t* ring )
 {
-  Node_t* new_node = (Node_t*) malloc( sizeof(Node_t) );
-  memset( new_node,    0, sizeof(Node_t) );
+  if ( task_list->ring_count >= TASK_RINGS_MAX )
+    return TASK_TOO_MANY_RINGS;
 
-  new_node->task = new_task;
+  memset( ring, 0, sizeof(TaskRing_t) );
+  task_list->rings[task_list->ring_count++] = ring;
 
-  if ( task_list->head == NULL )
-  {
-    new_node->next = NULL;
-    new_node->prev = NULL;
-    task_list->head = new_node;
-    task_list->tail = new_node;
-  }
-  else if ( new_task->priority == PRIORITY_NOW )
+  return TASK_OK;
+}
+
+/* interrupt-safe, constant time: no allocation and no interrupt masking, but only
+ * one producer may post to a given ring */
+Task_status postTask( TaskRing_t* ring, void (*taskHandler)( TaskContext_t* ),
+                      const void* params, uint32_t params_size,
+                      uint32_t priority, uint32_t deadline )
+{
+  uint32_t head = ring->head;
+  uint32_t tail = __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE );
+  TaskRequest_t* request;
+
+  if ( params_size > TASK_PARAMS_LENGTH )
+    return TASK_PARAMS_TOO_LONG;
+  if ( head - tail >= TASK_RING_LENGTH )
   {
-    new_node->next = task_list->head;
-    task_list->head->prev = new_node;
-    task_list->head = new_node;
+    ++ring->dropped;
+    return TASK_RING_FULL;
   }
-  else
+
+  request = &ring->requests[head & ( TASK_RING_LENGTH - 1 )];
+  request->taskHandler = taskHandler;
+  request->priority    = priority;
+  request->deadline    = deadline;
+  request->issue_time  = system_time;
+  request->params_size = params_size;
+  if ( params_size )
+    memcpy( request->params, params, params_size );
+
+  /* publish the request only once it is complete */
+  __atomic_store_n( &ring->head, head + 1, __ATOMIC_RELEASE );
+
+  return TASK_OK;
+}
+
+/* move posted requests into the ready queue, leaving them queued if the pool is empty */
+static void ringDrain( List_t* task_list )
+{
+  for ( uint32_t i = 0; i < task_list->ring_count; ++i )
   {
-    Node_t* traverse = task_list->head;
-    while ( traverse->next != NULL &&
-            traverse->next->task->priority <= new_task->priority )
-    {
-      traverse = traverse->next;
-    }
+    TaskRing_t* ring = task_list->rings[i];
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
 
-    if ( traverse->next == NULL )
-    {
-      traverse->next = new_node;
-      new_node->next = NULL;
-      new_node->prev = traverse;
-      task_list->tail = new_node;
-    }
-    else
+    while ( tail != head )
     {
-      new_node->next = traverse->next;
-      new_node->prev = traverse;
-      traverse->next->prev = new_node;
-      traverse->next = new_node;
+      TaskRequest_t* request = &ring->requests[tail & ( TASK_RING_LENGTH - 1 )];
+      if ( taskCreate( task_list, request->taskHandler, request->params,
+                       request->params_size, request->priority, request->deadline,
+                       0, 0, request->issue_time ) != TASK_OK )
+        break;
+      __atomic_store_n( &ring->tail, ++tail, __ATOMIC_RELEASE );
     }
   }
 }
 
-void printTaskList( List_t* task_list )
+static bool ringsEmpty( List_t* task_list )
 {
-  Node_t* traverse = task_list->head;
-  int i = 0;
+  for ( uint32_t i = 0; i < task_list->ring_count; ++i )
+  {
+    if ( task_list->rings[i]->head != task_list->rings[i]->tail )
+      return false;
+  }
+
+  return true;
+}
+
+/* new_task must be a slot handed out by createTask(), it is queued on its own node */
+Task_status createTaskExisting( List_t* task_list, Task_t* new_task )
+{
+  Node_t* new_node = &slotOf( new_task )->node;
+
+  if ( task_list->count >= TASK_QUEUE_LENGTH )
+    return TASK_QUEUE_FULL;
+
+  new_node->task          = new_task;
+  new_node->sequence      = task_list->sequence++;
+  new_node->next          = NULL;
+  new_node->queued_cycles = schedulerCycles();
+  traceEvent( TRACE_ENQUEUE, new_task->trace_id, new_node->sequence, new_node->queued_cycles );
+
+  task_list->heap[task_list->count] = new_node;
+  heapSiftUp( task_list, task_list->count++ );
+
+  return TASK_OK;
+}
 
-  while ( traverse != NULL )
+void printTaskList( List_t* task_list )
+{
+  /* heap order, not run order */
+  for ( uint32_t i = 0; i < task_list->count; ++i )
   {
-    printf( "Queue number: %d\n", i++ );
-    printf( "Params:       %s\n", (char*) traverse->task->context->params );
-    traverse = traverse->next;
+    printf( "Queue number: %u\n", (unsigned int) i );
+    printf( "Params:       %s\n", (char*) task_list->heap[i]->task->context->params );
   }
 }
 
+/* queued task with the earliest absolute deadline, or NULL if none has one */
 Task_t* nextOnDeadline( List_t* task_list )
 {
   Task_t* task;
   Node_t* priority_node = NULL;
-  Node_t* node = task_list->head;
+  Node_t* node;
 
-  while ( node != NULL )
+  for ( uint32_t i = 0; i < task_list->count; ++i )
   {
+    node = task_list->heap[i];
     task = node->task;
     if ( task->context->has_deadline )
     {
-      if ( priority_node == NULL )
+      if ( priority_node == NULL ||
+           compareDeadline( task->context, priority_node->task->context ) < 0 )
       {
         priority_node = node;
       }
-      else
-      {
-        TaskContext_t* pcontext = priority_node->task->context;
-        TaskContext_t* ncontext = node->task->context;
-
-        /* may have to account for system_time overflow */
-        if ( (ncontext->deadline - system_time - ncontext->issue_time) <
-             (pcontext->deadline - system_time - pcontext->issue_time) )
-        {
-          /* if the time to deadline of new_node is less than that of priority_node */
-          priority_node = node;
-        }
-      }
     }
-
-    node = node->next;
   }
 
-  return priority_node->task;
+  return priority_node != NULL ? priority_node->task : NULL;
 }
 
 void doTask( Task_t* task )
@@ -158,26 +480,130 @@ void doTask( Task_t* task )
   task->taskHandler( task->context );
 }
 
+/* call once per tick, from the SysTick (or TC) interrupt */
+void schedulerTick( void )
+{
+  ++system_time;
+}
+
+/* free-running cycle count, system_time extended with the SysTick down-counter */
+uint32_t schedulerCycles( void )
+{
+#ifdef TASK_HOST_BUILD
+  return system_time * TASK_HOST_CYCLES_PER_TICK;
+#else
+  uint32_t ticks, count;
+
+  /* re-read if the tick interrupt landed in between */
+  do
+  {
+    ticks = system_time;
+    count = SysTick->LOAD - SysTick->VAL;
+  } while ( ticks != system_time );
+
+  return ticks * ( SysTick->LOAD + 1 ) + count;
+#endif /* TASK_HOST_BUILD */
+}
+
+/* busy share of the time since the last call, in tenths of a percent */
+uint32_t getSchedulerLoad( List_t* task_list )
+{
+  uint64_t busy  = task_list->busy_cycles;
+  uint64_t total = busy + task_list->idle_cycles;
+
+  task_list->busy_cycles = 0;
+  task_list->idle_cycles = 0;
+
+  if ( total == 0 )
+    return 0;
+  return (uint32_t) ( ( busy * 1000 ) / total );
+}
+
+/* nothing ready: sleep until the next tick or peripheral interrupt */
+static void schedulerIdle( List_t* task_list )
+{
+  uint32_t start = schedulerCycles();
+
+#ifdef TASK_HOST_BUILD
+  schedulerTick();
+#else
+  /* with PRIMASK set an interrupt that is already pending still ends the WFI,
+   * so work posted between the check and the sleep is never missed */
+  __disable_irq();
+  if ( task_list->count == 0 && task_list->wheel_time == system_time &&
+       ringsEmpty( task_list ) )
+    system_sleep();
+  __enable_irq();
+#endif /* TASK_HOST_BUILD */
+
+  task_list->idle_cycles += schedulerCycles() - start;
+}
+
 void beginScheduler( List_t* task_list )
 {
   Task_t* task;
   Node_t* node;
+  TaskContext_t* context;
+  uint32_t cycles, end_cycles;
+
+#ifndef TASK_HOST_BUILD
+  /* IDLE_0 only gates the CPU clock; SysTick, SERCOM and EIC keep running to wake us.
+   * STANDBY would stop the tick. */
+  system_set_sleepmode( SYSTEM_SLEEPMODE_IDLE_0 );
+#endif /* TASK_HOST_BUILD */
+
   while ( true )
   {
-    if ( task_list->head != NULL )
+    wheelAdvance( task_list );
+    ringDrain( task_list );
+
+    if ( ( node = heapPop( task_list ) ) != NULL )
     {
-      task = task_list->head->task;
-      node = task_list->head;
-      task->context->start_time = system_time;
+      task = node->task;
+      context = task->context;
+      context->start_time = system_time;
+      context->lateness   = context->start_time - context->release_time;
+      if ( context->lateness > context->max_lateness )
+        context->max_lateness = context->lateness;
+      cycles = schedulerCycles();
+      traceEvent( TRACE_DISPATCH, task->trace_id, node->sequence, cycles );
       doTask( task );
-      task->context->end_time = system_time;
-      if ( node->next != NULL )
-        node->next->prev = NULL;
-      free( task->context->params );
-      free( task->context );
-      free( task );
-      task_list->head = node->next;
-      free( node );
+      end_cycles = schedulerCycles();
+      traceEvent( TRACE_COMPLETE, task->trace_id, node->sequence, end_cycles );
+      traceRun( task->trace_id, cycles - node->queued_cycles, end_cycles - cycles );
+      task_list->busy_cycles += end_cycles - cycles;
+      context->end_time = system_time;
+
+      ++context->runs;
+      ++task_list->dispatched;
+      if ( context->has_deadline &&
+           TIME_BEFORE( context->release_time + context->deadline, context->end_time ) )
+      {
+        ++context->deadline_misses;
+        ++task_list->deadline_misses;
+      }
+
+      if ( task->periodic )
+      {
+        /* re-arm in place on a fixed rate, the slot is never released */
+        context->release_time += task->period;
+        node->expires = context->release_time;
+        wheelInsert( task_list, node );
+      }
+      else
+      {
+        poolFree( slotOf( task ) );
+      }
+    }
+#ifdef TASK_HOST_BUILD
+    else if ( task_list->armed == 0 && ringsEmpty( task_list ) )
+    {
+      return;
+    }
+#endif /* TASK_HOST_BUILD */
+    else
+    {
+      schedulerIdle( task_list );
     }
   }
 }
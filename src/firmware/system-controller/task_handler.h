@@ -2,6 +2,7 @@
 #define TASK_HANDLER_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define PRIORITY_NOW      0
 #define PRIORITY_REALTIME 1
@@ -9,16 +10,89 @@
 #define PRIORITY_NORMAL   3
 #define PRIORITY_LOW      4
 
-#ifdef bool
-  typedef int bool;
-  #define true  1
-  #define false 0
-#endif /* bool */
+/* maximum number of tasks waiting in the ready queue at any one time */
+#ifndef TASK_QUEUE_LENGTH
+  #define TASK_QUEUE_LENGTH 64
+#endif /* TASK_QUEUE_LENGTH */
+
+/* statically allocated task slots, and the params bytes stored inline in each; more
+ * slots than queue places leave room for tasks parked on the timer wheel */
+#ifndef TASK_POOL_LENGTH
+  #define TASK_POOL_LENGTH TASK_QUEUE_LENGTH
+#endif /* TASK_POOL_LENGTH */
+#define TASK_PARAMS_LENGTH 24
+
+/* system_time advances by one on every schedulerTick() */
+#define TASK_TICK_HZ 1000
+
+/* define TASK_HOST_BUILD to run the scheduler off-target: sleeping is replaced by
+ * advancing the simulated clock, and beginScheduler() returns once nothing is left */
+#ifdef TASK_HOST_BUILD
+  #define TASK_HOST_CYCLES_PER_TICK 1000
+#endif /* TASK_HOST_BUILD */
+
+/* hierarchical timer wheel, TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS buckets each */
+#define TIMER_WHEEL_BITS   5
+#define TIMER_WHEEL_SLOTS  ( 1 << TIMER_WHEEL_BITS )
+#define TIMER_WHEEL_LEVELS 4
+
+/* wraparound-safe ordering of two system_time values less than 2^31 ticks apart */
+#define TIME_BEFORE( a, b ) ( (int32_t) ( (uint32_t) (a) - (uint32_t) (b) ) < 0 )
+
+/* interrupt-to-scheduler submission rings, TASK_RING_LENGTH must be a power of two */
+#define TASK_RING_LENGTH 8
+#define TASK_RINGS_MAX   4
+
+typedef enum SCHEDULER_POLICY
+{
+  SCHEDULER_PRIORITY     = 0x00, /* strict priority, FIFO within a level */
+  SCHEDULER_EDF          = 0x01, /* earliest deadline first, priority breaks ties */
+  SCHEDULER_PRIORITY_EDF = 0x02  /* strict priority, earliest deadline within a level */
+} Scheduler_policy;
+
+typedef enum TASK_STATUS
+{
+  TASK_OK              = 0x00,
+  TASK_QUEUE_FULL      = 0x01,
+  TASK_POOL_EMPTY      = 0x02,
+  TASK_PARAMS_TOO_LONG = 0x03,
+  TASK_RING_FULL       = 0x04,
+  TASK_TOO_MANY_RINGS  = 0x05
+} Task_status;
+
+typedef struct TaskPoolStats_t
+{
+  uint32_t capacity;   /* total slots */
+  uint32_t in_use;     /* slots currently allocated */
+  uint32_t high_water; /* most slots ever allocated at once */
+  uint32_t failures;   /* allocations refused because the pool was empty */
+} TaskPoolStats_t;
+
+typedef struct TaskContext_t TaskContext_t;
+
+/* a task posted from interrupt context, turned into a real task by the scheduler */
+typedef struct TaskRequest_t
+{
+  void (*taskHandler)( TaskContext_t* );
+  uint32_t priority;
+  uint32_t deadline;
+  uint32_t issue_time;
+  uint32_t params_size;
+  uint32_t params[( TASK_PARAMS_LENGTH + 3 ) / 4];
+} TaskRequest_t;
+
+/* lock-free single-producer ring: give each interrupt source its own */
+typedef struct TaskRing_t
+{
+  TaskRequest_t requests[TASK_RING_LENGTH];
+  volatile uint32_t head; /* written by the producer only */
+  volatile uint32_t tail; /* written by the scheduler only */
+  volatile uint32_t dropped;
+} TaskRing_t;
 
 typedef struct Node_t Node_t;
 typedef struct List_t List_t;
 typedef struct Task_t Task_t;
-typedef struct TaskContext_t TaskContext_t;
 
 struct TaskContext_t
 {
@@ -29,7 +103,14 @@ struct TaskContext_t
   uint32_t end_time;
 
   bool has_deadline;
-  uint32_t deadline;
+  uint32_t deadline;     /* relative to release_time */
+
+  uint32_t release_time; /* when the task (or this period of it) became ready */
+  uint32_t lateness;     /* start_time - release_time of the latest run */
+  uint32_t max_lateness;
+
+  uint32_t runs;
+  uint32_t deadline_misses; /* runs that completed after release_time + deadline */
 };
 
 struct Task_t
@@ -43,29 +124,68 @@ struct Task_t
   uint32_t period;
 
   uint32_t priority;
+
+  uint8_t trace_id; /* statistics slot, see trace.h */
 };
 
 
 struct Node_t
 {
   struct Task_t* task;
-  struct Node_t* next;
-  struct Node_t* prev;
+  uint32_t sequence; /* insertion order, keeps equal keys FIFO */
+  uint32_t expires;  /* release tick while parked on the timer wheel */
+  uint32_t queued_cycles; /* schedulerCycles() when it entered the ready queue */
+  struct Node_t* next; /* pool free list / timer wheel bucket link */
 };
 
+/* ready queue: binary min-heap ordered by the scheduling policy, then sequence,
+ * fed by a timer wheel holding delayed and periodic tasks until they are due */
 struct List_t
 {
-  struct Node_t* head;
-  struct Node_t* tail;
+  struct Node_t* heap[TASK_QUEUE_LENGTH];
+  uint32_t count;
+  uint32_t sequence;
+  Scheduler_policy policy;
+
+  uint32_t dispatched;
+  uint32_t deadline_misses;
+
+  struct Node_t* wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  uint32_t wheel_time; /* last tick the wheel has been advanced to */
+  uint32_t armed;      /* nodes parked on the wheel */
+  uint32_t dropped;    /* releases lost to a full ready queue, periodic tasks keep
+                          their slot and skip to the next period */
+
+  TaskRing_t* rings[TASK_RINGS_MAX];
+  uint32_t ring_count;
+
+  uint64_t busy_cycles; /* spent in task handlers since the last getSchedulerLoad() */
+  uint64_t idle_cycles; /* spent asleep since the last getSchedulerLoad() */
 };
 
+extern volatile uint32_t system_time;
+
 extern void initTaskList( List_t* task_list );
-extern void createTask( List_t* task_list, void (*taskHandler)( TaskContext_t* ),
-                        const void* params, uint32_t params_size,
-                        uint32_t priority, uint32_t deadline, uint32_t period );
-extern void createTaskExisting( List_t* task_list, Task_t* task );
+extern Task_status createTask( List_t* task_list, void (*taskHandler)( TaskContext_t* ),
+                               const void* params, uint32_t params_size,
+                               uint32_t priority, uint32_t deadline, uint32_t period );
+extern Task_status createTaskDelayed( List_t* task_list, void (*taskHandler)( TaskContext_t* ),
+                                      const void* params, uint32_t params_size,
+                                      uint32_t priority, uint32_t deadline, uint32_t period,
+                                      uint32_t delay );
+extern Task_status createTaskExisting( List_t* task_list, Task_t* task );
+extern void getTaskPoolStats( TaskPoolStats_t* stats );
+extern Task_status registerTaskRing( List_t* task_list, TaskRing_t* ring );
+extern Task_status postTask( TaskRing_t* ring, void (*taskHandler)( TaskContext_t* ),
+                             const void* params, uint32_t params_size,
+                             uint32_t priority, uint32_t deadline );
+extern void setSchedulerPolicy( List_t* task_list, Scheduler_policy policy );
+extern Task_t* nextOnDeadline( List_t* task_list );
 extern void printTaskList( List_t* task_list );
 extern void doTask( Task_t* task );
+extern void schedulerTick( void );
+extern uint32_t schedulerCycles( void );
+extern uint32_t getSchedulerLoad( List_t* task_list );
 extern void beginScheduler( List_t* task_list );
 extern void dummyHandler( TaskContext_t* context );
 
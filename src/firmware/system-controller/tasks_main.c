@@ -1,3 +1,5 @@
+/* host demo of the scheduler, build with -DTASK_HOST_BUILD */
+
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,9 +15,7 @@ void dummyHandler( TaskContext_t* context )
 int main(void)
 {
   List_t* task_list = (List_t*) malloc( sizeof(List_t) );
-  memset( task_list, 0, sizeof(List_t) );
-  task_list->head = NULL;
-  task_list->tail = NULL;
+  initTaskList( task_list );
 
   char post[20];
   strncpy( post, "Prateek died", 20 );
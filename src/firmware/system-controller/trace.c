@@ -0,0 +1,123 @@
+#include <stdint.h>
+#include <string.h>
+
+#ifndef TASK_HOST_BUILD
+  #include <asf.h>
+#endif /* TASK_HOST_BUILD */
+
+#include "trace.h"
+
+/* the statistics are updated by the scheduler and copied out from the pi bus interrupt,
+ * and the 64-bit total takes two stores on the M0+ */
+#ifdef TASK_HOST_BUILD
+  #define TRACE_ENTER_CRITICAL()
+  #define TRACE_LEAVE_CRITICAL()
+#else
+  #define TRACE_ENTER_CRITICAL() system_interrupt_enter_critical_section()
+  #define TRACE_LEAVE_CRITICAL() system_interrupt_leave_critical_section()
+#endif /* TASK_HOST_BUILD */
+
+/* written by the scheduler, read out from the pi bus interrupt */
+static TraceRecord_t trace_ring[TRACE_LENGTH];
+static volatile uint32_t trace_head = 0;
+static volatile uint32_t trace_tail = 0;
+static volatile uint32_t trace_dropped = 0;
+
+static TraceStats_t trace_stats[TRACE_HANDLERS_MAX];
+static uint32_t trace_handlers = 0;
+
+/* stable statistics slot for a handler, TRACE_NO_HANDLER once the table is full */
+uint8_t traceHandlerId( void (*taskHandler)( TaskContext_t* ) )
+{
+  uint32_t address = (uint32_t) (uintptr_t) taskHandler;
+
+  for ( uint32_t i = 0; i < trace_handlers; ++i )
+  {
+    if ( trace_stats[i].handler == address )
+      return (uint8_t) i;
+  }
+
+  if ( trace_handlers >= TRACE_HANDLERS_MAX )
+    return TRACE_NO_HANDLER;
+
+  memset( &trace_stats[trace_handlers], 0, sizeof(TraceStats_t) );
+  trace_stats[trace_handlers].handler    = address;
+  trace_stats[trace_handlers].min_cycles = UINT32_MAX;
+
+  return (uint8_t) trace_handlers++;
+}
+
+/* a full ring drops the new event rather than racing the reader for the oldest */
+void traceEvent( Trace_event event, uint8_t handler, uint32_t sequence, uint32_t cycles )
+{
+  uint32_t head = trace_head;
+  TraceRecord_t* record;
+
+  if ( head - __atomic_load_n( &trace_tail, __ATOMIC_ACQUIRE ) >= TRACE_LENGTH )
+  {
+    ++trace_dropped;
+    return;
+  }
+
+  record = &trace_ring[head & ( TRACE_LENGTH - 1 )];
+  record->cycles   = cycles;
+  record->event    = (uint8_t) event;
+  record->handler  = handler;
+  record->sequence = (uint16_t) sequence;
+
+  __atomic_store_n( &trace_head, head + 1, __ATOMIC_RELEASE );
+}
+
+void traceRun( uint8_t handler, uint32_t queue_cycles, uint32_t run_cycles )
+{
+  TraceStats_t* stats;
+
+  if ( handler >= trace_handlers )
+    return;
+
+  stats = &trace_stats[handler];
+  TRACE_ENTER_CRITICAL();
+  ++stats->count;
+  stats->total_cycles += run_cycles;
+  if ( run_cycles < stats->min_cycles )
+    stats->min_cycles = run_cycles;
+  if ( run_cycles > stats->max_cycles )
+    stats->max_cycles = run_cycles;
+  if ( queue_cycles > stats->max_queue_cycles )
+    stats->max_queue_cycles = queue_cycles;
+  TRACE_LEAVE_CRITICAL();
+}
+
+/* pop up to max_records of the oldest events, safe against a concurrent traceEvent() */
+uint32_t traceRead( TraceRecord_t* records, uint32_t max_records )
+{
+  uint32_t tail = trace_tail;
+  uint32_t head = __atomic_load_n( &trace_head, __ATOMIC_ACQUIRE );
+  uint32_t n = 0;
+
+  while ( tail != head && n < max_records )
+    records[n++] = trace_ring[tail++ & ( TRACE_LENGTH - 1 )];
+
+  __atomic_store_n( &trace_tail, tail, __ATOMIC_RELEASE );
+
+  return n;
+}
+
+uint32_t traceDropped( void )
+{
+  return trace_dropped;
+}
+
+/* a copy of one handler's statistics, all from between two runs; false past the last
+ * handler seen so far */
+bool traceStats( uint8_t handler, TraceStats_t* stats )
+{
+  if ( handler >= trace_handlers )
+    return false;
+
+  TRACE_ENTER_CRITICAL();
+  *stats = trace_stats[handler];
+  TRACE_LEAVE_CRITICAL();
+
+  return true;
+}
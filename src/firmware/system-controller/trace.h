@@ -0,0 +1,50 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+#include "task_handler.h"
+
+/* scheduler events kept for the pi to pull, TRACE_LENGTH must be a power of two */
+#define TRACE_LENGTH 64
+
+/* distinct task handlers with their own runtime statistics */
+#define TRACE_HANDLERS_MAX 16
+#define TRACE_NO_HANDLER   0xff
+
+typedef enum TRACE_EVENT
+{
+  TRACE_ENQUEUE  = 0x01, /* task entered the ready queue */
+  TRACE_DISPATCH = 0x02, /* handler called */
+  TRACE_COMPLETE = 0x03  /* handler returned */
+} Trace_event;
+
+/* 8 bytes on the wire, little endian, in this order */
+typedef struct TraceRecord_t
+{
+  uint32_t cycles;   /* schedulerCycles() at the event */
+  uint8_t  event;    /* Trace_event */
+  uint8_t  handler;  /* index into the statistics table, or TRACE_NO_HANDLER */
+  uint16_t sequence; /* low bits of the ready queue sequence, pairs up one task's events */
+} TraceRecord_t;
+
+/* 32 bytes on the wire, little endian, in this order */
+typedef struct TraceStats_t
+{
+  uint32_t handler;          /* handler address, look it up in the map file */
+  uint32_t count;
+  uint32_t min_cycles;
+  uint32_t max_cycles;
+  uint64_t total_cycles;     /* total / count is the mean runtime */
+  uint32_t max_queue_cycles; /* worst enqueue-to-dispatch delay */
+  uint32_t reserved;
+} TraceStats_t;
+
+extern uint8_t traceHandlerId( void (*taskHandler)( TaskContext_t* ) );
+extern void traceEvent( Trace_event event, uint8_t handler, uint32_t sequence, uint32_t cycles );
+extern void traceRun( uint8_t handler, uint32_t queue_cycles, uint32_t run_cycles );
+extern uint32_t traceRead( TraceRecord_t* records, uint32_t max_records );
+extern uint32_t traceDropped( void );
+extern bool traceStats( uint8_t handler, TraceStats_t* stats );
+
+#endif /* TRACE_H_ */
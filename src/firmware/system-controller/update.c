@@ -0,0 +1,60 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "update.h"
+
+_Static_assert( sizeof(UpdateFrame_t) == 48 && offsetof( UpdateFrame_t, reserved ) == 46,
+                "the REG_UPDATE frame is 48 bytes with no padding" );
+
+/* the frame the pi bus interrupt is not reading, cleared and stamped with the next
+ * sequence number; fill it in, then updateCommit(..) it */
+UpdateFrame_t* updateBegin( Update_t* update )
+{
+  UpdateFrame_t* frame = &update->frames[update->current ^ 1];
+
+  memset( frame, 0, sizeof(UpdateFrame_t) );
+  frame->version  = UPDATE_VERSION;
+  frame->length   = sizeof(UpdateFrame_t);
+  frame->sequence = ++update->sequence;
+
+  return frame;
+}
+
+/* the 12V rail's part of a frame: its status, module masks and the latest sweep */
+void updatePower( UpdateFrame_t* frame, const Power_t* pc, const Power_snapshot_t* telemetry )
+{
+  frame->timestamp    = telemetry->timestamp;
+  frame->power_status = (uint8_t) pc->status;
+
+  for ( uint8_t i = 0; i < pc->module_count; ++i )
+  {
+    if ( pc->power_state[i] )
+      frame->modules_on |= 1 << i;
+    if ( i < telemetry->module_count && telemetry->module[i].status == POWER_OK )
+      frame->modules_valid |= 1 << i;
+    if ( pc->fault[i].count && pc->fault[i].status != POWER_OK )
+      frame->modules_fault |= 1 << i;
+    else if ( pc->fault[i].count )
+      frame->modules_warning |= 1 << i;
+  }
+
+  frame->alerts      = pc->alerts;
+  frame->vin         = telemetry->vin;
+  frame->vout        = telemetry->vout;
+  frame->iout        = telemetry->iout;
+  frame->pout        = telemetry->pout;
+  frame->temperature = telemetry->temperature;
+}
+
+/* makes the frame from updateBegin(..) the one the pi reads */
+void updateCommit( Update_t* update )
+{
+  __atomic_store_n( &update->current, update->current ^ 1, __ATOMIC_RELEASE );
+}
+
+/* from the pi bus interrupt, which no task can run during */
+const UpdateFrame_t* updateCurrent( const Update_t* update )
+{
+  return &update->frames[update->current];
+}
@@ -0,0 +1,51 @@
+#ifndef UPDATE_H_
+#define UPDATE_H_
+
+#include <stdint.h>
+
+#include "power.h"
+
+#define UPDATE_VERSION 1
+
+/* REG_UPDATE reply, 48 bytes on the wire, little endian, in this order; power readings
+ * in milli-units (mV, mA, mW, milli-degrees C), bit i of a module mask is module i */
+typedef struct UpdateFrame_t
+{
+  uint8_t  version;          /* UPDATE_VERSION */
+  uint8_t  length;           /* of the frame, in bytes */
+  uint16_t sequence;         /* bumped every time the frame is rebuilt */
+  uint32_t timestamp;        /* system_time of the power readings */
+  uint8_t  power_status;     /* Power_status of the 12V rail */
+  uint8_t  exp_power_status; /* Power_status of the expansion bus supplies */
+  uint8_t  fan;              /* status_fan */
+  uint8_t  power;            /* status_power */
+  uint8_t  modules_on;       /* 12V modules switched on */
+  uint8_t  modules_valid;    /* 12V modules read by the last sweep */
+  uint8_t  modules_fault;    /* 12V modules whose last alert was a fault */
+  uint8_t  modules_warning;  /* 12V modules whose last alert only flagged warnings */
+  uint32_t alerts;           /* SMBALERT#s handled since boot */
+  int32_t  vin;              /* mean */
+  int32_t  vout;             /* mean */
+  int32_t  iout;             /* total */
+  int32_t  pout;             /* total */
+  int32_t  temperature;      /* hottest module */
+  int32_t  exp_pout;         /* expansion bus supplies' total */
+  uint16_t load;             /* scheduler load, in tenths of a percent */
+  uint16_t reserved;
+} UpdateFrame_t;
+
+/* double buffered: tasks rebuild the frame the pi bus interrupt is not reading, then flip */
+typedef struct Update_t
+{
+  UpdateFrame_t    frames[2];
+  volatile uint8_t current;  /* the frame the pi bus interrupt reads */
+  uint16_t         sequence; /* of the last frame begun */
+} Update_t;
+
+extern UpdateFrame_t* updateBegin( Update_t* update );
+extern void updatePower( UpdateFrame_t* frame, const Power_t* pc,
+                         const Power_snapshot_t* telemetry );
+extern void updateCommit( Update_t* update );
+extern const UpdateFrame_t* updateCurrent( const Update_t* update );
+
+#endif /* UPDATE_H_ */
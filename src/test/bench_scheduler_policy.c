@@ -0,0 +1,141 @@
+/**
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file bench_scheduler_policy.c
+ *
+ * \brief Host simulation of the scheduling policies, built with TASK_HOST_BUILD: the same
+ *        periodic task sets run under SCHEDULER_PRIORITY, SCHEDULER_EDF and
+ *        SCHEDULER_PRIORITY_EDF, and each prints its deadline miss ratio and dispatch
+ *        latency (release to start, in ticks).
+ *
+ * Handlers spend their cost by calling schedulerTick(), and are never preempted, as on
+ * the target. A run ends by jumping out of the scheduler at SIM_TICKS, leaving its
+ * periodic tasks armed; the pool is built large enough for every run's leftovers.
+ */
+
+#include <setjmp.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "task_handler.h"
+#include "test.h"
+
+#define SIM_TICKS 100000
+#define SIM_TASKS_MAX 8
+
+typedef struct SimTask_t
+{
+  uint32_t period;
+  uint32_t cost;     /* ticks the handler runs for */
+  uint32_t deadline; /* relative to each release */
+  uint32_t priority;
+} SimTask_t;
+
+typedef struct SimSet_t
+{
+  const char* name;
+  uint32_t count;
+  SimTask_t task[SIM_TASKS_MAX];
+} SimSet_t;
+
+/* a low priority task with a tight deadline, which strict priority makes wait */
+static const SimSet_t sim_sets[] =
+{
+  { "U=0.84", 4, { { 10, 2, 10, PRIORITY_LOW },
+                   { 20, 5, 20, PRIORITY_HIGH },
+                   { 50, 12, 50, PRIORITY_NORMAL },
+                   { 40, 6, 15, PRIORITY_NORMAL } } },
+  { "U=0.97", 5, { { 10, 2, 8, PRIORITY_LOW },
+                   { 20, 5, 20, PRIORITY_HIGH },
+                   { 50, 12, 50, PRIORITY_NORMAL },
+                   { 40, 6, 15, PRIORITY_NORMAL },
+                   { 100, 13, 100, PRIORITY_REALTIME } } },
+  { "U=1.07", 5, { { 10, 2, 8, PRIORITY_LOW },
+                   { 20, 5, 20, PRIORITY_HIGH },
+                   { 50, 17, 50, PRIORITY_NORMAL },
+                   { 40, 6, 15, PRIORITY_NORMAL },
+                   { 100, 13, 100, PRIORITY_REALTIME } } }
+};
+
+static const struct { Scheduler_policy policy; const char* name; } sim_policies[] =
+{
+  { SCHEDULER_PRIORITY,     "priority" },
+  { SCHEDULER_EDF,          "edf" },
+  { SCHEDULER_PRIORITY_EDF, "priority+edf" }
+};
+
+static List_t task_list;
+static jmp_buf sim_exit;
+static uint32_t sim_end;
+
+/* per run: jobs started, their summed and worst release-to-start latency */
+static uint32_t sim_jobs;
+static uint64_t sim_latency;
+static uint32_t sim_latency_max;
+
+void dummyHandler( TaskContext_t* context )
+{
+  (void) context;
+}
+
+static void simHandler( TaskContext_t* context )
+{
+  uint32_t cost = *(uint32_t*) context->params;
+
+  if ( TIME_BEFORE( sim_end, context->start_time ) )
+    longjmp( sim_exit, 1 );
+
+  ++sim_jobs;
+  sim_latency += context->lateness;
+  if ( context->lateness > sim_latency_max )
+    sim_latency_max = context->lateness;
+
+  while ( cost-- )
+    schedulerTick();
+}
+
+static void simRun( const SimSet_t* set, Scheduler_policy policy, const char* name )
+{
+  uint32_t misses;
+
+  initTaskList( &task_list );
+  task_list.wheel_time = system_time;
+  setSchedulerPolicy( &task_list, policy );
+  sim_end         = system_time + SIM_TICKS;
+  sim_jobs        = 0;
+  sim_latency     = 0;
+  sim_latency_max = 0;
+
+  /* every task released at once, the worst phasing */
+  for ( uint32_t i = 0; i < set->count; ++i )
+  {
+    const SimTask_t* t = &set->task[i];
+
+    CHECK_EQ( createTaskDelayed( &task_list, simHandler, &t->cost, sizeof(t->cost), t->priority,
+                                 t->deadline, t->period, t->period ), TASK_OK );
+  }
+
+  if ( setjmp( sim_exit ) == 0 )
+    beginScheduler( &task_list );
+
+  /* misses are counted as jobs complete, the one that jumped out is in neither count */
+  misses = task_list.deadline_misses;
+  CHECK( sim_jobs > 0 );
+  printf( "%-8s %-14s %8u %9.2f%% %9.2f %6u\n", set->name, name, sim_jobs,
+          100.0 * misses / sim_jobs, (double) sim_latency / sim_jobs, sim_latency_max );
+}
+
+int main( void )
+{
+  printf( "scheduling policies over %u ticks, latency in ticks\n", SIM_TICKS );
+  printf( "%-8s %-14s %8s %10s %9s %6s\n", "set", "policy", "jobs", "missed", "latency",
+          "max" );
+
+  for ( uint32_t s = 0; s < sizeof(sim_sets) / sizeof(sim_sets[0]); ++s )
+  {
+    for ( uint32_t p = 0; p < sizeof(sim_policies) / sizeof(sim_policies[0]); ++p )
+      simRun( &sim_sets[s], sim_policies[p].policy, sim_policies[p].name );
+  }
+
+  return testResult( "bench_scheduler_policy" );
+}
@@ -0,0 +1,221 @@
+/**
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file bench_task_queue.c
+ *
+ * \brief Host benchmark of the ready queue: the binary heap of task_handler.c against the
+ *        linear-insert linked list it replaced, with 10, 100 and 1000 tasks queued. Built
+ *        with TASK_QUEUE_LENGTH raised to fit the largest size.
+ *
+ * Each run keeps n tasks queued: every dispatched task queues one more of a random
+ * priority, until BENCH_DISPATCHES have run. The heap goes through the real scheduler,
+ * with its trace and accounting; the list is the baseline's insert and pop over the same
+ * tasks, without either, so its figures flatter it a little.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "task_handler.h"
+#include "test.h"
+
+#define BENCH_DISPATCHES 200000
+#define BENCH_ORDER      256
+
+static const uint32_t bench_sizes[] = { 10, 100, 1000 };
+
+static List_t task_list;
+static uint32_t remaining;
+static uint32_t next_id;
+
+/* ids and priorities in dispatch order, to check both queues agree */
+static uint32_t order[2][BENCH_ORDER];
+static uint32_t dispatched;
+
+void dummyHandler( TaskContext_t* context )
+{
+  (void) context;
+}
+
+static double elapsedNs( const struct timespec* start )
+{
+  struct timespec end;
+
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  return ( end.tv_sec - start->tv_sec ) * 1e9 + ( end.tv_nsec - start->tv_nsec );
+}
+
+static uint32_t randomPriority( void )
+{
+  return PRIORITY_REALTIME + rand() % PRIORITY_LOW;
+}
+
+static void heapHandler( TaskContext_t* context )
+{
+  if ( dispatched < BENCH_ORDER )
+    order[0][dispatched] = *(uint32_t*) context->params;
+  ++dispatched;
+
+  if ( remaining > 0 )
+  {
+    --remaining;
+    ++next_id;
+    createTask( &task_list, heapHandler, &next_id, sizeof(next_id), randomPriority(), 0, 0 );
+  }
+}
+
+static double benchHeap( uint32_t n )
+{
+  struct timespec start;
+
+  srand( n );
+  initTaskList( &task_list );
+  task_list.wheel_time = system_time;
+  for ( next_id = 0; next_id < n; ++next_id )
+    createTask( &task_list, heapHandler, &next_id, sizeof(next_id), randomPriority(), 0, 0 );
+  --next_id;
+  remaining  = BENCH_DISPATCHES;
+  dispatched = 0;
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  beginScheduler( &task_list );
+  return elapsedNs( &start ) / dispatched;
+}
+
+/* the baseline list: doubly linked, walked from the head to insert after the last task of
+ * the same or a higher priority, PRIORITY_NOW straight to the front. The baseline never
+ * put a task ahead of the head otherwise; that is fixed here, so both queues agree */
+typedef struct ListNode_t
+{
+  Task_t task;
+  TaskContext_t context;
+  uint32_t params[( TASK_PARAMS_LENGTH + 3 ) / 4];
+  struct ListNode_t* next;
+  struct ListNode_t* prev;
+} ListNode_t;
+
+static ListNode_t list_nodes[TASK_QUEUE_LENGTH];
+static ListNode_t* list_free;
+static ListNode_t* list_head;
+static ListNode_t* list_tail;
+
+static void listInsert( ListNode_t* node )
+{
+  ListNode_t* traverse = list_head;
+
+  if ( list_head == NULL )
+  {
+    node->next = node->prev = NULL;
+    list_head = list_tail = node;
+  }
+  else if ( node->task.priority == PRIORITY_NOW || list_head->task.priority > node->task.priority )
+  {
+    node->next = list_head;
+    node->prev = NULL;
+    list_head->prev = node;
+    list_head = node;
+  }
+  else
+  {
+    while ( traverse->next != NULL && traverse->next->task.priority <= node->task.priority )
+      traverse = traverse->next;
+
+    node->next = traverse->next;
+    node->prev = traverse;
+    if ( traverse->next == NULL )
+      list_tail = node;
+    else
+      traverse->next->prev = node;
+    traverse->next = node;
+  }
+}
+
+static void listCreate( uint32_t id, uint32_t priority )
+{
+  ListNode_t* node = list_free;
+
+  list_free = node->next;
+  memset( &node->task,    0, sizeof(Task_t) );
+  memset( &node->context, 0, sizeof(TaskContext_t) );
+  node->task.taskHandler = dummyHandler;
+  node->task.priority    = priority;
+  node->task.context     = &node->context;
+  node->context.params   = node->params;
+  memcpy( node->params, &id, sizeof(id) );
+  node->context.issue_time = system_time;
+  listInsert( node );
+}
+
+static double benchList( uint32_t n )
+{
+  struct timespec start;
+  ListNode_t* node;
+
+  srand( n );
+  list_head = list_tail = list_free = NULL;
+  for ( uint32_t i = 0; i < TASK_QUEUE_LENGTH; ++i )
+  {
+    list_nodes[i].next = list_free;
+    list_free = &list_nodes[i];
+  }
+  for ( next_id = 0; next_id < n; ++next_id )
+    listCreate( next_id, randomPriority() );
+  --next_id;
+  remaining  = BENCH_DISPATCHES;
+  dispatched = 0;
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  while ( ( node = list_head ) != NULL )
+  {
+    list_head = node->next;
+    if ( list_head != NULL )
+      list_head->prev = NULL;
+
+    node->context.start_time = system_time;
+    doTask( &node->task );
+    node->context.end_time = system_time;
+    if ( dispatched < BENCH_ORDER )
+      order[1][dispatched] = node->params[0];
+    ++dispatched;
+
+    node->next = list_free;
+    list_free  = node;
+
+    if ( remaining > 0 )
+    {
+      --remaining;
+      listCreate( ++next_id, randomPriority() );
+    }
+  }
+  return elapsedNs( &start ) / dispatched;
+}
+
+int main( void )
+{
+  printf( "ready queue, ns per dispatch with n tasks queued (%u dispatches)\n",
+          BENCH_DISPATCHES );
+  printf( "%8s %10s %10s %8s\n", "n", "heap", "list", "list/heap" );
+
+  for ( uint32_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); ++i )
+  {
+    uint32_t n = bench_sizes[i];
+    double heap, list;
+
+    if ( n > TASK_QUEUE_LENGTH )
+    {
+      printf( "%8u does not fit TASK_QUEUE_LENGTH %u\n", n, TASK_QUEUE_LENGTH );
+      continue;
+    }
+
+    heap = benchHeap( n );
+    list = benchList( n );
+    printf( "%8u %10.1f %10.1f %8.2f\n", n, heap, list, list / heap );
+
+    /* same tasks, same priorities, FIFO within a level: the same order */
+    CHECK( memcmp( order[0], order[1], sizeof(order[0]) ) == 0 );
+  }
+
+  return testResult( "bench_task_queue" );
+}
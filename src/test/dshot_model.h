@@ -0,0 +1,21 @@
+/**
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file dshot_model.h
+ *
+ * \brief Register accesses of dshot_send(..), as the Makefile rewrites them in the model
+ *        copy of dshot.c: its TC flag polls and PORT writes go to the test's model of the
+ *        bit clock and the pins, which advances with every access.
+ */
+
+#ifndef DSHOT_MODEL_H_
+#define DSHOT_MODEL_H_
+
+#include <asf.h>
+
+uint8_t model_read( Tc* hw );                  /* hw->COUNT8.INTFLAG.reg */
+void model_clear( Tc* hw, uint8_t flags );     /* hw->COUNT8.INTFLAG.reg = flags */
+void model_set( PortGroup* port, uint32_t pins );   /* port->OUTSET.reg = pins */
+void model_clr( PortGroup* port, uint32_t pins );   /* port->OUTCLR.reg = pins */
+
+#endif /* DSHOT_MODEL_H_ */
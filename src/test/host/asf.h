@@ -0,0 +1,436 @@
+/**
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file asf.h
+ *
+ * \brief Host stand-in for the parts of Atmel's ASF the firmware uses, so its modules
+ *        build for the host unit tests. Only declarations: each test defines the driver
+ *        functions it links against, as a model of the peripheral it exercises.
+ */
+
+#ifndef ASF_H_
+#define ASF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum status_code
+{
+  STATUS_OK                   = 0x00,
+  STATUS_ABORTED              = 0x04,
+  STATUS_BUSY                 = 0x05,
+  STATUS_ERR_IO               = 0x10,
+  STATUS_ERR_TIMEOUT          = 0x12,
+  STATUS_ERR_BAD_DATA         = 0x13,
+  STATUS_ERR_NO_MEMORY        = 0x15,
+  STATUS_ERR_INVALID_ARG      = 0x17,
+  STATUS_ERR_BAD_FORMAT       = 0x19,
+  STATUS_ERR_NOT_INITIALIZED  = 0x1a,
+  STATUS_ERR_BAD_FRQ          = 0x1b,
+  STATUS_ERR_DENIED           = 0x1c,
+  STATUS_ERR_PACKET_COLLISION = 0x1d,
+  STATUS_ERR_BAD_ADDRESS      = 0x1e,
+  STATUS_ERR_OVERFLOW         = 0x1f
+};
+
+/* registers, just those the firmware touches directly */
+
+typedef struct { int unused; } Sercom;
+
+typedef union
+{
+  struct
+  {
+    struct { volatile uint8_t reg; } INTFLAG;
+    struct { volatile uint16_t reg; } COUNT;
+    struct { volatile uint16_t reg; } CC[2];
+  } COUNT16;
+  struct
+  {
+    struct { volatile uint8_t reg; } INTFLAG;
+    struct { volatile uint8_t reg; } COUNT;
+    struct { volatile uint8_t reg; } PER;
+    struct { volatile uint8_t reg; } CC[2];
+  } COUNT8;
+} Tc;
+
+#define TC_INTFLAG_OVF ( 1 << 0 )
+#define TC_INTFLAG_MC0 ( 1 << 4 )
+#define TC_INTFLAG_MC1 ( 1 << 5 )
+
+typedef struct
+{
+  struct { volatile uint32_t reg; } OUTSET;
+  struct { volatile uint32_t reg; } OUTCLR;
+} PortGroup;
+
+typedef struct { volatile uint32_t LOAD, VAL, CTRL; } SysTick_Type;
+
+/* the instances are host memory, a test can look into them */
+extern Tc host_tc[6];
+extern Sercom host_sercom[6];
+extern SysTick_Type host_systick;
+
+#define TC0     ( &host_tc[0] )
+#define TC1     ( &host_tc[1] )
+#define TC2     ( &host_tc[2] )
+#define TC3     ( &host_tc[3] )
+#define TC4     ( &host_tc[4] )
+#define TC5     ( &host_tc[5] )
+#define SERCOM0 ( &host_sercom[0] )
+#define SERCOM1 ( &host_sercom[1] )
+#define SERCOM2 ( &host_sercom[2] )
+#define SERCOM3 ( &host_sercom[3] )
+#define SERCOM4 ( &host_sercom[4] )
+#define SERCOM5 ( &host_sercom[5] )
+#define SysTick ( &host_systick )
+
+uint32_t SysTick_Config( uint32_t ticks );
+void __disable_irq( void );
+void __enable_irq( void );
+
+/* system */
+
+enum system_sleepmode { SYSTEM_SLEEPMODE_IDLE_0 };
+enum gclk_generator { GCLK_GENERATOR_0 };
+
+void system_init( void );
+void system_sleep( void );
+void system_set_sleepmode( enum system_sleepmode mode );
+uint32_t system_gclk_gen_get_hz( enum gclk_generator generator );
+void system_interrupt_enter_critical_section( void );
+void system_interrupt_leave_critical_section( void );
+void system_interrupt_enable_global( void );
+
+#define SYSTEM_PINMUX_GPIO ( 1 << 7 )
+
+struct system_pinmux_config
+{
+  uint8_t mux_position;
+  int direction;
+  int input_pull;
+  bool powersave;
+};
+
+void system_pinmux_get_config_defaults( struct system_pinmux_config* config );
+void system_pinmux_pin_set_config( uint8_t gpio_pin, const struct system_pinmux_config* config );
+
+/* port */
+
+enum { PORT_PIN_DIR_INPUT, PORT_PIN_DIR_OUTPUT, PORT_PIN_DIR_OUTPUT_WTH_READBACK };
+enum { PORT_PIN_PULL_NONE, PORT_PIN_PULL_UP };
+
+struct port_config
+{
+  int direction;
+  int input_pull;
+  bool powersave;
+};
+
+void port_get_config_defaults( struct port_config* config );
+void port_pin_set_config( uint8_t gpio_pin, const struct port_config* config );
+void port_pin_set_output_level( uint8_t gpio_pin, bool level );
+bool port_pin_get_input_level( uint8_t gpio_pin );
+void port_pin_toggle_output_level( uint8_t gpio_pin );
+PortGroup* port_get_group_from_gpio_pin( uint8_t gpio_pin );
+
+void delay_init( void );
+void delay_us( uint32_t us );
+void delay_ms( uint32_t ms );
+
+/* I2C master and slave */
+
+struct i2c_master_module { Sercom* hw; };
+struct i2c_slave_module
+{
+  uint8_t* buffer;
+  volatile uint16_t buffer_remaining;
+  volatile uint16_t buffer_length;
+};
+
+struct i2c_master_config
+{
+  uint32_t baud_rate;
+  uint32_t pinmux_pad0;
+  uint32_t pinmux_pad1;
+  uint16_t buffer_timeout;
+  uint16_t unknown_bus_state_timeout;
+};
+
+struct i2c_slave_config
+{
+  uint16_t address;
+  int address_mode;
+  uint32_t pinmux_pad0;
+  uint32_t pinmux_pad1;
+};
+
+struct i2c_master_packet
+{
+  uint16_t address;
+  uint16_t data_length;
+  uint8_t* data;
+  bool ten_bit_address;
+  bool high_speed;
+  uint8_t hs_master_code;
+};
+
+struct i2c_slave_packet
+{
+  uint16_t data_length;
+  uint8_t* data;
+};
+
+enum i2c_master_callback
+{
+  I2C_MASTER_CALLBACK_WRITE_COMPLETE,
+  I2C_MASTER_CALLBACK_READ_COMPLETE,
+  I2C_MASTER_CALLBACK_ERROR
+};
+
+enum i2c_slave_callback
+{
+  I2C_SLAVE_CALLBACK_READ_REQUEST,
+  I2C_SLAVE_CALLBACK_WRITE_REQUEST,
+  I2C_SLAVE_CALLBACK_READ_COMPLETE,
+  I2C_SLAVE_CALLBACK_WRITE_COMPLETE
+};
+
+#define I2C_SLAVE_ADDRESS_MODE_MASK 0
+
+typedef void (*i2c_master_callback_t)( struct i2c_master_module *const module );
+typedef void (*i2c_slave_callback_t)( struct i2c_slave_module *const module );
+
+void i2c_master_get_config_defaults( struct i2c_master_config* config );
+enum status_code i2c_master_init( struct i2c_master_module* module, Sercom* hw,
+                                  const struct i2c_master_config* config );
+void i2c_master_enable( struct i2c_master_module* module );
+void i2c_master_disable( struct i2c_master_module* module );
+void i2c_master_reset( struct i2c_master_module* module );
+enum status_code i2c_master_write_packet_job( struct i2c_master_module* module,
+                                              struct i2c_master_packet* packet );
+enum status_code i2c_master_write_packet_job_no_stop( struct i2c_master_module* module,
+                                                      struct i2c_master_packet* packet );
+enum status_code i2c_master_read_packet_job( struct i2c_master_module* module,
+                                             struct i2c_master_packet* packet );
+enum status_code i2c_master_get_job_status( struct i2c_master_module* module );
+void i2c_master_cancel_job( struct i2c_master_module* module );
+void i2c_master_send_stop( struct i2c_master_module* module );
+void i2c_master_register_callback( struct i2c_master_module* module,
+                                   i2c_master_callback_t callback,
+                                   enum i2c_master_callback type );
+void i2c_master_enable_callback( struct i2c_master_module* module,
+                                 enum i2c_master_callback type );
+
+void i2c_slave_get_config_defaults( struct i2c_slave_config* config );
+enum status_code i2c_slave_init( struct i2c_slave_module* module, Sercom* hw,
+                                 const struct i2c_slave_config* config );
+void i2c_slave_enable( struct i2c_slave_module* module );
+void i2c_slave_register_callback( struct i2c_slave_module* module,
+                                  i2c_slave_callback_t callback,
+                                  enum i2c_slave_callback type );
+void i2c_slave_enable_callback( struct i2c_slave_module* module,
+                                enum i2c_slave_callback type );
+enum status_code i2c_slave_write_packet_job( struct i2c_slave_module* module,
+                                             struct i2c_slave_packet* packet );
+enum status_code i2c_slave_read_packet_job( struct i2c_slave_module* module,
+                                            struct i2c_slave_packet* packet );
+
+/* external interrupts */
+
+enum { EXTINT_PULL_NONE, EXTINT_PULL_UP, EXTINT_PULL_DOWN };
+enum
+{
+  EXTINT_DETECT_NONE,
+  EXTINT_DETECT_RISING,
+  EXTINT_DETECT_FALLING,
+  EXTINT_DETECT_BOTH,
+  EXTINT_DETECT_HIGH,
+  EXTINT_DETECT_LOW
+};
+enum extint_callback_type { EXTINT_CALLBACK_TYPE_DETECT };
+
+struct extint_chan_conf
+{
+  uint32_t gpio_pin;
+  uint32_t gpio_pin_mux;
+  int gpio_pin_pull;
+  bool wake_if_sleeping;
+  bool filter_input_signal;
+  int detection_criteria;
+};
+
+typedef void (*extint_callback_t)( void );
+
+void extint_chan_get_config_defaults( struct extint_chan_conf* config );
+void extint_chan_set_config( uint8_t channel, const struct extint_chan_conf* config );
+enum status_code extint_register_callback( extint_callback_t callback, uint8_t channel,
+                                           enum extint_callback_type type );
+enum status_code extint_chan_enable_callback( uint8_t channel, enum extint_callback_type type );
+
+/* TC */
+
+enum tc_counter_size { TC_COUNTER_SIZE_8BIT, TC_COUNTER_SIZE_16BIT, TC_COUNTER_SIZE_32BIT };
+enum tc_wave_generation
+{
+  TC_WAVE_GENERATION_NORMAL_FREQ,
+  TC_WAVE_GENERATION_MATCH_FREQ,
+  TC_WAVE_GENERATION_NORMAL_PWM,
+  TC_WAVE_GENERATION_MATCH_PWM
+};
+enum tc_clock_prescaler
+{
+  TC_CLOCK_PRESCALER_DIV1,
+  TC_CLOCK_PRESCALER_DIV2,
+  TC_CLOCK_PRESCALER_DIV4,
+  TC_CLOCK_PRESCALER_DIV8,
+  TC_CLOCK_PRESCALER_DIV16,
+  TC_CLOCK_PRESCALER_DIV64,
+  TC_CLOCK_PRESCALER_DIV256,
+  TC_CLOCK_PRESCALER_DIV1024
+};
+enum tc_compare_capture_channel { TC_COMPARE_CAPTURE_CHANNEL_0, TC_COMPARE_CAPTURE_CHANNEL_1 };
+enum tc_callback
+{
+  TC_CALLBACK_OVERFLOW,
+  TC_CALLBACK_ERROR,
+  TC_CALLBACK_CC_CHANNEL0,
+  TC_CALLBACK_CC_CHANNEL1
+};
+
+struct tc_pwm_channel
+{
+  bool enabled;
+  uint32_t pin_out;
+  uint32_t pin_mux;
+};
+
+struct tc_8bit_config
+{
+  uint8_t value;
+  uint8_t period;
+  uint8_t compare_capture_channel[2];
+};
+
+struct tc_16bit_config
+{
+  uint16_t value;
+  uint16_t compare_capture_channel[2];
+};
+
+struct tc_config
+{
+  enum gclk_generator clock_source;
+  enum tc_counter_size counter_size;
+  enum tc_clock_prescaler clock_prescaler;
+  enum tc_wave_generation wave_generation;
+  bool run_in_standby;
+  bool oneshot;
+  bool count_direction;
+  struct tc_pwm_channel pwm_channel[2];
+  struct tc_8bit_config counter_8_bit;
+  struct tc_16bit_config counter_16_bit;
+};
+
+struct tc_module { Tc* hw; };
+
+typedef void (*tc_callback_t)( struct tc_module *const module );
+
+void tc_get_config_defaults( struct tc_config* config );
+enum status_code tc_init( struct tc_module* module, Tc* hw, const struct tc_config* config );
+void tc_enable( struct tc_module* module );
+void tc_disable( struct tc_module* module );
+void tc_start_counter( struct tc_module* module );
+void tc_stop_counter( struct tc_module* module );
+enum status_code tc_set_compare_value( struct tc_module* module,
+                                       enum tc_compare_capture_channel channel,
+                                       uint32_t compare );
+enum status_code tc_set_top_value( struct tc_module* module, uint32_t top );
+enum status_code tc_set_count_value( struct tc_module* module, uint32_t count );
+uint32_t tc_get_count_value( struct tc_module* module );
+enum status_code tc_register_callback( struct tc_module* module, tc_callback_t callback,
+                                       enum tc_callback type );
+void tc_enable_callback( struct tc_module* module, enum tc_callback type );
+void tc_disable_callback( struct tc_module* module, enum tc_callback type );
+
+/* pins, as gpio numbers, and pinmux settings (pin << 16 | mux) */
+
+#define PIN_PA00 0
+#define PIN_PA01 1
+#define PIN_PA02 2
+#define PIN_PA03 3
+#define PIN_PA04 4
+#define PIN_PA05 5
+#define PIN_PA06 6
+#define PIN_PA07 7
+#define PIN_PA08 8
+#define PIN_PA09 9
+#define PIN_PA10 10
+#define PIN_PA11 11
+#define PIN_PA12 12
+#define PIN_PA13 13
+#define PIN_PA14 14
+#define PIN_PA15 15
+#define PIN_PA16 16
+#define PIN_PA17 17
+#define PIN_PA18 18
+#define PIN_PA19 19
+#define PIN_PA20 20
+#define PIN_PA21 21
+#define PIN_PA22 22
+#define PIN_PA23 23
+#define PIN_PA24 24
+#define PIN_PA25 25
+#define PIN_PA27 27
+#define PIN_PA28 28
+#define PIN_PB00 32
+#define PIN_PB01 33
+#define PIN_PB02 34
+#define PIN_PB03 35
+#define PIN_PB04 36
+#define PIN_PB05 37
+#define PIN_PB06 38
+#define PIN_PB07 39
+#define PIN_PB08 40
+#define PIN_PB09 41
+#define PIN_PB10 42
+#define PIN_PB11 43
+#define PIN_PB12 44
+#define PIN_PB13 45
+#define PIN_PB14 46
+#define PIN_PB15 47
+#define PIN_PB16 48
+#define PIN_PB17 49
+#define PIN_PB22 54
+#define PIN_PB23 55
+#define PIN_PB30 62
+#define PIN_PB31 63
+
+#define PIN_PA06A_EIC_EXTINT6 6L
+#define MUX_PA06A_EIC_EXTINT6 0L
+
+#define PINMUX_PA08C_SERCOM0_PAD0 ( ( 8UL << 16 ) | 2 )
+#define PINMUX_PA09C_SERCOM0_PAD1 ( ( 9UL << 16 ) | 2 )
+#define PINMUX_PA16C_SERCOM1_PAD0 ( ( 16UL << 16 ) | 2 )
+#define PINMUX_PA17C_SERCOM1_PAD1 ( ( 17UL << 16 ) | 2 )
+#define PINMUX_PB12C_SERCOM4_PAD0 ( ( 44UL << 16 ) | 2 )
+#define PINMUX_PB13C_SERCOM4_PAD1 ( ( 45UL << 16 ) | 2 )
+#define PINMUX_PB30D_SERCOM5_PAD0 ( ( 62UL << 16 ) | 3 )
+#define PINMUX_PB31D_SERCOM5_PAD1 ( ( 63UL << 16 ) | 3 )
+
+#define PINMUX_PA00F_TC2_WO0 ( ( 0UL << 16 ) | 5 )
+#define PINMUX_PA01F_TC2_WO1 ( ( 1UL << 16 ) | 5 )
+#define PINMUX_PA04F_TC0_WO0 ( ( 4UL << 16 ) | 5 )
+#define PINMUX_PA05F_TC0_WO1 ( ( 5UL << 16 ) | 5 )
+#define PINMUX_PA06F_TC1_WO0 ( ( 6UL << 16 ) | 5 )
+#define PINMUX_PA07F_TC1_WO1 ( ( 7UL << 16 ) | 5 )
+#define PINMUX_PA18F_TC3_WO0 ( ( 18UL << 16 ) | 5 )
+#define PINMUX_PA19F_TC3_WO1 ( ( 19UL << 16 ) | 5 )
+#define PINMUX_PA22F_TC4_WO0 ( ( 22UL << 16 ) | 5 )
+#define PINMUX_PA23F_TC4_WO1 ( ( 23UL << 16 ) | 5 )
+#define PINMUX_PA24F_TC5_WO0 ( ( 24UL << 16 ) | 5 )
+#define PINMUX_PA25F_TC5_WO1 ( ( 25UL << 16 ) | 5 )
+
+#endif /* ASF_H_ */
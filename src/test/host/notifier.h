@@ -0,0 +1,24 @@
+/**
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file notifier.h
+ *
+ * \brief Host stand-in for the system controller's error notifier, which power.c reports
+ *        to. A test defines Notifier to see what was reported.
+ */
+
+#ifndef NOTIFIER_H_
+#define NOTIFIER_H_
+
+#include <stdint.h>
+
+#define SYSTEM_POWER 0x01
+
+struct Notifier_
+{
+  void (*error)( uint8_t system, uint8_t status );
+};
+
+extern const struct Notifier_ Notifier;
+
+#endif /* NOTIFIER_H_ */
@@ -0,0 +1,50 @@
+/**
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file test.h
+ *
+ * \brief Checks for the host unit tests. A failed check prints where it failed and the
+ *        test carries on; main() returns testResult(..) so make stops on a failure.
+ */
+
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <stdio.h>
+
+static int test_checks;
+static int test_failures;
+
+#define CHECK( cond )                                                             \
+  do                                                                              \
+  {                                                                               \
+    ++test_checks;                                                                \
+    if ( !( cond ) )                                                              \
+    {                                                                             \
+      ++test_failures;                                                            \
+      printf( "%s:%d: CHECK( %s ) failed\n", __FILE__, __LINE__, #cond );         \
+    }                                                                             \
+  } while ( 0 )
+
+#define CHECK_EQ( a, b )                                                          \
+  do                                                                              \
+  {                                                                               \
+    long long check_a = (long long) ( a );                                        \
+    long long check_b = (long long) ( b );                                        \
+    ++test_checks;                                                                \
+    if ( check_a != check_b )                                                     \
+    {                                                                             \
+      ++test_failures;                                                            \
+      printf( "%s:%d: CHECK_EQ( %s, %s ) failed: %lld != %lld\n",                 \
+              __FILE__, __LINE__, #a, #b, check_a, check_b );                     \
+    }                                                                             \
+  } while ( 0 )
+
+/* exit status of a test binary: 0 if every check passed */
+static inline int testResult( const char* name )
+{
+  printf( "%s: %d checks, %d failed\n", name, test_checks, test_failures );
+  return test_failures != 0;
+}
+
+#endif /* TEST_H_ */
@@ -0,0 +1,213 @@
+/**
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file test_dshot.c
+ *
+ * \brief Host tests of the DShot output: frames against reference values, and a frame
+ *        sent by dshot_send(..) against a model of its bit clock TC, decoded back off the
+ *        pins from the pulse widths.
+ */
+
+#include <asf.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dshot.h"
+#include "dshot_model.h"
+#include "pwm.h"
+#include "test.h"
+
+Tc host_tc[6];
+Sercom host_sercom[6];
+SysTick_Type host_systick;
+
+/*
+ * The bit clock: an 8-bit TC counting 0 to top, flagging OVF as it wraps and MC0/MC1 on
+ * reaching a compare. Every flag poll costs 1 to 3 counts and every other register access
+ * 1, as a loop of a few instructions would at one count per cycle.
+ */
+static Tc* bit_tc;
+static uint32_t bit_top = 0xff, bit_cc[2], bit_count, bit_prescaler;
+static uint8_t bit_flags;
+static uint32_t clock_now;
+
+/* the pins: what is high, since when, and the pulse widths seen */
+static PortGroup pin_port;
+static uint32_t pin_level;
+static uint32_t pin_high_at[32];
+static uint32_t pin_pulses[32];
+static uint32_t pin_width[32][DSHOT_FRAME_BITS + 1];
+static bool wrong_register;
+
+static void tick( uint32_t counts )
+{
+  while ( counts-- )
+  {
+    ++clock_now;
+    bit_count = bit_count >= bit_top ? 0 : bit_count + 1;
+    if ( bit_count == 0 )         bit_flags |= TC_INTFLAG_OVF;
+    if ( bit_count == bit_cc[0] ) bit_flags |= TC_INTFLAG_MC0;
+    if ( bit_count == bit_cc[1] ) bit_flags |= TC_INTFLAG_MC1;
+  }
+}
+
+uint8_t model_read( Tc* hw )
+{
+  wrong_register |= hw != bit_tc;
+  tick( 1 + rand() % 3 );
+  return bit_flags;
+}
+
+void model_clear( Tc* hw, uint8_t flags )
+{
+  wrong_register |= hw != bit_tc;
+  tick( 1 );
+  bit_flags &= (uint8_t) ~flags;
+}
+
+void model_set( PortGroup* port, uint32_t pins )
+{
+  wrong_register |= port != &pin_port;
+  tick( 1 );
+  for ( uint32_t p = 0; p < 32; ++p )
+  {
+    if ( ( pins >> p ) & 1 && !( ( pin_level >> p ) & 1 ) )
+      pin_high_at[p] = clock_now;
+  }
+  pin_level |= pins;
+}
+
+void model_clr( PortGroup* port, uint32_t pins )
+{
+  wrong_register |= port != &pin_port;
+  tick( 1 );
+  for ( uint32_t p = 0; p < 32; ++p )
+  {
+    if ( ( pins >> p ) & 1 && ( pin_level >> p ) & 1 )
+    {
+      if ( pin_pulses[p] <= DSHOT_FRAME_BITS )
+        pin_width[p][pin_pulses[p]] = clock_now - pin_high_at[p];
+      ++pin_pulses[p];
+    }
+  }
+  pin_level &= ~pins;
+}
+
+void tc_get_config_defaults( struct tc_config* config ) { memset( config, 0, sizeof(*config) ); }
+enum status_code tc_init( struct tc_module* module, Tc* hw, const struct tc_config* config )
+{
+  module->hw    = hw;
+  bit_tc        = hw;
+  bit_top       = config->counter_8_bit.period;
+  bit_prescaler = config->clock_prescaler;
+  return STATUS_OK;
+}
+void tc_enable( struct tc_module* module ) { (void) module; }
+enum status_code tc_set_top_value( struct tc_module* module, uint32_t top )
+{
+  (void) module;
+  bit_top = top;
+  return STATUS_OK;
+}
+enum status_code tc_set_compare_value( struct tc_module* module,
+                                       enum tc_compare_capture_channel channel,
+                                       uint32_t compare )
+{
+  (void) module;
+  bit_cc[channel] = compare;
+  return STATUS_OK;
+}
+PortGroup* port_get_group_from_gpio_pin( uint8_t gpio_pin )
+{
+  return gpio_pin < 32 ? &pin_port : NULL;
+}
+
+void system_interrupt_enter_critical_section( void ) {}
+void system_interrupt_leave_critical_section( void ) {}
+
+/* value, telemetry bit, frame: the 11-bit value and the telemetry bit, then the XOR of
+ * their three nibbles */
+static void testFrames( void )
+{
+  static const struct { uint16_t value; bool telemetry; uint16_t frame; } reference[] =
+  {
+    { 1046, false, 0x82c6 },
+    { 0,    false, 0x0000 },
+    { 48,   false, 0x0606 },
+    { 2047, false, 0xffee },
+    { 1,    true,  0x0033 },
+    { 2047, true,  0xffff }
+  };
+
+  for ( uint32_t i = 0; i < sizeof(reference) / sizeof(reference[0]); ++i )
+    CHECK_EQ( dshot_frame( reference[i].value, reference[i].telemetry ), reference[i].frame );
+
+  /* bits above the value are not sent */
+  CHECK_EQ( dshot_frame( 1046 | 0x800, false ), 0x82c6 );
+}
+
+/* four pins get their frames in one pass: each decodes from its pulse widths, the widths
+ * are within the 2 counts of poll jitter of 3/8 and 3/4 of a bit, and the pins end low */
+static void testSend( void )
+{
+  static const uint8_t pins[4]    = { PWM1, PWM2, PWM7, PWM8 };
+  static const uint16_t value[4]  = { 1046, 48, 2047, 0 };
+  Dshot_buffer_t buffer;
+  uint32_t bit, start, took;
+
+  srand( 25 );
+  CHECK( dshot_init( TC3 ) );
+  CHECK_EQ( bit_prescaler, TC_CLOCK_PRESCALER_DIV1 );
+  CHECK( dshot_rate_ok( 150 ) );
+  /* at 8 MHz a DShot300 0 is too short to time */
+  CHECK( PWM_GCLK_HZ > 8000000UL || !dshot_rate_ok( 300 ) );
+
+  dshot_clear( &buffer );
+  for ( uint8_t i = 0; i < 4; ++i )
+    dshot_encode( &buffer, pins[i], dshot_frame( value[i], i == 3 ) );
+
+  start = clock_now;
+  dshot_send( 150, &buffer );
+  took = clock_now - start;
+  bit  = bit_top + 1;
+
+  CHECK( !wrong_register );
+  CHECK_EQ( bit, PWM_GCLK_HZ / 150000 );
+  CHECK( took >= ( DSHOT_FRAME_BITS + DSHOT_GAP_BITS ) * bit );
+  CHECK( took <= ( DSHOT_FRAME_BITS + DSHOT_GAP_BITS + 1 ) * bit + 4 );
+  CHECK_EQ( pin_level, 0 );
+
+  for ( uint8_t i = 0; i < 4; ++i )
+  {
+    uint16_t frame = dshot_frame( value[i], i == 3 );
+    uint16_t decoded = 0;
+    uint8_t p = pins[i];
+
+    CHECK_EQ( pin_pulses[p], DSHOT_FRAME_BITS );
+    for ( uint32_t b = 0; b < DSHOT_FRAME_BITS; ++b )
+    {
+      bool one = ( frame >> ( 15 - b ) ) & 1;
+      int32_t ideal = (int32_t) ( one ? bit * 3 / 4 : bit * 3 / 8 );
+      int32_t error = (int32_t) pin_width[p][b] - ideal;
+
+      decoded = (uint16_t) ( ( decoded << 1 ) | ( pin_width[p][b] * 2 > bit ) );
+      CHECK( error >= -2 && error <= 2 );
+    }
+    CHECK_EQ( decoded, frame );
+  }
+
+  /* nothing to send, nothing happens */
+  dshot_clear( &buffer );
+  start = clock_now;
+  dshot_send( 150, &buffer );
+  CHECK_EQ( clock_now, start );
+}
+
+int main( void )
+{
+  testFrames();
+  testSend();
+
+  return testResult( "dshot" );
+}
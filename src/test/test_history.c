@@ -0,0 +1,347 @@
+/**
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file test_history.c
+ *
+ * \brief Host tests of the telemetry history: min/max/mean decimation into 1 s and 1 min
+ *        entries, each ring wrapping around, and the pi reading a level page by page
+ *        while it gains entries.
+ */
+
+#include <asf.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "history.h"
+#include "test.h"
+
+volatile uint32_t system_time;
+
+static History_t history;
+
+/* a page taken the moment historyAdd(..) pushes an entry, as if the pi bus interrupt had
+ * come in right then */
+static bool page_on_push;
+static uint16_t push_page;
+static History_page_t pushed_page;
+
+void system_interrupt_enter_critical_section( void )
+{
+  if ( page_on_push )
+  {
+    page_on_push = false;
+    CHECK( historyPage( &history, HISTORY_LEVEL_RAW, push_page, &pushed_page ) );
+  }
+}
+void system_interrupt_leave_critical_section( void ) {}
+
+/* sample n: every reading of every module follows n, module m reads m higher */
+static void sample( uint32_t n, uint8_t modules, Power_snapshot_t* snapshot )
+{
+  memset( snapshot, 0, sizeof(Power_snapshot_t) );
+  snapshot->module_count = modules;
+  for ( uint8_t m = 0; m < modules; ++m )
+  {
+    Power_module_snapshot_t* module = &snapshot->module[m];
+
+    module->status      = POWER_OK;
+    module->vin         = (int32_t) ( 12000 + 10 * ( n + m ) );
+    module->vout        = (int32_t) ( 12000 + n + m );
+    module->iout        = (int32_t) ( n + m );
+    module->pout        = (int32_t) ( 10 * ( n + m ) );
+    module->temperature = (int32_t) ( 40000 + 10 * ( n + m ) );
+  }
+}
+
+static void add( uint32_t n, uint8_t modules )
+{
+  Power_snapshot_t snapshot;
+
+  sample( n, modules, &snapshot );
+  system_time = n;
+  historyAdd( &history, &snapshot );
+}
+
+/* entry k of a level, oldest first, straight out of memory */
+static const void* entry( const History_header_t* header, uint16_t k )
+{
+  uint16_t slot = (uint16_t) ( ( header->head + header->depth - header->count + k )
+                               % header->depth );
+  return (const uint8_t*) ( header + 1 ) + (uint32_t) slot * header->entry_size;
+}
+
+/* a second is the min, max and mean of its ten samples, a minute of its sixty seconds;
+ * a module missing from some samples is aggregated over the rest, from all of them not
+ * at all */
+static void testDecimation( void )
+{
+  const History_header_t* raw     = historyLevel( &history, HISTORY_LEVEL_RAW );
+  const History_header_t* seconds = historyLevel( &history, HISTORY_LEVEL_SECOND );
+  const History_header_t* minutes = historyLevel( &history, HISTORY_LEVEL_MINUTE );
+  const History_aggregate_t* aggregate;
+  const History_raw_t* sampled;
+  Power_snapshot_t snapshot;
+
+  historyInit( &history, 4 );
+  CHECK_EQ( raw->version, HISTORY_VERSION );
+  CHECK_EQ( raw->modules, 4 );
+  CHECK_EQ( raw->depth, HISTORY_RAW_DEPTH );
+  CHECK_EQ( raw->entry_size, sizeof(History_raw_t) );
+  CHECK_EQ( raw->period, HISTORY_RAW_PERIOD );
+  CHECK_EQ( seconds->period, 1000 );
+  CHECK_EQ( minutes->period, 60000 );
+
+  /* module 2 drops out of the first half of the second, module 3 all of it */
+  for ( uint32_t n = 0; n < HISTORY_SECOND_SAMPLES; ++n )
+  {
+    sample( n, 4, &snapshot );
+    if ( n < HISTORY_SECOND_SAMPLES / 2 )
+      snapshot.module[2].status = POWER_PMBUS;
+    snapshot.module[3].status = POWER_PMBUS;
+    historyAdd( &history, &snapshot );
+
+    CHECK_EQ( seconds->count, n == HISTORY_SECOND_SAMPLES - 1 );
+  }
+
+  /* raw readings at their channel's scale, rounded */
+  sampled = entry( raw, 0 );
+  CHECK_EQ( sampled->value[1][HISTORY_VIN], 1201 );
+  CHECK_EQ( sampled->value[1][HISTORY_VOUT], 12001 );
+  CHECK_EQ( sampled->value[1][HISTORY_POUT], 1 );
+  CHECK_EQ( sampled->value[1][HISTORY_TEMPERATURE], 4001 );
+  CHECK_EQ( sampled->value[2][HISTORY_VIN], HISTORY_INVALID );
+  CHECK_EQ( sampled->value[4][HISTORY_VIN], HISTORY_INVALID );
+
+  aggregate = entry( seconds, 0 );
+  CHECK_EQ( aggregate->stat[0][HISTORY_IOUT].min, 0 );
+  CHECK_EQ( aggregate->stat[0][HISTORY_IOUT].max, 9 );
+  CHECK_EQ( aggregate->stat[0][HISTORY_IOUT].mean, 5 );  /* 4.5, rounded */
+  CHECK_EQ( aggregate->stat[1][HISTORY_VOUT].min, 12001 );
+  CHECK_EQ( aggregate->stat[1][HISTORY_VOUT].max, 12010 );
+  CHECK_EQ( aggregate->stat[1][HISTORY_VOUT].mean, 12006 );
+  CHECK_EQ( aggregate->stat[2][HISTORY_IOUT].min, 7 );
+  CHECK_EQ( aggregate->stat[2][HISTORY_IOUT].max, 11 );
+  CHECK_EQ( aggregate->stat[2][HISTORY_IOUT].mean, 9 );
+  CHECK_EQ( aggregate->stat[3][HISTORY_IOUT].mean, HISTORY_INVALID );
+  CHECK_EQ( aggregate->stat[3][HISTORY_IOUT].min, HISTORY_INVALID );
+  CHECK_EQ( aggregate->stat[4][HISTORY_IOUT].mean, HISTORY_INVALID );
+
+  /* the rest of the minute with every module there */
+  for ( uint32_t n = HISTORY_SECOND_SAMPLES;
+        n < HISTORY_SECOND_SAMPLES * HISTORY_MINUTE_SECONDS; ++n )
+  {
+    add( n, 4 );
+    CHECK_EQ( minutes->count, n == HISTORY_SECOND_SAMPLES * HISTORY_MINUTE_SECONDS - 1 );
+  }
+  CHECK_EQ( seconds->written, HISTORY_MINUTE_SECONDS );
+  CHECK_EQ( minutes->timestamp, HISTORY_SECOND_SAMPLES * HISTORY_MINUTE_SECONDS - 1 );
+
+  /* second s has its mean at 10 s + 5, the minute the mean of those */
+  aggregate = entry( minutes, 0 );
+  CHECK_EQ( aggregate->stat[0][HISTORY_IOUT].min, 0 );
+  CHECK_EQ( aggregate->stat[0][HISTORY_IOUT].max, 599 );
+  CHECK_EQ( aggregate->stat[0][HISTORY_IOUT].mean, 300 );
+  CHECK_EQ( aggregate->stat[0][HISTORY_VIN].min, 1200 );
+  CHECK_EQ( aggregate->stat[0][HISTORY_VIN].max, 1799 );
+
+  /* module 3 came back after the first second, which it is left out of */
+  CHECK_EQ( aggregate->stat[3][HISTORY_IOUT].min, 13 );
+  CHECK_EQ( aggregate->stat[3][HISTORY_IOUT].max, 602 );
+  CHECK_EQ( aggregate->stat[3][HISTORY_IOUT].mean, 308 );
+  CHECK_EQ( aggregate->stat[4][HISTORY_IOUT].mean, HISTORY_INVALID );
+}
+
+/* each ring keeps its newest depth - 1 entries, oldest first from head - count on */
+static void testWraparound( void )
+{
+  const History_header_t* raw     = historyLevel( &history, HISTORY_LEVEL_RAW );
+  const History_header_t* seconds = historyLevel( &history, HISTORY_LEVEL_SECOND );
+  const History_header_t* minutes = historyLevel( &history, HISTORY_LEVEL_MINUTE );
+  const uint32_t samples = HISTORY_SECOND_SAMPLES * HISTORY_MINUTE_SECONDS *
+                           ( HISTORY_MINUTE_DEPTH + 3 ) + 7;
+  const History_aggregate_t* aggregate;
+
+  historyInit( &history, 2 );
+  for ( uint32_t n = 0; n < samples; ++n )
+    add( n, 2 );
+
+  CHECK_EQ( raw->written, samples );
+  CHECK_EQ( raw->count, HISTORY_RAW_DEPTH - 1 );
+  CHECK_EQ( raw->head, samples % HISTORY_RAW_DEPTH );
+  for ( uint16_t k = 0; k < raw->count; ++k )
+  {
+    const History_raw_t* sampled = entry( raw, k );
+    CHECK_EQ( sampled->value[0][HISTORY_VOUT], 12000 + samples - raw->count + k );
+  }
+
+  CHECK_EQ( seconds->written, samples / HISTORY_SECOND_SAMPLES );
+  CHECK_EQ( seconds->count, HISTORY_SECOND_DEPTH - 1 );
+  for ( uint16_t k = 0; k < seconds->count; ++k )
+  {
+    uint32_t first = ( seconds->written - seconds->count + k ) * HISTORY_SECOND_SAMPLES;
+    aggregate = entry( seconds, k );
+    CHECK_EQ( aggregate->stat[1][HISTORY_VOUT].min, 12000 + first + 1 );
+    CHECK_EQ( aggregate->stat[1][HISTORY_VOUT].max,
+              12000 + first + HISTORY_SECOND_SAMPLES );
+  }
+
+  CHECK_EQ( minutes->written, HISTORY_MINUTE_DEPTH + 3 );
+  CHECK_EQ( minutes->count, HISTORY_MINUTE_DEPTH - 1 );
+  CHECK_EQ( minutes->head, ( HISTORY_MINUTE_DEPTH + 3 ) % HISTORY_MINUTE_DEPTH );
+  for ( uint16_t k = 0; k < minutes->count; ++k )
+  {
+    uint32_t first = ( minutes->written - minutes->count + k ) *
+                     HISTORY_SECOND_SAMPLES * HISTORY_MINUTE_SECONDS;
+    aggregate = entry( minutes, k );
+    CHECK_EQ( aggregate->stat[0][HISTORY_VOUT].min, 12000 + first );
+    CHECK_EQ( aggregate->stat[0][HISTORY_VOUT].max,
+              12000 + first + HISTORY_SECOND_SAMPLES * HISTORY_MINUTE_SECONDS - 1 );
+  }
+}
+
+/* pages tile a level's image, the first one its header */
+static void testPages( void )
+{
+  const History_header_t* seconds = historyLevel( &history, HISTORY_LEVEL_SECOND );
+  uint32_t size = historyLevelSize( seconds );
+  uint16_t pages = (uint16_t) ( ( size + HISTORY_PAGE_DATA - 1 ) / HISTORY_PAGE_DATA );
+  uint8_t image[sizeof(history.seconds)];
+  History_page_t page;
+  uint32_t offset = 0;
+
+  CHECK_EQ( size, sizeof(history.seconds) );
+
+  for ( uint16_t p = 0; p < pages; ++p )
+  {
+    CHECK( historyPage( &history, HISTORY_LEVEL_SECOND, p, &page ) );
+    CHECK_EQ( page.level, HISTORY_LEVEL_SECOND );
+    CHECK_EQ( page.page, p );
+    CHECK_EQ( page.pages, pages );
+    CHECK_EQ( page.written, seconds->written );
+    CHECK_EQ( page.head, seconds->head );
+    CHECK_EQ( page.length, p < pages - 1 ? HISTORY_PAGE_DATA : size - offset );
+    memcpy( &image[offset], page.data, page.length );
+    offset += page.length;
+  }
+  CHECK_EQ( offset, size );
+  CHECK( memcmp( image, seconds, size ) == 0 );
+
+  CHECK( historyPage( &history, HISTORY_LEVEL_SECOND, 0, &page ) );
+  CHECK( memcmp( page.data, seconds, sizeof(History_header_t) ) == 0 );
+
+  CHECK( !historyPage( &history, HISTORY_LEVEL_SECOND, pages, &page ) );
+  CHECK( !historyPage( &history, HISTORY_LEVEL_MINUTE + 1, 0, &page ) );
+}
+
+/* a page into the image of the raw level; the slots from the header's head up to the
+ * page's head have been rewritten since the header was taken */
+static void keepPage( uint8_t* image, bool* stale, const History_header_t* header,
+                      const History_page_t* page )
+{
+  memcpy( &image[(uint32_t) page->page * HISTORY_PAGE_DATA], page->data, page->length );
+
+  for ( uint32_t s = 0; s <= page->written - header->written && s < header->depth; ++s )
+    stale[( header->head + s ) % header->depth] = true;
+}
+
+/* The pi reads the raw level a page at a time while samples keep coming in, each page
+ * possibly as historyAdd(..) is about to push. Dropping the slots the pages' written
+ * and head say were rewritten leaves only entries that are whole and in order. */
+static void testPagedRead( void )
+{
+  const History_header_t* raw = historyLevel( &history, HISTORY_LEVEL_RAW );
+  const uint16_t per_entry = sizeof(History_raw_t);
+  uint32_t n = 0, kept = 0, dropped = 0, torn = 0;
+
+  historyInit( &history, POWER_MODULE_MAX );
+  for ( ; n < 3 * HISTORY_RAW_DEPTH; ++n )
+    add( n, POWER_MODULE_MAX );
+
+  for ( uint32_t round = 0; round < 8; ++round )
+  {
+    uint8_t image[sizeof(history.raw)];
+    bool stale[HISTORY_RAW_DEPTH] = { false };
+    History_header_t header;
+    History_page_t page;
+    uint16_t pages;
+
+    /* the header, taken just before a push, when the slot at head is freshly written */
+    push_page    = 0;
+    page_on_push = true;
+    add( n++, POWER_MODULE_MAX );
+    CHECK( !page_on_push );
+    page = pushed_page;
+    memcpy( &header, page.data, sizeof(header) );
+    CHECK_EQ( page.written, header.written );
+    CHECK_EQ( page.head, header.head );
+    CHECK_EQ( header.written + 1, raw->written );
+    pages = page.pages;
+
+    for ( uint16_t p = 1; p < pages; ++p )
+    {
+      /* a sample now and then between pages; every so often the pi also gets the page
+       * the sample is going into, just before it is pushed */
+      if ( ( p + round ) % 16 == 0 )
+        add( n++, POWER_MODULE_MAX );
+      if ( ( p + round ) % 13 == 0 )
+      {
+        push_page    = (uint16_t) ( ( sizeof(History_header_t) + raw->head * per_entry )
+                                    / HISTORY_PAGE_DATA );
+        page_on_push = true;
+        add( n++, POWER_MODULE_MAX );
+        keepPage( image, stale, &header, &pushed_page );
+      }
+
+      CHECK( historyPage( &history, HISTORY_LEVEL_RAW, p, &page ) );
+      keepPage( image, stale, &header, &page );
+    }
+
+    /* and last, with nothing after it to say the slot has changed */
+    push_page    = (uint16_t) ( ( sizeof(History_header_t) + raw->head * per_entry )
+                                / HISTORY_PAGE_DATA );
+    page_on_push = true;
+    add( n++, POWER_MODULE_MAX );
+    keepPage( image, stale, &header, &pushed_page );
+
+    for ( uint16_t k = 0; k < header.count; ++k )
+    {
+      uint16_t slot = (uint16_t) ( ( header.head + header.depth - header.count + k )
+                                   % header.depth );
+      History_raw_t sampled;
+      uint32_t expect = header.written - header.count + k;
+      bool whole;
+
+      memcpy( &sampled, &image[sizeof(History_header_t) + (uint32_t) slot * per_entry],
+              per_entry );
+      whole = sampled.value[0][HISTORY_VOUT] == (int16_t) ( 12000 + expect ) &&
+              sampled.value[POWER_MODULE_MAX - 1][HISTORY_TEMPERATURE] ==
+                (int16_t) ( 4000 + expect + POWER_MODULE_MAX - 1 );
+
+      if ( stale[slot] )
+      {
+        ++dropped;
+        torn += !whole;
+        continue;
+      }
+      ++kept;
+      CHECK( whole );
+    }
+  }
+
+  printf( "paged reads: %u entries kept, %u dropped, %u of those torn\n", kept, dropped, torn );
+
+  /* the rule had something to do, and did not throw everything away */
+  CHECK( torn > 0 );
+  CHECK( dropped >= torn );
+  CHECK( kept > dropped );
+}
+
+int main( void )
+{
+  testDecimation();
+  testWraparound();
+  testPages();
+  testPagedRead();
+
+  return testResult( "history" );
+}
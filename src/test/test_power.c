@@ -0,0 +1,882 @@
+/**
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file test_power.c
+ *
+ * \brief Host tests of the power controller: the LINEAR11/LINEAR16 codec against a
+ *        floating point reference over every word, the current sharing loop against
+ *        a model of six converters in parallel, and SMBALERT# handling. The codec is
+ *        also timed against the floating point decode it replaced, and the bus
+ *        transactions of a snapshot sweep counted against register-by-register reads.
+ *        The power sequencer runs on the host scheduler: staggering, the inrush limit,
+ *        and switchOn/switchOff cancelling each other.
+ */
+
+#include <asf.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "defs.h"
+#include "notifier.h"
+#include "power.h"
+#include "smbus.h"
+#include "test.h"
+
+/* the codec, not part of power.h */
+int32_t power_decodeLinear11( uint16_t word );
+int32_t power_decodeLinear16( uint16_t word, int8_t exp );
+uint16_t power_encodeLinear11( int32_t value );
+uint16_t power_encodeLinear16( int32_t value, int8_t exp );
+
+#define MODULES 6
+
+/* PMBus commands the model answers, as power.c numbers them */
+#define REG_CLEAR_FAULTS 0x03
+#define REG_VOUT_MODE    0x20
+#define REG_VOUT_TRIM    0x22
+#define REG_STATUS_WORD  0x79
+#define REG_STATUS_IOUT  0x7b
+#define REG_READ_VIN     0x88
+#define REG_READ_VOUT    0x8b
+#define REG_READ_IOUT    0x8c
+#define REG_READ_TEMPERATURE_1 0x8d
+#define PMBUS_ARA        0x0c
+
+/* STATUS_WORD and STATUS_IOUT bits the model raises */
+#define STATUS_IOUT          0x4000
+#define STATUS_IOUT_OC_WARN  0x20
+#define STATUS_IOUT_OC_FAULT 0x80
+
+/* VOUT_MODE of the model converters: LINEAR16, exponent -9 */
+#define MODEL_VOUT_MODE 0x17
+#define MODEL_VOUT_EXP  -9
+
+/* VOUT_TRIM of each model converter, in V */
+static double model_trim[MODULES];
+static uint32_t trim_writes;
+static uint8_t trim_nak;   /* address refusing VOUT_TRIM writes, 0 for none */
+static uint32_t notified;
+
+/* SMBALERT#: the modules pulling it low, the STATUS_IOUT each reports, and a command the
+ * bus fails for, 0 for none */
+static uint8_t alerting;
+static uint8_t model_status_iout[MODULES];
+static uint8_t fail_cmd;
+
+/* the sequencer's view: a module reads 48 V in, and once its enable pin (its index) is
+ * high, 12 V out and its inrush current; every switch is logged */
+#define SWITCH_LOG 64
+
+typedef struct Switch_t
+{
+  uint8_t  module;
+  bool     on;
+  uint32_t time;
+} Switch_t;
+
+static bool model_on[MODULES];
+static int32_t model_inrush[MODULES]; /* mA */
+static Switch_t switches[SWITCH_LOG];
+static uint32_t switch_count;
+
+static uint16_t modelReading( uint8_t address, uint8_t cmd )
+{
+  uint8_t i = (uint8_t) ( address - 1 );
+
+  if ( address < 1 || address > MODULES )
+    return 0;
+
+  switch ( cmd )
+  {
+    case REG_STATUS_WORD: return model_status_iout[i] ? STATUS_IOUT : 0;
+    case REG_READ_VIN:    return power_encodeLinear11( 48000 );
+    case REG_READ_VOUT:   return model_on[i] ? power_encodeLinear16( 12000, MODEL_VOUT_EXP ) : 0;
+    case REG_READ_IOUT:   return power_encodeLinear11( model_on[i] ? model_inrush[i] : 0 );
+    default:              return 0;
+  }
+}
+
+/* transactions on the wire, START to STOP; split_reads models the bus before combined
+ * reads, a STOP after the command and a second transaction for the data */
+static uint32_t bus_transactions;
+static bool split_reads;
+
+static void countRead( void )
+{
+  bus_transactions += split_reads ? 2 : 1;
+}
+
+static enum status_code modelReadByte( struct i2c_master_module *const module,
+                                       uint8_t address, uint8_t* data )
+{
+  (void) module;
+  if ( address != PMBUS_ARA || alerting == 0 )
+    return STATUS_ERR_BAD_ADDRESS;
+
+  /* the lowest address wins arbitration */
+  for ( uint8_t i = 0; ; ++i )
+  {
+    if ( alerting & ( 1 << i ) )
+    {
+      *data = (uint8_t) ( ( i + 1 ) << 1 );
+      return STATUS_OK;
+    }
+  }
+}
+
+static enum status_code modelReadByteData( struct i2c_master_module *const module,
+                                           uint8_t address, uint8_t cmd, uint8_t* data )
+{
+  (void) module;
+  countRead();
+  if ( cmd == fail_cmd )
+    return STATUS_ERR_TIMEOUT;
+  if ( cmd == REG_STATUS_IOUT && address >= 1 && address <= MODULES )
+    *data = model_status_iout[address - 1];
+  else
+    *data = cmd == REG_VOUT_MODE ? MODEL_VOUT_MODE : 0;
+  return STATUS_OK;
+}
+
+static enum status_code modelReadWordData( struct i2c_master_module *const module,
+                                           uint8_t address, uint8_t cmd, uint16_t* data )
+{
+  (void) module;
+  countRead();
+  if ( cmd == fail_cmd )
+    return STATUS_ERR_TIMEOUT;
+  *data = modelReading( address, cmd );
+  return STATUS_OK;
+}
+
+static enum status_code modelWriteByte( struct i2c_master_module *const module,
+                                        uint8_t address, uint8_t data )
+{
+  (void) module;
+  if ( data == fail_cmd )
+    return STATUS_ERR_TIMEOUT;
+  if ( data == REG_CLEAR_FAULTS && address >= 1 && address <= MODULES )
+  {
+    alerting &= (uint8_t) ~( 1 << ( address - 1 ) );
+    model_status_iout[address - 1] = 0;
+  }
+  return STATUS_OK;
+}
+
+static enum status_code modelWriteWordData( struct i2c_master_module *const module,
+                                            uint8_t address, uint8_t cmd, uint16_t data )
+{
+  (void) module;
+  if ( address == trim_nak )
+    return STATUS_ERR_BAD_ADDRESS;
+  if ( cmd == REG_VOUT_TRIM && address >= 1 && address <= MODULES )
+  {
+    model_trim[address - 1] = ldexp( (int16_t) data, MODEL_VOUT_EXP );
+    ++trim_writes;
+  }
+  return STATUS_OK;
+}
+
+/* a queued read runs at once, as one combined transaction */
+static enum status_code modelSubmit( struct i2c_master_module *const module,
+                                     SMBus_transaction* transaction )
+{
+  uint32_t before = bus_transactions;
+  uint16_t word = 0;
+
+  if ( transaction->read_length == 1 )
+    transaction->status = modelReadByteData( module, transaction->address,
+                                             transaction->write_data[0],
+                                             transaction->read_data );
+  else
+  {
+    transaction->status = modelReadWordData( module, transaction->address,
+                                             transaction->write_data[0], &word );
+    transaction->read_data[0] = (uint8_t) word;
+    transaction->read_data[1] = (uint8_t) ( word >> 8 );
+  }
+  /* one combined transaction, split_reads or not */
+  bus_transactions = before + 1;
+
+  return STATUS_OK;
+}
+
+static enum status_code modelWait( SMBus_transaction* transaction )
+{
+  return transaction->status;
+}
+
+static bool modelHasPEC( struct i2c_master_module *const module, uint8_t address )
+{
+  (void) module;
+  (void) address;
+  return false;
+}
+
+const struct SMBus_ SMBus =
+{
+  .writeByte     = modelWriteByte,
+  .readByte      = modelReadByte,
+  .readByteData  = modelReadByteData,
+  .writeWordData = modelWriteWordData,
+  .readWordData  = modelReadWordData,
+  .hasPEC        = modelHasPEC,
+  .submit        = modelSubmit,
+  .wait          = modelWait,
+};
+
+static void notifyError( uint8_t system, uint8_t status )
+{
+  (void) system;
+  (void) status;
+  ++notified;
+}
+
+const struct Notifier_ Notifier = { notifyError };
+
+/* the enable pins, one per module */
+void port_get_config_defaults( struct port_config* config ) { (void) config; }
+void port_pin_set_config( uint8_t gpio_pin, const struct port_config* config )
+{
+  (void) gpio_pin;
+  (void) config;
+}
+void port_pin_set_output_level( uint8_t gpio_pin, bool level )
+{
+  if ( gpio_pin >= MODULES )
+    return;
+  if ( model_on[gpio_pin] != level && switch_count < SWITCH_LOG )
+    switches[switch_count++] = (Switch_t) { gpio_pin, level, system_time };
+  model_on[gpio_pin] = level;
+}
+
+/* value of a word in milli-units, rounded half up like the firmware, saturated */
+static int64_t reference( int32_t mantissa, int exp )
+{
+  double milli = floor( ldexp( mantissa, exp ) * 1000.0 + 0.5 );
+
+  if ( milli > INT32_MAX ) return INT32_MAX;
+  if ( milli < INT32_MIN ) return INT32_MIN;
+  return (int64_t) milli;
+}
+
+/* every LINEAR11 word decodes to its value, and re-encodes to within rounding of it */
+static void testLinear11( void )
+{
+  uint32_t wrong = 0, drift = 0;
+
+  for ( uint32_t w = 0; w < 0x10000; ++w )
+  {
+    int exp      = (int16_t) w >> 11;
+    int mantissa = (int16_t) ( w << 5 ) >> 5;
+    int32_t value = power_decodeLinear11( (uint16_t) w );
+    int32_t again;
+    int64_t step;
+
+    if ( value != reference( mantissa, exp ) )
+    {
+      if ( wrong++ < 4 )
+        printf( "LINEAR11 %04x: %d, not %lld\n", w, value, (long long) reference( mantissa, exp ) );
+    }
+
+    /* saturated values have nothing to come back to */
+    if ( value == INT32_MAX || value == INT32_MIN )
+      continue;
+
+    /* the encoder may pick a finer exponent, off by at most half its step and the
+     * rounding to milli-units */
+    again = power_decodeLinear11( power_encodeLinear11( value ) );
+    step  = exp >= -10 ? ( 1000LL << ( exp + 10 ) ) >> 10 : 1;
+    if ( llabs( (int64_t) again - value ) > step / 2 + 1 )
+    {
+      if ( drift++ < 4 )
+        printf( "LINEAR11 %04x: %d came back as %d\n", w, value, again );
+    }
+  }
+
+  CHECK_EQ( wrong, 0 );
+  CHECK_EQ( drift, 0 );
+
+  /* the firmware's own set points */
+  CHECK_EQ( power_decodeLinear11( power_encodeLinear11( 48000 ) ), 48000 );
+  CHECK_EQ( power_decodeLinear11( power_encodeLinear11( -2500 ) ), -2500 );
+  CHECK_EQ( power_decodeLinear11( power_encodeLinear11( 0 ) ), 0 );
+}
+
+/* every LINEAR16 word at every exponent decodes to its value; where a step is at least a
+ * milli-unit it re-encodes to the same word, elsewhere to within a milli-unit */
+static void testLinear16( void )
+{
+  uint32_t wrong = 0, drift = 0;
+
+  for ( int exp = -16; exp <= 15; ++exp )
+  {
+    for ( uint32_t w = 0; w < 0x10000; ++w )
+    {
+      int32_t value = power_decodeLinear16( (uint16_t) w, (int8_t) exp );
+      uint16_t word;
+
+      if ( value != reference( (int32_t) w, exp ) )
+      {
+        if ( wrong++ < 4 )
+          printf( "LINEAR16 %04x, 2^%d: %d\n", w, exp, value );
+      }
+
+      if ( value == INT32_MAX )
+        continue;
+
+      word = power_encodeLinear16( value, (int8_t) exp );
+      if ( exp >= MODEL_VOUT_EXP ? word != w
+                                 : abs( power_decodeLinear16( word, (int8_t) exp ) - value ) > 1 )
+      {
+        if ( drift++ < 4 )
+          printf( "LINEAR16 %04x, 2^%d: %d came back as %04x\n", w, exp, value, word );
+      }
+    }
+  }
+
+  CHECK_EQ( wrong, 0 );
+  CHECK_EQ( drift, 0 );
+
+  CHECK_EQ( power_encodeLinear16( 12000, MODEL_VOUT_EXP ), 12 * 512 );
+  CHECK_EQ( power_encodeLinear16( -1, MODEL_VOUT_EXP ), 0 );
+  CHECK_EQ( power_encodeLinear16( INT32_MAX, MODEL_VOUT_EXP ), 0xffff );
+}
+
+/* rounds of all 65536 words for the codec timing */
+#define CODEC_BENCH_ROUNDS 50
+
+/* the decodes the integer codec replaced: powl() and pow() through soft float on the
+ * M0+, with the mantissa sign extended properly */
+static double floatLinear11( uint16_t word )
+{
+  int8_t  n = (int16_t) word >> 11;
+  int16_t y = (int16_t) ( word << 5 ) >> 5;
+  return (double) ( y * powl( 2, n ) );
+}
+
+static double floatLinear16( uint16_t word, int8_t exp )
+{
+  return word * pow( 2, exp );
+}
+
+static double elapsedNs( const struct timespec* start )
+{
+  struct timespec end;
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  return ( end.tv_sec - start->tv_sec ) * 1e9 + ( end.tv_nsec - start->tv_nsec );
+}
+
+/* both decodes over every word; the host has a hardware FPU, so the ratio here is well
+ * short of the soft float one on the part */
+static void testCodecCost( void )
+{
+  /* read afresh for each word, as the firmware takes it from its cache, so neither path
+   * gets its scaling hoisted out of the loop */
+  static volatile int8_t exp = MODEL_VOUT_EXP;
+  const double words = (double) CODEC_BENCH_ROUNDS * 0x10000;
+  volatile int64_t sink_int = 0;
+  volatile double sink_float = 0;
+  struct timespec start;
+  double int11, float11, int16, float16;
+  int64_t sum = 0;
+  double fsum = 0;
+  uint32_t apart = 0;
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( uint32_t r = 0; r < CODEC_BENCH_ROUNDS; ++r )
+    for ( uint32_t w = 0; w < 0x10000; ++w )
+      sum += power_decodeLinear11( (uint16_t) w );
+  int11 = elapsedNs( &start ) / words;
+  sink_int = sum;
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( uint32_t r = 0; r < CODEC_BENCH_ROUNDS; ++r )
+    for ( uint32_t w = 0; w < 0x10000; ++w )
+      fsum += floatLinear11( (uint16_t) w );
+  float11 = elapsedNs( &start ) / words;
+  sink_float = fsum;
+
+  sum = 0;
+  fsum = 0;
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( uint32_t r = 0; r < CODEC_BENCH_ROUNDS; ++r )
+    for ( uint32_t w = 0; w < 0x10000; ++w )
+      sum += power_decodeLinear16( (uint16_t) w, exp );
+  int16 = elapsedNs( &start ) / words;
+  sink_int = sum;
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( uint32_t r = 0; r < CODEC_BENCH_ROUNDS; ++r )
+    for ( uint32_t w = 0; w < 0x10000; ++w )
+      fsum += floatLinear16( (uint16_t) w, exp );
+  float16 = elapsedNs( &start ) / words;
+  sink_float = fsum;
+
+  (void) sink_int;
+  (void) sink_float;
+  printf( "LINEAR11 decode: integer %.2f ns, float %.2f ns (%.1fx)\n", int11, float11,
+          float11 / int11 );
+  printf( "LINEAR16 decode: integer %.2f ns, float %.2f ns (%.1fx)\n", int16, float16,
+          float16 / int16 );
+
+  /* what was timed agrees to the milli-unit, short of saturation */
+  for ( uint32_t w = 0; w < 0x10000; ++w )
+  {
+    int32_t value = power_decodeLinear11( (uint16_t) w );
+    if ( value != INT32_MAX && value != INT32_MIN
+         && fabs( floatLinear11( (uint16_t) w ) * 1000.0 - value ) > 0.5 )
+      ++apart;
+    if ( fabs( floatLinear16( (uint16_t) w, exp ) * 1000.0
+               - power_decodeLinear16( (uint16_t) w, exp ) ) > 0.5 )
+      ++apart;
+  }
+  CHECK_EQ( apart, 0 );
+}
+
+/*
+ * Six converters at 12 V with a spread of set point errors and output resistances, all
+ * feeding one bus: the current of each is (12 + offset + trim - bus) / R, and the bus
+ * settles where the currents add up to the load.
+ */
+static double model_offset[MODULES] = { 0.05, -0.03, 0.02, -0.06, 0.0, 0.04 };
+static const double model_r[MODULES]      = { 0.010, 0.012, 0.009, 0.011, 0.013, 0.010 };
+
+static double modelSnapshot( double load, Power_snapshot_t* snapshot )
+{
+  double num = 0, den = 0, bus, low = 1e9, high = -1e9;
+
+  for ( int i = 0; i < MODULES; ++i )
+  {
+    num += ( 12.0 + model_offset[i] + model_trim[i] ) / model_r[i];
+    den += 1.0 / model_r[i];
+  }
+  bus = ( num - load ) / den;
+
+  snapshot->module_count = MODULES;
+  snapshot->valid_count  = MODULES;
+  snapshot->iout         = 0;
+  for ( int i = 0; i < MODULES; ++i )
+  {
+    double current = ( 12.0 + model_offset[i] + model_trim[i] - bus ) / model_r[i];
+
+    snapshot->module[i].status = POWER_OK;
+    snapshot->module[i].iout   = (int32_t) lround( current * 1000.0 );
+    snapshot->iout            += snapshot->module[i].iout;
+    if ( current < low )  low  = current;
+    if ( current > high ) high = current;
+  }
+
+  return high - low;
+}
+
+static void testBalance( void )
+{
+  static uint8_t address[MODULES] = { 1, 2, 3, 4, 5, 6 };
+  static bool state[MODULES];
+  Power_t pc = { .status = POWER_OK, .module_count = MODULES, .power_state = state,
+                 .module_addr = address };
+  Power_snapshot_t snapshot = { 0 };
+  double spread, start;
+  uint32_t writes;
+  int32_t kept;
+
+  /* light load is left alone */
+  modelSnapshot( MODULES * POWER_BALANCE_MIN_LOAD / 2, &snapshot );
+  CHECK_EQ( power_balance( &pc, &snapshot ), POWER_OK );
+  CHECK_EQ( trim_writes, 0 );
+
+  start = spread = modelSnapshot( 60.0, &snapshot );
+  for ( int step = 0; step < 60; ++step )
+  {
+    int32_t before[MODULES];
+
+    for ( int i = 0; i < MODULES; ++i )
+      before[i] = pc.vout_trim[i];
+    CHECK_EQ( power_balance( &pc, &snapshot ), POWER_OK );
+
+    for ( int i = 0; i < MODULES; ++i )
+    {
+      CHECK( abs( pc.vout_trim[i] - before[i] ) <= POWER_MILLI( POWER_TRIM_STEP ) );
+      CHECK( abs( pc.vout_trim[i] ) <= POWER_MILLI( POWER_TRIM_MAX ) );
+      CHECK( fabs( model_trim[i] * 1000.0 - pc.vout_trim[i] ) < 2.0 );
+    }
+    spread = modelSnapshot( 60.0, &snapshot );
+  }
+
+  CHECK( start > 4 * POWER_BALANCE_BAND );
+  CHECK( spread <= 2 * POWER_BALANCE_BAND + 0.1 );
+
+  /* balanced: hardly anything more to write */
+  writes = trim_writes;
+  power_balance( &pc, &snapshot );
+  modelSnapshot( 60.0, &snapshot );
+  power_balance( &pc, &snapshot );
+  CHECK( trim_writes - writes <= 2 );
+
+  /* a module without valid telemetry keeps its trim */
+  snapshot.module[0].status = POWER_PMBUS;
+  snapshot.module[0].iout   = 0;
+  snapshot.valid_count      = MODULES - 1;
+  kept = pc.vout_trim[0];
+  power_balance( &pc, &snapshot );
+  CHECK_EQ( pc.vout_trim[0], kept );
+  CHECK_EQ( notified, 0 );
+
+  /* a refused trim write is returned, the rail stays POWER_OK and the loop goes on */
+  model_offset[1] += 0.3;
+  modelSnapshot( 60.0, &snapshot );
+  kept     = pc.vout_trim[1];
+  trim_nak = 2;
+  CHECK_EQ( power_balance( &pc, &snapshot ), POWER_PMBUS );
+  CHECK_EQ( pc.status, POWER_OK );
+  CHECK_EQ( pc.vout_trim[1], kept );
+  trim_nak = 0;
+  CHECK_EQ( power_balance( &pc, &snapshot ), POWER_OK );
+  CHECK( pc.vout_trim[1] < kept );
+  #ifdef DEBUG_MODE
+    CHECK_EQ( notified, 1 );
+  #endif /* DEBUG_MODE */
+}
+
+/* a bus error while serving SMBALERT# is kept in the module's fault record and returned,
+ * the rail is left as it is; only a real fault takes it down */
+static void testAlert( void )
+{
+  static uint8_t address[MODULES] = { 1, 2, 3, 4, 5, 6 };
+  static uint8_t enable[MODULES];
+  static bool state[MODULES] = { true, true, true, true, true, true };
+  Power_t pc = { .status = POWER_OK, .module_count = MODULES, .power_state = state,
+                 .module_addr = address, .enable_pin = enable };
+
+  /* a warning whose STATUS_IOUT can not be read: left alerting, to be asked again */
+  alerting = 1 << 2;
+  model_status_iout[2] = STATUS_IOUT_OC_WARN;
+  fail_cmd = REG_STATUS_IOUT;
+  CHECK_EQ( power_handleAlert( &pc ), POWER_PMBUS );
+  CHECK_EQ( pc.status, POWER_OK );
+  CHECK_EQ( pc.fault[2].bus, POWER_PMBUS );
+  CHECK_EQ( alerting, 1 << 2 );
+
+  fail_cmd = 0;
+  CHECK_EQ( power_handleAlert( &pc ), POWER_OK );
+  CHECK_EQ( pc.status, POWER_OK );
+  CHECK_EQ( pc.fault[2].bus, POWER_OK );
+  CHECK_EQ( pc.fault[2].iout, STATUS_IOUT_OC_WARN );
+  CHECK_EQ( pc.fault[2].status, POWER_OK );
+  CHECK_EQ( alerting, 0 );
+
+  /* STATUS_WORD and CLEAR_FAULTS failing alike */
+  alerting = 1 << 4;
+  fail_cmd = REG_STATUS_WORD;
+  CHECK_EQ( power_handleAlert( &pc ), POWER_PMBUS );
+  CHECK_EQ( pc.status, POWER_OK );
+  CHECK_EQ( pc.fault[4].bus, POWER_PMBUS );
+
+  fail_cmd = REG_CLEAR_FAULTS;
+  CHECK_EQ( power_handleAlert( &pc ), POWER_PMBUS );
+  CHECK_EQ( pc.status, POWER_OK );
+  CHECK_EQ( pc.fault[4].bus, POWER_PMBUS );
+  CHECK_EQ( alerting, 1 << 4 );
+
+  fail_cmd = 0;
+  CHECK_EQ( power_handleAlert( &pc ), POWER_OK );
+  CHECK_EQ( alerting, 0 );
+  for ( int i = 0; i < MODULES; ++i )
+    CHECK( state[i] );
+
+  /* an over-current fault shuts the rail down */
+  alerting = 1 << 1;
+  model_status_iout[1] = STATUS_IOUT_OC_FAULT;
+  CHECK_EQ( power_handleAlert( &pc ), POWER_OVERLIMIT );
+  CHECK_EQ( pc.status, POWER_OVERLIMIT );
+  CHECK_EQ( pc.fault[1].status, POWER_OVERLIMIT );
+  for ( int i = 0; i < MODULES; ++i )
+    CHECK( !state[i] );
+}
+
+/* a sweep register by register, as balanceTask and the pi bus used to take it */
+static uint32_t registerSweep( Power_t* pc )
+{
+  uint32_t before = bus_transactions;
+  int32_t value;
+
+  CHECK_EQ( power_getVin( pc, &value ), POWER_OK );
+  CHECK_EQ( power_getVout( pc, &value ), POWER_OK );
+  CHECK_EQ( power_getIout( pc, &value ), POWER_OK );
+  CHECK_EQ( power_getPout( pc, &value ), POWER_OK );
+  for ( uint8_t i = 0; i < pc->module_count; ++i )
+    CHECK_EQ( power_readModule( pc, i, REG_READ_TEMPERATURE_1, &value ), POWER_OK );
+
+  return bus_transactions - before;
+}
+
+/* the snapshot takes at most half the transactions of the register-by-register sweep it
+ * replaced, and no more than the getters take today */
+static void testSnapshotTransactions( void )
+{
+  static uint8_t address[MODULES] = { 1, 2, 3, 4, 5, 6 };
+  static bool state[MODULES];
+  Power_t pc = { .status = POWER_OK, .module_count = MODULES, .power_state = state,
+                 .module_addr = address };
+  Power_snapshot_t snapshot;
+  uint32_t before, first, cached, baseline, getters;
+
+  /* the first sweep reads VOUT_MODE too, later ones have it cached */
+  before = bus_transactions;
+  CHECK_EQ( power_snapshot( &pc, &snapshot ), POWER_OK );
+  first = bus_transactions - before;
+  CHECK_EQ( snapshot.transactions, first );
+  CHECK_EQ( first, 6 * MODULES );
+
+  before = bus_transactions;
+  CHECK_EQ( power_snapshot( &pc, &snapshot ), POWER_OK );
+  cached = bus_transactions - before;
+  CHECK_EQ( snapshot.transactions, cached );
+  CHECK_EQ( cached, 5 * MODULES );
+  CHECK_EQ( snapshot.valid_count, MODULES );
+
+  /* before: split reads, and power_getVout asking every module for VOUT_MODE each time */
+  split_reads = true;
+  pc.vout_exponent_known = 0;
+  baseline = registerSweep( &pc );
+  split_reads = false;
+
+  getters = registerSweep( &pc );
+
+  printf( "sweep of %d modules: %u transactions register by register before, %u now; "
+          "snapshot %u, %u with VOUT_MODE\n", MODULES, baseline, getters, cached, first );
+  CHECK( baseline >= 2 * cached );
+  CHECK( baseline >= 2 * first );
+  CHECK( cached <= getters );
+  CHECK_EQ( pc.status, POWER_OK );
+}
+
+/* the sequencer's power controller: six modules on enable pins 0 to 5, all down, each
+ * drawing a safe inrush current */
+static List_t task_list;
+static uint8_t seq_address[MODULES] = { 1, 2, 3, 4, 5, 6 };
+static uint8_t seq_enable[MODULES]  = { 0, 1, 2, 3, 4, 5 };
+static bool seq_state[MODULES];
+
+static void sequenceSetup( Power_t* pc )
+{
+  *pc = (Power_t) { .status = POWER_OFF, .module_count = MODULES, .power_state = seq_state,
+                    .module_addr = seq_address, .enable_pin = seq_enable,
+                    .task_list = &task_list };
+  for ( int i = 0; i < MODULES; ++i )
+  {
+    seq_state[i]    = false;
+    model_on[i]     = false;
+    model_inrush[i] = POWER_MILLI( POWER_IOUT_OC_WARN ) / 2;
+  }
+  switch_count = 0;
+  initTaskList( &task_list );
+}
+
+/* powerTask's part: a switchOn/switchOff some time into a sequence */
+typedef struct Switch_request_t
+{
+  Power_t* pc;
+  bool     on;
+} Switch_request_t;
+
+static Power_status switch_result;
+
+static void switchTask( TaskContext_t* context )
+{
+  Switch_request_t* request = (Switch_request_t*) context->params;
+
+  switch_result = request->on ? power_switchOn( request->pc ) : power_switchOff( request->pc );
+}
+
+static void switchAfter( Power_t* pc, bool on, uint32_t delay_ms )
+{
+  Switch_request_t request = { pc, on };
+
+  CHECK_EQ( createTaskDelayed( &task_list, switchTask, &request, sizeof(request),
+                               PRIORITY_HIGH, 0, 0, delay_ms * TASK_TICK_HZ / 1000 ), TASK_OK );
+}
+
+/* time of a module's first switch to on after from, UINT32_MAX if none */
+static uint32_t switchedAt( uint8_t module, bool on, uint32_t from )
+{
+  for ( uint32_t k = 0; k < switch_count; ++k )
+  {
+    if ( switches[k].module == module && switches[k].on == on && switches[k].time >= from )
+      return switches[k].time;
+  }
+  return UINT32_MAX;
+}
+
+/* up one at a time, each only after the last has settled, and down in reverse order */
+static void testSequence( void )
+{
+  Power_t pc;
+  uint32_t generation;
+
+  sequenceSetup( &pc );
+  CHECK_EQ( power_switchOn( &pc ), POWER_INIT );
+  CHECK_EQ( pc.status, POWER_INIT );
+
+  /* asked again while coming up: left alone */
+  generation = pc.sequence_generation;
+  CHECK_EQ( power_switchOn( &pc ), POWER_INIT );
+  CHECK_EQ( pc.sequence_generation, generation );
+
+  beginScheduler( &task_list );
+  CHECK_EQ( pc.status, POWER_OK );
+  CHECK_EQ( pc.sequence, POWER_SEQ_IDLE );
+  CHECK_EQ( switch_count, MODULES );
+  for ( int i = 0; i < MODULES; ++i )
+  {
+    CHECK( seq_state[i] );
+    CHECK( model_on[i] );
+    CHECK_EQ( switches[i].module, i );
+    CHECK( switches[i].on );
+    if ( i > 0 )
+      CHECK( switches[i].time - switches[i - 1].time >=
+             POWER_INRUSH_DELAY + POWER_SETTLE_DELAY + POWER_STAGGER_ON );
+  }
+
+  switch_count = 0;
+  CHECK_EQ( power_switchOff( &pc ), POWER_INIT );
+  beginScheduler( &task_list );
+  CHECK_EQ( pc.status, POWER_OFF );
+  CHECK_EQ( switch_count, MODULES );
+  for ( int i = 0; i < MODULES; ++i )
+  {
+    CHECK( !seq_state[i] );
+    CHECK( !model_on[i] );
+    CHECK_EQ( switches[i].module, MODULES - 1 - i );
+    CHECK( !switches[i].on );
+    if ( i > 0 )
+      CHECK( switches[i].time - switches[i - 1].time >= POWER_STAGGER_OFF );
+  }
+}
+
+/* a module drawing more than POWER_INRUSH_LIMIT as it comes up takes every module down;
+ * the limit trips before the modules' own OC fault latches them off */
+static void testInrush( void )
+{
+  Power_t pc;
+
+  CHECK( POWER_INRUSH_LIMIT > POWER_IOUT_OC_WARN );
+  CHECK( POWER_INRUSH_LIMIT < POWER_IOUT_OC_FAULT );
+
+  /* right at the limit is fine */
+  sequenceSetup( &pc );
+  model_inrush[3] = POWER_MILLI( POWER_INRUSH_LIMIT );
+  CHECK_EQ( power_switchOn( &pc ), POWER_INIT );
+  beginScheduler( &task_list );
+  CHECK_EQ( pc.status, POWER_OK );
+
+  sequenceSetup( &pc );
+  model_inrush[3] = POWER_MILLI( POWER_INRUSH_LIMIT ) + 500;
+  notified = 0;
+  CHECK_EQ( power_switchOn( &pc ), POWER_INIT );
+  beginScheduler( &task_list );
+  CHECK_EQ( pc.status, POWER_OVERLIMIT );
+  CHECK_EQ( pc.sequence, POWER_SEQ_IDLE );
+#ifdef DEBUG_MODE
+  CHECK_EQ( notified, 1 );
+#endif /* DEBUG_MODE */
+
+  /* module 3 was switched on and straight off again, along with those before it; those
+   * after it never came up */
+  for ( int i = 0; i < MODULES; ++i )
+  {
+    CHECK( !seq_state[i] );
+    CHECK( !model_on[i] );
+    CHECK_EQ( switchedAt( i, true, 0 ) != UINT32_MAX, i <= 3 );
+  }
+  CHECK_EQ( switchedAt( 3, false, 0 ) - switchedAt( 3, true, 0 ), POWER_INRUSH_DELAY );
+}
+
+/* a switchOff bumps the generation: the on-sequence's task already queued does nothing,
+ * and the module it was bringing up goes down with the rest */
+static void testSwitchOffCancelsOn( void )
+{
+  Power_t pc;
+  const uint32_t step = POWER_INRUSH_DELAY + POWER_SETTLE_DELAY + POWER_STAGGER_ON;
+  uint32_t start, off;
+
+  sequenceSetup( &pc );
+  start = system_time;
+  CHECK_EQ( power_switchOn( &pc ), POWER_INIT );
+
+  /* module 2 has just been enabled, its inrush check is still to come */
+  off = start + 2 * step + POWER_INRUSH_DELAY / 2;
+  switchAfter( &pc, false, off - start );
+  beginScheduler( &task_list );
+
+  CHECK_EQ( switch_result, POWER_INIT );
+  CHECK_EQ( pc.status, POWER_OFF );
+  CHECK_EQ( pc.sequence, POWER_SEQ_IDLE );
+  for ( int i = 0; i < MODULES; ++i )
+  {
+    CHECK( !seq_state[i] );
+    CHECK( !model_on[i] );
+    CHECK_EQ( switchedAt( i, true, start ) < off, i <= 2 );
+    CHECK_EQ( switchedAt( i, true, off ), UINT32_MAX );
+    CHECK_EQ( switchedAt( i, false, off ) != UINT32_MAX, i <= 2 );
+  }
+
+  /* one shutdown, staggered as ever, with no stale step of the old sequence mixed in */
+  CHECK_EQ( switch_count, 6 );
+  for ( uint32_t k = 4; k < switch_count; ++k )
+  {
+    CHECK_EQ( switches[k].module, switches[k - 1].module - 1 );
+    CHECK( switches[k].time - switches[k - 1].time >= POWER_STAGGER_OFF );
+  }
+}
+
+/* a switchOn halfway through a shutdown cancels it: the modules still up stay up, and
+ * those already down come back */
+static void testSwitchOnCancelsOff( void )
+{
+  Power_t pc;
+  uint32_t start, on;
+
+  sequenceSetup( &pc );
+  CHECK_EQ( power_switchOn( &pc ), POWER_INIT );
+  beginScheduler( &task_list );
+  CHECK_EQ( pc.status, POWER_OK );
+
+  /* modules 5 and 4 are down, 3 is next */
+  start = system_time;
+  CHECK_EQ( power_switchOff( &pc ), POWER_INIT );
+  on = start + POWER_STAGGER_OFF + POWER_STAGGER_OFF / 2;
+  switchAfter( &pc, true, on - start );
+  beginScheduler( &task_list );
+
+  CHECK_EQ( switch_result, POWER_INIT );
+  CHECK_EQ( pc.status, POWER_OK );
+  CHECK_EQ( pc.sequence, POWER_SEQ_IDLE );
+  for ( int i = 0; i < MODULES; ++i )
+  {
+    CHECK( seq_state[i] );
+    CHECK( model_on[i] );
+    CHECK_EQ( switchedAt( i, false, start ) < on, i >= 4 );
+    CHECK_EQ( switchedAt( i, false, on ), UINT32_MAX );
+    CHECK_EQ( switchedAt( i, true, on ) != UINT32_MAX, i >= 4 );
+  }
+}
+
+int main( void )
+{
+  testLinear11();
+  testLinear16();
+  testCodecCost();
+  testBalance();
+  testAlert();
+  testSnapshotTransactions();
+  testSequence();
+  testInrush();
+  testSwitchOffCancelsOn();
+  testSwitchOnCancelsOff();
+
+  return testResult( "power" );
+}
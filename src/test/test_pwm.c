@@ -0,0 +1,352 @@
+/**
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file test_pwm.c
+ *
+ * \brief Host tests of the PWM duty latching against a model of the six TCs: duty updates
+ *        and commits land at period boundaries without a glitch, a commit lands whole,
+ *        and compares are only ever written from the overflow interrupt.
+ */
+
+#include <asf.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "pindefs.h"
+#include "pwm.h"
+#include "test.h"
+
+#define PERIOD     0x10000 /* counts, PWM_TOP_NORMAL + 1 */
+#define PERIODS    20000
+#define LATENCY    400     /* most counts from overflow to its interrupt */
+
+Tc host_tc[6];
+Sercom host_sercom[6];
+SysTick_Type host_systick;
+
+/* channel to TC and compare, see pindefs.h */
+static Tc *const channel_tc[PWM_CHANNEL_COUNT] =
+{
+  PWM1_MOD, PWM2_MOD, PWM3_MOD, PWM4_MOD, PWM5_MOD, PWM6_MOD,
+  PWM7_MOD, PWM8_MOD, PWM9_MOD, PWM10_MOD, PWM11_MOD, PWM12_MOD
+};
+static const uint8_t channel_cc[PWM_CHANNEL_COUNT] =
+{
+  PWM1_CHANNEL, PWM2_CHANNEL, PWM3_CHANNEL, PWM4_CHANNEL, PWM5_CHANNEL, PWM6_CHANNEL,
+  PWM7_CHANNEL, PWM8_CHANNEL, PWM9_CHANNEL, PWM10_CHANNEL, PWM11_CHANNEL, PWM12_CHANNEL
+};
+
+/*
+ * The model TCs count in step, TC t t counts behind TC0 as pwm_init(..) starts them one
+ * after the other. now is the count of TC0 since the start of the current period; a
+ * compare written at count c of its TC takes effect from there on.
+ */
+static uint32_t now;
+static bool in_isr;
+static struct tc_module* tc_module_of[6];
+static tc_callback_t tc_callback[6];
+static bool tc_callback_on[6];
+static uint16_t tc_compare[6][2];
+static uint8_t tc_flag[6];
+
+/* compare writes of the current period: at which count, what value */
+#define WRITES_MAX 8
+static uint32_t write_count[6][2];
+static uint32_t write_at[6][2][WRITES_MAX];
+static uint16_t write_value[6][2][WRITES_MAX];
+static uint16_t compare_at_start[6][2];
+
+static uint32_t writes_outside_isr;
+
+static inline uint8_t tcIndex( Tc* hw )
+{
+  return (uint8_t) ( hw - host_tc );
+}
+
+static inline uint32_t countOf( uint8_t t )
+{
+  return ( now - t ) & ( PERIOD - 1 );
+}
+
+void tc_get_config_defaults( struct tc_config* config ) { memset( config, 0, sizeof(*config) ); }
+enum status_code tc_init( struct tc_module* module, Tc* hw, const struct tc_config* config )
+{
+  uint8_t t = tcIndex( hw );
+
+  module->hw = hw;
+  tc_module_of[t] = module;
+  tc_compare[t][0] = config->counter_16_bit.compare_capture_channel[0];
+  tc_compare[t][1] = config->counter_16_bit.compare_capture_channel[1];
+  return STATUS_OK;
+}
+void tc_enable( struct tc_module* module ) { (void) module; }
+enum status_code tc_register_callback( struct tc_module* module, tc_callback_t callback,
+                                       enum tc_callback type )
+{
+  (void) type;
+  tc_callback[tcIndex( module->hw )] = callback;
+  return STATUS_OK;
+}
+void tc_enable_callback( struct tc_module* module, enum tc_callback type )
+{
+  (void) type;
+  tc_callback_on[tcIndex( module->hw )] = true;
+}
+void tc_disable_callback( struct tc_module* module, enum tc_callback type )
+{
+  (void) type;
+  tc_callback_on[tcIndex( module->hw )] = false;
+}
+uint32_t tc_get_count_value( struct tc_module* module )
+{
+  return countOf( tcIndex( module->hw ) );
+}
+enum status_code tc_set_compare_value( struct tc_module* module,
+                                       enum tc_compare_capture_channel channel,
+                                       uint32_t compare )
+{
+  uint8_t t = tcIndex( module->hw );
+  uint32_t n = write_count[t][channel];
+
+  if ( !in_isr )
+    ++writes_outside_isr;
+  if ( n < WRITES_MAX )
+  {
+    write_at[t][channel][n]    = countOf( t );
+    write_value[t][channel][n] = (uint16_t) compare;
+  }
+  write_count[t][channel] = n + 1;
+  tc_compare[t][channel]  = (uint16_t) compare;
+  return STATUS_OK;
+}
+
+/* DShot is not configured, dshot.c links against these all the same */
+enum status_code tc_set_top_value( struct tc_module* module, uint32_t top )
+{
+  (void) module;
+  (void) top;
+  return STATUS_OK;
+}
+PortGroup* port_get_group_from_gpio_pin( uint8_t gpio_pin )
+{
+  (void) gpio_pin;
+  return NULL;
+}
+void port_get_config_defaults( struct port_config* config ) { (void) config; }
+void port_pin_set_config( uint8_t gpio_pin, const struct port_config* config )
+{
+  (void) gpio_pin;
+  (void) config;
+}
+void port_pin_set_output_level( uint8_t gpio_pin, bool level )
+{
+  (void) gpio_pin;
+  (void) level;
+}
+
+void system_interrupt_enter_critical_section( void ) {}
+void system_interrupt_leave_critical_section( void ) {}
+
+/* INTFLAG is write-one-to-clear: the register only records what the driver wrote, the
+ * flags themselves are in tc_flag */
+static void flagWrites( void )
+{
+  for ( uint8_t t = 0; t < 6; ++t )
+  {
+    tc_flag[t] &= (uint8_t) ~host_tc[t].COUNT16.INTFLAG.reg;
+    host_tc[t].COUNT16.INTFLAG.reg = 0;
+  }
+}
+
+/* the overflow interrupt of TC t, if it is enabled and flagged */
+static void overflowInterrupt( uint8_t t )
+{
+  if ( !tc_callback_on[t] || !( tc_flag[t] & TC_INTFLAG_OVF ) )
+    return;
+
+  tc_flag[t] &= (uint8_t) ~TC_INTFLAG_OVF;
+  in_isr = true;
+  tc_callback[t]( tc_module_of[t] );
+  in_isr = false;
+  flagWrites();
+}
+
+/*
+ * Width of the pulse a compare output put out over a period: high from the overflow until
+ * the count first equals the compare in effect at that count. 0 if it went low at once,
+ * PERIOD if it never went low.
+ */
+static uint32_t pulseWidth( uint8_t t, uint8_t cc )
+{
+  uint32_t n = write_count[t][cc];
+  uint32_t from = 0;
+  uint16_t compare = compare_at_start[t][cc];
+
+  for ( uint32_t i = 0; i <= n; ++i )
+  {
+    uint32_t to = i < n ? write_at[t][cc][i] : PERIOD;
+
+    if ( compare >= from && compare < to )
+      return compare;
+    if ( i < n )
+    {
+      from    = to;
+      compare = write_value[t][cc][i];
+    }
+  }
+
+  return PERIOD;
+}
+
+/*
+ * Random single updates and commits, each at a random point of a period, with the
+ * overflow interrupts late by a random number of counts. Every period of every output
+ * has to be one clean pulse of either the old or the new width; a commit has to be in
+ * every compare once pwm_get_commit() reports it, and no compare may move while it waits.
+ */
+static void testLatch( void )
+{
+  uint16_t want[PWM_CHANNEL_COUNT] = { 0 };
+  uint16_t staged = 0;
+  uint32_t glitches = 0, torn = 0, early = 0, latched = 0, commits = 0;
+
+  srand( 22 );
+  pwm_init();
+  flagWrites();
+
+  for ( uint32_t period = 0; period < PERIODS; ++period )
+  {
+    uint32_t latency[6];
+    uint32_t action_at = 8 + rand() % ( PERIOD - 16 );
+    int action = rand() % 8;
+    bool action_done = false;
+
+    for ( uint8_t t = 0; t < 6; ++t )
+    {
+      latency[t] = rand() % LATENCY;
+      for ( uint8_t cc = 0; cc < 2; ++cc )
+      {
+        compare_at_start[t][cc] = tc_compare[t][cc];
+        write_count[t][cc] = 0;
+      }
+    }
+
+    /* the interesting moments of a period, in order: each TC's overflow, its interrupt
+     * and the update from the main loop */
+    for ( now = 0; now < PERIOD; ++now )
+    {
+      for ( uint8_t t = 0; t < 6; ++t )
+      {
+        if ( countOf( t ) == 0 && period + now > 0 )
+          tc_flag[t] |= TC_INTFLAG_OVF;
+        if ( countOf( t ) == latency[t] )
+        {
+          uint16_t before = pwm_get_commit();
+          bool pending = before != staged;
+          uint32_t writes = 0;
+
+          for ( uint8_t u = 0; u < 6; ++u )
+            writes += write_count[u][0] + write_count[u][1];
+          overflowInterrupt( t );
+          for ( uint8_t u = 0; u < 6; ++u )
+            writes -= write_count[u][0] + write_count[u][1];
+
+          if ( pwm_get_commit() != before )
+          {
+            ++commits;
+            for ( uint8_t c = 0; c < PWM_CHANNEL_COUNT; ++c )
+            {
+              if ( tc_compare[tcIndex( channel_tc[c] )][channel_cc[c]] != want[c] )
+                ++torn;
+            }
+          }
+          else if ( pending && writes != 0 )
+          {
+            ++early;
+          }
+        }
+      }
+
+      if ( now == action_at && !action_done )
+      {
+        action_done = true;
+        if ( action < 3 )
+        {
+          uint8_t c = (uint8_t) ( rand() % PWM_CHANNEL_COUNT );
+          uint16_t duty = (uint16_t) ( rand() % 4 == 0 ? rand() % 500 : rand() % PERIOD );
+
+          /* joins a commit that is waiting, so it has to be in it once it lands */
+          CHECK( pwm_set_duty( c, duty ) );
+          want[c] = duty;
+        }
+        else if ( action == 3 )
+        {
+          for ( uint8_t c = 0; c < PWM_CHANNEL_COUNT; ++c )
+            want[c] = (uint16_t) ( rand() % 4 == 0 ? rand() % 500 : rand() % PERIOD );
+          staged = pwm_set_all( want );
+          CHECK( staged != 0 );
+        }
+        flagWrites();
+        /* an interrupt enabled with its flag already up goes off right away */
+        for ( uint8_t t = 0; t < 6; ++t )
+          overflowInterrupt( t );
+      }
+
+      /* nothing else happens in between, skip ahead */
+      if ( now > LATENCY + 6 && now < action_at )
+        now = action_at - 1;
+      else if ( now > LATENCY + 6 && now > action_at )
+        break;
+    }
+
+    for ( uint8_t t = 0; t < 6; ++t )
+    {
+      for ( uint8_t cc = 0; cc < 2; ++cc )
+      {
+        uint32_t width = pulseWidth( t, cc );
+
+        if ( width != compare_at_start[t][cc] && width != tc_compare[t][cc] )
+        {
+          if ( glitches++ < 4 )
+            printf( "period %u TC%u/%u: %u counts high, not %u or %u\n", period, t, cc,
+                    width, compare_at_start[t][cc], tc_compare[t][cc] );
+        }
+        if ( tc_compare[t][cc] != compare_at_start[t][cc] )
+          ++latched;
+      }
+    }
+  }
+
+  CHECK_EQ( glitches, 0 );
+  CHECK_EQ( torn, 0 );
+  CHECK_EQ( early, 0 );
+  CHECK_EQ( writes_outside_isr, 0 );
+  CHECK( latched > PERIODS / 4 );
+  CHECK( commits > PERIODS / 16 );
+
+  /* two more periods and everything asked for is out */
+  for ( uint32_t period = 0; period < 2; ++period )
+  {
+    for ( uint8_t t = 0; t < 6; ++t )
+    {
+      tc_flag[t] |= TC_INTFLAG_OVF;
+      now = t + 10;
+      overflowInterrupt( t );
+    }
+  }
+  for ( uint8_t c = 0; c < PWM_CHANNEL_COUNT; ++c )
+  {
+    CHECK_EQ( tc_compare[tcIndex( channel_tc[c] )][channel_cc[c]], want[c] );
+    CHECK_EQ( pwm_get_duty( c ), want[c] );
+  }
+  CHECK_EQ( pwm_get_commit(), staged );
+  for ( uint8_t t = 0; t < 6; ++t )
+    CHECK( !tc_callback_on[t] );
+}
+
+int main( void )
+{
+  testLatch();
+
+  return testResult( "pwm" );
+}
@@ -0,0 +1,531 @@
+/**
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file test_smbus.c
+ *
+ * \brief Host tests of the SMBus engine against a model I2C master that completes every
+ *        job at once: PEC generation and checking (and its cost per byte against a
+ *        bitwise CRC), gathered block writes, the wire cost of repeated-START reads,
+ *        and retries, backoff and bus recovery.
+ */
+
+#include <asf.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "smbus.h"
+#include "test.h"
+
+#define SLAVE_ADDRESS 0x5b
+
+Tc host_tc[6];
+Sercom host_sercom[6];
+SysTick_Type host_systick;
+
+static struct i2c_master_module i2c_master;
+
+/* the model bus: what went out in the last write, what the slave sends back */
+static i2c_master_callback_t bus_callback[3];
+static enum status_code bus_status;
+static uint8_t bus_written[256];
+static const uint8_t* bus_written_from; /* the buffer the job was given */
+static uint16_t bus_written_length;
+static uint32_t bus_writes;
+static uint8_t slave_reply[SMBUS_BLOCK_MAX + 4];
+static uint32_t slave_corrupt; /* replies still to go out with a flipped bit */
+static uint32_t slave_nack[128];    /* writes still to be NACKed, per address */
+static uint32_t slave_timeout[128]; /* writes still to end in an SCL low timeout */
+static uint32_t slave_refuse;       /* jobs still to be refused as STATUS_BUSY */
+static uint32_t sda_stuck;          /* recovery clocks until SDA is let go */
+static uint32_t recovery_clocks;
+
+/* what the completed jobs cost on the wire at 400 kHz: a START (or repeated START) and a
+ * STOP take about a bit time each, a byte nine with its ACK, and a STOP is followed by
+ * the bus free time before the next START */
+#define WIRE_BIT_NS 2500
+#define WIRE_BUF_NS 1300
+
+static uint32_t wire_bytes;
+static uint32_t wire_starts;
+static uint32_t wire_stops;
+static uint32_t wire_ns;
+static bool wire_stopped;
+
+static void wireJob( uint32_t data_length, bool stop )
+{
+  if ( wire_stopped )
+    wire_ns += WIRE_BUF_NS;
+  wire_ns    += WIRE_BIT_NS + 9 * WIRE_BIT_NS * ( 1 + data_length );
+  wire_bytes += 1 + data_length;
+  ++wire_starts;
+  if ( stop )
+  {
+    wire_ns += WIRE_BIT_NS;
+    ++wire_stops;
+  }
+  wire_stopped = stop;
+}
+
+static void wireReset( void )
+{
+  wire_bytes = wire_starts = wire_stops = wire_ns = 0;
+  wire_stopped = false;
+}
+
+void i2c_master_get_config_defaults( struct i2c_master_config* config ) { (void) config; }
+enum status_code i2c_master_init( struct i2c_master_module* module, Sercom* hw,
+                                  const struct i2c_master_config* config )
+{
+  (void) config;
+  module->hw = hw;
+  return STATUS_OK;
+}
+void i2c_master_enable( struct i2c_master_module* module ) { (void) module; }
+void i2c_master_disable( struct i2c_master_module* module ) { (void) module; }
+void i2c_master_cancel_job( struct i2c_master_module* module ) { (void) module; }
+void i2c_master_send_stop( struct i2c_master_module* module ) { (void) module; }
+void i2c_master_enable_callback( struct i2c_master_module* module,
+                                 enum i2c_master_callback type )
+{
+  (void) module;
+  (void) type;
+}
+void i2c_master_register_callback( struct i2c_master_module* module,
+                                   i2c_master_callback_t callback,
+                                   enum i2c_master_callback type )
+{
+  (void) module;
+  bus_callback[type] = callback;
+}
+enum status_code i2c_master_get_job_status( struct i2c_master_module* module )
+{
+  (void) module;
+  return bus_status;
+}
+
+static enum status_code busWrite( struct i2c_master_module* module,
+                                  struct i2c_master_packet* packet, bool stop )
+{
+  if ( slave_refuse > 0 )
+  {
+    --slave_refuse;
+    return STATUS_BUSY;
+  }
+  if ( slave_nack[packet->address] > 0 || slave_timeout[packet->address] > 0 )
+  {
+    if ( slave_nack[packet->address] > 0 )
+    {
+      --slave_nack[packet->address];
+      bus_status = STATUS_ERR_BAD_ADDRESS;
+    }
+    else
+    {
+      --slave_timeout[packet->address];
+      bus_status = STATUS_ERR_TIMEOUT;
+      sda_stuck  = 3;
+    }
+    bus_callback[I2C_MASTER_CALLBACK_ERROR]( module );
+    return STATUS_OK;
+  }
+
+  memcpy( bus_written, packet->data, packet->data_length );
+  bus_written_from   = packet->data;
+  bus_written_length = packet->data_length;
+  ++bus_writes;
+  wireJob( packet->data_length, stop );
+  bus_callback[I2C_MASTER_CALLBACK_WRITE_COMPLETE]( module );
+  return STATUS_OK;
+}
+
+enum status_code i2c_master_write_packet_job( struct i2c_master_module* module,
+                                              struct i2c_master_packet* packet )
+{
+  return busWrite( module, packet, true );
+}
+enum status_code i2c_master_write_packet_job_no_stop( struct i2c_master_module* module,
+                                                      struct i2c_master_packet* packet )
+{
+  return busWrite( module, packet, false );
+}
+enum status_code i2c_master_read_packet_job( struct i2c_master_module* module,
+                                             struct i2c_master_packet* packet )
+{
+  memcpy( packet->data, slave_reply, packet->data_length );
+  wireJob( packet->data_length, true );
+  if ( slave_corrupt > 0 )
+  {
+    --slave_corrupt;
+    packet->data[packet->data_length - 1] ^= 0x10;
+  }
+  bus_callback[I2C_MASTER_CALLBACK_READ_COMPLETE]( module );
+  return STATUS_OK;
+}
+
+void system_interrupt_enter_critical_section( void ) {}
+void system_interrupt_leave_critical_section( void ) {}
+
+/* bus recovery pins: SDA reads low until it has had sda_stuck clocks */
+void port_get_config_defaults( struct port_config* config ) { (void) config; }
+void port_pin_set_config( uint8_t gpio_pin, const struct port_config* config )
+{
+  (void) gpio_pin;
+  (void) config;
+}
+void port_pin_set_output_level( uint8_t gpio_pin, bool level )
+{
+  (void) gpio_pin;
+  (void) level;
+}
+bool port_pin_get_input_level( uint8_t gpio_pin )
+{
+  (void) gpio_pin;
+  if ( sda_stuck == 0 )
+    return true;
+  --sda_stuck;
+  ++recovery_clocks;
+  return false;
+}
+void delay_us( uint32_t us ) { (void) us; }
+void system_pinmux_get_config_defaults( struct system_pinmux_config* config ) { (void) config; }
+void system_pinmux_pin_set_config( uint8_t gpio_pin, const struct system_pinmux_config* config )
+{
+  (void) gpio_pin;
+  (void) config;
+}
+
+/* CRC-8, polynomial x^8 + x^2 + x + 1, one bit at a time */
+static uint8_t crc8Bitwise( uint8_t crc, const uint8_t* data, uint32_t count )
+{
+  while ( count-- )
+  {
+    crc ^= *data++;
+    for ( int bit = 0; bit < 8; ++bit )
+      crc = ( crc & 0x80 ) ? (uint8_t) ( ( crc << 1 ) ^ 0x07 ) : (uint8_t) ( crc << 1 );
+  }
+
+  return crc;
+}
+
+/* the table matches the polynomial for every byte from every state, and the CRC-8/SMBUS
+ * check value; a frame split anywhere gives the same PEC */
+static void testPecVectors( void )
+{
+  static const uint8_t check[] = "123456789";
+  static const uint8_t frame[] = { 0xb6, 0x01, 0x80, 0xb7, 0x1a, 0xf0 };
+  uint32_t mismatches = 0;
+
+  for ( uint32_t crc = 0; crc < 256; ++crc )
+  {
+    for ( uint32_t byte = 0; byte < 256; ++byte )
+    {
+      uint8_t b = (uint8_t) byte;
+
+      if ( smbus_pec( (uint8_t) crc, &b, 1 ) != crc8Bitwise( (uint8_t) crc, &b, 1 ) )
+        ++mismatches;
+    }
+  }
+  CHECK_EQ( mismatches, 0 );
+
+  CHECK_EQ( smbus_pec( 0, check, 9 ), 0xf4 );
+  CHECK_EQ( smbus_pec( 0, NULL, 0 ), 0x00 );
+
+  for ( uint32_t split = 0; split <= sizeof(frame); ++split )
+    CHECK_EQ( smbus_pec( smbus_pec( 0, frame, split ), frame + split, sizeof(frame) - split ),
+              crc8Bitwise( 0, frame, sizeof(frame) ) );
+}
+
+/* per-byte cost of the table against the bitwise CRC, over a long frame; printed, not
+ * checked, a loaded host would make a bound flaky */
+#define PEC_BENCH_BYTES  4096
+#define PEC_BENCH_ROUNDS 2000
+
+static double elapsedNs( const struct timespec* start )
+{
+  struct timespec end;
+
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  return ( end.tv_sec - start->tv_sec ) * 1e9 + ( end.tv_nsec - start->tv_nsec );
+}
+
+static void testPecCost( void )
+{
+  static uint8_t frame[PEC_BENCH_BYTES];
+  volatile uint8_t sink;
+  struct timespec start;
+  double table, bitwise;
+  uint8_t crc_table = 0, crc_bitwise = 0;
+
+  for ( uint32_t i = 0; i < sizeof(frame); ++i )
+    frame[i] = (uint8_t) ( i * 31 + 7 );
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( uint32_t r = 0; r < PEC_BENCH_ROUNDS; ++r )
+    crc_table = smbus_pec( crc_table, frame, sizeof(frame) );
+  table = elapsedNs( &start ) / ( (double) PEC_BENCH_ROUNDS * sizeof(frame) );
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( uint32_t r = 0; r < PEC_BENCH_ROUNDS; ++r )
+    crc_bitwise = crc8Bitwise( crc_bitwise, frame, sizeof(frame) );
+  bitwise = elapsedNs( &start ) / ( (double) PEC_BENCH_ROUNDS * sizeof(frame) );
+
+  sink = crc_table;
+  (void) sink;
+  printf( "PEC per byte: table %.2f ns, bitwise %.2f ns (%.1fx)\n", table, bitwise,
+          bitwise / table );
+  CHECK_EQ( crc_table, crc_bitwise );
+}
+
+/* a write to a PEC device carries the PEC of address, command and data; others do not */
+static void testWritePec( void )
+{
+  uint8_t wire[3] = { (uint8_t) ( SLAVE_ADDRESS << 1 ), 0x01, 0x80 };
+
+  CHECK_EQ( smbus_writeByteData( &i2c_master, SLAVE_ADDRESS, 0x01, 0x80 ), STATUS_OK );
+  CHECK_EQ( bus_written_length, 2 );
+
+  smbus_setPEC( &i2c_master, SLAVE_ADDRESS, true );
+  CHECK( smbus_hasPEC( &i2c_master, SLAVE_ADDRESS ) );
+  CHECK( !smbus_hasPEC( &i2c_master, SLAVE_ADDRESS + 1 ) );
+
+  CHECK_EQ( smbus_writeByteData( &i2c_master, SLAVE_ADDRESS, 0x01, 0x80 ), STATUS_OK );
+  CHECK_EQ( bus_written_length, 3 );
+  CHECK_EQ( bus_written[0], 0x01 );
+  CHECK_EQ( bus_written[1], 0x80 );
+  CHECK_EQ( bus_written[2], crc8Bitwise( 0, wire, sizeof(wire) ) );
+}
+
+/* a read from a PEC device is checked over the whole frame, including the repeated start
+ * address; a corrupt reply is retried, one corrupt every time fails */
+static void testReadPec( void )
+{
+  uint8_t wire[5] = { (uint8_t) ( SLAVE_ADDRESS << 1 ), 0x8b,
+                      (uint8_t) ( ( SLAVE_ADDRESS << 1 ) | 1 ), 0x34, 0x12 };
+  SMBus_errors before, after;
+  uint16_t word = 0;
+
+  smbus_setPEC( &i2c_master, SLAVE_ADDRESS, true );
+  slave_reply[0] = 0x34;
+  slave_reply[1] = 0x12;
+  slave_reply[2] = crc8Bitwise( 0, wire, sizeof(wire) );
+  smbus_getErrors( &i2c_master, SLAVE_ADDRESS, &before );
+
+  slave_corrupt = 0;
+  CHECK_EQ( smbus_readWordData( &i2c_master, SLAVE_ADDRESS, 0x8b, &word ), STATUS_OK );
+  CHECK_EQ( word, 0x1234 );
+
+  slave_corrupt = 2;
+  word = 0;
+  CHECK_EQ( smbus_readWordData( &i2c_master, SLAVE_ADDRESS, 0x8b, &word ), STATUS_OK );
+  CHECK_EQ( word, 0x1234 );
+  smbus_getErrors( &i2c_master, SLAVE_ADDRESS, &after );
+  CHECK_EQ( after.pec, before.pec + 2 );
+
+  slave_corrupt = MAX_RETRIES + 1;
+  CHECK_EQ( smbus_readWordData( &i2c_master, SLAVE_ADDRESS, 0x8b, &word ),
+            STATUS_ERR_BAD_DATA );
+  smbus_getErrors( &i2c_master, SLAVE_ADDRESS, &after );
+  CHECK_EQ( after.pec, before.pec + 2 + MAX_RETRIES + 1 );
+  slave_corrupt = 0;
+
+  smbus_setPEC( &i2c_master, SLAVE_ADDRESS, false );
+}
+
+/* the spans go out back to back in one write, after the command and (for a block write)
+ * the byte count, with the PEC over all of it */
+static void testGather( void )
+{
+  static const uint8_t header[2]  = { 0xaa, 0xbb };
+  static const uint8_t payload[3] = { 0x01, 0x02, 0x03 };
+  static const uint8_t block[SMBUS_BLOCK_MAX + 1] = { 0 };
+  const SMBus_span spans[3] = { { header, 2 }, { NULL, 0 }, { payload, 3 } };
+  const SMBus_span too_long = { block, SMBUS_BLOCK_MAX + 1 };
+  const uint8_t wire[7] = { (uint8_t) ( SLAVE_ADDRESS << 1 ), 0x30, 0xaa, 0xbb, 0x01, 0x02, 0x03 };
+  const uint8_t block_wire[8] = { (uint8_t) ( SLAVE_ADDRESS << 1 ), 0x30, 5,
+                                  0xaa, 0xbb, 0x01, 0x02, 0x03 };
+  uint8_t data[3] = { 0x01, 0x02, 0x03 };
+  static uint8_t raw[4 * SMBUS_BLOCK_MAX + 1];
+  uint32_t writes;
+
+  CHECK_EQ( smbus_writeGather( &i2c_master, SLAVE_ADDRESS, 0x30, spans, 3 ), STATUS_OK );
+  CHECK_EQ( bus_written_length, 6 );
+  CHECK( memcmp( bus_written, wire + 1, 6 ) == 0 );
+
+  CHECK_EQ( smbus_writeBlockData( &i2c_master, SLAVE_ADDRESS, 0x30, data, 3 ), STATUS_OK );
+  CHECK_EQ( bus_written_length, 4 );
+  CHECK( memcmp( bus_written, ( const uint8_t[] ) { 0x30, 0x01, 0x02, 0x03 }, 4 ) == 0 );
+
+  smbus_setPEC( &i2c_master, SLAVE_ADDRESS, true );
+  CHECK_EQ( smbus_blockWrite( &i2c_master, SLAVE_ADDRESS, 0x30, spans, 3 ), STATUS_OK );
+  CHECK_EQ( bus_written_length, 8 );
+  CHECK( memcmp( bus_written, block_wire + 1, 7 ) == 0 );
+  CHECK_EQ( bus_written[7], crc8Bitwise( 0, block_wire, 8 ) );
+  smbus_setPEC( &i2c_master, SLAVE_ADDRESS, false );
+
+  /* too long never reaches the bus */
+  writes = bus_writes;
+  CHECK_EQ( smbus_blockWrite( &i2c_master, SLAVE_ADDRESS, 0x30, &too_long, 1 ),
+            STATUS_ERR_INVALID_ARG );
+  CHECK_EQ( smbus_writeGather( &i2c_master, SLAVE_ADDRESS, 0x30, &too_long, 1 ),
+            STATUS_ERR_INVALID_ARG );
+  CHECK_EQ( smbus_writeBlockData( &i2c_master, SLAVE_ADDRESS, 0x30, raw + 1, SMBUS_BLOCK_MAX + 1 ),
+            STATUS_ERR_INVALID_ARG );
+  CHECK_EQ( bus_writes, writes );
+
+  /* a longer raw write goes out of the caller's buffer, command first */
+  for ( uint32_t i = 0; i < sizeof(raw); ++i )
+    raw[i] = (uint8_t) ( 0x30 + i );
+  CHECK_EQ( smbus_writeBlock( &i2c_master, SLAVE_ADDRESS, raw, sizeof(raw) ), STATUS_OK );
+  CHECK( bus_written_from == raw );
+  CHECK_EQ( bus_written_length, sizeof(raw) );
+  CHECK( memcmp( bus_written, raw, sizeof(raw) ) == 0 );
+}
+
+/* a register read is one write and a repeated-START read: against the write, STOP, START
+ * and read it replaced, the same bytes go out with one STOP and no bus free time less */
+static void testRepeatedStart( void )
+{
+  static const char* name[3] = { "byte", "word", "block of 4" };
+  uint8_t data[4];
+  uint16_t word;
+
+  slave_reply[0] = 0x34;
+  slave_reply[1] = 0x12;
+  for ( int read = 0; read < 3; ++read )
+  {
+    uint32_t bytes, stops, ns;
+
+    wireReset();
+    if ( read == 0 )
+      CHECK_EQ( smbus_readByteData( &i2c_master, SLAVE_ADDRESS, 0x8b, data ), STATUS_OK );
+    else if ( read == 1 )
+      CHECK_EQ( smbus_readWordData( &i2c_master, SLAVE_ADDRESS, 0x8b, &word ), STATUS_OK );
+    else
+      CHECK_EQ( smbus_readBlockData( &i2c_master, SLAVE_ADDRESS, 0x8b, data, 4 ), STATUS_OK );
+    CHECK_EQ( wire_starts, 2 );
+    CHECK_EQ( wire_stops, 1 );
+    bytes = wire_bytes;
+    stops = wire_stops;
+    ns    = wire_ns;
+
+    /* the baseline's command write, then a read of its own */
+    wireReset();
+    CHECK_EQ( smbus_writeByte( &i2c_master, SLAVE_ADDRESS, 0x8b ), STATUS_OK );
+    if ( read == 0 )
+      CHECK_EQ( smbus_readByte( &i2c_master, SLAVE_ADDRESS, data ), STATUS_OK );
+    else if ( read == 1 )
+      CHECK_EQ( smbus_readWord( &i2c_master, SLAVE_ADDRESS, &word ), STATUS_OK );
+    else
+      CHECK_EQ( smbus_readBlock( &i2c_master, SLAVE_ADDRESS, data, 4 ), STATUS_OK );
+
+    printf( "read %-10s  repeated START: %u bytes %5.1f us  STOP + START: %u bytes %5.1f us\n",
+            name[read], bytes, ns / 1000.0, wire_bytes, wire_ns / 1000.0 );
+    CHECK_EQ( bytes, wire_bytes );
+    CHECK_EQ( stops + 1, wire_stops );
+    CHECK_EQ( wire_ns - ns, WIRE_BIT_NS + WIRE_BUF_NS );
+  }
+}
+
+/* devices back off on their own schedules, and one backing off does not hold up the
+ * rest of the bus */
+static void testBackoff( void )
+{
+  static const SMBus_policy policy = { .retries = 5, .backoff_us = 1000, .backoff_max_us = 8000,
+                                       .deadline_us = 0 };
+  uint8_t byte = 0x01;
+  SMBus_transaction a = { .address = 0x22, .write_data = &byte, .write_length = 1 };
+  SMBus_transaction b = { .address = 0x23, .write_data = &byte, .write_length = 1 };
+  SMBus_transaction c = { .address = 0x40, .write_data = &byte, .write_length = 1 };
+  uint32_t a_done = 0, b_done = 0;
+
+  smbus_setPolicy( &i2c_master, 0x22, &policy );
+  smbus_setPolicy( &i2c_master, 0x23, &policy );
+  slave_nack[0x22] = 2;
+  slave_nack[0x23] = 4;
+
+  smbus_submit( &i2c_master, &a );
+  smbus_submit( &i2c_master, &b );
+  smbus_submit( &i2c_master, &c );
+  CHECK_EQ( c.status, STATUS_OK );
+
+  /* 1 + 2 ms for a, 1 + 2 + 4 + 8 ms for b */
+  for ( uint32_t ms = 1; ms < 100 && ( a_done == 0 || b_done == 0 ); ++ms )
+  {
+    CHECK( !smbus_service( 1000 ) );
+    if ( a_done == 0 && a.status != STATUS_BUSY )
+      a_done = ms;
+    if ( b_done == 0 && b.status != STATUS_BUSY )
+      b_done = ms;
+  }
+  CHECK_EQ( a.status, STATUS_OK );
+  CHECK_EQ( a_done, 3 );
+  CHECK_EQ( b.status, STATUS_OK );
+  CHECK_EQ( b_done, 15 );
+
+  /* a device that keeps NACKing gives up once its retries are spent */
+  slave_nack[0x22] = policy.retries + 1;
+  smbus_submit( &i2c_master, &a );
+  for ( uint32_t ms = 0; ms < 100 && a.status == STATUS_BUSY; ++ms )
+    smbus_service( 1000 );
+  CHECK_EQ( a.status, STATUS_ERR_BAD_ADDRESS );
+  CHECK_EQ( slave_nack[0x22], 0 );
+}
+
+/* a job that will not start backs off without a recovery; an SCL low timeout holds the
+ * bus until smbus_recover(..) has clocked SDA free, and asks for that only once */
+static void testRecovery( void )
+{
+  uint8_t byte = 0x01;
+  SMBus_transaction d = { .address = 0x25, .write_data = &byte, .write_length = 1 };
+  SMBus_transaction f = { .address = 0x24, .write_data = &byte, .write_length = 1 };
+  SMBus_transaction g = { .address = 0x40, .write_data = &byte, .write_length = 1 };
+  SMBus_errors errors;
+  uint32_t asked = 0;
+
+  slave_refuse = 1;
+  smbus_submit( &i2c_master, &d );
+  for ( uint32_t ms = 0; ms < 20 && d.status == STATUS_BUSY; ++ms )
+    asked += smbus_service( 1000 );
+  CHECK_EQ( d.status, STATUS_OK );
+  CHECK_EQ( asked, 0 );
+  smbus_getErrors( &i2c_master, 0x25, &errors );
+  CHECK_EQ( errors.bus, 1 );
+  CHECK_EQ( errors.recoveries, 0 );
+
+  slave_timeout[0x24] = 1;
+  recovery_clocks = 0;
+  smbus_submit( &i2c_master, &f );
+  smbus_submit( &i2c_master, &g );
+  for ( uint32_t ms = 0; ms < 20; ++ms )
+    asked += smbus_service( 1000 );
+  CHECK_EQ( asked, 1 );
+  CHECK_EQ( g.status, STATUS_BUSY );
+  CHECK_EQ( recovery_clocks, 0 );
+
+  smbus_recover();
+  CHECK_EQ( g.status, STATUS_OK );
+  CHECK_EQ( recovery_clocks, 3 );
+  for ( uint32_t ms = 0; ms < 20 && f.status == STATUS_BUSY; ++ms )
+    smbus_service( 1000 );
+  CHECK_EQ( f.status, STATUS_OK );
+  smbus_getErrors( &i2c_master, 0x24, &errors );
+  CHECK_EQ( errors.timeout, 1 );
+  CHECK_EQ( errors.recoveries, 1 );
+}
+
+int main( void )
+{
+  CHECK_EQ( smbus_configure( &i2c_master, SERCOM0, PINMUX_PA08C_SERCOM0_PAD0,
+                             PINMUX_PA09C_SERCOM0_PAD1, 400 ), STATUS_OK );
+
+  testPecVectors();
+  testPecCost();
+  testWritePec();
+  testReadPec();
+  testGather();
+  testRepeatedStart();
+  testBackoff();
+  testRecovery();
+
+  return testResult( "smbus" );
+}
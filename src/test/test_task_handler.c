@@ -0,0 +1,462 @@
+/**
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file test_task_handler.c
+ *
+ * \brief Host tests of the scheduler, built with TASK_HOST_BUILD: ready queue order under
+ *        each policy, the slot pool, the timer wheel (across a system_time wrap), the
+ *        interrupt submission rings, periodic re-arming, and that none of it touches the
+ *        heap.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "task_handler.h"
+#include "test.h"
+
+#define RUN_MAX 256
+
+static List_t task_list;
+
+/* what ran, in order: the first params word of each task, and when */
+static uint32_t run_id[RUN_MAX];
+static uint32_t run_time[RUN_MAX];
+static uint32_t run_count;
+
+void dummyHandler( TaskContext_t* context )
+{
+  (void) context;
+}
+
+static void recordHandler( TaskContext_t* context )
+{
+  if ( run_count < RUN_MAX )
+  {
+    run_id[run_count]   = ( (uint32_t*) context->params )[0];
+    run_time[run_count] = system_time;
+  }
+  ++run_count;
+}
+
+/* an empty list, its wheel at the current time */
+static void freshList( void )
+{
+  initTaskList( &task_list );
+  task_list.wheel_time = system_time;
+  run_count = 0;
+}
+
+/* priorities run highest first, PRIORITY_NOW ahead of all, FIFO within a level */
+static void testPriorityOrder( void )
+{
+  uint32_t priority[48];
+  uint32_t id;
+
+  freshList();
+  srand( 1 );
+  for ( id = 0; id < 48; ++id )
+  {
+    priority[id] = rand() % ( PRIORITY_LOW + 1 );
+    CHECK_EQ( createTask( &task_list, recordHandler, &id, sizeof(id), priority[id], 0, 0 ),
+              TASK_OK );
+  }
+
+  beginScheduler( &task_list );
+
+  CHECK_EQ( run_count, 48 );
+  for ( uint32_t i = 1; i < run_count; ++i )
+  {
+    uint32_t a = run_id[i - 1];
+    uint32_t b = run_id[i];
+
+    CHECK( priority[a] < priority[b] || ( priority[a] == priority[b] && a < b ) );
+  }
+}
+
+/* EDF: earliest absolute deadline first, no deadline last, priority breaks ties */
+static void testEarliestDeadline( void )
+{
+  static const uint32_t deadline[5] = { 40, 5, 100, 20, 0 };
+  static const uint32_t priority[5] = { PRIORITY_LOW, PRIORITY_NORMAL, PRIORITY_HIGH,
+                                        PRIORITY_REALTIME, PRIORITY_LOW };
+  static const uint32_t expected[5] = { 1, 3, 0, 2, 4 };
+
+  /* deadlines straddle the wrap of system_time */
+  system_time = 0xfffffff0u;
+  freshList();
+  setSchedulerPolicy( &task_list, SCHEDULER_EDF );
+  for ( uint32_t id = 0; id < 5; ++id )
+    createTask( &task_list, recordHandler, &id, sizeof(id), priority[id], deadline[id], 0 );
+
+  CHECK( nextOnDeadline( &task_list ) != NULL );
+  beginScheduler( &task_list );
+
+  CHECK_EQ( run_count, 5 );
+  for ( uint32_t i = 0; i < 5; ++i )
+    CHECK_EQ( run_id[i], expected[i] );
+  CHECK( nextOnDeadline( &task_list ) == NULL );
+}
+
+/* the pool runs out at TASK_POOL_LENGTH, the ready queue at TASK_QUEUE_LENGTH, and every
+ * slot comes back once its task has run */
+static void testPool( void )
+{
+  TaskPoolStats_t before, after;
+  uint8_t params[TASK_PARAMS_LENGTH + 1] = { 0 };
+  uint32_t created = 0;
+
+  freshList();
+  getTaskPoolStats( &before );
+  CHECK_EQ( before.capacity, TASK_POOL_LENGTH );
+  CHECK_EQ( before.in_use, 0 );
+
+  CHECK_EQ( createTask( &task_list, dummyHandler, params, sizeof(params), PRIORITY_LOW, 0, 0 ),
+            TASK_PARAMS_TOO_LONG );
+
+  while ( createTask( &task_list, dummyHandler, params, TASK_PARAMS_LENGTH,
+                      PRIORITY_LOW, 0, 0 ) == TASK_OK )
+    ++created;
+  CHECK_EQ( created, TASK_QUEUE_LENGTH );
+  CHECK_EQ( createTask( &task_list, dummyHandler, NULL, 0, PRIORITY_LOW, 0, 0 ),
+            TASK_QUEUE_FULL );
+
+  /* delayed tasks do not take a place in the queue, only a slot */
+  if ( TASK_POOL_LENGTH == TASK_QUEUE_LENGTH )
+  {
+    CHECK_EQ( createTaskDelayed( &task_list, dummyHandler, NULL, 0, PRIORITY_LOW, 0, 0, 5 ),
+              TASK_POOL_EMPTY );
+    getTaskPoolStats( &after );
+    CHECK_EQ( after.failures, before.failures + 1 );
+  }
+
+  getTaskPoolStats( &after );
+  CHECK_EQ( after.in_use, TASK_QUEUE_LENGTH );
+  CHECK( after.high_water >= TASK_QUEUE_LENGTH );
+
+  beginScheduler( &task_list );
+  getTaskPoolStats( &after );
+  CHECK_EQ( after.in_use, 0 );
+}
+
+/* delayed tasks run on exactly their tick, from every level of the wheel */
+static void testTimerWheel( void )
+{
+  uint32_t due[40];
+  uint32_t start;
+
+  system_time = 0xfffff000u;
+  freshList();
+  start = system_time;
+  srand( 3 );
+  for ( uint32_t id = 0; id < 40; ++id )
+  {
+    uint32_t delay;
+
+    if ( id < 16 )      delay = 1 + rand() % 40;
+    else if ( id < 32 ) delay = 1 + rand() % 5000;
+    else                delay = 1 + rand() % 2000000;
+
+    due[id] = start + delay;
+    CHECK_EQ( createTaskDelayed( &task_list, recordHandler, &id, sizeof(id), PRIORITY_NORMAL,
+                                 0, 0, delay ), TASK_OK );
+  }
+  CHECK_EQ( task_list.armed, 40 );
+
+  beginScheduler( &task_list );
+
+  CHECK_EQ( run_count, 40 );
+  for ( uint32_t i = 0; i < run_count && i < RUN_MAX; ++i )
+    CHECK_EQ( run_time[i], due[run_id[i]] );
+  CHECK_EQ( task_list.armed, 0 );
+}
+
+/* a delayed task falling due with every other slot queued still finds room: a parked node
+ * holds its slot, so with TASK_POOL_LENGTH == TASK_QUEUE_LENGTH the queue can not be full */
+static void testWheelFullPool( void )
+{
+  TaskPoolStats_t stats;
+  uint32_t id = 9;
+
+  freshList();
+  createTaskDelayed( &task_list, recordHandler, &id, sizeof(id), PRIORITY_LOW, 0, 0, 1 );
+  while ( createTask( &task_list, dummyHandler, NULL, 0, PRIORITY_LOW, 0, 0 ) == TASK_OK )
+    continue;
+
+  beginScheduler( &task_list );
+
+  CHECK_EQ( run_count, 1 );
+  CHECK_EQ( run_id[0], id );
+  if ( TASK_POOL_LENGTH == TASK_QUEUE_LENGTH )
+    CHECK_EQ( task_list.dropped, 0 );
+  getTaskPoolStats( &stats );
+  CHECK_EQ( stats.in_use, 0 );
+}
+
+/* a ring takes TASK_RING_LENGTH requests, counts the ones it refuses, and hands them to
+ * the scheduler in order */
+static void testRing( void )
+{
+  static TaskRing_t ring;
+  uint32_t posted = 0;
+  uint32_t id;
+
+  freshList();
+  CHECK_EQ( registerTaskRing( &task_list, &ring ), TASK_OK );
+
+  for ( id = 0; id < TASK_RING_LENGTH + 2; ++id )
+  {
+    if ( postTask( &ring, recordHandler, &id, sizeof(id), PRIORITY_HIGH, 0 ) == TASK_OK )
+      ++posted;
+  }
+  CHECK_EQ( posted, TASK_RING_LENGTH );
+  CHECK_EQ( ring.dropped, 2 );
+
+  beginScheduler( &task_list );
+
+  CHECK_EQ( run_count, TASK_RING_LENGTH );
+  for ( uint32_t i = 0; i < run_count; ++i )
+    CHECK_EQ( run_id[i], i );
+
+  for ( uint32_t r = 0; r < TASK_RINGS_MAX - 1; ++r )
+    registerTaskRing( &task_list, &ring );
+  CHECK_EQ( registerTaskRing( &task_list, &ring ), TASK_TOO_MANY_RINGS );
+}
+
+/* two producer threads stand in for two interrupts, each with its own ring */
+#define STRESS_POSTS 20000
+
+static TaskRing_t stress_ring[2];
+static uint32_t stress_next[2];
+static uint32_t stress_errors;
+
+static void stressHandler( TaskContext_t* context )
+{
+  uint32_t* params = (uint32_t*) context->params;
+
+  if ( params[1] != stress_next[params[0]] )
+    ++stress_errors;
+  stress_next[params[0]] = params[1] + 1;
+}
+
+static void* stressProducer( void* arg )
+{
+  uint32_t params[2] = { (uint32_t) (uintptr_t) arg, 0 };
+
+  while ( params[1] < STRESS_POSTS )
+  {
+    if ( postTask( &stress_ring[params[0]], stressHandler, params, sizeof(params),
+                   PRIORITY_HIGH, 0 ) == TASK_OK )
+      ++params[1];
+    else
+      sched_yield(); /* let the scheduler drain it, the host may have one core */
+  }
+
+  return NULL;
+}
+
+static void testRingThreads( void )
+{
+  pthread_t producer[2];
+
+  freshList();
+  for ( uintptr_t p = 0; p < 2; ++p )
+  {
+    registerTaskRing( &task_list, &stress_ring[p] );
+    stress_next[p] = 0;
+  }
+  stress_errors = 0;
+
+  for ( uintptr_t p = 0; p < 2; ++p )
+    pthread_create( &producer[p], NULL, stressProducer, (void*) p );
+
+  /* the host scheduler returns whenever the rings run dry */
+  while ( stress_next[0] < STRESS_POSTS || stress_next[1] < STRESS_POSTS )
+  {
+    beginScheduler( &task_list );
+    sched_yield();
+  }
+
+  for ( uintptr_t p = 0; p < 2; ++p )
+    pthread_join( producer[p], NULL );
+
+  CHECK_EQ( stress_errors, 0 );
+  CHECK_EQ( stress_next[0], STRESS_POSTS );
+  CHECK_EQ( stress_next[1], STRESS_POSTS );
+}
+
+/* a periodic task re-arms on a fixed rate, even when a run overshoots its tick; the host
+ * scheduler never returns with one armed, so the test jumps out of it */
+static jmp_buf periodic_exit;
+
+static void periodicHandler( TaskContext_t* context )
+{
+  recordHandler( context );
+
+  /* the second run takes 3 ticks */
+  if ( run_count == 2 )
+  {
+    schedulerTick();
+    schedulerTick();
+    schedulerTick();
+  }
+  if ( run_count == 6 )
+    longjmp( periodic_exit, 1 );
+}
+
+static void testPeriodic( void )
+{
+  uint32_t id = 7;
+  uint32_t start;
+
+  freshList();
+  start = system_time;
+  createTaskDelayed( &task_list, periodicHandler, &id, sizeof(id), PRIORITY_NORMAL, 2, 10, 10 );
+
+  if ( setjmp( periodic_exit ) == 0 )
+    beginScheduler( &task_list );
+
+  CHECK_EQ( run_count, 6 );
+  for ( uint32_t i = 0; i < run_count; ++i )
+    CHECK_EQ( run_time[i], start + 10 * ( i + 1 ) );
+  CHECK_EQ( task_list.deadline_misses, 1 );
+}
+
+/* a periodic task falling due on a full ready queue skips that release, not the rest:
+ * only possible with more slots than queue places, as the full queue holds the rest */
+static uint32_t filler_id;
+
+static void fillerHandler( TaskContext_t* context )
+{
+  (void) context;
+
+  /* the periodic task falls due while this puts the queue back at full */
+  schedulerTick();
+  createTask( &task_list, dummyHandler, NULL, 0, PRIORITY_LOW, 0, 0 );
+}
+
+static void testWheelQueueFull( void )
+{
+  uint32_t id = 11;
+  uint32_t start;
+
+  if ( TASK_POOL_LENGTH <= TASK_QUEUE_LENGTH )
+    return;
+
+  freshList();
+  start = system_time;
+  createTaskDelayed( &task_list, periodicHandler, &id, sizeof(id), PRIORITY_HIGH, 0, 4, 1 );
+  createTask( &task_list, fillerHandler, &filler_id, sizeof(filler_id), PRIORITY_NOW, 0, 0 );
+  while ( createTask( &task_list, dummyHandler, NULL, 0, PRIORITY_LOW, 0, 0 ) == TASK_OK )
+    continue;
+  CHECK_EQ( task_list.count, TASK_QUEUE_LENGTH );
+
+  /* periodicHandler jumps out on the sixth run */
+  run_count = 4;
+  if ( setjmp( periodic_exit ) == 0 )
+    beginScheduler( &task_list );
+
+  CHECK_EQ( task_list.dropped, 1 );
+  CHECK_EQ( run_count, 6 );
+  CHECK_EQ( run_time[4], start + 1 + 4 );
+  CHECK_EQ( run_time[5], start + 1 + 8 );
+}
+
+/* creating, running and re-arming tasks never touches the heap: the test is linked with
+ * malloc and friends wrapped, and counts the calls made while it watches */
+void* __real_malloc( size_t size );
+void* __real_calloc( size_t count, size_t size );
+void* __real_realloc( void* pointer, size_t size );
+void __real_free( void* pointer );
+
+static volatile bool heap_watch;
+static volatile uint32_t heap_calls;
+
+void* __wrap_malloc( size_t size )
+{
+  heap_calls += heap_watch;
+  return __real_malloc( size );
+}
+void* __wrap_calloc( size_t count, size_t size )
+{
+  heap_calls += heap_watch;
+  return __real_calloc( count, size );
+}
+void* __wrap_realloc( void* pointer, size_t size )
+{
+  heap_calls += heap_watch;
+  return __real_realloc( pointer, size );
+}
+void __wrap_free( void* pointer )
+{
+  heap_calls += heap_watch;
+  __real_free( pointer );
+}
+
+static void* volatile heap_probe;
+
+static void noHeapHandler( TaskContext_t* context )
+{
+  uint32_t id = 21;
+
+  recordHandler( context );
+
+  /* tasks created from a handler, as the firmware's are */
+  createTask( &task_list, dummyHandler, &id, sizeof(id), PRIORITY_NORMAL, 5, 0 );
+  createTaskDelayed( &task_list, dummyHandler, &id, sizeof(id), PRIORITY_LOW, 0, 0, 3 );
+  if ( run_count == 20 )
+    longjmp( periodic_exit, 1 );
+}
+
+static void testNoHeap( void )
+{
+  static TaskRing_t ring;
+  uint32_t id = 20;
+
+  /* the wrap is in place: a call while watching is seen */
+  heap_watch = true;
+  heap_probe = malloc( 16 );
+  free( heap_probe );
+  heap_watch = false;
+  CHECK_EQ( heap_calls, 2 );
+
+  heap_calls = 0;
+  heap_watch = true;
+
+  freshList();
+  registerTaskRing( &task_list, &ring );
+  for ( uint32_t i = 0; i < 8; ++i )
+    createTask( &task_list, recordHandler, &i, sizeof(i), PRIORITY_HIGH, 0, 0 );
+  postTask( &ring, recordHandler, &id, sizeof(id), PRIORITY_NOW, 0 );
+  createTaskDelayed( &task_list, noHeapHandler, &id, sizeof(id), PRIORITY_NORMAL, 0, 4, 4 );
+
+  if ( setjmp( periodic_exit ) == 0 )
+    beginScheduler( &task_list );
+
+  heap_watch = false;
+  CHECK_EQ( run_count, 20 );
+  CHECK_EQ( heap_calls, 0 );
+}
+
+int main( void )
+{
+  testPriorityOrder();
+  testEarliestDeadline();
+  testPool();
+  testTimerWheel();
+  testWheelFullPool();
+  testRing();
+  testRingThreads();
+
+  /* last, they leave their tasks armed */
+  testNoHeap();
+  testPeriodic();
+  testWheelQueueFull();
+
+  return testResult( TASK_POOL_LENGTH > TASK_QUEUE_LENGTH ? "task_handler, pool > queue"
+                                                          : "task_handler" );
+}
@@ -0,0 +1,134 @@
+/**
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file test_trace.c
+ *
+ * \brief Host tests of the scheduler trace: the runtime statistics the pi reads with
+ *        REG_STATS, and trace-decoder run over records as REG_TRACE sends them.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "test.h"
+
+static void handlerA( TaskContext_t* context ) { (void) context; }
+static void handlerB( TaskContext_t* context ) { (void) context; }
+
+/* statistics are handed out as a copy, and the total does not stop at 32 bits */
+static void testStats( void )
+{
+  TraceStats_t stats;
+  uint8_t a = traceHandlerId( handlerA );
+  uint8_t b = traceHandlerId( handlerB );
+
+  CHECK_EQ( a, 0 );
+  CHECK_EQ( b, 1 );
+  CHECK_EQ( traceHandlerId( handlerA ), a );
+
+  traceRun( a, 10, 0xf0000000u );
+  traceRun( a, 30, 0xf0000000u );
+  traceRun( a, 20, 5 );
+
+  CHECK( traceStats( a, &stats ) );
+  CHECK_EQ( stats.handler, (uint32_t) (uintptr_t) handlerA );
+  CHECK_EQ( stats.count, 3 );
+  CHECK_EQ( stats.min_cycles, 5 );
+  CHECK_EQ( stats.max_cycles, 0xf0000000u );
+  CHECK_EQ( stats.total_cycles, 2 * 0xf0000000ull + 5 );
+  CHECK_EQ( stats.max_queue_cycles, 30 );
+
+  /* a copy: later runs leave it alone */
+  traceRun( a, 0, 1 );
+  CHECK_EQ( stats.count, 3 );
+  CHECK( traceStats( a, &stats ) );
+  CHECK_EQ( stats.count, 4 );
+
+  CHECK( traceStats( b, &stats ) );
+  CHECK_EQ( stats.count, 0 );
+  CHECK( !traceStats( b + 1, &stats ) );
+  CHECK( !traceStats( TRACE_NO_HANDLER, &stats ) );
+}
+
+/* records straight out of traceRead(..), through the decoder: times from the first
+ * record and runtimes from dispatch to completion, across the cycle counter wrapping */
+static void testDecoder( void )
+{
+  static const struct { uint32_t cycles; Trace_event event; uint16_t sequence; } events[] =
+  {
+    { 0xfffe0000u, TRACE_ENQUEUE,  7 },
+    { 0xfffebb80u, TRACE_DISPATCH, 7 },  /* 1000 us in */
+    { 0x00001000u, TRACE_COMPLETE, 7 },  /* across the wrap */
+    { 0x00002000u, TRACE_COMPLETE, 9 },  /* never dispatched */
+  };
+  static const struct { double time; const char* event; double runtime; } expect[] =
+  {
+    { 0.0,    "enqueue",  -1 },
+    { 1000.0, "dispatch", -1 },
+    { 2816.0, "complete", 1816.0 },
+    { 2901.3, "complete", -1 },
+  };
+  TraceRecord_t records[8];
+  char path[] = "/tmp/test_trace-XXXXXX";
+  char command[256], line[128];
+  uint32_t n, lines = 0;
+  FILE* dump;
+  FILE* decoded;
+  int fd;
+
+  for ( uint32_t i = 0; i < sizeof(events) / sizeof(events[0]); ++i )
+    traceEvent( events[i].event, 0, events[i].sequence, events[i].cycles );
+
+  n = traceRead( records, 8 );
+  CHECK_EQ( n, 4 );
+  CHECK_EQ( traceRead( records + n, 8 - n ), 0 );
+
+  /* REG_TRACE sends the records as they sit in memory, little endian like the M0+ */
+  fd = mkstemp( path );
+  CHECK( fd >= 0 );
+  dump = fdopen( fd, "wb" );
+  fwrite( records, sizeof(TraceRecord_t), n, dump );
+  fclose( dump );
+
+  snprintf( command, sizeof(command), "%s 48000000 < %s", TRACE_DECODER, path );
+  decoded = popen( command, "r" );
+  CHECK( decoded != NULL );
+  if ( decoded == NULL )
+    return;
+
+  CHECK( fgets( line, sizeof(line), decoded ) != NULL ); /* column titles */
+  while ( fgets( line, sizeof(line), decoded ) != NULL && lines < n )
+  {
+    double time, runtime = -1;
+    char event[16];
+    unsigned handler, sequence;
+    int fields = sscanf( line, "%lf %15s %u %u %lf", &time, event, &handler, &sequence,
+                         &runtime );
+
+    CHECK( fields >= 4 );
+    CHECK( time > expect[lines].time - 0.1 && time < expect[lines].time + 0.1 );
+    CHECK( strcmp( event, expect[lines].event ) == 0 );
+    CHECK_EQ( handler, 0 );
+    CHECK_EQ( sequence, events[lines].sequence );
+    CHECK_EQ( fields == 5, expect[lines].runtime >= 0 );
+    if ( fields == 5 )
+      CHECK( runtime > expect[lines].runtime - 0.1 && runtime < expect[lines].runtime + 0.1 );
+    ++lines;
+  }
+
+  CHECK_EQ( lines, n );
+  CHECK_EQ( pclose( decoded ), 0 );
+  unlink( path );
+}
+
+int main( void )
+{
+  testStats();
+  testDecoder();
+
+  return testResult( "trace" );
+}
@@ -0,0 +1,198 @@
+/**
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file test_update.c
+ *
+ * \brief Host tests of the REG_UPDATE frame: its wire layout, which the pi side parser
+ *        follows byte for byte, its versioning and the double buffer flip.
+ */
+
+#include <asf.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "test.h"
+#include "update.h"
+
+static Update_t update;
+
+/* version 1 of the frame: any change here is a new UPDATE_VERSION and a new pi side parser */
+static void testLayout( void )
+{
+  static const struct { const char* field; size_t offset, expected; } layout[] =
+  {
+    { "version",          offsetof( UpdateFrame_t, version ),           0 },
+    { "length",           offsetof( UpdateFrame_t, length ),            1 },
+    { "sequence",         offsetof( UpdateFrame_t, sequence ),          2 },
+    { "timestamp",        offsetof( UpdateFrame_t, timestamp ),         4 },
+    { "power_status",     offsetof( UpdateFrame_t, power_status ),      8 },
+    { "exp_power_status", offsetof( UpdateFrame_t, exp_power_status ),  9 },
+    { "fan",              offsetof( UpdateFrame_t, fan ),              10 },
+    { "power",            offsetof( UpdateFrame_t, power ),            11 },
+    { "modules_on",       offsetof( UpdateFrame_t, modules_on ),       12 },
+    { "modules_valid",    offsetof( UpdateFrame_t, modules_valid ),    13 },
+    { "modules_fault",    offsetof( UpdateFrame_t, modules_fault ),    14 },
+    { "modules_warning",  offsetof( UpdateFrame_t, modules_warning ),  15 },
+    { "alerts",           offsetof( UpdateFrame_t, alerts ),           16 },
+    { "vin",              offsetof( UpdateFrame_t, vin ),              20 },
+    { "vout",             offsetof( UpdateFrame_t, vout ),             24 },
+    { "iout",             offsetof( UpdateFrame_t, iout ),             28 },
+    { "pout",             offsetof( UpdateFrame_t, pout ),             32 },
+    { "temperature",      offsetof( UpdateFrame_t, temperature ),      36 },
+    { "exp_pout",         offsetof( UpdateFrame_t, exp_pout ),         40 },
+    { "load",             offsetof( UpdateFrame_t, load ),             44 },
+    { "reserved",         offsetof( UpdateFrame_t, reserved ),         46 }
+  };
+
+  for ( size_t i = 0; i < sizeof(layout) / sizeof(layout[0]); ++i )
+  {
+    if ( layout[i].offset != layout[i].expected )
+      printf( "  %s\n", layout[i].field );
+    CHECK_EQ( layout[i].offset, layout[i].expected );
+  }
+  CHECK_EQ( sizeof(UpdateFrame_t), 48 );
+  CHECK_EQ( UPDATE_VERSION, 1 );
+}
+
+/* what the pi sees: the frame's bytes, multi-byte fields little endian */
+static uint32_t wireField( const UpdateFrame_t* frame, size_t offset, size_t size )
+{
+  const uint8_t* bytes = (const uint8_t*) frame;
+  uint32_t value = 0;
+
+  for ( size_t b = size; b > 0; --b )
+    value = ( value << 8 ) | bytes[offset + b - 1];
+
+  return value;
+}
+
+/* every frame carries the version and its length, and a sequence number one up on the
+ * last, wrapping at 16 bits */
+static void testVersioning( void )
+{
+  memset( &update, 0, sizeof(update) );
+
+  for ( uint32_t n = 1; n <= 0x10010; ++n )
+  {
+    /* on to just short of the wrap */
+    if ( n == 16 )
+    {
+      n = 0xfff0;
+      update.sequence = n - 1;
+    }
+
+    UpdateFrame_t* frame = updateBegin( &update );
+    updateCommit( &update );
+
+    const UpdateFrame_t* current = updateCurrent( &update );
+    CHECK( current == frame );
+    CHECK_EQ( wireField( current, 0, 1 ), UPDATE_VERSION );
+    CHECK_EQ( wireField( current, 1, 1 ), sizeof(UpdateFrame_t) );
+    CHECK_EQ( wireField( current, 2, 2 ), n & 0xffff );
+  }
+  CHECK_EQ( update.sequence, 0x0010 );
+}
+
+/* the frame being built is never the one the pi reads, which stays as it was until the
+ * flip, and a new frame starts out clear of whatever the old buffer held */
+static void testFlip( void )
+{
+  memset( &update, 0, sizeof(update) );
+
+  UpdateFrame_t* frame = updateBegin( &update );
+  frame->vin  = 12000;
+  frame->load = 500;
+  updateCommit( &update );
+  const UpdateFrame_t* first = updateCurrent( &update );
+  CHECK( first == frame );
+
+  for ( uint8_t n = 0; n < 4; ++n )
+  {
+    UpdateFrame_t before = *updateCurrent( &update );
+
+    UpdateFrame_t* next = updateBegin( &update );
+    CHECK( next != updateCurrent( &update ) );
+    CHECK_EQ( next->vin, 0 );
+    CHECK_EQ( next->load, 0 );
+
+    next->vin  = 12000 + n + 1;
+    next->load = 500 + n + 1;
+    CHECK( memcmp( &before, updateCurrent( &update ), sizeof(UpdateFrame_t) ) == 0 );
+
+    updateCommit( &update );
+    CHECK( updateCurrent( &update ) == next );
+    CHECK_EQ( updateCurrent( &update )->vin, 12000 + n + 1 );
+    CHECK_EQ( wireField( updateCurrent( &update ), 44, 2 ), 500 + n + 1 );
+  }
+
+  /* begun again without a commit, the same spare buffer is rebuilt */
+  UpdateFrame_t* spare = updateBegin( &update );
+  CHECK( updateBegin( &update ) == spare );
+}
+
+/* the 12V rail's fields and module masks, as the pi reads them off the wire */
+static void testPower( void )
+{
+  bool power_state[4] = { true, true, false, true };
+  Power_t pc;
+  Power_snapshot_t telemetry;
+
+  memset( &update, 0, sizeof(update) );
+  memset( &pc, 0, sizeof(pc) );
+  memset( &telemetry, 0, sizeof(telemetry) );
+
+  pc.status       = POWER_OVERTEMP;
+  pc.module_count = 4;
+  pc.power_state  = power_state;
+  pc.alerts       = 0x01020304;
+  pc.fault[1].count  = 2;
+  pc.fault[1].status = POWER_OVERTEMP;
+  pc.fault[3].count  = 1;
+  pc.fault[3].status = POWER_OK;
+
+  telemetry.timestamp    = 0xa1b2c3d4;
+  telemetry.module_count = 4;
+  telemetry.module[0].status = POWER_OK;
+  telemetry.module[1].status = POWER_OK;
+  telemetry.module[2].status = POWER_PMBUS;
+  telemetry.module[3].status = POWER_OK;
+  telemetry.vin         = 12034;
+  telemetry.vout        = -5;
+  telemetry.iout        = 31250;
+  telemetry.pout        = 376000;
+  telemetry.temperature = 61500;
+
+  UpdateFrame_t* frame = updateBegin( &update );
+  updatePower( frame, &pc, &telemetry );
+  updateCommit( &update );
+
+  const UpdateFrame_t* current = updateCurrent( &update );
+  CHECK_EQ( wireField( current, 4, 4 ), 0xa1b2c3d4 );
+  CHECK_EQ( wireField( current, 8, 1 ), POWER_OVERTEMP );
+  CHECK_EQ( wireField( current, 12, 1 ), 0x0b ); /* modules 0, 1 and 3 on */
+  CHECK_EQ( wireField( current, 13, 1 ), 0x0b ); /* module 2 failed the sweep */
+  CHECK_EQ( wireField( current, 14, 1 ), 0x02 ); /* module 1 faulted */
+  CHECK_EQ( wireField( current, 15, 1 ), 0x08 ); /* module 3 only warned */
+  CHECK_EQ( wireField( current, 16, 4 ), 0x01020304 );
+  CHECK_EQ( (int32_t) wireField( current, 20, 4 ), 12034 );
+  CHECK_EQ( (int32_t) wireField( current, 24, 4 ), -5 );
+  CHECK_EQ( (int32_t) wireField( current, 28, 4 ), 31250 );
+  CHECK_EQ( (int32_t) wireField( current, 32, 4 ), 376000 );
+  CHECK_EQ( (int32_t) wireField( current, 36, 4 ), 61500 );
+
+  /* the rest is main.c's, and left clear */
+  CHECK_EQ( wireField( current, 9, 3 ), 0 );
+  CHECK_EQ( wireField( current, 40, 4 ), 0 );
+  CHECK_EQ( wireField( current, 44, 4 ), 0 );
+}
+
+int main( void )
+{
+  testLayout();
+  testVersioning();
+  testFlip();
+  testPower();
+
+  return testResult( "update" );
+}
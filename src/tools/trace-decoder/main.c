@@ -0,0 +1,85 @@
+/**
+ * This file is a part of the AHTI hardware abstraction layer (ahti-hal).
+ *
+ * \file main.c
+ *
+ * \brief Host-side decoder for system controller scheduler traces.
+ *
+ * Reads a dump of trace records (the REG_TRACE payloads with their leading count byte
+ * stripped, concatenated) from stdin and prints a timeline, pairing each completion with
+ * its dispatch to show the handler's runtime.
+ *
+ * Usage: trace-decoder <cpu_hz> < dump.bin
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RECORD_LENGTH 8 /* see TraceRecord_t in system-controller/trace.h */
+
+#define TRACE_ENQUEUE  0x01
+#define TRACE_DISPATCH 0x02
+#define TRACE_COMPLETE 0x03
+
+static uint32_t dispatched_at[65536];
+static uint8_t  dispatched[65536];
+
+static const char* eventName( uint8_t event )
+{
+  switch ( event )
+  {
+    case TRACE_ENQUEUE:  return "enqueue";
+    case TRACE_DISPATCH: return "dispatch";
+    case TRACE_COMPLETE: return "complete";
+    default:             return "unknown";
+  }
+}
+
+int main( int argc, char** argv )
+{
+  uint8_t  raw[RECORD_LENGTH];
+  uint32_t first = 0;
+  int      have_first = 0;
+  double   cycles_per_us;
+
+  if ( argc != 2 || ( cycles_per_us = atof( argv[1] ) / 1e6 ) <= 0 )
+  {
+    fprintf( stderr, "usage: %s <cpu_hz> < dump.bin\n", argv[0] );
+    return 1;
+  }
+
+  printf( "%12s  %-8s  %7s  %5s  %s\n", "time (us)", "event", "handler", "seq", "runtime (us)" );
+
+  while ( fread( raw, 1, RECORD_LENGTH, stdin ) == RECORD_LENGTH )
+  {
+    uint32_t cycles   = raw[0] | ( raw[1] << 8 ) | ( raw[2] << 16 ) | ( (uint32_t) raw[3] << 24 );
+    uint8_t  event    = raw[4];
+    uint8_t  handler  = raw[5];
+    uint16_t sequence = (uint16_t) ( raw[6] | ( raw[7] << 8 ) );
+
+    if ( !have_first )
+    {
+      first = cycles;
+      have_first = 1;
+    }
+
+    printf( "%12.1f  %-8s  %7u  %5u", (uint32_t) ( cycles - first ) / cycles_per_us,
+            eventName( event ), handler, sequence );
+
+    if ( event == TRACE_DISPATCH )
+    {
+      dispatched_at[sequence] = cycles;
+      dispatched[sequence] = 1;
+    }
+    else if ( event == TRACE_COMPLETE && dispatched[sequence] )
+    {
+      printf( "  %.1f", (uint32_t) ( cycles - dispatched_at[sequence] ) / cycles_per_us );
+      dispatched[sequence] = 0;
+    }
+
+    printf( "\n" );
+  }
+
+  return 0;
+}